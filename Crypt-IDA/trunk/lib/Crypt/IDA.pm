@@ -139,7 +139,10 @@ sub fill_from_fh {
 	      $bytes_read+=$rc;
 	    }
 	    return $buf;
-	  }
+	  },
+	  # lets ida_process_streams read the fd directly in C
+	  FD    => real_fileno($fh),
+	  ALIGN => $align,
 	 };
 }
 
@@ -179,10 +182,19 @@ sub empty_to_fh {
 	  SUB => sub {
 	    my $str=shift;
 	    return syswrite $fh, $str;
-	  }
+	  },
+	  FD  => real_fileno($fh),
 	 };
 }
 
+# Return the file descriptor for a handle, or undef if it doesn't have
+# a real one (eg, an in-memory file)
+sub real_fileno {
+  my $fh = shift;
+  my $fd = fileno($fh);
+  return (defined($fd) and $fd >= 0) ? $fd : undef;
+}
+
 sub empty_to_file {
   my ($self, $class);
   if ($_[0] eq $classname or ref($_[0]) eq $classname) {
@@ -239,7 +251,7 @@ sub ida_process_streams {
     $class=$classname;
   }
   my ($xform, $in, $fillers, $out, $emptiers, $bytes_to_read,
-     $inorder, $outorder)=@_;
+     $inorder, $outorder, $prep, $pipeline, $flags, $hashes)=@_;
 
   # default values are no byte-swapping, read bytes until eof
   $inorder=0         unless defined($inorder);
@@ -255,6 +267,7 @@ sub ida_process_streams {
       map { $xform->$_ } qw{WIDTH ROWS COLS ORGNUM};
   
   my $bytes_read=0;
+  my $used=0;			# bytes of each stream multiplied so far
   my ($IR, $OW);		# input read, output write pointers
   my ($ILEN, $OLEN);
   my ($IFmin, $OFmax);		# input and output buffer fill levels
@@ -358,6 +371,45 @@ sub ida_process_streams {
     $oright = $width;
     $want_out_size = $width;
   }
+  # If every stream is a plain file descriptor (as set up by
+  # fill_from_fh, empty_to_file, etc.), the whole loop below can be
+  # done in C without calling back into Perl for each buffer.
+  # With the pipeline option, reading, multiplying and writing are
+  # also done in separate threads, so that they all overlap. flags
+  # (bit 0 io_uring, bit 1 fsync) are passed on to it and also
+  # select the pipeline, as does asking for hashes of the streams.
+  @$hashes=() if $hashes;
+  if (($pipeline or $flags or $hashes) and
+      Math::FastGF2::Matrix->can("pipeline_fd_c") and
+      !grep { !defined($_->{FD}) } @$fillers, @$emptiers) {
+    my $rc = Math::FastGF2::Matrix::pipeline_fd_c
+      ($prep || $xform,
+       [ map { $_->{FD} } @$fillers ],
+       [ map { $_->{ALIGN} || 0 } @$fillers ],
+       [ map { $_->{FD} } @$emptiers ],
+       $bytes_to_read, $inorder, $outorder, 0, 0, $pipeline || 0,
+       $flags || 0, $hashes);
+    carp "process_streams: error in pipeline"
+      unless defined($rc);
+    return $rc;
+  }
+  if (Math::FastGF2::Matrix->can("process_streams_fd_c") and
+      !grep { !defined($_->{FD}) } @$fillers, @$emptiers) {
+    my $rc = Math::FastGF2::Matrix::process_streams_fd_c
+      ($prep || $xform,
+       $in,  [ map { $_->{FD} } @$fillers ],
+             [ map { $_->{ALIGN} || 0 } @$fillers ],
+       $out, [ map { $_->{FD} } @$emptiers ],
+       $bytes_to_read, $inorder, $outorder);
+    carp "process_streams: error processing file descriptors"
+      unless defined($rc);
+    return $rc;
+  }
+
+  # Math::FastGF2 0.08 can make the transform's tables just once
+  $prep = $xform->prepare($inorder, $outorder)
+    if !$prep and $xform->can("prepare");
+
   for my $i (0 .. $nemptiers - 1) {
     # Set up per-emptier variables
     my @varlist = ();
@@ -390,9 +442,12 @@ sub ida_process_streams {
 
 	#warn "Before adjusting maxfill: $max_fill (bytes read $bytes_read)\n";
 	#warn "BF on filler $i is ". $fillvars[$i]->[BF] . "\n";
+	# with several fillers, each gives its share of bytes_to_read
 	if ($bytes_to_read and
-	    ($bytes_read  + $max_fill > $bytes_to_read)) {
-	  $max_fill = $bytes_to_read - $bytes_read;
+	    ($used + $fillvars[$i]->[BF] + $max_fill >
+	     $bytes_to_read / $nfillers)) {
+	  $max_fill = $bytes_to_read / $nfillers -
+	    $used - $fillvars[$i]->[BF];
 	}
 
 	#next unless $max_fill;
@@ -440,11 +495,13 @@ sub ida_process_streams {
 
 	  #warn "Adding string '$aligned' to input buffer\n";
 
+	  # bytes go into the buffer as they are; the multiply takes
+	  # care of $inorder (and $outorder) as it goes
 	  $in->
 	    setvals_str($in->
 		    offset_to_rowcol($fillvars[$i]->[IW]),
 		    $aligned,
-		    $inorder);
+		    0);
 
 	  # For the purpose of updating IW and BF variables, we
 	  # pretend we didn't see any bytes from partial words
@@ -526,7 +583,7 @@ sub ida_process_streams {
 	  $str=$out->
 	    getvals_str($rr,$cc,
 		    $max_empty / $width,
-		    $outorder);
+		    0);
 	  #substr $str, 0, $emptyvars[$i]->[SKIP], "";
 	  $rc=$emptyvars[$i]->[CALLBACK]->($str);
 
@@ -562,12 +619,21 @@ sub ida_process_streams {
 	$k = $OCOLS - $start_out_col;
       }
       #warn "k is now $k\n";
-      Math::FastGF2::Matrix::multiply_submatrix_c
-	  ($xform, $in, $out,
-	   0, 0, $XROWS,
-	   $start_in_col, $start_out_col, $k);
+      if ($prep) {
+	Math::FastGF2::Matrix::Prepared::multiply_submatrix_c
+	    ($prep, $in, $out,
+	     0, 0, $XROWS,
+	     $start_in_col, $start_out_col, $k, 0);
+      } else {
+	Math::FastGF2::Matrix::multiply_submatrix_c
+	    ($xform, $in, $out,
+	     0, 0, $XROWS,
+	     $start_in_col, $start_out_col, $k,
+	     0, $inorder, $outorder);
+      }
       $IFmin -= $want_in_size * $k;
       $OFmax += $want_out_size * $k;
+      $used  += $want_in_size * $k;
       $IR+=$iright * $k;
       if ($IR > $fillvars[0]->[ENDING]) {
 	$IR=0;
@@ -892,14 +958,15 @@ sub ida_key_to_matrix {
 	  "width"       => undef,
 	  "sharelist"   => undef,
 	  "key"         => undef,
+	  "systematic"  => 0,	# identity rows for shares 0 .. k-1?
 	  "invert?"     => 0,	# want us to invert the matrix?
 	  "skipchecks?" => 0,	# skip long checks on options?
 	  @_,
 	 );
-  my ($k,$n,$w,$sharelist,$key,$invert,$skipchecks) =
+  my ($k,$n,$w,$sharelist,$key,$systematic,$invert,$skipchecks) =
     map {
       exists($o{$_}) ? $o{$_} : undef;
-    } qw(quorum shares width sharelist key invert? skipchecks?);
+    } qw(quorum shares width sharelist key systematic invert? skipchecks?);
 
   # skip error checking if the caller tells us it's OK
   unless (defined($skipchecks) and $skipchecks) {
@@ -909,6 +976,23 @@ sub ida_key_to_matrix {
     }
   }
 
+  # The inverse of a Cauchy matrix has a closed form that's much
+  # cheaper to calculate than doing Gaussian elimination. That doesn't
+  # apply to systematic matrices, which are inverted (and cached) by
+  # Math::FastGF2::Matrix's invert below.
+  if ($invert and !$systematic and @$sharelist == $k) {
+    my $inv=eval {
+      Math::FastGF2::Matrix->
+	  new_inverse_cauchy(size   => $k,
+			     width  => $w,
+			     xylist => $key,
+			     xvals  => $sharelist,
+			     org    => "rowwise");
+    };
+    carp "Failed to invert matrix: $@" unless defined($inv);
+    return $inv;
+  }
+
   my $mat=Math::FastGF2::Matrix ->
     new(rows => scalar(@$sharelist),
 	cols => $k,
@@ -920,6 +1004,10 @@ sub ida_key_to_matrix {
   }
   my $dest_row=0;
   for my $row (@$sharelist) {
+    if ($systematic and $row < $k) {
+      $mat->setval($dest_row++, $row, 1);
+      next;
+    }
     for my $col (0 .. $k-1) {
       my $x   = $key->[$row];
       my $y   = $key->[$n+$col];
@@ -935,6 +1023,36 @@ sub ida_key_to_matrix {
   }
 }
 
+# Batch callers (Crypt::IDA::ShareFile's sf_split_many, etc.) pass the
+# same hash as the "cache" option to every ida_split/ida_combine call,
+# so that the buffer matrices and the prepared transform are only made
+# again when their shape or the transform changes rather than once per
+# file.
+sub ida_cached_buffer {
+  my ($cache, $name, %o) = @_;
+  my $m = $cache ? $cache->{$name} : undef;
+
+  return $m if defined($m) and $m->ROWS == $o{rows} and
+    $m->COLS == $o{cols} and $m->WIDTH == $o{width} and
+    $m->ORG eq $o{org};
+  $m = Math::FastGF2::Matrix->new(%o);
+  $cache->{$name} = $m if $cache and defined($m);
+  return $m;
+}
+
+sub ida_cached_prepared {
+  my ($cache, $mat, $inorder, $outorder) = @_;
+
+  return undef unless $cache and $mat->can("prepare");
+  my $id = join ",", $mat->WIDTH, $mat->ROWS, $mat->COLS, $mat->ORG,
+    $inorder, $outorder, $mat->getvals(0, 0, $mat->ROWS * $mat->COLS);
+  unless (defined($cache->{prepared_id}) and $cache->{prepared_id} eq $id) {
+    $cache->{prepared}    = $mat->prepare($inorder, $outorder);
+    $cache->{prepared_id} = $id;
+  }
+  return $cache->{prepared};
+}
+
 sub ida_split {
   my ($self, $class);
   if ($_[0] eq $classname or ref($_[0]) eq $classname) {
@@ -953,6 +1071,7 @@ sub ida_split {
      key => undef,
      matrix => undef,
      sharelist => undef,
+     systematic => 0,		# shares 0 .. k-1 are plain stripes?
      # source, sinks
      filler => undef,
      emptiers => undef,
@@ -960,6 +1079,11 @@ sub ida_split {
      rand => "/dev/urandom",
      bufsize => 4096,
      bytes => 0,
+     cache => undef,		# hash to keep buffers/tables in
+     pipeline => 0,		# compute threads for threaded pipeline
+     uring => 0,		# pipeline does its I/O with io_uring
+     fsync => 0,		# pipeline syncs the shares/output at the end
+     hashes => undef,		# [] to get SHA-256 of each stream back in
      # byte order flags
      inorder => 0,
      outorder => 0,
@@ -1067,18 +1191,22 @@ sub ida_split {
 			    "width"       => $w,
 			    "sharelist"   => $sharelist,
 			    "key"         => $key,
+			    "systematic"  => $o{systematic},
 			    "skipchecks?" => 0);
   }
 
   # create the buffer matrices and start the transform
-  my $in = Math::FastGF2::Matrix->new(rows=>$k,
-				      cols=>$bufsize,
-				      width=>$w,
-				      org => "colwise");
-  my $out= Math::FastGF2::Matrix->new(rows=>scalar(@$sharelist),
-				      cols=>$bufsize,
-				      width=>$w,
-				      org => "rowwise");
+  my $cache = $o{cache};
+  my $in = ida_cached_buffer($cache, "split_in",
+			     rows=>$k,
+			     cols=>$bufsize,
+			     width=>$w,
+			     org => "colwise");
+  my $out= ida_cached_buffer($cache, "split_out",
+			     rows=>scalar(@$sharelist),
+			     cols=>$bufsize,
+			     width=>$w,
+			     org => "rowwise");
   unless (defined($in) and defined($out)) {
     carp "failed to allocate input/output buffer matrices";
     return undef;
@@ -1087,7 +1215,12 @@ sub ida_split {
 			     $in, [$filler],
 			     $out, $emptiers,
 			     $bytes_to_read,
-			     $inorder, $outorder);
+			     $inorder, $outorder,
+			     ida_cached_prepared($cache, $mat,
+						 $inorder, $outorder),
+			     $o{pipeline},
+			     ($o{uring} ? 1 : 0) | ($o{fsync} ? 2 : 0),
+			     $o{hashes});
   if (defined ($rc)) {
     return ($key,$mat,$rc);
   } else {
@@ -1115,12 +1248,18 @@ sub ida_combine {
      key => undef,
      matrix => undef,
      sharelist => undef,
+     systematic => 0,		# key was used for a systematic split?
      # source, sinks
      fillers => undef,
      emptier => undef,
      # misc options
      bufsize => 4096,
      bytes => 0,
+     cache => undef,		# hash to keep buffers/tables in
+     pipeline => 0,		# compute threads for threaded pipeline
+     uring => 0,		# pipeline does its I/O with io_uring
+     fsync => 0,		# pipeline syncs the shares/output at the end
+     hashes => undef,		# [] to get SHA-256 of each stream back in
      # byte order flags
      inorder => 0,
      outorder => 0,
@@ -1185,7 +1324,7 @@ sub ida_combine {
   }
 
   if (defined($key)) {
-    ida_check_list($sharelist,"share",0,$k-1);
+    ida_check_list($sharelist,"share",0,$n-1);
     unless (scalar(@$sharelist) == $k) {
       carp "sharelist does not have k=$k elements";
       return undef;
@@ -1199,14 +1338,17 @@ sub ida_combine {
   }
 
   # create the buffer matrices and start the transform
-  my $in = Math::FastGF2::Matrix->new(rows=>$k,
-				      cols=>$bufsize,
-				      width=>$w,
-				      org => "rowwise");
-  my $out= Math::FastGF2::Matrix->new(rows=>$k,
-				      cols=>$bufsize,
-				      width=>$w,
-				      org => "colwise");
+  my $cache = $o{cache};
+  my $in = ida_cached_buffer($cache, "combine_in",
+			     rows=>$k,
+			     cols=>$bufsize,
+			     width=>$w,
+			     org => "rowwise");
+  my $out= ida_cached_buffer($cache, "combine_out",
+			     rows=>$k,
+			     cols=>$bufsize,
+			     width=>$w,
+			     org => "colwise");
   unless (defined($in) and defined($out)) {
     carp "failed to allocate input/output buffer matrices";
     return undef;
@@ -1220,7 +1362,12 @@ sub ida_combine {
 			     $in, $fillers,
 			     $out, [$emptier],
 			     $bytes_to_read,
-			     $inorder, $outorder);
+			     $inorder, $outorder,
+			     ida_cached_prepared($cache, $mat,
+						 $inorder, $outorder),
+			     $o{pipeline},
+			     ($o{uring} ? 1 : 0) | ($o{fsync} ? 2 : 0),
+			     $o{hashes});
 
 }
 
@@ -1476,6 +1623,7 @@ is as follows:
      matrix => undef,
      # optionally specify which shares to produce
      sharelist => undef,  # [ $row1, $row2, ... ]
+     systematic => 0,     # shares 0 .. k-1 are plain stripes?
      # source, sinks
      filler => undef,
      emptiers => undef,   # [ $empty1, $empty2, ... ]
@@ -1483,6 +1631,11 @@ is as follows:
      rand => "/dev/urandom",
      bufsize => 4096,
      bytes => 0,
+     cache => undef,      # {} shared between calls
+     pipeline => 0,       # compute threads (reader/writer threads too)
+     uring => 0,          # pipeline I/O through io_uring
+     fsync => 0,          # pipeline fsyncs outputs when done
+     hashes => undef,     # [] gets SHA-256 of each stream
      # byte order flags
      inorder => 0,
      outorder => 0,
@@ -1503,6 +1656,13 @@ the L<Keys and transform matrices> and L<KEY MANAGEMENT> sections.
 if specified, only shares corresponding to those rows in the transform
 matrix will be created.
 
+=item * systematic makes a transform matrix (from the key) whose
+first k rows are the identity matrix, with the Cauchy rows for shares
+k to n-1 below them. Shares 0 to k-1 are then plain stripes of the
+input and only the other n-k need any multiplying. Any k shares can
+still be combined, but the same systematic option must be given to
+C<ida_combine> along with the key.
+
 =item * emptiers is a reference to a list of empty callbacks. The list
 should contain one empty callback for each share to be produced.
 
@@ -1523,6 +1683,44 @@ larger chunks of data) will be required.
 set to zero to indicate that all bytes up to EOF should be read. This
 value must be a multiple of quorum x width
 
+=item * cache is for splitting (or combining) many small inputs in a
+row. Pass a reference to the same (initially empty) hash to each
+call and the input/output buffer matrices and the transform's
+multiply tables will be kept there and reused as long as the buffer
+size and transform stay the same, instead of being made again for
+every call. The contents of the hash are private.
+
+=item * pipeline, if set to a number of threads greater than zero,
+runs the split (or combine) as a pipeline: one thread reads the input
+into a pool of buffers, that many threads multiply full buffers, and
+one thread per output stream writes them out. Disk and CPU time then
+overlap instead of taking turns. It only applies when every filler
+and emptier is a plain file descriptor (as made by C<fill_from_file>,
+C<empty_to_fh> and so on) and needs a Math::FastGF2 with
+C<pipeline_fd_c>; otherwise it's ignored. The buffers are sized by
+the pipeline itself (64K columns each), not by bufsize.
+
+=item * uring makes the pipeline do its reading and writing through a
+Linux io_uring instead of reader and writer threads: all the share
+writes (or input reads) for a buffer go to the kernel in one system
+call, and several buffers' worth can be in flight at once. Setting it
+selects the pipeline even if pipeline is 0 (with the default number
+of compute threads). If the kernel has no io_uring, or some stream is
+not a seekable file, the threads are used as before.
+
+=item * fsync has the pipeline fsync each output stream once
+everything has been written, so that the shares are on disk when the
+call returns.
+
+=item * hashes, if set to a reference to an array, has the pipeline
+work out the SHA-256 digest of each stream as the data goes through,
+while it's still in cache. The array is filled with the 32-byte
+digests of the input stream(s) then the output stream(s), so for a
+split that's the input followed by each share, and for a combine each
+share followed by the output. Input digests don't count any padding
+added at eof. Like uring, it selects the pipeline; if the pipeline
+can't be used, the array is left empty.
+
 =item * inorder and outorder can be used to specify the byte order of
 the input and output streams, respectively. The values can be set to 0
 (stream uses native byte order), 1 (stream uses little-endian byte
@@ -1579,12 +1777,18 @@ The template for a call to C<ida_combine> is as follows:
      key => undef,
      matrix => undef,
      sharelist => undef,  # use in conjunction with key
+     systematic => 0,     # use in conjunction with key
      # sources, sink
      fillers => undef,    # [$filler1, $filler2, ... ]
      emptier => undef,
      # misc options
      bufsize => 4096,
      bytes => 0,
+     cache => undef,      # {} shared between calls
+     pipeline => 0,       # compute threads (reader/writer threads too)
+     uring => 0,          # pipeline I/O through io_uring
+     fsync => 0,          # pipeline fsyncs outputs when done
+     hashes => undef,     # [] gets SHA-256 of each stream
      # byte order flags
      inorder => 0,
      outorder => 0,
@@ -1618,10 +1822,20 @@ element in the fillers array.
 
 =item * if a key parameter is supplied, the C<ida_combine> routine
 will generate the appropriate transform matrix I<and its inverse> (in
-contrast to the case where a matrix parameter is supplied).
+contrast to the case where a matrix parameter is supplied). Set
+systematic if the shares were made with that option. Combining
+shares 0 to k-1 of a systematic split needs no arithmetic at all,
+since the multiply copies rows of the identity matrix.
 
 =back
 
+Inverse matrices are cached by Math::FastGF2::Matrix, keyed on the
+key, sharelist and width (or, for L<Crypt::IDA::ShareFile>, on the
+transform rows read from the share headers). Combining many files
+that were split with the same scheme only works out the inverse
+once. See "Inverse cache" in L<Math::FastGF2::Matrix> for how to
+resize the cache or get hit/miss counts.
+
 The return value is the number of bytes actually written to the output
 stream, or undef if there was an error. As noted earlier, this value
 may be larger than the initial size of the secret due to padding to
@@ -1910,6 +2124,15 @@ read" and "EOF" state variables, updating them after every call to the
 callback, and using them to return extra padding bytes after the
 stream's natural end-of-file, where appropriate.
 
+The callbacks made by C<fill_from_fh>, C<fill_from_file>,
+C<empty_to_fh> and C<empty_to_file> also store the underlying file
+descriptor under an C<FD> key. If every fill and empty handler for a
+split or combine has one, the whole job is done in C (by
+Math::FastGF2's streaming engine) and the C<SUB> callbacks are never
+called. Custom callbacks should not set C<FD> unless reading or
+writing that descriptor directly gives the same result as calling
+their C<SUB>.
+
 Please consult the source code for the existing C<fill_from_*> and
 C<empty_to_*> callback creation code for working examples.
 
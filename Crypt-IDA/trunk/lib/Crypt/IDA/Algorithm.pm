@@ -3,6 +3,7 @@ package Crypt::IDA::Algorithm;
 use strict;
 use warnings;
 
+use Math::FastGF2;
 use Math::FastGF2::Matrix;
 use Crypt::IDA;
 use Crypt::IDA::SlidingWindow;
@@ -13,8 +14,9 @@ use Class::Tiny qw/sw/,
     # * It's meaningless when combining
     # * It's either implied or overridden when splitting
     k => undef, w => 1,
-    mode => undef, bufsize => 16384,
-    inorder => 0, outorder => 0, # passed to getvals_str/setvals_str
+    mode => undef, bufsize => undef, # default sized to fit L2 cache
+    adapt => 0, min_bufsize => undef, max_bufsize => undef,
+    inorder => 0, outorder => 0, # byte order conversion done by multiply
 
     # Simplify transform/key specification. Either provide a transform
     # matrix or a key with optional sharelist. Don't support sharelist
@@ -29,14 +31,16 @@ use Class::Tiny qw/sw/,
 
 sub BUILD {
     my ($self, $args) = @_;
-    for my $req ( qw(k w mode bufsize inorder outorder) ) {
+    for my $req ( qw(k w mode inorder outorder) ) {
 	die "$req attribute required" unless defined $self->$req;
     }
     die "Bad mode!" unless $self->{mode} =~ /^(split|combine)$/;
-    for my $plus ( qw(k w bufsize) ) {
+    for my $plus ( qw(k w bufsize min_bufsize max_bufsize) ) {
+	next unless defined $self->$plus;
 	die "$plus attribute strictly positive" unless $self->$plus > 0;
     }
-    for my $ints ( qw(k w bufsize) ) {
+    for my $ints ( qw(k w bufsize min_bufsize max_bufsize) ) {
+	next unless defined $self->$ints;
 	die "$ints attribute must be a whole number" 
 	    unless int($self->$ints) == $self->$ints;
     }
@@ -104,29 +108,29 @@ sub BUILD {
 	}
     }
 
-    # create input, output matrices
-    my ($in,$out);
-    if ($self->mode eq 'split') {
-	die "key/sharelist needs an xval" unless $xform_rows >= 1;
-	$in = Math::FastGF2::Matrix->new(
-	    rows  => $k,          cols => $self->{bufsize},
-	    width => $self->{w},  org  => "colwise");
-	$out = Math::FastGF2::Matrix->new(
-	    rows  => $xform_rows, cols => $self->{bufsize},
-	    width => $self->{w},  org  => "rowwise");
-    } else {
-	$in = Math::FastGF2::Matrix->new(
-	    rows  => $k,          cols => $self->{bufsize},
-	    width => $self->{w},  org  => "rowwise");
-	$out = Math::FastGF2::Matrix->new(
-	    rows  => $k,          cols => $self->{bufsize},
-	    width => $self->{w},  org  => "colwise");
-    }
-    $self->{imat} = $in;
-    $self->{omat} = $out;
+    die "key/sharelist needs an xval"
+	if $self->mode eq 'split' and $xform_rows < 1;
     die "error" unless $xform_rows;
     $self->{xform_rows} = $xform_rows;
 
+    # create input, output matrices
+    $self->{bufsize} = $self->default_bufsize($k, $self->{w}, $xform_rows)
+	unless defined $self->{bufsize};
+    @{$self}{qw(imat omat)} = $self->_buffers($self->{bufsize});
+
+    # limits for adapt (not checked against bufsize; resize can
+    # always go outside them)
+    $self->{min_bufsize} = int($self->{bufsize} / 8) || 1
+	unless defined $self->{min_bufsize};
+    $self->{max_bufsize} = $self->{bufsize} * 8
+	unless defined $self->{max_bufsize};
+    $self->{full} = $self->{idle} = 0;
+
+    # Math::FastGF2 0.08 can make the transform's tables just once
+    $self->{prep} = $self->{xform}->prepare($self->{inorder},
+					    $self->{outorder})
+	if $self->{xform}->can("prepare");
+
     # sliding window
     $self->{sw} = Crypt::IDA::SlidingWindow->new(
 	mode => $self->{mode}, window => $self->{bufsize},
@@ -139,6 +143,119 @@ sub BUILD {
 sub splitter { shift->new(mode => 'split', @_) }
 sub combiner { shift->new(mode => 'combine', @_) }
 
+# Default window: the input and output matrices together (k + n rows
+# of w bytes per column) should fill about half of one CPU's L2 cache,
+# leaving the rest for the multiply's tables and scratch space.
+use constant L2_GUESS => 1 << 20;	# if Math::FastGF2 can't tell us
+
+sub default_bufsize {
+    my ($class, $k, $w, $rows) = @_;
+    my $l2 = Math::FastGF2->can("gf2_cache_size") ?
+	Math::FastGF2::gf2_cache_size(2) : 0;
+    my $cols = int(($l2 || L2_GUESS) / 2 / (($k + $rows) * $w));
+    $cols -= $cols % 64;
+    $cols < 1024 ? 1024 : $cols;
+}
+
+# new input and output matrices of $cols columns
+sub _buffers {
+    my ($self, $cols) = @_;
+    my ($k, $w, $rows) = @{$self}{qw(k w xform_rows)};
+    if ($self->{mode} eq 'split') {
+	return (Math::FastGF2::Matrix->new(
+		    rows  => $k,    cols => $cols,
+		    width => $w,    org  => "colwise"),
+		Math::FastGF2::Matrix->new(
+		    rows  => $rows, cols => $cols,
+		    width => $w,    org  => "rowwise"));
+    } else {
+	return (Math::FastGF2::Matrix->new(
+		    rows  => $k,    cols => $cols,
+		    width => $w,    org  => "rowwise"),
+		Math::FastGF2::Matrix->new(
+		    rows  => $k,    cols => $cols,
+		    width => $w,    org  => "colwise"));
+    }
+}
+
+# Copy the columns [$from, $to) (linear pointers) of one row of a
+# rowwise matrix, or of a whole colwise one ($row undef), to a new
+# matrix with a different window
+sub _move_cols {
+    my ($old, $new, $row, $from, $to, $oldwin, $newwin) = @_;
+    my $words = defined($row) ? 1 : $old->ROWS; # per column
+    $row = 0 unless defined $row;
+    while ($from < $to) {
+	my $cols = $to - $from;
+	$cols = $oldwin - $from % $oldwin if $cols > $oldwin - $from % $oldwin;
+	$cols = $newwin - $from % $newwin if $cols > $newwin - $from % $newwin;
+	$new->setvals_str($row, $from % $newwin,
+			  $old->getvals_str($row, $from % $oldwin,
+					    $cols * $words, 0), 0);
+	$from += $cols;
+    }
+}
+
+# Change the window, keeping whatever is buffered. Callers should ask
+# can_fill etc. again afterwards.
+sub resize {
+    my ($self, $cols) = @_;
+    my $sw = $self->{sw};
+    my $oldwin = $sw->{window};
+
+    die "bufsize must be a whole number > 0"
+	unless $cols > 0 and int($cols) == $cols;
+    return $cols if $cols == $oldwin;
+    $sw->resize($cols);		# dies if buffered columns won't fit
+
+    my ($in, $out) = $self->_buffers($cols);
+    my $bundle = $sw->{bundle};
+    if ($self->{mode} eq 'split') {
+	_move_cols($self->{imat}, $in, undef,
+		   $sw->{read_tail}, $sw->{read_head}, $oldwin, $cols);
+	_move_cols($self->{omat}, $out, $_,
+		   $bundle->[$_]->{tail}, $bundle->[$_]->{head}, $oldwin, $cols)
+	    for 0 .. $#$bundle;
+    } else {
+	_move_cols($self->{imat}, $in, $_,
+		   $bundle->[$_]->{tail}, $bundle->[$_]->{head}, $oldwin, $cols)
+	    for 0 .. $#$bundle;
+	_move_cols($self->{omat}, $out, undef,
+		   $sw->{write_tail}, $sw->{write_head}, $oldwin, $cols);
+    }
+    @{$self}{qw(imat omat bufsize)} = ($in, $out, $cols);
+    $self->{full} = $self->{idle} = 0;
+    $cols;
+}
+
+# With adapt on, called from split_stream/combine_streams with what
+# was buffered just before processing. If the input was full (fills
+# held up for want of space) or processing was cut short by output
+# that hadn't been written yet (drains falling behind), twice running,
+# the window doubles so that there's more to work on in each call.
+# If less than a quarter of it has been in use for 8 calls running,
+# it halves, to stay in cache.
+sub _adapt {
+    my ($self, $in, $out) = @_;
+    my $win = $self->{sw}->{window};
+
+    $self->{full} = ($in == $win or $in + $out > $win) ? $self->{full} + 1 : 0;
+    $self->{idle} = ($in + $out) * 4 < $win ? $self->{idle} + 1 : 0;
+
+    if ($self->{full} >= 2 and $win < $self->{max_bufsize}) {
+	my $new = $win * 2;
+	$new = $self->{max_bufsize} if $new > $self->{max_bufsize};
+	$self->resize($new);
+    } elsif ($self->{idle} >= 8 and $win > $self->{min_bufsize}) {
+	my $new = int($win / 2);
+	my ($bin, $bout) = $self->{sw}->buffered;
+	$new = $self->{min_bufsize} if $new < $self->{min_bufsize};
+	$new = $bin  if $new < $bin;
+	$new = $bout if $new < $bout;
+	$self->resize($new);
+    }
+}
+
 sub fill_stream {
     my ($self,$str) = @_;
     my $k    = $self->{k};
@@ -155,11 +272,11 @@ sub fill_stream {
 
     # need to split string if we straddled matrix boundary
     my ($first,$second) = $sw->destraddle($sw->{read_head},$cols);
-    $str2 = substr $str, $first * $k * $w if defined $second;
+    $str2 = substr $str, $first * $k * $w, length($str), '' if defined $second;
 
     my $rel_col = $sw->{read_head} % $sw->{window};
-    $mat->setvals_str(0, $rel_col, $str, $self->{inorder});
-    $mat->setvals_str(0, 0, $str2, $self->{inorder}) if defined $second;
+    $mat->setvals_str(0, $rel_col, $str, 0);
+    $mat->setvals_str(0, 0, $str2, 0) if defined $second;
 
     $sw->advance_read($cols);
 }
@@ -183,15 +300,33 @@ sub fill_substream {
     # need to split string if we straddled matrix boundary
     my $hash = $sw->{bundle}->[$row];
     my ($first,$second) = $sw->destraddle($hash->{head},$cols);
-    $str2 = substr $str, $first * $w if defined $second;
+    $str2 = substr $str, $first * $w, length($str), '' if defined $second;
 
     my $rel_col = $hash->{head} % $sw->{window};
-    $mat->setvals_str($row, $rel_col, $str, $self->{inorder});
-    $mat->setvals_str($row, 0, $str2, $self->{inorder}) if defined $second;
+    $mat->setvals_str($row, $rel_col, $str, 0);
+    $mat->setvals_str($row, 0, $str2, 0) if defined $second;
 
     $sw->advance_read_substream($row,$cols);
 }
 
+# multiply the same columns of input and output by the transform
+sub _multiply {
+    my ($self, $in, $out, $rows, $col, $cols) = @_;
+
+    if ($self->{prep}) {
+	Math::FastGF2::Matrix::Prepared::multiply_submatrix_c(
+	    $self->{prep}, $in, $out,
+	    0, 0, $rows,
+	    $col, $col, $cols, 0);
+    } else {
+	Math::FastGF2::Matrix::multiply_submatrix_c(
+	    $self->{xform}, $in, $out,
+	    0, 0, $rows,
+	    $col, $col, $cols,
+	    0, $self->{inorder}, $self->{outorder});
+    }
+}
+
 sub split_stream {
     my ($self,$cols) = @_;
     my $sw = $self->{sw};
@@ -206,23 +341,18 @@ sub split_stream {
     # need to split requests if we straddled matrix boundary
     my ($first,$second) = $sw->destraddle($sw->{processed},$cols);
 
-    my $xform = $self->{xform};
     my $in    = $self->{imat};
     my $out   = $self->{omat};
     my $rel_col = $sw->{processed} % $sw->{window};
     my $n     = $self->{xform_rows};
     my $w     = $self->{w};
+    my @buffered = $self->{adapt} ? $sw->buffered : ();
 
-    Math::FastGF2::Matrix::multiply_submatrix_c(
-	$xform, $in, $out,
-	0, 0, $n,
-	$rel_col, $rel_col, $first);
-    Math::FastGF2::Matrix::multiply_submatrix_c(
-	$xform, $in, $out,
-	0, 0, $n,
-	0, 0, $second) if defined $second;
+    $self->_multiply($in, $out, $n, $rel_col, $first);
+    $self->_multiply($in, $out, $n, 0, $second) if defined $second;
 
     $sw->advance_process($cols);
+    $self->_adapt(@buffered) if $self->{adapt};
 }
 
 sub combine_streams {
@@ -238,22 +368,17 @@ sub combine_streams {
     # need to split requests if we straddled matrix boundary
     my ($first,$second) = $sw->destraddle($sw->{processed},$cols);
 
-    my $xform = $self->{xform};
     my $rows  = $self->{xform_rows};
     my $in    = $self->{imat};
     my $out   = $self->{omat};
     my $rel_col = $sw->{processed} % $sw->{window};
+    my @buffered = $self->{adapt} ? $sw->buffered : ();
 
-    Math::FastGF2::Matrix::multiply_submatrix_c(
-	$xform, $in, $out,
-	0, 0, $rows,
-	$rel_col, $rel_col, $first);
-    Math::FastGF2::Matrix::multiply_submatrix_c(
-	$xform, $in, $out,
-	0, 0, $rows,
-	0, 0, $second) if defined $second;
+    $self->_multiply($in, $out, $rows, $rel_col, $first);
+    $self->_multiply($in, $out, $rows, 0, $second) if defined $second;
 
     $sw->advance_process($cols);
+    $self->_adapt(@buffered) if $self->{adapt};
 }
 
 sub empty_stream {
@@ -270,9 +395,9 @@ sub empty_stream {
     my $k = $self->{k};
     my $str = '';
     my $mat = $self->{omat};
-    my $order = $self->{outorder};
+    my $order = 0;		# multiply already did outorder
 
-    my ($first,$second) = $sw->destraddle($sw->{read_tail},$cols);
+    my ($first,$second) = $sw->destraddle($sw->{write_tail},$cols);
     my $rel_col = $sw->{write_tail} % $sw->{window};
 
     $str = $mat->getvals_str(0,$rel_col,$first  * $k,$order);
@@ -301,7 +426,7 @@ sub empty_substream {
     my $str = '';
     my $mat = $self->{omat};
     #my $w   = $self->{w};
-    my $order = $self->{outorder};
+    my $order = 0;		# multiply already did outorder
     my ($first,$second) = $sw->destraddle($tail,$cols);
     my $rel_col = $tail % $sw->{window};
     $str = $mat->getvals_str($row,$rel_col,$first, $order);
@@ -518,9 +643,12 @@ The full list of options available when creating a new splitter is as follows:
  
     # Defaults provided:
     w => 1,                      # field width == 1 byte
-    bufsize  => 16384,           # columns in in/out matrices
+    bufsize  => undef,           # columns in in/out matrices (see below)
     inorder  => 0,               # no byte-swapping ...
     outorder => 0,               # ie, native byte order
+    adapt    => 0,               # don't resize the window by itself
+    min_bufsize => bufsize / 8,  # limits for adapt
+    max_bufsize => bufsize * 8,
  );
 
 The 'n' value (number of shares) is not passed in explicitly. Instead
@@ -556,11 +684,37 @@ The full list of options available when creating a new combiner is as follows:
  
     # defaults provided:
     w => 1,                      # field width == 1 byte
-    bufsize  => 16384,           # columns in in/out matrices
+    bufsize  => undef,           # columns in in/out matrices (see below)
     inorder  => 0,               # no byte-swapping ...
     outorder => 0,               # ie, native byte order
+    adapt    => 0,               # don't resize the window by itself
+    min_bufsize => bufsize / 8,  # limits for adapt
+    max_bufsize => bufsize * 8,
  );
 
+=head1 WINDOW SIZE
+
+If 'bufsize' isn't given, the window is sized so that the input and
+output matrices together take up about half of one CPU's share of the
+L2 cache, as reported by C<Math::FastGF2::gf2_cache_size> (1MB is
+assumed if it can't tell). It's a multiple of 64 columns and at least
+1024. C<Crypt::IDA::Algorithm-E<gt>default_bufsize($k, $w, $rows)>
+returns the value that would be used, and C<bufsize> the one in use.
+
+The window can be changed at any time with
+
+ $alg->resize($cols);
+
+Whatever is buffered is kept, so the new size must be at least as
+large as what C<$alg-E<gt>sw-E<gt>buffered> reports (it dies
+otherwise). Call C<can_fill> etc. again afterwards.
+
+With 'adapt' set, C<split_stream> and C<combine_streams> do this
+themselves, between 'min_bufsize' and 'max_bufsize'. The window
+doubles after two calls running that found the input full or the
+output backed up, so that each call gets more done, and halves after
+eight calls running where less than a quarter of it was in use.
+
 =head1 CALLBACKS
 
 None currently implemented in this class, but see
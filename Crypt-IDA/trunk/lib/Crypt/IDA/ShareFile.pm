@@ -9,12 +9,15 @@ use vars qw(@ISA @EXPORT @EXPORT_OK %EXPORT_TAGS $VERSION);
 
 use Carp;
 use Fcntl qw(:DEFAULT :seek);
+use POSIX ();
+use Time::HiRes ();
 use Crypt::IDA qw(:all);
 
 require Exporter;
 
 my @export_default = qw( sf_calculate_chunk_sizes
-			 sf_split sf_combine);
+			 sf_split sf_combine sf_update
+			 sf_split_many sf_combine_many sf_combine_range);
 my @export_extras  = qw( sf_sprintf_filename );
 
 our @ISA = qw(Exporter);
@@ -217,6 +220,20 @@ sub sf_mk_file_ostream {
 # 1 	 opt_large_w    Large (2-byte) s value?
 # 2 	 opt_final      Final chunk in file? (1=full file/final chunk)
 # 3 	 opt_transform  Is transform data included?
+# 4 	 opt_systematic Split with a systematic transform?
+# 5 	 opt_hash       Share data is followed by a hash trailer?
+#
+# opt_systematic means that shares 0 .. k-1 are plain stripes of the
+# input (their transform rows are rows of the identity matrix) and the
+# rest are Cauchy parity rows made from the same key. Readers that
+# don't know about this bit can still combine the shares if the
+# transform rows are stored, since it doesn't change the layout.
+#
+# opt_hash means that the share data is followed by a 64-byte trailer:
+# the SHA-256 digest of this share's data, then the SHA-256 digest of
+# the chunk of the original file (without padding). The amount of share
+# data is known from the chunk range, so readers that don't know about
+# the trailer never read it.
 #
 # Note that the chunk_next field is 1 greater than the actual offset
 # of the chunk end. In other words, the chunk ranges from the byte
@@ -308,6 +325,8 @@ sub sf_read_ida_header {
   $header_info->{opt_large_w}   = ($header_info->{options} & 2) >> 1;
   $header_info->{opt_final}     = ($header_info->{options} & 4) >> 2;
   $header_info->{opt_transform} = ($header_info->{options} & 8) >> 3;
+  $header_info->{opt_systematic}= ($header_info->{options} & 16) >> 4;
+  $header_info->{opt_hash}      = ($header_info->{options} & 32) >> 5;
 
   # read k (regular or large variety) and check for consistency
   return $header_info unless
@@ -449,6 +468,8 @@ sub sf_write_ida_header {
 		   chunk_next => undef,
 		   transform => undef,
 		   opt_final => undef,
+		   systematic => 0,
+		   hash => 0,
 		   dry_run => 0,
 		   @_
 		  );
@@ -456,11 +477,11 @@ sub sf_write_ida_header {
 
   # save to local variables
   my ($ostream,$version,$k,$s,$chunk_start,$chunk_next,
-      $transform,$opt_final,$dry_run) =
+      $transform,$opt_final,$systematic,$hash,$dry_run) =
     map {
       exists($header_info{$_}) ? $header_info{$_} : undef
     } qw(ostream version quorum width chunk_start chunk_next transform
-	 opt_final dry_run);
+	 opt_final systematic hash dry_run);
 
   return 0 unless defined($version) and $version == 1;
   return 0 unless defined($k) and defined($s) and
@@ -507,7 +528,9 @@ sub sf_write_ida_header {
 		       ($opt_large_k)        |
 		       ($opt_large_w)   << 1 |
 		       ($opt_final)     << 2 |
-		       ($opt_transform) << 3),
+		       ($opt_transform) << 3 |
+		       ($systematic ? 1 : 0) << 4 |
+		       ($hash ? 1 : 0) << 5),
 		      1);
   $header_size += 1;
 
@@ -739,7 +762,7 @@ sub sf_calculate_chunk_sizes {
 		     "chunk_start" => $cb,
 		     "chunk_next"  => $file_size,
 		     "chunk_size"  => $file_size - $cb,
-		     "file_size"   => $hs + $padded_file_size,
+		     "file_size"   => $hs + $file_size - $cb,
 		     "opt_final"   => 1,
 		     "padding"     => $padded_file_size - $file_size,
 		    };
@@ -798,6 +821,14 @@ sub sf_split {
 	 # allow creation of a subset of shares, chunks
 	 sharelist => undef,	# [ $row1, $row2, ... ]
 	 chunklist => undef,	# [ $chunk1, $chunk2, ... ]
+	 # shares 0 .. k-1 are plain stripes, the rest parity
+	 systematic => 0,
+	 # multiply straight between mmap'd input and share files
+	 mmap => 0,
+	 # split up to this many chunks at once in forked workers
+	 max_parallel => 1,
+	 # append SHA-256 of share data and original to each share
+	 hash => 0,
 	 # specify pattern to use for share filenames
 	 filespec => undef,	# default value set later on
 	 @_,
@@ -809,7 +840,7 @@ sub sf_split {
 	 opt_final => 0,
 	);
 
-  my (@chunks, @results);
+  my (@chunks, @results, $header_size);
 
   # Copy options into local variables
   my ($n, $k, $w, $filename,
@@ -878,12 +909,77 @@ sub sf_split {
     $chunklist=[ 0 .. scalar(@chunks) - 1 ];
   }
 
-  # Now loop through each chunk that we've been asked to create
-  for my $i (@$chunklist) {
+  # Unfortunately, creating a new share isn't quite as simple as
+  # calling ida_split with all our parameters. The job is
+  # complicated by the fact that we need to store both the share
+  # data and (usually) a row of the transform matrix. In the case
+  # where a new transform matrix would be created by the call to
+  # ida_split, then we would have to wait until it returned before
+  # writing the transform rows for it to each share header. But that
+  # would require that we write the header after the share, which
+  # isn't a very nice solution. Also, we'd still have to calculate
+  # the correct amount of space to allocate for the header before
+  # setting up the empty handlers, which is also a bit messy.
+  #
+  # The simplest solution is to examine the key/matrix and
+  # save_transform options we've been given and call the
+  # ida_generate_key and/or ida_key_to_matrix routines ourselves, if
+  # necessary. Then we will know which transform rows to save with
+  # each share and we can pass our generated key/matrix directly on
+  # to ida_split. The same transform is used for every chunk.
+
+  if (ida_check_transform_opts(%o)) {
+    carp "Can't proceed due to problem with transform options";
+    return undef;
+  }
+  unless (defined($mat)) {
+    if (defined ($key)) {
+      if (ida_check_key($k,$n,$w,$key)) {
+	carp "Problem with supplied key";
+	return undef;
+      }
+    } else {
+      $rng=ida_rng_init($w,$rng);	# swap string for closure
+      unless (defined($rng)) {
+	carp "Failed to initialise random number generator";
+	return undef;
+      }
+      $key=ida_generate_key($k,$n,$w,$rng);
+    }
+
+    # now generate matrix from key
+    $mat=ida_key_to_matrix( "quorum"      => $k,
+			    "shares"      => $n,
+			    "width"       => $w,
+			    "sharelist"   => $sharelist,
+			    "key"         => $key,
+			    "systematic"  => $o{systematic},
+			    "skipchecks?" => 0);
+    unless (defined($mat)) {
+      carp "bad return value from ida_key_to_matrix";
+      return undef;
+    }
+    $o{"matrix"}=$mat;	# stash new matrix
+    $o{"key"}=undef;		# and undefine key (if any)
+  }
+
+  # The mmap code works on just the rows for the shares being made,
+  # but the caller gets back the full matrix either way. The hashes
+  # are made by the streaming pipeline, so they rule out mmap.
+  my $mapped=($o{mmap} and !$o{hash} and sf_can_map());
+  my $mapmat=$mapped ? $o{"matrix"}->copy_rows(@$sharelist) : undef;
+
+  # Each chunk is done by this closure, which returns the number of
+  # bytes read and the names of the share files made, or an empty
+  # list on failure. Chunks don't depend on each other, so they can
+  # be done in any order, or in separate processes.
+  my $split_chunk = sub {
+    my $i=shift;
 
     my $chunk=$chunks[$i];
     my @sharefiles=();		# we return a list of files in each
                                 # chunk at the end of the routine.
+    my @sharefhs=();
 
     # Unpack chunk details into local variables. Not all these
     # variables are needed, but we might as well unpack them anyway.
@@ -903,60 +999,7 @@ sub sf_split {
     my $filler=fill_from_file($filename, $k * $w, $chunk_start);
     unless (defined($filler)) {
       carp "Failed to open input file: $!";
-      return undef;
-    }
-
-    # Unfortunately, creating a new share isn't quite as simple as
-    # calling ida_split with all our parameters. The job is
-    # complicated by the fact that we need to store both the share
-    # data and (usually) a row of the transform matrix. In the case
-    # where a new transform matrix would be created by the call to
-    # ida_split, then we would have to wait until it returned before
-    # writing the transform rows for it to each share header. But that
-    # would require that we write the header after the share, which
-    # isn't a very nice solution. Also, we'd still have to calculate
-    # the correct amount of space to allocate for the header before
-    # setting up the empty handlers, which is also a bit messy.
-    #
-    # The simplest solution is to examine the key/matrix and
-    # save_transform options we've been given and call the
-    # ida_generate_key and/or ida_key_to_matrix routines ourselves, if
-    # necessary. Then we will know which transform rows to save with
-    # each share and we can pass our generated key/matrix directly on
-    # to ida_split.
-
-    if (ida_check_transform_opts(%o)) {
-      carp "Can't proceed due to problem with transform options";
-      return undef;
-    }
-    unless (defined($mat)) {
-      if (defined ($key)) {
-	if (ida_check_key($k,$n,$w,$key)) {
-	  carp "Problem with supplied key";
-	  return undef;
-	}
-      } else {
-	$rng=ida_rng_init($w,$rng);	# swap string for closure
-	unless (defined($rng)) {
-	  carp "Failed to initialise random number generator";
-	  return undef;
-	}
-	$key=ida_generate_key($k,$n,$w,$rng);
-      }
-
-      # now generate matrix from key
-      $mat=ida_key_to_matrix( "quorum"      => $k,
-			      "shares"      => $n,
-			      "width"       => $w,
-			      "sharelist"   => $sharelist,
-			      "key"         => $key,
-			      "skipchecks?" => 0);
-      unless (defined($mat)) {
-	carp "bad return value from ida_key_to_matrix";
-	return undef;
-      }
-      $o{"matrix"}=$mat;	# stash new matrix
-      $o{"key"}=undef;		# and undefine key (if any)
+      return ();
     }
 
     $o{"chunk_start"}= $chunk_start;  # same values for all shares
@@ -974,22 +1017,24 @@ sub sf_split {
       my $sharestream = sf_mk_file_ostream($sharename, $w);
       unless (defined($sharestream)) {
 	carp "Failed to create share file (chunk $i, share $j): $!";
-	return undef;
+	return ();
       }
       my $hs=sf_write_ida_header(%o, ostream => $sharestream,
 				 transform => [$mat->getvals($j,0,$k)]);
       unless (defined ($hs) and $hs > 0) {
 	carp "Problem writing header for share (chunk $i, share $j)";
-	return undef;
+	return ();
       }
       unless ($hs + $chunk_size == $file_size) {
 	carp "file size mismatch ($i,$j) (this shouldn't happen)";
 	carp "hs=$hs; chunk_size=$chunk_size; file_size=$file_size; pad=$padding";
-	return undef;
+	return ();
       }
       my $emptier=empty_to_fh($sharestream->{"FH"}->(),$hs);
       push @$emptiers, $emptier;
       push @sharefiles, $sharename;
+      push @sharefhs, $sharestream->{"FH"}->();
+      $header_size=$hs;
     }
 
     # Now that we've written the headers and set up the fill and empty
@@ -998,18 +1043,55 @@ sub sf_split {
     # create all shares for this chunk.
     $o{"filler"}   = $filler;
     $o{"emptiers"} = $emptiers;
-    my ($key,$mat,$bytes)=ida_split(%o);
+    $o{"bytes"}    = $opt_final ? 0 : $chunk_size; # stop at end of chunk
+    $o{"hashes"}   = $o{hash} ? [] : undef;
+    my $bytes;
+    if ($mapped) {
+      $bytes=sf_mapped_split($mapmat, $filename, $chunk_start, $chunk_size,
+			     \@sharefiles, $header_size, %o);
+    } else {
+      (undef,undef,$bytes)=ida_split(%o);
+    }
 
-    # check for success, then save the results
-    unless (defined($mat)) {
+    # check for success
+    unless (defined($bytes)) {
       carp "detected failure in ida_split; quitting";
-      return undef;
+      return ();
+    }
+
+    # hashes come back for the input, then each share
+    if ($o{hash}) {
+      my $hashes=$o{"hashes"};
+      unless (@$hashes == 1 + @sharefhs) {
+	carp "No hashes from ida_split (needs Math::FastGF2 pipeline)";
+	return ();
+      }
+      for my $s (0 .. $#sharefhs) {
+	unless (sf_write_hash_trailer($sharefhs[$s], $hashes->[1 + $s],
+				      $hashes->[0])) {
+	  carp "Failed to write hash trailer to $sharefiles[$s]: $!";
+	  return ();
+	}
+      }
     }
-    push @results, [$key,$mat,$bytes, @sharefiles];
 
     # Perl should handle closing file handles for us once they go out
     # of scope and they're destroyed.
+    return ($bytes, @sharefiles);
+  };
 
+  # Now do each chunk that we've been asked to create, either here
+  # one after another or in up to max_parallel child processes
+  if ($o{max_parallel} > 1 and @$chunklist > 1) {
+    my @done=sf_run_parallel($split_chunk, $chunklist, $o{max_parallel});
+    return undef unless @done;
+    push @results, map { [$o{"key"}, $o{"matrix"}, @$_] } @done;
+  } else {
+    for my $i (@$chunklist) {
+      my @done=$split_chunk->($i);
+      return undef unless @done;
+      push @results, [$o{"key"}, $o{"matrix"}, @done];
+    }
   }
 
   return @results;
@@ -1106,8 +1188,17 @@ sub sf_combine {
      matrix => undef,
      shares => undef,		# only needed if key supplied
      sharelist => undef,	# only needed if key supplied
+     systematic => undef,	# as for key (default: from header)
      # misc options
      bufsize => 4096,
+     mmap => 0,			# multiply between mmap'd files
+     verify => 1,		# check shares against their hash trailers
+     # Given more than quorum infiles, combine from whichever k deliver
+     # data first, swapping in a spare for any that stalls for more
+     # than deadline seconds (at the next segment boundary)
+     fastest => 0,
+     deadline => 2,
+     segment => 262144,	# columns
      @_,
      # byte order options (can't be overriden)
      inorder => 2,
@@ -1161,6 +1252,8 @@ sub sf_combine {
   }
   $infiles=$new_filelist;
 
+  return sf_combine_fastest(%o, infiles => $infiles) if $o{fastest};
+
   # If k-value is given, only check it after we've de-duped the input
   # file list.
   if (defined($k) and scalar(@$infiles) < $k) {
@@ -1178,6 +1271,7 @@ sub sf_combine {
   # Read in headers from each infile and create a new filler for each
   my ($nshares, $header_info, $header_size)=(0,undef,undef);
   my ($chunk_start,$chunk_next)=(undef,undef);
+  my $hashed=$o{verify};	# do all the shares used have trailers?
   foreach my $infile (@$infiles) {
 
     my $istream=sf_mk_file_istream($infile,1);
@@ -1204,8 +1298,11 @@ sub sf_combine {
     $header_size = $header_info->{header_size};
     $chunk_start = $header_info->{chunk_start};
     $chunk_next  = $header_info->{chunk_next};
+    $o{systematic} = $header_info->{opt_systematic}
+      unless defined $o{systematic};
 
     if (++$nshares <= $k) {
+      $hashed=0 unless $header_info->{opt_hash};
       if ($header_info->{opt_transform}) {
 	if (defined($mat)) {
 	  carp "Ignoring file transform data (overriden by matrix option)";
@@ -1279,23 +1376,73 @@ sub sf_combine {
     $bytes += (($k * $w) - $bytes % ($k * $w));
   }
 
-  # we leave creating/opening the output file until relatively late
-  # since we need to know what offset to seek to in it, and we only
-  # know that when we've examined the sharefile headers
-  my $emptier=empty_to_file($outfile,undef,$chunk_start);
-
-  # Need to update %o before calling ida_combine
-  $o{"emptier"} = $emptier;	# leave error-checking to ida_combine
-  $o{"fillers"} = $fillers;
-  $o{"matrix"}  = $mat     unless (defined($key));
-  $o{"quorum"}  = $k;
-  $o{"width"}   = $w;
-  $o{"bytes"}   = $bytes;
-
-  my $output_bytes=ida_combine(%o);
+  my $output_bytes;
+  if ($bytes == 0) {
+    # An empty chunk has nothing to combine. ida_combine would take
+    # bytes => 0 to mean "read to EOF", and read the hash trailers as
+    # share data, so just make the output file. Every hash in the
+    # trailers should be that of no data.
+    return undef unless defined(empty_to_file($outfile,undef,$chunk_start));
+    $output_bytes=0;
+    $o{"hashes"}=$hashed ? [ (SF_HASH_EMPTY()) x ($k + 1) ] : undef;
+  } elsif ($o{mmap} and sf_can_map()) {
+    if (defined($key)) {
+      $mat=ida_key_to_matrix(quorum      => $k,
+			     shares      => $shares,
+			     width       => $w,
+			     sharelist   => $sharelist,
+			     key         => $key,
+			     systematic  => $o{systematic},
+			     "skipchecks?" => 0,
+			     "invert?"   => 1);
+      unless (defined($mat)) {
+	carp "Failed to invert transform matrix";
+	return undef;
+      }
+    }
+    $output_bytes=sf_mapped_combine($mat, [ @$infiles[0 .. $k - 1] ],
+				    $header_size, $outfile, $chunk_start,
+				    $bytes, %o, quorum => $k, width => $w);
+  } else {
+    # we leave creating/opening the output file until relatively late
+    # since we need to know what offset to seek to in it, and we only
+    # know that when we've examined the sharefile headers
+    my $emptier=empty_to_file($outfile,undef,$chunk_start);
+
+    # Need to update %o before calling ida_combine
+    $o{"emptier"} = $emptier;	# leave error-checking to ida_combine
+    $o{"fillers"} = $fillers;
+    $o{"matrix"}  = $mat     unless (defined($key));
+    $o{"quorum"}  = $k;
+    $o{"width"}   = $w;
+    $o{"bytes"}   = $bytes;
+    $o{"hashes"}  = $hashed ? [] : undef;
+
+    $output_bytes=ida_combine(%o);
+  }
 
   return undef unless defined($output_bytes);
 
+  # The pipeline hashed each share as it read it (and the output, but
+  # that only matches the original's hash if there was no padding).
+  # If it couldn't be used there's nothing to check against.
+  if ($hashed and $o{"hashes"} and @{$o{"hashes"}}) {
+    my $hashes=$o{"hashes"};
+    for my $i (0 .. $k - 1) {
+      my ($share,$orig)=sf_read_hash_trailer($infiles->[$i],
+					     $header_size + $bytes / $k);
+      unless (defined($share) and $share eq $hashes->[$i]) {
+	carp "Share file $infiles->[$i] doesn't match its hash";
+	return undef;
+      }
+      if ($i == 0 and $bytes == $chunk_next - $chunk_start and
+	  $orig ne $hashes->[$k]) {
+	carp "Combined output doesn't match the original file's hash";
+	return undef;
+      }
+    }
+  }
+
   if ($header_info->{opt_final}) {
     #warn "Truncating output file to $header_info->{chunk_next} bytes\n";
     truncate $outfile, $header_info->{chunk_next};
@@ -1304,6 +1451,932 @@ sub sf_combine {
   return $output_bytes;
 }
 
+# "Fastest k of n" combine (sf_combine with fastest => 1). A reader
+# process is started for each candidate share. It reads the header,
+# then the share data a segment at a time, staying no more than
+# SF_READ_AHEAD segments ahead of the combine, and writes "H" and then
+# a "." per segment to its pipe as it goes. The first k shares to get
+# their header and first segment read are used and the other readers
+# are stopped. Each segment is then combined (from the page cache)
+# once all k shares have read it; a share that hasn't within the
+# deadline is swapped for a spare, whose reader starts at that
+# segment, and the inverse matrix is remade for the new set.
+use constant SF_READ_AHEAD => 4;
+use constant SF_REAP_GRACE => 0.2;	# seconds before TERM becomes KILL
+my @sf_unreaped;		# stopped readers still stuck in I/O
+
+sub sf_start_reader {
+  my ($file, $segcols, $first, $others) = @_;
+  my ($rd, $wr, $crd, $cwr, $pid);
+
+  return undef unless pipe($rd, $wr) and pipe($crd, $cwr);
+  return undef unless defined($pid = fork);
+  if ($pid == 0) {
+    close $rd;
+    close $cwr;
+    for (@$others) { close $_->{rd}; close $_->{cmd} }
+    my $istream = sf_mk_file_istream($file, 1);
+    my $hdr = defined($istream) ? sf_read_ida_header($istream) : undef;
+    POSIX::_exit(1) unless $hdr and !$hdr->{error};
+    syswrite $wr, "H";
+
+    my $colsize = $hdr->{k} * $hdr->{w};
+    my $bytes   = $hdr->{chunk_next} - $hdr->{chunk_start};
+    $bytes += $colsize - $bytes % $colsize if $bytes % $colsize;
+    my $len = $bytes / $hdr->{k};
+    my $seglen = $segcols * $hdr->{w};
+    my ($fh, $buf, $consumed) = (undef, undef, 0);
+    POSIX::_exit(1) unless sysopen $fh, $file, O_RDONLY;
+    for (my $j = $first; $j * $seglen < $len; ++$j) {
+      while ($j >= $first + $consumed + SF_READ_AHEAD) {
+	my $got = sysread($crd, $buf, 64);
+	POSIX::_exit(0) unless $got;	# parent has finished with us
+	$consumed += $got;
+      }
+      my $want = $len - $j * $seglen;
+      $want = $seglen if $want > $seglen;
+      sysseek $fh, $hdr->{header_size} + $j * $seglen, SEEK_SET;
+      while ($want > 0) {
+	my $got = sysread($fh, $buf, $want > 65536 ? 65536 : $want);
+	POSIX::_exit(1) unless $got;
+	$want -= $got;
+      }
+      syswrite $wr, ".";
+    }
+    POSIX::_exit(0);
+  }
+  close $wr;
+  close $crd;
+  return { file => $file, pid => $pid, rd => $rd, cmd => $cwr,
+	   hdr => 0, got => $first, done => 0, failed => 0 };
+}
+
+# Read progress from the readers, waiting up to $timeout seconds
+# (forever if undef) for at least one of them to say something
+sub sf_poll_readers {
+  my ($timeout, @readers) = @_;
+  my ($rin, $rout) = ("");
+
+  @readers = grep { !$_->{done} } @readers;
+  return unless @readers;
+  vec($rin, fileno($_->{rd}), 1) = 1 for @readers;
+  return unless select($rout = $rin, undef, undef, $timeout) > 0;
+  for my $r (@readers) {
+    next unless vec($rout, fileno($r->{rd}), 1);
+    my $got = sysread($r->{rd}, my $buf, 4096);
+    next if !defined($got) and $!{EINTR};
+    if ($got) {
+      $r->{hdr} = 1 if $buf =~ s/^H//;
+      $r->{got} += length($buf);
+    } else {
+      $r->{done} = 1;
+      waitpid($r->{pid}, 0);
+      $r->{failed} = 1 if $? or !$r->{hdr};
+    }
+  }
+}
+
+sub sf_stop_reader {
+  my $r = shift;
+
+  close $r->{cmd};
+  close $r->{rd};
+  return if $r->{done};
+  kill 'TERM', $r->{pid};
+  push @sf_unreaped, $r->{pid};
+}
+
+# Wait for the stopped readers to exit, killing any that haven't
+# after SF_REAP_GRACE seconds (a stalled or stopped one can ignore
+# TERM). One stuck in uninterruptible I/O stays on the list for the
+# next call to try again.
+sub sf_reap_readers {
+  for my $sig (undef, 'KILL') {
+    kill $sig, @sf_unreaped if $sig and @sf_unreaped;
+    my $until = Time::HiRes::time() + SF_REAP_GRACE;
+    while (1) {
+      @sf_unreaped = grep { waitpid($_, POSIX::WNOHANG()) == 0 } @sf_unreaped;
+      last unless @sf_unreaped and Time::HiRes::time() < $until;
+      Time::HiRes::sleep(0.01);
+    }
+  }
+}
+
+# Has the reader got segment $seg in (or read all there is)?
+sub sf_reader_has {
+  my ($r, $seg) = @_;
+  return !$r->{failed} && $r->{hdr} && ($r->{got} > $seg || $r->{done});
+}
+
+sub sf_combine_fastest {
+  my %o = @_;
+  my ($infiles, $outfile, $key) = @o{qw(infiles outfile key)};
+  my ($k, $w) = @o{qw(quorum width)};
+  my ($chunk_start, $chunk_next, $header_size);
+  my (@readers, @chosen, $mat);
+  my $total = 0;
+
+  # reap any readers stopped by earlier calls that have since exited
+  @sf_unreaped = grep { waitpid($_, POSIX::WNOHANG()) == 0 } @sf_unreaped;
+
+  if (defined($o{matrix})) {
+    carp "fastest combine needs transform rows in the shares or a key";
+    return undef;
+  }
+  if (defined($key) and @{$o{sharelist}} != @$infiles) {
+    carp "key option needs a sharelist entry for each infile";
+    return undef;
+  }
+  local $SIG{PIPE} = 'IGNORE';
+
+  # Read and check the header of a share whose reader has it cached;
+  # false if it doesn't belong with the others
+  my $take = sub {
+    my $r = shift;
+    my $istream = sf_mk_file_istream($r->{file}, 1);
+    my $hdr = defined($istream) ?
+      sf_read_ida_header($istream, $k, $w, $chunk_start, $chunk_next,
+			 $header_size) :
+      { error => 1, error_message => "can't open: $!" };
+    if ($hdr->{error}) {
+      carp "$r->{file}: $hdr->{error_message}";
+    } elsif (!defined($key) and !$hdr->{opt_transform}) {
+      carp "$r->{file}: no transform data and no key was supplied";
+    } else {
+      ($k, $w, $chunk_start, $chunk_next, $header_size) =
+	map { $hdr->{$_} } qw(k w chunk_start chunk_next header_size);
+      $o{systematic} = $hdr->{opt_systematic}
+	unless defined $o{systematic};
+      $r->{header} = $hdr;
+      return 1;
+    }
+    $r->{failed} = 1;
+    return 0;
+  };
+  my $fail = sub {
+    carp shift;
+    sf_stop_reader($_) for @readers;
+    sf_reap_readers();
+    return undef;
+  };
+
+  # race all the candidates for their header and first segment
+  for my $i (0 .. $#$infiles) {
+    my $r = sf_start_reader($infiles->[$i], $o{segment}, 0, \@readers);
+    return $fail->("Failed to start reader for $infiles->[$i]: $!")
+      unless $r;
+    $r->{index} = $i;
+    push @readers, $r;
+  }
+  while (!defined($k) or @chosen < $k) {
+    for my $r (@readers) {
+      next if $r->{taken} or !sf_reader_has($r, 0);
+      next unless $take->($r);
+      $r->{taken} = 1;
+      push @chosen, $r;
+      last if @chosen == $k;
+    }
+    last if defined($k) and @chosen == $k;
+    return $fail->("Not enough shares to combine (have " .
+		   scalar(@chosen) . ")")
+      unless grep { !$_->{done} } @readers;
+    sf_poll_readers(undef, @readers);
+  }
+
+  # the rest are spares, fastest first; stop their readers for now
+  my @spares = sort { $b->{hdr} <=> $a->{hdr} or $b->{got} <=> $a->{got} }
+    grep { !$_->{taken} and !$_->{failed} } @readers;
+  sf_stop_reader($_) for @spares;
+  @readers = @chosen;
+
+  my $bytes = $chunk_next - $chunk_start;
+  $bytes += $k * $w - $bytes % ($k * $w) if $bytes % ($k * $w);
+  my $len    = $bytes / $k;
+  my $seglen = $o{segment} * $w;
+  my $nsegs = int(($len + $seglen - 1) / $seglen);
+
+  for my $seg (0 .. $nsegs - 1) {
+    my $start = Time::HiRes::time();
+    while (my @late = grep { !sf_reader_has($_, $seg) } @chosen) {
+      my $left = $start + $o{deadline} - Time::HiRes::time();
+      if (my @failed = grep { $_->{failed} } @late) {
+	# a share that fails outright is replaced right away
+	return $fail->("Reading $failed[0]->{file} failed and no spares left")
+	  unless @spares;
+	$left = 0;
+      }
+      if ($left > 0 or !@spares) {
+	sf_poll_readers($left > 0 ? $left : undef, @late);
+	next;
+      }
+
+      # swap the stalled (or failed) shares for spares
+      for my $i (0 .. $k - 1) {
+	next if sf_reader_has($chosen[$i], $seg) or !@spares;
+	my $old   = $chosen[$i];
+	my $spare = shift @spares;
+	my $r = sf_start_reader($spare->{file}, $o{segment}, $seg, \@readers);
+	return $fail->("Failed to start reader for $spare->{file}: $!")
+	  unless $r;
+	$r->{index} = $spare->{index};
+	sf_stop_reader($old);
+	@readers = grep { $_ != $old } @readers, $r;
+	$chosen[$i] = $r;
+	undef $mat;
+      }
+      $start = Time::HiRes::time();
+    }
+    for my $r (@chosen) {
+      next if $r->{header};
+      return $fail->("Share $r->{file} doesn't match the others")
+	unless $take->($r);
+    }
+
+    # inverse matrix for the current set of shares
+    unless (defined($mat)) {
+      if (defined($key)) {
+	$mat = ida_key_to_matrix(quorum      => $k,
+				 shares      => $o{shares},
+				 width       => $w,
+				 sharelist   => [ map { $o{sharelist}->[$_->{index}] }
+						  @chosen ],
+				 key         => $key,
+				 systematic  => $o{systematic},
+				 "skipchecks?" => 0,
+				 "invert?"   => 1);
+      } else {
+	$mat = Math::FastGF2::Matrix->new(rows => $k, cols => $k,
+					  width => $w, org => "rowwise");
+	$mat->setvals(0, 0, [ map { @{$_->{header}->{transform}} } @chosen ],
+		      $o{inorder});
+	$mat = $mat->invert();
+      }
+      return $fail->("Failed to invert matrix for combine")
+	unless defined($mat);
+    }
+
+    my $want = $len - $seg * $seglen;
+    $want = $seglen if $want > $seglen;
+    my $got = ida_combine(%o,
+			  fillers  => [ map {
+			    fill_from_file($_->{file}, $k * $w,
+					   $header_size + $seg * $seglen)
+			  } @chosen ],
+			  emptier  => empty_to_file($outfile, undef,
+						    $chunk_start +
+						    $seg * $seglen * $k),
+			  matrix   => $mat,
+			  key      => undef,
+			  quorum   => $k,
+			  width    => $w,
+			  bytes    => $want * $k,
+			  hashes   => undef);
+    return $fail->("ida_combine failed on segment $seg") unless defined($got);
+    $total += $got;
+    syswrite $_->{cmd}, "." for @chosen;	# let them read further ahead
+  }
+
+  sf_stop_reader($_) for @readers;
+  sf_reap_readers();
+  empty_to_file($outfile) unless $nsegs;	# empty chunk: still create it
+  truncate $outfile, $chunk_next if $chosen[0]->{header}->{opt_final};
+  return $total;
+}
+
+# Hash trailers (see opt_hash above). Writing appends one to a share
+# file handle; reading returns the (share, original) digests from the
+# trailer at the given offset, or an empty list.
+use constant SF_HASH_LEN => 32;
+use constant SF_HASH_EMPTY => pack "H*",	# SHA-256 of no data
+  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+sub sf_write_hash_trailer {
+  my ($fh, $share, $orig) = @_;
+  my $trailer = $share . $orig;
+
+  return 0 unless length($trailer) == 2 * SF_HASH_LEN;
+  return 0 unless defined(sysseek $fh, 0, SEEK_END);
+  my $rc = syswrite $fh, $trailer;
+  return defined($rc) && $rc == length($trailer);
+}
+
+sub sf_read_hash_trailer {
+  my ($filename, $offset) = @_;
+  my ($fh, $trailer);
+
+  return () unless sysopen $fh, $filename, O_RDONLY;
+  return () unless defined(sysseek $fh, $offset, SEEK_SET);
+  return () unless (sysread($fh, $trailer, 2 * SF_HASH_LEN) || 0)
+    == 2 * SF_HASH_LEN;
+  return (substr($trailer, 0, SF_HASH_LEN), substr($trailer, SF_HASH_LEN));
+}
+
+# Cut a share file back to the end of its data and clear opt_hash
+sub sf_drop_hash_trailer {
+  my ($filename, $size) = @_;
+  my ($fh, $options);
+
+  return 0 unless sysopen $fh, $filename, O_RDWR;
+  return 0 unless defined(sysseek $fh, 3, SEEK_SET) and
+    sysread($fh, $options, 1) == 1;
+  $options = chr(ord($options) & ~32);
+  return 0 unless defined(sysseek $fh, 3, SEEK_SET) and
+    syswrite($fh, $options) == 1;
+  return truncate $fh, $size;
+}
+
+# mmap versions of the ida_split/ida_combine calls in sf_split and
+# sf_combine. The input is mapped read-only with MADV_SEQUENTIAL, the
+# output files are mapped for writing (space for them is allocated
+# up front) and a prepared transform multiplies from one mapping to
+# the others directly, so the data never goes through a Perl string
+# or a read/write call. Files are mapped a slice of columns at a time
+# to keep the mappings a sensible size. Both return the number of
+# (padded) bytes of input, as ida_split and ida_combine do, or undef.
+use constant SF_MAP_COLS => 1 << 22;
+
+sub sf_can_map {
+  return Math::FastGF2::Matrix::Prepared->can("multiply_rows_c");
+}
+
+sub sf_mapped_split {
+  my ($mat, $filename, $offset, $bytes, $sharefiles, $hs, %o) = @_;
+  my ($k, $w) = ($o{quorum}, $o{width});
+  my $class   = "Math::FastGF2::Matrix";
+  my $colsize = $k * $w;
+  my $full    = int($bytes / $colsize);
+  my $tail    = $bytes - $full * $colsize;
+  my $prep    = $mat->prepare($o{inorder}, $o{outorder});
+  my ($c, $nc, $in, @out);
+
+  for ($c=0; $c < $full; $c += $nc) {
+    $nc  = $full - $c < SF_MAP_COLS ? $full - $c : SF_MAP_COLS;
+    $in  = $class->new_from_file(rows => $k, cols => $nc, width => $w,
+				 org => "colwise", file => $filename,
+				 offset => $offset + $c * $colsize,
+				 advise => "sequential");
+    @out = map {
+      $class->new_from_file(rows => 1, cols => $nc, width => $w,
+			    file => $_, offset => $hs + $c * $w,
+			    writable => 1);
+    } @$sharefiles;
+    return undef if grep { !defined } $in, @out;
+    return undef unless $prep->multiply($in, \@out);
+  }
+
+  # The final column gets padded with zeroes, so it can't come
+  # straight from the mapping
+  if ($tail) {
+    my ($fh, $buf);
+    return undef unless sysopen $fh, $filename, O_RDONLY;
+    sysseek $fh, $offset + $full * $colsize, SEEK_SET;
+    return undef unless sysread($fh, $buf, $tail) == $tail;
+    close $fh;
+    $in  = $class->new_from_string(rows => $k, cols => 1, width => $w,
+				   org => "colwise", string => \$buf);
+    @out = map {
+      $class->new_from_file(rows => 1, cols => 1, width => $w,
+			    file => $_, offset => $hs + $full * $w,
+			    writable => 1);
+    } @$sharefiles;
+    return undef if grep { !defined } $in, @out;
+    return undef unless $prep->multiply($in, \@out);
+  }
+  return ($full + ($tail ? 1 : 0)) * $colsize;
+}
+
+sub sf_mapped_combine {
+  my ($mat, $infiles, $hs, $outfile, $offset, $bytes, %o) = @_;
+  my ($k, $w) = ($o{quorum}, $o{width});
+  my $class   = "Math::FastGF2::Matrix";
+  my $colsize = $k * $w;
+  my $cols    = $bytes / $colsize;
+  my $prep    = $mat->prepare($o{inorder}, $o{outorder});
+  my ($c, $nc, $out, @in);
+
+  for ($c=0; $c < $cols; $c += $nc) {
+    $nc  = $cols - $c < SF_MAP_COLS ? $cols - $c : SF_MAP_COLS;
+    @in  = map {
+      $class->new_from_file(rows => 1, cols => $nc, width => $w,
+			    file => $_, offset => $hs + $c * $w,
+			    advise => "sequential");
+    } @$infiles;
+    $out = $class->new_from_file(rows => $k, cols => $nc, width => $w,
+				 org => "colwise", file => $outfile,
+				 offset => $offset + $c * $colsize,
+				 writable => 1);
+    return undef if grep { !defined } $out, @in;
+    return undef unless $prep->multiply(\@in, $out);
+  }
+  return $bytes;
+}
+
+# Run $job->($i) for each $i in @$list in forked child processes, at
+# most $max at a time. The job returns a list of strings (or an empty
+# list on failure), which the child passes back up a pipe. Returns a
+# list of array refs holding each job's results, in the same order as
+# @$list, or an empty list if any of them failed.
+sub sf_run_parallel {
+  my ($job, $list, $max) = @_;
+  my @todo = @$list;
+  my (%running, %done, $failed);
+
+  while (%running or (@todo and !$failed)) {
+    while (@todo and !$failed and keys(%running) < $max) {
+      my $i = shift @todo;
+      my ($rd, $wr, $pid);
+      unless (pipe($rd, $wr) and defined($pid = fork)) {
+	carp "Failed to start worker for chunk $i: $!";
+	$failed = 1;
+	last;
+      }
+      if ($pid == 0) {
+	close $rd;
+	my @got = $job->($i);
+	syswrite $wr, join("\0", @got);
+	close $wr;
+	# skip END blocks and destructors belonging to the parent
+	POSIX::_exit(@got ? 0 : 1);
+      }
+      close $wr;
+      $running{fileno($rd)} = { pid => $pid, job => $i, fh => $rd, buf => "" };
+    }
+    last unless %running;
+
+    # wait for output or eof from any of the workers
+    my ($rin, $rout) = ("");
+    vec($rin, $_, 1) = 1 for keys %running;
+    next unless select($rout = $rin, undef, undef, undef) > 0;
+    for my $fd (keys %running) {
+      next unless vec($rout, $fd, 1);
+      my $w = $running{$fd};
+      my $got = sysread($w->{fh}, $w->{buf}, 4096, length($w->{buf}));
+      next if $got or (!defined($got) and $!{EINTR});
+      delete $running{$fd};
+      close $w->{fh};
+      waitpid($w->{pid}, 0);
+      if ($? == 0) {
+	$done{$w->{job}} = [ split /\0/, $w->{buf} ];
+      } else {
+	$failed = 1;
+      }
+    }
+  }
+  return () if $failed;
+  return @done{@$list};
+}
+
+# Batch versions of sf_split and sf_combine for large numbers of small
+# files, where setting up each call costs more than the arithmetic.
+# Every file is still done by sf_split/sf_combine, but the transform
+# matrix is only made once, and ida_split/ida_combine keep their
+# buffer matrices and multiply tables in a shared cache hash between
+# files.
+sub sf_split_many {
+  my ($self,$class);
+  if ($_[0] eq $classname or ref($_[0]) eq $classname) {
+    $self=shift;
+    $class=ref($self);
+  } else {
+    $self=$classname;
+  }
+  my %o=(
+	 files => undef,	# [ $file1, $file2, ... ]
+	 # everything else is as for sf_split
+	 shares => undef,
+	 quorum => undef,
+	 width => 1,
+	 key => undef,
+	 matrix => undef,
+	 rand => "/dev/urandom",
+	 systematic => 0,
+	 @_,
+	);
+  my ($files,$n,$k,$w,$key,$mat,$rng) =
+    map { $o{$_} } qw(files shares quorum width key matrix rand);
+  delete $o{files};
+
+  unless (ref($files)) {
+    carp "files must be a list of file names";
+    return undef;
+  }
+  unless ($w == 1 or $w == 2 or $w == 4) {
+    carp "Invalid width value";
+    return undef;
+  }
+  unless (defined($k) and defined($n) and $k > 0 and $n > 0) {
+    carp "Need quorum and shares values";
+    return undef;
+  }
+  if (defined($key) and defined($mat)) {
+    carp "Conflicting key/matrix options given.";
+    return undef;
+  }
+
+  # make the transform once for all the files
+  unless (defined($mat)) {
+    if (defined ($key)) {
+      if (ida_check_key($k,$n,$w,$key)) {
+	carp "Problem with supplied key";
+	return undef;
+      }
+    } else {
+      $rng=ida_rng_init($w,$rng);
+      unless (defined($rng)) {
+	carp "Failed to initialise random number generator";
+	return undef;
+      }
+      $key=ida_generate_key($k,$n,$w,$rng);
+    }
+    $mat=ida_key_to_matrix( "quorum"      => $k,
+			    "shares"      => $n,
+			    "width"       => $w,
+			    "sharelist"   => [ 0 .. $n - 1 ],
+			    "key"         => $key,
+			    "systematic"  => $o{systematic},
+			    "skipchecks?" => 0);
+    unless (defined($mat)) {
+      carp "bad return value from ida_key_to_matrix";
+      return undef;
+    }
+  }
+
+  my $cache={};
+  my @results=();
+  for my $file (@$files) {
+    my @chunks=sf_split(%o, filename => $file, key => undef,
+			matrix => $mat, cache => $cache);
+    if (defined($chunks[0])) {
+      map { $_->[0] = $key } @chunks;
+      push @results, [ @chunks ];
+    } else {
+      push @results, undef;
+    }
+  }
+  return @results;
+}
+
+sub sf_combine_many {
+  my ($self,$class);
+  if ($_[0] eq $classname or ref($_[0]) eq $classname) {
+    $self=shift;
+    $class=ref($self);
+  } else {
+    $self=$classname;
+  }
+  my %o=(
+	 jobs => undef,		# [ { infiles => [...], outfile => ... }, ... ]
+	 # anything else is passed on to each sf_combine call
+	 @_,
+	);
+  my $jobs=$o{jobs};
+  delete $o{jobs};
+
+  unless (ref($jobs)) {
+    carp "jobs must be a list of { infiles => ..., outfile => ... } hashes";
+    return undef;
+  }
+
+  my $cache={};
+  return map { scalar sf_combine(%o, %$_, cache => $cache) } @$jobs;
+}
+
+# Shares are linear in the input: each column of a share is a row of
+# the transform times the matching column of input. So a change to
+# some bytes of the original file can be applied to existing shares by
+# adding (xoring) T * (new xor old) into just the columns it touches,
+# rather than splitting the whole file again. The multiply is done by
+# Math::FastGF2::Matrix's multiply_xor straight into a writable
+# mapping of each share file.
+sub sf_update {
+  my ($self,$class);
+  if ($_[0] eq $classname or ref($_[0]) eq $classname) {
+    $self=shift;
+    $class=ref($self);
+  } else {
+    $self=$classname;
+  }
+  my %o=
+    (
+     infiles => undef,		# [ $file1, $file2, ... ] (same chunk)
+     offset => undef,		# offset of change in original file
+     old => undef,		# bytes there before the change
+     new => undef,		# and after
+     # Only needed if the share files don't store transform rows. A
+     # matrix here holds the transform rows (not inverted) for infiles,
+     # in the same order. With a key, the 'shares' and 'sharelist'
+     # options must also be given, as for sf_combine.
+     key => undef,
+     matrix => undef,
+     shares => undef,
+     sharelist => undef,
+     systematic => undef,	# default: as recorded in share headers
+     @_,
+    );
+
+  my ($infiles,$offset,$old,$new,$key,$mat,$n,$sharelist) =
+    map { $o{$_} } qw(infiles offset old new key matrix shares sharelist);
+
+  unless (ref($infiles) and @$infiles) {
+    carp "No share files to update";
+    return undef;
+  }
+  unless (defined($offset) and $offset >= 0) {
+    carp "Need an offset >= 0 for the change";
+    return undef;
+  }
+  unless (defined($old) and defined($new) and length($old) == length($new)) {
+    carp "old and new must be strings of the same length";
+    return undef;
+  }
+  if (defined($key) and defined($mat)) {
+    carp "Conflicting key/matrix options given.";
+    return undef;
+  }
+  if (defined($key) and !(defined($n) and defined($sharelist) and
+			  @$sharelist == @$infiles)) {
+    carp "key option also requires shares and a sharelist for each infile.";
+    return undef;
+  }
+  if (defined($mat) and $mat->ROWS != @$infiles) {
+    carp "matrix must have one row for each infile";
+    return undef;
+  }
+
+  # read headers, checking that all the shares agree
+  my ($k,$w,$chunk_start,$chunk_next,$header_size);
+  my (@rows, @hashed, $header_info);
+  foreach my $infile (@$infiles) {
+    my $istream=sf_mk_file_istream($infile,1);
+    unless (defined($istream)) {
+      carp "Problem opening share file $infile: $!";
+      return undef;
+    }
+    $header_info=sf_read_ida_header($istream,$k,$w,$chunk_start,
+				    $chunk_next,$header_size);
+    if ($header_info->{error}) {
+      carp $header_info->{error_message};
+      return undef;
+    }
+    ($k,$w,$chunk_start,$chunk_next,$header_size) =
+      map { $header_info->{$_} } qw(k w chunk_start chunk_next header_size);
+    $o{systematic} = $header_info->{opt_systematic}
+      unless defined $o{systematic};
+    push @hashed, $header_info->{opt_hash};
+
+    unless (defined($key) or defined($mat)) {
+      unless ($header_info->{opt_transform}) {
+	carp "Share file contains no transform data and no " .
+	  "key/matrix options were supplied.";
+	return undef;
+      }
+      push @rows, @{$header_info->{transform}};
+    }
+  }
+
+  # only the part of the change that falls within this chunk
+  my ($from,$to)=($offset, $offset + length($old));
+  $from = $chunk_start if $from < $chunk_start;
+  $to   = $chunk_next  if $to   > $chunk_next;
+  return 0 if $from >= $to;
+
+  # delta covers whole columns, zero outside the change
+  my $colsize = $k * $w;
+  my $col     = int(($from - $chunk_start) / $colsize);
+  my $ncols   = int(($to - $chunk_start - 1) / $colsize) + 1 - $col;
+  my $delta   = ("\0" x ($from - $chunk_start - $col * $colsize)) .
+    (substr($old, $from - $offset, $to - $from) ^
+     substr($new, $from - $offset, $to - $from));
+  return $to - $from unless $delta =~ /[^\0]/;
+  $delta .= "\0" x ($ncols * $colsize - length($delta));
+
+  my $dmat=Math::FastGF2::Matrix->
+    new_from_string(rows => $k, cols => $ncols, width => $w,
+		    org => "colwise", string => \$delta);
+
+  if (defined($key)) {
+    $mat=ida_key_to_matrix(quorum     => $k,
+			   shares     => $n,
+			   width      => $w,
+			   sharelist  => $sharelist,
+			   key        => $key,
+			   systematic => $o{systematic});
+  } elsif (!defined($mat)) {
+    $mat=Math::FastGF2::Matrix->new(rows => scalar(@$infiles), cols => $k,
+				    width => $w, org => "rowwise");
+    $mat->setvals(0,0,\@rows,2) if defined $mat;
+  }
+  unless (defined($mat) and $mat->COLS == $k and $mat->WIDTH == $w) {
+    carp "Problem with transform matrix for update";
+    return undef;
+  }
+
+  # share data is big-endian, like the input
+  for my $i (0 .. $#$infiles) {
+    my $share=Math::FastGF2::Matrix->
+      new_from_file(rows => 1, cols => $ncols, width => $w,
+		    file => $infiles->[$i], writable => 1,
+		    offset => $header_size + $col * $w);
+    unless (defined($share)) {
+      carp "Failed to map share file $infiles->[$i] for update";
+      return undef;
+    }
+    $mat->copy_rows($i)->multiply_xor($dmat,$share,0,2,2);
+  }
+
+  # The hash trailers no longer match, and bringing them up to date
+  # would mean reading all of the share data, so drop them instead
+  my $padded = $chunk_next - $chunk_start;
+  $padded += $colsize - $padded % $colsize if $padded % $colsize;
+  for my $i (grep { $hashed[$_] } 0 .. $#$infiles) {
+    unless (sf_drop_hash_trailer($infiles->[$i],
+				 $header_size + $padded / $k)) {
+      carp "Failed to remove hash trailer from $infiles->[$i]: $!";
+      return undef;
+    }
+  }
+
+  return $to - $from;
+}
+
+# Each share column holds k consecutive words of input, so any range
+# of the original file can be got back by reading just the columns
+# that cover it from k shares of each chunk it falls in and
+# multiplying those by the chunk's inverse matrix.
+sub sf_combine_range {
+  my ($self,$class);
+  if ($_[0] eq $classname or ref($_[0]) eq $classname) {
+    $self=shift;
+    $class=ref($self);
+  } else {
+    $self=$classname;
+  }
+  my %o=
+    (
+     infiles => undef,		# shares of one or more chunks
+     offset => 0,		# range of the original file to return
+     length => undef,		# default: to the end of the file
+     # As for sf_combine, except that a (pre-inverted) matrix is used
+     # for every chunk, with the first quorum shares given for each
+     key => undef,
+     matrix => undef,
+     shares => undef,
+     sharelist => undef,	# one for each infile
+     systematic => undef,	# default: as recorded in share headers
+     @_,
+    );
+
+  my ($infiles,$offset,$length,$key,$mat,$sharelist) =
+    map { $o{$_} } qw(infiles offset length key matrix sharelist);
+
+  unless (ref($infiles) and @$infiles) {
+    carp "No share files to read from";
+    return undef;
+  }
+  unless (defined($offset) and $offset >= 0 and
+	  (!defined($length) or $length >= 0)) {
+    carp "Need an offset >= 0 and a length >= 0 (or undef)";
+    return undef;
+  }
+  if (defined($key) and defined($mat)) {
+    carp "Conflicting key/matrix options given.";
+    return undef;
+  }
+  if (defined($key) and !(defined($o{shares}) and defined($sharelist) and
+			  @$sharelist == @$infiles)) {
+    carp "key option also requires shares and a sharelist for each infile.";
+    return undef;
+  }
+
+  # Sort the shares into chunks by their headers, keeping the first k
+  # of each. The chunk that has opt_final set says where the file ends.
+  my (%chunks, $eof);
+  for my $i (0 .. $#$infiles) {
+    my $istream=sf_mk_file_istream($infiles->[$i],1);
+    unless (defined($istream)) {
+      carp "Problem opening share file $infiles->[$i]: $!";
+      return undef;
+    }
+    my $header_info=sf_read_ida_header($istream);
+    if ($header_info->{error}) {
+      carp $header_info->{error_message};
+      return undef;
+    }
+    my $chunk=$chunks{$header_info->{chunk_start}} ||=
+      { header => $header_info, files => [], rows => [], sharelist => [] };
+    my $first=$chunk->{header};
+    if (grep { $header_info->{$_} != $first->{$_} }
+	qw(k w chunk_next header_size)) {
+      carp "Share file $infiles->[$i] doesn't match others of its chunk";
+      return undef;
+    }
+    next if @{$chunk->{files}} == $first->{k};
+    unless (defined($key) or defined($mat) or $header_info->{opt_transform}) {
+      carp "Share file contains no transform data and no " .
+	"key/matrix options were supplied.";
+      return undef;
+    }
+    push @{$chunk->{files}}, $infiles->[$i];
+    push @{$chunk->{rows}}, @{$header_info->{transform}}
+      if $header_info->{opt_transform};
+    push @{$chunk->{sharelist}}, $sharelist->[$i] if defined($key);
+    $eof=$header_info->{chunk_next} if $header_info->{opt_final};
+  }
+
+  my $end = defined($length) ? $offset + $length : $eof;
+  unless (defined($end)) {
+    carp "Need the final chunk's shares to read to the end of the file";
+    return undef;
+  }
+  $end = $eof if defined($eof) and $end > $eof;
+
+  my $data="";
+  my $pos=$offset;		# next byte wanted
+  for my $chunk_start (sort { $a <=> $b } keys %chunks) {
+    last if $pos >= $end;
+    my $chunk=$chunks{$chunk_start};
+    my ($k,$w,$chunk_next,$header_size) =
+      map { $chunk->{header}->{$_} } qw(k w chunk_next header_size);
+    next if $chunk_next <= $pos;
+    last if $chunk_start > $pos;	# missing chunk; reported below
+    unless (@{$chunk->{files}} == $k) {
+      carp "Need $k shares of the chunk at $chunk_start to combine";
+      return undef;
+    }
+    my $to = $end < $chunk_next ? $end : $chunk_next;
+
+    # whole columns covering [$pos, $to) in this chunk
+    my $colsize = $k * $w;
+    my $col     = int(($pos - $chunk_start) / $colsize);
+    my $ncols   = int(($to - $chunk_start - 1) / $colsize) + 1 - $col;
+
+    my $inv=$mat;
+    unless (defined($inv)) {
+      my $systematic = defined($o{systematic}) ?
+	$o{systematic} : $chunk->{header}->{opt_systematic};
+      if (defined($key)) {
+	$inv=ida_key_to_matrix(quorum      => $k,
+			       shares      => $o{shares},
+			       width       => $w,
+			       sharelist   => $chunk->{sharelist},
+			       key         => $key,
+			       systematic  => $systematic,
+			       "skipchecks?" => 0,
+			       "invert?"   => 1);
+      } else {
+	$inv=Math::FastGF2::Matrix->new(rows => $k, cols => $k,
+					width => $w, org => "rowwise");
+	$inv->setvals(0,0,$chunk->{rows},2);
+	$inv=$inv->invert();
+      }
+      unless (defined($inv)) {
+	carp "Failed to invert matrix for chunk at $chunk_start";
+	return undef;
+      }
+    }
+
+    # read those columns from each share (rows of the input matrix)
+    my $in="";
+    for my $file (@{$chunk->{files}}) {
+      my ($fh, $want, $got);
+      unless (sysopen $fh, $file, O_RDONLY and
+	      sysseek $fh, $header_size + $col * $w, SEEK_SET) {
+	carp "Problem reading share file $file: $!";
+	return undef;
+      }
+      for ($want=$ncols * $w; $want > 0; $want -= $got) {
+	$got=sysread $fh, $in, $want, length($in);
+	unless ($got) {
+	  carp "Share file $file is too short";
+	  return undef;
+	}
+      }
+    }
+
+    # share data is big-endian, like the input
+    my $out="\0" x ($ncols * $colsize);
+    my $inmat=Math::FastGF2::Matrix->
+      new_from_string(rows => $k, cols => $ncols, width => $w,
+		      org => "rowwise", string => \$in);
+    my $outmat=Math::FastGF2::Matrix->
+      new_from_string(rows => $k, cols => $ncols, width => $w,
+		      org => "colwise", string => \$out);
+    unless (defined($inmat) and defined($outmat) and
+	    $inv->multiply($inmat,$outmat,0,2,2)) {
+      carp "Failed to combine columns of chunk at $chunk_start";
+      return undef;
+    }
+    $data .= substr($out, $pos - $chunk_start - $col * $colsize, $to - $pos);
+    $pos = $to;
+  }
+  if ($pos < $end) {
+    carp "No shares given for the chunk holding byte $pos";
+    return undef;
+  }
+  return $data;
+}
+
+
 1;
 
 __END__
@@ -1318,6 +2391,8 @@ Crypt::IDA::ShareFile - Archive file format for Crypt::IDA module
  
   @list  = sf_split( ... );
   $bytes = sf_combine ( ... );
+  @lists = sf_split_many( files => [ ... ], ... );
+  @bytes = sf_combine_many( jobs => [ ... ], ... );
 
 =head1 DESCRIPTION
 
@@ -1381,6 +2456,14 @@ and default values, is as follows:
 	 # allow creation of a subset of shares, chunks
 	 sharelist => undef,	# [ $row1, $row2, ... ]
 	 chunklist => undef,	# [ $chunk1, $chunk2, ... ]
+	 # shares 0 .. k-1 are plain stripes, the rest parity
+	 systematic => 0,
+	 # multiply straight between mmap'd input and share files
+	 mmap => 0,
+	 # split up to this many chunks at once in forked workers
+	 max_parallel => 1,
+	 # append SHA-256 of share data and original to each share
+	 hash => 0,
 	 # specify pattern to use for share filenames
 	 filespec => undef,	# default value set later on
    );
@@ -1419,9 +2502,50 @@ replaced by:
 
 =back
 
+With C<< systematic => 1 >>, shares 0 to k-1 are plain stripes of
+the input file (share i holds every k'th word, starting at word i)
+and only shares k and up are worked out from the key. This saves most
+of the work of a split where n is not much bigger than k (eg, for a
+(6,8) scheme, only 2 rows in 8 need multiplying), and combining from
+shares 0 to k-1 just interleaves them again. Any k shares can still
+be combined. The option is ignored if a C<matrix> is given, and is
+recorded in the share headers, so C<sf_combine> doesn't need to be
+told about it.
+
+With C<< mmap => 1 >>, each chunk of the input file is mapped into
+memory (with C<MADV_SEQUENTIAL>, so the kernel reads ahead), the share
+files are extended to their full size and mapped for writing, and the
+transform works directly from one mapping to the others. No data is
+copied through Perl strings or read/write calls, and the bufsize
+option isn't used. The share files are the same either way. This
+needs a Math::FastGF2 with the prepared multiply on lists of rows;
+otherwise the option is quietly ignored. C<sf_combine> takes the
+same option.
+
+Each chunk has its own share files and headers, so chunks can be
+split at the same time. With C<< max_parallel => $p >> (and more than
+one chunk to do), C<sf_split> forks up to C<$p> child processes, each
+of which splits one chunk and then exits, starting a new one as each
+finishes. The list returned is in the same order as for a serial
+split. Setting C<$p> to the number of cores, and C<n_chunks> (or one
+of the other chunking options) to at least that many chunks, lets a
+split of a large file use all of them. This can be combined with the
+C<mmap> option.
+
+With C<< hash => 1 >>, each share file gets a trailer after its data
+holding the SHA-256 digest of the share data and the SHA-256 digest
+of the chunk of the input file it came from (see L<File Format>). The
+digests are worked out by Math::FastGF2's pipeline while the data is
+going through it, so nothing has to be read a second time to get
+them; this needs a Math::FastGF2 with C<pipeline_fd_c>, and the
+C<mmap> option is ignored. The pipeline, uring and fsync options of
+C<ida_split> can be given here too.
+
 If an error is encountered during the creation of one set of shares in
 a multi-chunk job, then the routine returns immediately without
-attempting to split any other remaining chunks.
+attempting to split any other remaining chunks. In parallel mode, no
+new chunks are started after a failure, but any that are already
+running are allowed to finish before the routine returns undef.
 
 =head1 COMBINE OPERATION
 
@@ -1440,8 +2564,14 @@ and default values, is as follows:
      matrix => undef,
      shares => undef,		# required if key supplied
      sharelist => undef,	# required if key supplied
+     systematic => undef,	# default: as recorded in share headers
      # misc options
      bufsize => 4096,
+     mmap => 0,			# map the files instead of streaming
+     verify => 1,		# check shares against their hash trailers
+     fastest => 0,		# use the first quorum infiles to respond
+     deadline => 2,		# seconds before a share is replaced
+     segment => 262144,		# columns combined at a time (fastest)
     );
 
 The minimal set of inputs is:
@@ -1467,6 +2597,131 @@ processed, if any any padding bytes were added to it during the
 C<sf_split> routine, these will be removed by truncating the output
 file.
 
+If the shares were made with the C<hash> option, each share is hashed
+as it's read and checked against its trailer, and the output against
+the original's digest (unless the chunk had padding added). A
+mismatch is reported and C<sf_combine> returns undef, although the
+output file has been written by then. Set C<verify> to 0 to skip
+this, or use C<mmap>, which doesn't check.
+
+With C<< fastest => 1 >>, C<infiles> can list more than a quorum of
+shares (all of them, say, on different disks or network mounts), and
+the ones used are those that turn out to be quickest to read. A
+reader process is started for each share. The first I<k> to read
+their header and first segment (C<segment> columns of share data)
+are used and the rest are kept as spares. The chunk is then combined
+a segment at a time, each one as soon as all I<k> readers have it,
+with the readers staying a few segments ahead. If one of the shares
+in use fails, or hasn't read the next segment after C<deadline>
+seconds, it's replaced by a spare, starting from that segment, and
+the inverse matrix is made again for the new set of shares. Shares
+must carry their transform rows, or else C<key> must be given with a
+C<sharelist> entry for each infile; C<matrix> can't be used, since
+it would only fit one set of shares. Hash trailers aren't checked in
+this mode.
+
+=head1 RANGE OPERATION
+
+To read part of a file that has been split, without combining all of
+it:
+
+ $data = sf_combine_range(
+     infiles => [ $file1, $file2, ... ],  # shares of any chunks
+     offset  => 0,             # first byte wanted
+     length  => undef,         # default: up to the end of the file
+     # only needed if the shares don't store transform rows
+     key => undef,
+     matrix => undef,          # pre-inverted, used for every chunk
+     shares => undef,          # required if key supplied
+     sharelist => undef,       # required if key supplied (one per infile)
+     systematic => undef,      # default: as recorded in share headers
+ );
+
+The shares can be from any or all of the chunks, in any order. They
+are sorted into chunks by their headers, and the first I<quorum>
+listed for each chunk are used. Each column of a share holds
+I<quorum> consecutive words of the original, so for each chunk that
+the range falls in, only the columns covering it are read from the
+shares and multiplied by the chunk's inverse matrix. Seeking about
+in a large file that's stored only as shares is then about as quick
+as reading it.
+
+The return value is a string with the bytes asked for (fewer if the
+range goes past the end of the file), or undef on error, including
+when no shares were given for a chunk in the range. Reading to the
+end of the file needs the final chunk's shares, since that's where
+the file's length is recorded.
+
+=head1 BATCH OPERATIONS
+
+Splitting or combining a large number of small files one call at a
+time spends most of its time setting up rather than doing
+arithmetic. These two routines do a whole list of files in one call:
+
+ @results = sf_split_many(
+     files => [ $file1, $file2, ... ],
+     # any other sf_split options, eg:
+     quorum => 3,
+     shares => 5,
+ );
+
+ @bytes = sf_combine_many(
+     jobs => [ { infiles => [ ... ], outfile => $name1 },
+               { infiles => [ ... ], outfile => $name2 }, ... ],
+     # any other sf_combine options apply to every job
+ );
+
+C<sf_split_many> makes one key (unless given a key or matrix) and
+splits every file with the same transform matrix. It returns one
+element for each file, in order: a reference to the list that
+C<sf_split> would have returned for it (with the key filled in), or
+undef if that file couldn't be split. Since all files share a
+transform, anyone holding a quorum of shares of one file has the
+matrix rows for all of them; use separate C<sf_split> calls if that
+matters.
+
+C<sf_combine_many> calls C<sf_combine> for each job, with the job's
+options added to the common ones, and returns the byte count (or
+undef) for each job in order.
+
+Both keep the buffer matrices and multiply tables between files (see
+the cache option of C<ida_split> in L<Crypt::IDA>), and with the
+transform rows stored in the share headers, C<sf_combine_many> only
+works out each inverse matrix once as well.
+
+=head1 UPDATE OPERATION
+
+When some bytes of a file that has already been split are changed,
+the shares can be patched in place rather than split again:
+
+ $bytes = sf_update(
+     infiles => [ $file1, $file2, ... ],  # shares from one chunk
+     offset  => $offset,       # where the change starts in the file
+     old     => $old_bytes,    # what was there
+     new     => $new_bytes,    # what's there now (same length)
+     # only needed if the shares don't store transform rows
+     key => undef,
+     matrix => undef,          # transform rows, one per infile
+     shares => undef,          # required if key supplied
+     sharelist => undef,       # required if key supplied
+     systematic => undef,      # default: as recorded in share headers
+ );
+
+Each share column is a row of the transform matrix times a column of
+the input, so adding the transform times (new xor old) to the columns
+that the change touches gives the same shares as splitting the
+changed file. Only those columns of each share file are read and
+written. Any subset of the shares of a chunk may be updated, but
+shares that are left out will no longer combine with the others.
+
+The return value is the number of bytes of the change that fall
+within the chunk (changes outside it are ignored, so the same change
+can be passed along with the shares of each chunk in turn), or undef
+on error. The file size can't be changed this way.
+
+Any hash trailers (see the C<hash> option of C<sf_split>) on the
+updated shares are removed, since they no longer match.
+
 =head1 ANCILLARY ROUTINES
 
 The extra routines are exported by using the ":extras" or ":all"
@@ -1533,7 +2788,8 @@ required, see the discussion in the L<Crypt::IDA> man page.
 
 =head2 File Format
 
-Each share file consists of a header and some share data. For the
+Each share file consists of a header, some share data and an optional
+hash trailer. For the
 current version of the file format (version 1), the header format is
 as follows:
 
@@ -1557,6 +2813,14 @@ The options bits are as follows:
   1 	  opt_large_w    Large (2-byte) w value?
   2 	  opt_final      Final chunk in file? (1=full file/final chunk)
   3 	  opt_transform  Is transform data included?
+  4 	  opt_systematic Split with a systematic transform?
+  5 	  opt_hash       Share data is followed by a hash trailer?
+
+The hash trailer is 64 bytes: the SHA-256 digest of the share data,
+then the SHA-256 digest of the chunk of the original file (from
+chunk_start up to chunk_next, without padding). The length of the
+share data follows from the chunk range, so code that doesn't know
+about the trailer never reads it.
 
 All file offsets are stored in a variable-width format. They are
 stored as the concatenation of two values:
@@ -1610,9 +2874,6 @@ storage of decryption key in share files;
 possibility of a cheater presenting an invalid share at the combine
 stage;
 
-=item * implement regular checksum/hash to detect damage to share
-data;
-
 =item * implement storing a row number with shares in the case where
 the transform data for that share is not stored in the sharefile
 header;
@@ -260,6 +260,33 @@ sub advance_process {
     return 0;
 }
 
+# Columns in use in the input and output buffers: read but not yet
+# processed, and processed but not yet written. Substreams that are
+# ahead of the bundle count too.
+sub buffered {
+    my $self = shift;
+    my ($in_hi, $out_lo) = ($self->{read_head}, $self->{write_tail});
+    if ($self->{combining}) {
+	for my $rowptr (@{$self->{bundle}}) {
+	    $in_hi = $rowptr->{head} if $rowptr->{head} > $in_hi;
+	}
+    }
+    ($in_hi - $self->{read_tail}, $self->{write_head} - $out_lo);
+}
+
+# Change the window size. Pointers are linear, so they don't change,
+# but whatever is buffered has to fit in the new window. The caller
+# has to move the buffered columns to their new places (pointer %
+# window) in the matrices.
+sub resize {
+    my ($self, $window) = @_;
+    die "window attribute must be > 0" unless $window > 0;
+    my ($in, $out) = $self->buffered;
+    die "New window too small for buffered columns"
+	if $in > $window or $out > $window;
+    $self->{window} = $window;
+}
+
 # Utility method to split some read/write into two contiguous
 # reads/writes if it straddles the end of a buffer
 sub destraddle {
@@ -316,6 +343,10 @@ Crypt::IDA::SlidingWindow - Abstract Sliding Window class
   $sw->advance_write($cols);               # emptying output stream
   $sw->advance_write_substream($row,$cols);# emptying output substream
 
+  # resizing (caller moves the matrix contents)
+  my ($in_cols, $out_cols) = $sw->buffered;
+  $sw->resize($new_window);
+
 =head1 WARNING
 
 This class is not meant to be called directly. Its functionality can
@@ -412,6 +443,18 @@ For example:
  $str.= $mat->getvals($row,0,       $second,$order) if defined($second);
 
 
+=head2 Resizing
+
+The window can be changed at any time with C<resize>, as long as the
+new size is at least as big as what's buffered. C<buffered> returns
+the number of columns held in the input buffer (read, but not yet
+processed, including any substreams that are ahead) and in the output
+buffer (processed, but not yet written). Since the pointers are
+linear, they stay as they are, but each buffered column has to be
+moved from C<pointer % old_window> to C<pointer % new_window> in the
+matrices. C<Crypt::IDA::Algorithm> does this in its own C<resize>
+method.
+
 =head2 Substream Bundles
 
 This class maintains an extra set of head and tail pointers for each
@@ -1,6 +1,6 @@
 # -*- Perl -*-
 
-use Test::More tests => 6;
+use Test::More tests => 44;
 BEGIN { use_ok('Crypt::IDA::ShareFile', ':all') };
 
 use Crypt::IDA ":all";
@@ -72,3 +72,357 @@ ok ($secret eq $got_back,     "(3,3) scheme without key/matrix");
 
 unlink $tempfile;
 
+
+# Systematic (6,8) split: shares 0..5 are stripes of the input, and
+# any 6 shares combine. The header records the option.
+$secret=join "", map { chr int rand 256 } 1 .. 6000;
+open TEMPFILE, ">$tempfile" or die "Couldn't created tempfile\n";
+binmode TEMPFILE;
+print TEMPFILE $secret;
+close TEMPFILE;
+
+my @r=sf_split(quorum => 6, shares => 8, filename => $tempfile,
+	       systematic => 1);
+ok (defined($r[0]), "systematic split");
+
+open SHARE, "<$tempfile-2.sf"; binmode SHARE;
+my $istream=Crypt::IDA::ShareFile::sf_mk_file_istream("$tempfile-2.sf", 1);
+my $hdr=Crypt::IDA::ShareFile::sf_read_ida_header($istream);
+seek SHARE, $hdr->{header_size}, 0;
+my $stripe=do { local $/; <SHARE> };
+close SHARE;
+ok ($hdr->{opt_systematic} &&
+    $stripe eq join("", map { substr($secret, $_ * 6 + 2, 1) } 0 .. 999),
+    "systematic data share is a plain stripe");
+
+for my $shares ([0..5], [5,3,1,0,2,4], [7,1,2,6,4,5]) {
+  unlink $tempfile;
+  sf_combine(infiles => [ map { "$tempfile-$_.sf"} @$shares ],
+	     outfile => $tempfile);
+  open TEMPFILE, "<$tempfile"; binmode TEMPFILE;
+  $got_back=do { local $/; <TEMPFILE> };
+  close TEMPFILE;
+  ok ($secret eq $got_back, "systematic combine from shares @$shares");
+}
+map { unlink "$tempfile-$_.sf"} (0..7);
+unlink $tempfile;
+
+# sf_update: patch shares in place after changing some bytes, then
+# combine using parity shares. Two chunks, with the change straddling
+# the boundary between them.
+sub write_file {
+  my ($name,$data)=@_;
+  open my $fh, ">", $name or die "Couldn't write $name\n";
+  binmode $fh;
+  print $fh $data;
+  close $fh;
+}
+sub read_file {
+  my $name=shift;
+  open my $fh, "<", $name or return undef;
+  binmode $fh;
+  local $/;
+  return scalar <$fh>;
+}
+
+$secret=join "", map { chr int rand 256 } 1 .. 5001;
+write_file($tempfile, $secret);
+@r=sf_split(quorum => 3, shares => 5, width => 1, filename => $tempfile,
+	    n_chunks => 2);
+my @chunks=map { [ @$_[3 .. 7] ] } @r;
+
+my $offset=int(length($secret) / 2) - 10;
+my $new   =join "", map { chr int rand 256 } 1 .. 37;
+my $old   =substr($secret, $offset, 37);
+substr($secret, $offset, 37, $new);
+
+my $total=0;
+for my $files (@chunks) {
+  $total += sf_update(infiles => $files, offset => $offset,
+		      old => $old, new => $new);
+}
+is ($total, 37, "sf_update applies whole change across chunks");
+
+# update nothing if the change misses a chunk entirely
+is (sf_update(infiles => $chunks[0], offset => length($secret) - 1,
+	      old => "a", new => "b"), 0, "sf_update outside chunk");
+
+for my $shares ([0,1,2], [4,3,1]) {
+  unlink $tempfile;
+  for my $files (@chunks) {
+    sf_combine(infiles => [ @$files[@$shares] ], outfile => $tempfile);
+  }
+  ok (read_file($tempfile) eq $secret, "combine after sf_update (@$shares)");
+}
+
+# and the shares match a fresh split of the changed file with the
+# same transform
+write_file($tempfile, $secret);
+my $fresh="$tempfile.fresh";
+rename $tempfile, $fresh;
+@r=sf_split(quorum => 3, shares => 5, width => 1, filename => $fresh,
+	    n_chunks => 2, matrix => $r[0]->[1]);
+my $same=1;
+for my $c (0, 1) {
+  for my $s (0 .. 4) {
+    $same=0 unless read_file($chunks[$c]->[$s]) eq read_file($r[$c]->[3 + $s]);
+  }
+}
+ok ($same, "updated shares match new split");
+unlink $fresh, (map { @$_ } @chunks), (map { @$_[3 .. 7] } @r);
+
+# sf_split_many/sf_combine_many: several small files, one transform
+my @files=map { "$tempfile.many$_" } 0 .. 4;
+my %data=map { $_ => join "", map { chr int rand 256 } 1 .. 1 + int rand 200 }
+  @files;
+write_file($_, $data{$_}) for @files;
+@r=sf_split_many(files => \@files, quorum => 3, shares => 5);
+ok (@r == @files && !grep({ !defined } @r), "sf_split_many results");
+ok (!grep({ !$_->[0]->[1]->eq($r[0]->[0]->[1]) } @r),
+    "sf_split_many uses one transform");
+unlink @files;
+my @bytes=sf_combine_many(jobs => [ map {
+  { infiles => [ @{$r[$_]->[0]}[3 + $_ % 3, 6, 7] ], outfile => $files[$_] }
+} 0 .. $#files ]);
+ok (!grep({ read_file($files[$_]) ne $data{$files[$_]} } 0 .. $#files),
+    "sf_combine_many");
+unlink @files, map { @{$_->[0]}[3 .. 7] } @r;
+
+# mmap mode: shares must be the same as with streams, and either kind
+# of share combines either way
+$secret=join "", map { chr int rand 256 } 1 .. 10007;
+write_file($tempfile, $secret);
+@r=sf_split(quorum => 4, shares => 6, filename => $tempfile, n_chunks => 3);
+my @streamed=map { my $c=$_; [ map { read_file($_) } @$c[3 .. 8] ] } @r;
+my @m=sf_split(quorum => 4, shares => 6, filename => $tempfile, n_chunks => 3,
+	       matrix => $r[0]->[1], mmap => 1);
+$same=@m == 3;
+for my $c (0 .. $#m) {
+  for my $s (0 .. 5) {
+    $same=0 unless read_file($m[$c]->[3 + $s]) eq $streamed[$c]->[$s];
+  }
+}
+ok ($same, "mmap split matches streamed split");
+ok (!grep({ $_->[1] != $r[0]->[1] } @m),
+    "mmap split returns the matrix it was given");
+for my $mmap (0, 1) {
+  unlink $tempfile;
+  for my $c (@m) {
+    sf_combine(infiles => [ @$c[5, 8, 3, 7] ], outfile => $tempfile,
+	       mmap => $mmap);
+  }
+  ok (read_file($tempfile) eq $secret, "combine with mmap => $mmap");
+}
+unlink $tempfile, map { @$_[3 .. 8] } @m;
+
+# parallel split: forked workers must give the same shares, in the
+# same order, as a serial split
+write_file($tempfile, $secret);
+@r=sf_split(quorum => 4, shares => 6, filename => $tempfile, n_chunks => 5);
+@streamed=map { my $c=$_; [ map { read_file($_) } @$c[3 .. 8] ] } @r;
+unlink map { @$_[3 .. 8] } @r;
+@m=sf_split(quorum => 4, shares => 6, filename => $tempfile, n_chunks => 5,
+	    matrix => $r[0]->[1], max_parallel => 3);
+ok (@m == 5 && !grep({ $m[$_]->[2] != $r[$_]->[2] } 0 .. 4),
+    "parallel split results in order");
+$same=@m == 5;
+for my $c (0 .. $#m) {
+  for my $s (0 .. 5) {
+    $same=0 unless read_file($m[$c]->[3 + $s]) eq $streamed[$c]->[$s];
+  }
+}
+ok ($same, "parallel split matches serial split");
+unlink $tempfile, map { @$_[3 .. 8] } @m;
+
+# threaded pipeline: same shares as the single-threaded C loop
+write_file($tempfile, $secret);
+@r=sf_split(quorum => 4, shares => 6, filename => $tempfile);
+@streamed=map { read_file($_) } @{$r[0]}[3 .. 8];
+unlink @{$r[0]}[3 .. 8];
+@m=sf_split(quorum => 4, shares => 6, filename => $tempfile,
+	    matrix => $r[0]->[1], pipeline => 2);
+ok (@m == 1 && !grep({ read_file($m[0]->[3 + $_]) ne $streamed[$_] } 0 .. 5),
+    "split with pipeline matches");
+unlink $tempfile;
+sf_combine(infiles => [ @{$m[0]}[4, 8, 5, 3] ], outfile => $tempfile,
+	   pipeline => 3);
+ok (read_file($tempfile) eq $secret, "combine with pipeline");
+unlink $tempfile, @{$m[0]}[3 .. 8];
+
+# the same through io_uring (falls back to threads without it)
+write_file($tempfile, $secret);
+@m=sf_split(quorum => 4, shares => 6, filename => $tempfile,
+	    matrix => $r[0]->[1], uring => 1, fsync => 1);
+ok (@m == 1 && !grep({ read_file($m[0]->[3 + $_]) ne $streamed[$_] } 0 .. 5),
+    "split with io_uring matches");
+unlink $tempfile;
+sf_combine(infiles => [ @{$m[0]}[7, 3, 6, 4] ], outfile => $tempfile,
+	   uring => 1);
+ok (read_file($tempfile) eq $secret, "combine with io_uring");
+unlink $tempfile, @{$m[0]}[3 .. 8];
+
+# hash trailers: SHA-256 of each share's data and of the original
+# chunk, made while splitting and checked while combining
+SKIP: {
+  skip "no Digest::SHA", 7 unless eval { require Digest::SHA; 1 };
+  write_file($tempfile, $secret);
+  @m=sf_split(quorum => 4, shares => 6, filename => $tempfile,
+	      matrix => $r[0]->[1], hash => 1, n_chunks => 2);
+  # 10007 bytes in two chunks: 5004 + 5003 (padded to 5004)
+  my $ok=(@m == 2);
+  for my $c (0, 1) {
+    my $orig=Digest::SHA::sha256(substr($secret, 5004 * $c, 5004));
+    for my $s (0 .. 5) {
+      my $share=read_file($m[$c]->[3 + $s]);
+      my $trailer=substr($share, -64, 64, "");
+      my $hs=length($share) - 1251;
+      $ok=0 unless $trailer eq
+	Digest::SHA::sha256(substr($share, $hs)) . $orig;
+    }
+  }
+  ok ($ok, "split with hash trailers");
+  unlink $tempfile;
+  ok (sf_combine(infiles => [ @{$m[0]}[8, 4, 3, 5] ], outfile => $tempfile)
+      && sf_combine(infiles => [ @{$m[1]}[3, 4, 5, 6] ],
+		    outfile => $tempfile)
+      && read_file($tempfile) eq $secret, "combine checks hash trailers");
+
+  # damage one byte of share data
+  my $share=read_file($m[1]->[6]);
+  substr($share, -100, 1) ^= "\1";
+  write_file($m[1]->[6], $share);
+  {
+    local $SIG{__WARN__}=sub {};
+    ok (!defined(sf_combine(infiles => [ @{$m[1]}[3, 4, 5, 6] ],
+			    outfile => $tempfile)),
+	"combine fails on damaged share");
+  }
+  ok (sf_combine(infiles => [ @{$m[1]}[3, 4, 5, 6] ], outfile => $tempfile,
+		 verify => 0),
+      "combine with verify => 0");
+  write_file($m[1]->[6], substr($share, 0, -100) .
+	     (substr($share, -100, 1) ^ "\1") . substr($share, -99));
+
+  # sf_update drops the trailers, which no longer match
+  my $size=-s $m[0]->[3];
+  substr($secret, 10, 3) ^= "xyz";
+  write_file($tempfile, $secret);
+  sf_update(infiles => [ @{$m[0]}[3 .. 8] ], offset => 10,
+	    old => substr($secret, 10, 3) ^ "xyz",
+	    new => substr($secret, 10, 3));
+  is (-s $m[0]->[3], $size - 64, "sf_update removes hash trailer");
+  unlink $tempfile;
+  sf_combine(infiles => [ @{$m[0]}[7, 6, 5, 4] ], outfile => $tempfile);
+  sf_combine(infiles => [ @{$m[1]}[8, 7, 6, 5] ], outfile => $tempfile);
+  ok (read_file($tempfile) eq $secret, "combine after sf_update");
+  unlink $tempfile, map { @$_[3 .. 8] } @m;
+
+  # an empty file has nothing but the trailers to check
+  write_file($tempfile, "");
+  {
+    local $SIG{__WARN__}=sub {};	# zero-sized file
+    @m=sf_split(quorum => 4, shares => 6, filename => $tempfile,
+		matrix => $r[0]->[1], hash => 1);
+  }
+  unlink $tempfile;
+  ok (defined(sf_combine(infiles => [ @{$m[0]}[5, 3, 8, 6] ],
+			 outfile => $tempfile))
+      && -e $tempfile && -s $tempfile == 0, "combine empty file with hashes");
+  unlink $tempfile, map { @$_[3 .. 8] } @m;
+}
+
+# fastest k of n: given all the shares, combine from whichever come
+# in first, a segment at a time. A missing share and one that never
+# delivers anything (a fifo with no writer) just don't get picked.
+write_file($tempfile, $secret);
+@m=sf_split(quorum => 4, shares => 6, filename => $tempfile, n_chunks => 3);
+unlink $tempfile;
+for my $c (@m) {
+  sf_combine(infiles => [ @$c[3 .. 8] ], outfile => $tempfile,
+	     fastest => 1, segment => 300);
+}
+ok (read_file($tempfile) eq $secret, "fastest combine");
+unlink $tempfile;
+my $fifo="$tempfile.fifo";
+my @extra=("$tempfile.missing");
+push @extra, $fifo if POSIX::mkfifo($fifo, 0600);
+{
+  local $SIG{__WARN__}=sub {};
+  for my $c (@m) {
+    sf_combine(infiles => [ @extra, @$c[3 .. 6] ], outfile => $tempfile,
+	       fastest => 1, segment => 100, deadline => 0.5);
+  }
+}
+ok (read_file($tempfile) eq $secret, "fastest combine skips dead shares");
+
+# shares that give out part way through are swapped for spares
+unlink $tempfile;
+truncate $_, (-s $_) - 500 for map { @$_[3, 4] } @m;
+{
+  local $SIG{__WARN__}=sub {};
+  for my $c (@m) {
+    sf_combine(infiles => [ @$c[3 .. 8] ], outfile => $tempfile,
+	       fastest => 1, segment => 100);
+  }
+}
+ok (read_file($tempfile) eq $secret, "fastest combine swaps failed shares");
+unlink $tempfile, $fifo, map { @$_[3 .. 8] } @m;
+
+# a share that stalls part way through but stays alive is swapped too,
+# and its reader (stopped, so deaf to TERM) is killed and reaped
+# before sf_combine returns
+write_file($tempfile, $secret);
+@m=sf_split(quorum => 4, shares => 6, filename => $tempfile, n_chunks => 3);
+unlink $tempfile;
+{
+  no warnings 'redefine';
+  my $start=\&Crypt::IDA::ShareFile::sf_start_reader;
+  my (%stall, @pids);
+  local *Crypt::IDA::ShareFile::sf_start_reader=sub {
+    my $r=$start->(@_);
+    push @pids, $r->{pid} if $r;
+    if ($r and $stall{$_[0]} and !$_[2]) {
+      my $buf="";
+      sysread($r->{rd}, $buf, 64, length $buf) until $buf =~ /^H\./;
+      kill 'STOP', $r->{pid};
+      @$r{qw(hdr got)}=(1, length($buf) - 1);
+    }
+    return $r;
+  };
+  local $SIG{__WARN__}=sub {};
+  for my $c (@m) {
+    $stall{$c->[3]}=1;
+    sf_combine(infiles => [ @$c[3 .. 8] ], outfile => $tempfile,
+	       fastest => 1, segment => 100, deadline => 0.5);
+  }
+  ok (read_file($tempfile) eq $secret
+      && !grep({ waitpid($_, POSIX::WNOHANG()) != -1 } @pids),
+      "fastest combine swaps stalled shares and reaps their readers");
+}
+unlink $tempfile, map { @$_[3 .. 8] } @m;
+
+# sf_combine_range: any bytes of the original from shares of the
+# chunks covering them, in any order and from any k of each chunk
+write_file($tempfile, $secret);
+@m=sf_split(quorum => 4, shares => 6, filename => $tempfile, n_chunks => 3);
+my @pool=map { @$_[8, 3, 6, 5, 4] } reverse @m;
+my $bad=0;
+for (1 .. 50) {
+  my $off=int rand length $secret;
+  my $len=int rand 4000;
+  $bad++ unless sf_combine_range(infiles => \@pool, offset => $off,
+				 length => $len) eq substr($secret, $off, $len);
+}
+ok (!$bad, "sf_combine_range, random ranges");
+ok (sf_combine_range(infiles => \@pool) eq $secret,
+    "sf_combine_range, whole file");
+is (sf_combine_range(infiles => \@pool, offset => 10000, length => 100),
+    substr($secret, 10000), "sf_combine_range stops at end of file");
+{
+  local $SIG{__WARN__}=sub {};
+  ok (!defined(sf_combine_range(infiles => [ @{$m[0]}[3 .. 8],
+					     @{$m[2]}[3 .. 8] ],
+				offset => 3000, length => 1000)),
+      "sf_combine_range needs every chunk in the range");
+}
+unlink $tempfile, map { @$_[3 .. 8] } @m;
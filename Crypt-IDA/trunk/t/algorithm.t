@@ -324,4 +324,72 @@ for $str ("A", "BC", "DEF", "GHIJ", "KLMNO", "PQRSTU") {  # 6 x
   }
 }
 
+# Default window sized from the cache, and resizing (by hand, or as
+# fills and drains come and go with adapt) mustn't lose or reorder
+# anything, whatever is buffered at the time
+{
+  my $key = [1 .. 7];		# 4 xvals, k = 3
+  my $s = Crypt::IDA::Algorithm->splitter(k => 3, key => $key);
+  ok ($s->bufsize >= 1024 && $s->bufsize % 64 == 0,
+      "default bufsize (" . $s->bufsize . ")");
+
+  my $msg = join "", map { chr int rand 256 } 1 .. 3 * 5000;
+  my $ref = Crypt::IDA::Algorithm->splitter(k => 3, key => $key,
+					    bufsize => 5000);
+  $ref->fill_stream($msg);
+  $ref->split_stream;
+  my @want = map { $ref->empty_substream($_) } 0 .. 3;
+
+  for my $how ("resize", "adapt") {
+    $s = Crypt::IDA::Algorithm->splitter(k => 3, key => $key, bufsize => 32,
+					 adapt => $how eq "adapt",
+					 min_bufsize => 8, max_bufsize => 512);
+    my ($in, @out, %sizes) = ($msg);
+    while (length $in or grep { $_ } $s->sw->buffered) {
+      my $cols = int rand(1 + $s->sw->can_fill);
+      $cols = length($in) / 3 if $cols > length($in) / 3;
+      $s->fill_stream(substr $in, 0, 3 * $cols, "");
+      $s->split_stream(int rand(1 + ($s->sw->can_advance)[1]));
+      # drain some rows more than others
+      for my $row (0 .. 3) {
+	my $avail = $s->sw->can_empty_substream($row);
+	$out[$row] .= $s->empty_substream($row, int rand(1 + $avail))
+	  if $row % 2 or !length $in or rand() < .3;
+      }
+      if ($how eq "resize" and rand() < .3) {
+	my ($bin, $bout) = $s->sw->buffered;
+	my $new = 8 + int rand 100;
+	$s->resize($new) if $new >= $bin and $new >= $bout;
+      }
+      ++$sizes{$s->bufsize};
+    }
+    ok (!grep({ $out[$_] ne $want[$_] } 0 .. 3), "split with $how");
+    ok (keys(%sizes) > 1, "window changed with $how");
+
+    my $c = Crypt::IDA::Algorithm->combiner(k => 3, key => $key,
+					    sharelist => [3, 1, 0],
+					    bufsize => 16, min_bufsize => 8,
+					    max_bufsize => 512,
+					    adapt => $how eq "adapt");
+    my @sh = @out[3, 1, 0];
+    my ($got, $n) = ("", 0);
+    while (grep({ length } @sh) or grep { $_ } $c->sw->buffered) {
+      for my $row (0 .. 2) {
+	my $cols = int rand(1 + $c->sw->can_fill_substream($row));
+	$cols = length $sh[$row] if $cols > length $sh[$row];
+	$c->fill_substream($row, substr $sh[$row], 0, $cols, "");
+      }
+      $c->combine_streams;
+      $got .= $c->empty_stream(int rand(1 + $c->sw->can_empty))
+	if length $sh[0] == 0 or rand() < .5;
+      if ($how eq "resize" and rand() < .3) {
+	my ($bin, $bout) = $c->sw->buffered;
+	my $new = 8 + int rand 100;
+	$c->resize($new) if $new >= $bin and $new >= $bout;
+      }
+    }
+    ok ($got eq $msg, "combine with $how");
+  }
+}
+
 done_testing;
@@ -262,6 +262,15 @@ is ($c->bundle->[0]->{tail}, 2, "advanced combine substream 0's tail");
 is ($c->bundle->[1]->{tail}, 2, "advanced combine substream 1's tail");
 is ($c->bundle->[2]->{tail}, 2, "advanced combine substream 2's tail");
 
+# Resizing: row 0 has read up to 8 and the others to 6, with 2
+# columns processed and none written
+is_deeply([$c->buffered], [6, 2], "buffered counts row 0's extra input");
+eval { $c->resize(5) };
+ok ($@, "expect error shrinking window below buffered input");
+$c->resize(20);
+is ($c->window, 20, "window resized");
+is ($c->can_fill_substream(0), 14, "more room to read after resize");
+
 
 
 
@@ -5,6 +5,12 @@
 
 #include "ppport.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
 #include "clib/FastGF2.h"
 
 #include "perlsubs.c"
@@ -13,6 +19,9 @@ MODULE = Math::FastGF2		PACKAGE = Math::FastGF2
 
 PROTOTYPES: ENABLE
 
+BOOT:
+  gf2_region_init();
+
 gf2_u32
 gf2_mul (width, a, b)
 	int	width
@@ -40,6 +49,31 @@ gf2_u32
 gf2_info (bits)
 	int bits
 
+const char *
+gf2_region_kernel ()
+
+int
+gf2_region_select (name)
+	const char *name
+
+void
+gf2_fixed_kernels ()
+  PREINIT:
+	int ks[GF2_FIXED_MAX], n, i;
+  PPCODE:
+	n = gf2_fixed_list(ks, GF2_FIXED_MAX);
+	EXTEND(SP, n);
+	for (i=0; i < n; ++i)
+	  PUSHs(sv_2mortal(newSViv(ks[i])));
+
+int
+gf2_fixed_enable (on)
+	int on
+
+long
+gf2_cache_size (level)
+	int level
+
 
 MODULE = Math::FastGF2     PACKAGE = Math::FastGF2::Matrix     PREFIX = mat_
 
@@ -56,6 +90,28 @@ mat_alloc_c (class, rows, cols, width, org)
   int width
   int org
 
+SV *
+mat_wrap_string_c (class, rows, cols, width, org, Buf, offset)
+  char* class
+  int rows
+  int cols
+  int width
+  int org
+  SV *Buf
+  int offset
+
+SV *
+mat_map_file_c (class, rows, cols, width, org, fd, offset, writable, advice = 0)
+  char* class
+  int rows
+  int cols
+  int width
+  int org
+  int fd
+  NV offset
+  int writable
+  int advice
+
 void
 mat_DESTROY (self)
   SV* self
@@ -92,7 +148,7 @@ mat_setval(self, row, col, val)
   gf2_u32 val
 
 void
-mat_multiply_submatrix_c (S, T, R, sr, rr, nr, xc, rc, nc)
+mat_multiply_submatrix_c (S, T, R, sr, rr, nr, xc, rc, nc, threads = 0, inorder = 0, outorder = 0, acc = 0)
   SV *S
   SV *T
   SV *R
@@ -102,6 +158,63 @@ mat_multiply_submatrix_c (S, T, R, sr, rr, nr, xc, rc, nc)
   int xc
   int rc
   int nc
+  int threads
+  int inorder
+  int outorder
+  int acc
+
+int
+mat_threads_c (n)
+  int n
+
+SV *
+mat_prepare_c (Self, inorder, outorder)
+  SV *Self
+  int inorder
+  int outorder
+
+int
+mat_solve_c (Self, Result)
+  SV *Self
+  SV *Result
+
+int
+mat_invert_c (Self, Result)
+  SV *Self
+  SV *Result
+
+int
+mat_inverse_cauchy_c (Self, Xylist, Sharelist)
+  SV *Self
+  SV *Xylist
+  SV *Sharelist
+
+SV *
+mat_process_streams_fd_c (Xform, In, Fillfds, Aligns, Out, Emptyfds, bytes, inorder, outorder)
+  SV *Xform
+  SV *In
+  SV *Fillfds
+  SV *Aligns
+  SV *Out
+  SV *Emptyfds
+  NV bytes
+  int inorder
+  int outorder
+
+SV *
+mat_pipeline_fd_c (Xform, Fillfds, Aligns, Emptyfds, bytes, inorder, outorder, cols = 0, nbufs = 0, workers = 0, flags = 0, Hashes = &PL_sv_undef)
+  SV *Xform
+  SV *Fillfds
+  SV *Aligns
+  SV *Emptyfds
+  NV bytes
+  int inorder
+  int outorder
+  int cols
+  int nbufs
+  int workers
+  int flags
+  SV *Hashes
 
 int
 mat_values_eq_c (This, That) 
@@ -148,6 +261,49 @@ mat_offset_to_rowcol (Self, offset, OUTLIST row, OUTLIST col)
   int row
   int col
 
+MODULE = Math::FastGF2  PACKAGE = Math::FastGF2::Matrix::Prepared  PREFIX = prep_
+
+PROTOTYPES: ENABLE
+
+void
+prep_DESTROY (self)
+  SV *self
+
+int
+prep_ROWS (self)
+  SV *self
+
+int
+prep_COLS (self)
+  SV *self
+
+int
+prep_WIDTH (self)
+  SV *self
+
+int
+prep_multiply_submatrix_c (P, T, R, pr, rr, nr, xc, rc, nc, threads = 0)
+  SV *P
+  SV *T
+  SV *R
+  int pr
+  int rr
+  int nr
+  int xc
+  int rc
+  int nc
+  int threads
+
+int
+prep_multiply_rows_c (P, T, R, xc, rc, nc, threads = 0)
+  SV *P
+  SV *T
+  SV *R
+  int xc
+  int rc
+  int nc
+  int threads
+
 MODULE = Math::FastGF2  PACKAGE = Math::FastGF2::Matrix::FillSub  PREFIX = cbk__
 
 PROTOTYPES: ENABLE
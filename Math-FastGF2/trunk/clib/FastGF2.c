@@ -7,8 +7,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "FastGF2.h"
 
+/*
+  SIMD region kernels are only built with gcc/clang on x86, where we
+  can compile individual functions for a given instruction set with
+  the target attribute and check for it at run time with
+  __builtin_cpu_supports. Everything else gets the scalar code.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GF2_X86_SIMD
+#include <immintrin.h>
+#endif
+
 static const gf2_u8  poly_u8  = 0x1b;
 static const gf2_u16 poly_u16 = 0x2b;
 static const gf2_u32 poly_u32 = 0x8d;
@@ -1321,6 +1333,9 @@ static gf2_u32 gf2_long_mod_inverse_u32 (gf2_u32 x);
 static gf2_u16 gf2_long_mod_power_u16 (gf2_u16 x, gf2_u16 y);
 static gf2_u32 gf2_long_mod_power_u32 (gf2_u32 x, gf2_u32 y);
 
+/* set by gf2_region_select to the PCLMULQDQ version if possible */
+static gf2_u32 (*u32_mul_fn) (gf2_u32 a, gf2_u32 b) = gf2_fast_u32_mul;
+
 /* generic interface where 'width' is passed as a parameter */
 gf2_u32 gf2_mul (int width, gf2_u32 a, gf2_u32 b) {
   /* keep 8-bit log/exp tables handy */
@@ -1333,7 +1348,7 @@ gf2_u32 gf2_mul (int width, gf2_u32 a, gf2_u32 b) {
   case 16:
     return gf2_fast_u16_mul(a,b);
   case 32:
-    return gf2_fast_u32_mul(a,b);
+    return u32_mul_fn(a,b);
   default:
     fprintf (stderr, "gf2_mul: width %d not one of (8,16,32)\n",width);
     return 0;
@@ -1377,7 +1392,7 @@ gf2_u32 gf2_div (int width, gf2_u32 a, gf2_u32 b) {
   case 16:
     return gf2_fast_u16_mul(a, gf2_long_mod_inverse_u16(b));
   case 32:
-    return gf2_fast_u32_mul(a, gf2_long_mod_inverse_u32(b));
+    return u32_mul_fn(a, gf2_long_mod_inverse_u32(b));
   default:
     fprintf (stderr, "gf2_div: width %d not one of (8,16,32)\n",width);
     return 0;
@@ -1566,9 +1581,9 @@ static gf2_u32 gf2_long_mod_power_u32 (gf2_u32 x, gf2_u32 y) {
   if ((y == 0) || (y == 0xffffffffl)) return 1;
   mask >>= (32 - size_in_bits_u32(y));
   while (mask>>=1) {
-    z=gf2_fast_u32_mul(z,z);
+    z=u32_mul_fn(z,z);
     if (y & mask) {
-      z=gf2_fast_u32_mul(x,z);
+      z=u32_mul_fn(x,z);
     }
   }
   return z;
@@ -1589,3 +1604,1053 @@ gf2_u32 gf2_info(int bits) {
       sizeof(fast_gf2_shift_u32);
   }
 }
+
+/* Region operations */
+
+/*
+  Multiplying a whole buffer by a constant c can be done without any
+  log/exp lookups by splitting each source byte into two nibbles and
+  using a pair of 16-entry tables holding c * {0..15} and
+  c * {0..15}<<4. The product is the xor of the two lookups. Each
+  table fits in a 128-bit register, so with SSSE3 (and AVX2 and
+  AVX-512BW) a single pshufb does 16 (32, 64) lookups at once.
+
+  The tables for all 256 values of c take up 8Kb and are built once
+  when the region code is first initialised.
+*/
+static gf2_u8 region_nibble_tab[256][32];
+
+static void gf2_region_mul8_scalar (gf2_u8 *dest, const gf2_u8 *src,
+				    gf2_u8 c, size_t len, int acc) {
+  const gf2_u8 *lo = region_nibble_tab[c];
+  const gf2_u8 *hi = lo + 16;
+
+  if (acc) {
+    for (; len--; ++src, ++dest)
+      *dest ^= lo[*src & 15] ^ hi[*src >> 4];
+  } else {
+    for (; len--; ++src, ++dest)
+      *dest  = lo[*src & 15] ^ hi[*src >> 4];
+  }
+}
+
+#ifdef GF2_X86_SIMD
+
+__attribute__((target("ssse3")))
+static void gf2_region_mul8_ssse3 (gf2_u8 *dest, const gf2_u8 *src,
+				   gf2_u8 c, size_t len, int acc) {
+  __m128i lo   = _mm_loadu_si128((const __m128i *) region_nibble_tab[c]);
+  __m128i hi   = _mm_loadu_si128((const __m128i *)(region_nibble_tab[c] + 16));
+  __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i s, p;
+
+  for (; len >= 16; len -= 16, src += 16, dest += 16) {
+    s = _mm_loadu_si128((const __m128i *) src);
+    p = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+		      _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4),
+							 mask)));
+    if (acc)
+      p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i *) dest));
+    _mm_storeu_si128((__m128i *) dest, p);
+  }
+  gf2_region_mul8_scalar(dest, src, c, len, acc);
+}
+
+__attribute__((target("avx2")))
+static void gf2_region_mul8_avx2 (gf2_u8 *dest, const gf2_u8 *src,
+				  gf2_u8 c, size_t len, int acc) {
+  __m256i lo   = _mm256_broadcastsi128_si256
+    (_mm_loadu_si128((const __m128i *) region_nibble_tab[c]));
+  __m256i hi   = _mm256_broadcastsi128_si256
+    (_mm_loadu_si128((const __m128i *)(region_nibble_tab[c] + 16)));
+  __m256i mask = _mm256_set1_epi8(0x0f);
+  __m256i s, p;
+
+  for (; len >= 32; len -= 32, src += 32, dest += 32) {
+    s = _mm256_loadu_si256((const __m256i *) src);
+    p = _mm256_xor_si256
+      (_mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+       _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4),
+						mask)));
+    if (acc)
+      p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i *) dest));
+    _mm256_storeu_si256((__m256i *) dest, p);
+  }
+  gf2_region_mul8_scalar(dest, src, c, len, acc);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void gf2_region_mul8_avx512bw (gf2_u8 *dest, const gf2_u8 *src,
+				      gf2_u8 c, size_t len, int acc) {
+  __m512i lo   = _mm512_broadcast_i32x4
+    (_mm_loadu_si128((const __m128i *) region_nibble_tab[c]));
+  __m512i hi   = _mm512_broadcast_i32x4
+    (_mm_loadu_si128((const __m128i *)(region_nibble_tab[c] + 16)));
+  __m512i mask = _mm512_set1_epi8(0x0f);
+  __m512i s, p;
+
+  for (; len >= 64; len -= 64, src += 64, dest += 64) {
+    s = _mm512_loadu_si512((const void *) src);
+    p = _mm512_xor_si512
+      (_mm512_shuffle_epi8(lo, _mm512_and_si512(s, mask)),
+       _mm512_shuffle_epi8(hi, _mm512_and_si512(_mm512_srli_epi64(s, 4),
+						mask)));
+    if (acc)
+      p = _mm512_xor_si512(p, _mm512_loadu_si512((const void *) dest));
+    _mm512_storeu_si512((void *) dest, p);
+  }
+  gf2_region_mul8_scalar(dest, src, c, len, acc);
+}
+
+#endif
+
+/*
+  16- and 32-bit regions use the same idea. Since the multiplier is
+  fixed for the whole region, c * s is linear in s, so it's the xor of
+  c * (each nibble of s in its own position). For the SIMD kernels,
+  each of those per-nibble products is split into bytes, giving 4 x 2
+  (16-bit) or 8 x 4 (32-bit) tables of 16 bytes that pshufb can use
+  directly. The source words are first split into byte planes (all
+  the low bytes together, etc.) and the result bytes are interleaved
+  again before being stored.
+
+  The scalar code uses one 256-entry table per byte of the source
+  word instead. All tables are built from the products of c and each
+  power of x, so setting them up only needs xors, not multiplies.
+  Very short regions just use the regular multiply.
+
+  Byte swapping the source or result words is also linear, so it can
+  be folded into the basis: bit i of a swapped source word is really
+  bit i ^ 8 (16-bit) or i ^ 24 (32-bit), and each basis product can be
+  stored already swapped. The kernels then do the conversion for free.
+*/
+#define GF2_REGION_TABLE_MIN 32
+
+#define GF2_BSWAP16(x) ((gf2_u16) (((x) << 8) | ((x) >> 8)))
+#define GF2_BSWAP32(x) ((((x) & 0xff) << 24) | (((x) & 0xff00) << 8) | \
+			(((x) >> 8) & 0xff00) | (((x) >> 24) & 0xff))
+
+static void gf2_region_basis16 (gf2_u16 c, gf2_u16 *basis, int flags) {
+  gf2_u16 b[16];
+  int i;
+  for (i=0; i < 16; ++i, c = (c << 1) ^ ((c & 0x8000) ? poly_u16 : 0))
+    b[i] = c;
+  for (i=0; i < 16; ++i) {
+    c = b[(flags & GF2_REGION_SWAP_IN) ? i ^ 8 : i];
+    basis[i] = (flags & GF2_REGION_SWAP_OUT) ? GF2_BSWAP16(c) : c;
+  }
+}
+
+static void gf2_region_basis32 (gf2_u32 c, gf2_u32 *basis, int flags) {
+  gf2_u32 b[32];
+  int i;
+  for (i=0; i < 32; ++i, c = (c << 1) ^ ((c & 0x80000000ul) ? poly_u32 : 0))
+    b[i] = c;
+  for (i=0; i < 32; ++i) {
+    c = b[(flags & GF2_REGION_SWAP_IN) ? i ^ 24 : i];
+    basis[i] = (flags & GF2_REGION_SWAP_OUT) ? GF2_BSWAP32(c) : c;
+  }
+}
+
+/* word-at-a-time multiply for short regions and tails */
+static void gf2_region_short16 (gf2_u16 *dest, const gf2_u16 *src,
+				gf2_u16 c, size_t words, int flags) {
+  gf2_u16 s;
+
+  for (; words--; ++src, ++dest) {
+    s = *src;
+    if (flags & GF2_REGION_SWAP_IN)  s = GF2_BSWAP16(s);
+    s = gf2_fast_u16_mul(c, s);
+    if (flags & GF2_REGION_SWAP_OUT) s = GF2_BSWAP16(s);
+    *dest = (flags & GF2_REGION_XOR) ? *dest ^ s : s;
+  }
+}
+
+static void gf2_region_short32 (gf2_u32 *dest, const gf2_u32 *src,
+				gf2_u32 c, size_t words, int flags) {
+  gf2_u32 s;
+
+  for (; words--; ++src, ++dest) {
+    s = *src;
+    if (flags & GF2_REGION_SWAP_IN)  s = GF2_BSWAP32(s);
+    s = gf2_fast_u32_mul(c, s);
+    if (flags & GF2_REGION_SWAP_OUT) s = GF2_BSWAP32(s);
+    *dest = (flags & GF2_REGION_XOR) ? *dest ^ s : s;
+  }
+}
+
+/* fill table[0 .. 2^bits-1] with all xor combinations of basis[] */
+#define GF2_SPAN_TABLE(table, basis, bits) do {		\
+    int _b, _v;						\
+    (table)[0] = 0;					\
+    for (_b=0; _b < (bits); ++_b)			\
+      for (_v=0; _v < (1 << _b); ++_v)			\
+	(table)[_v | (1 << _b)] = (table)[_v] ^ (basis)[_b];	\
+  } while (0)
+
+/*
+  Tables for the scalar kernels: one 256-entry table for each byte of
+  the source word, one after the other
+*/
+static void gf2_region_bytetab16 (void *tab, gf2_u16 c, int flags) {
+  gf2_u16 basis[16], *t = tab;
+
+  gf2_region_basis16(c, basis, flags);
+  GF2_SPAN_TABLE(t,       basis,     8);
+  GF2_SPAN_TABLE(t + 256, basis + 8, 8);
+}
+
+static void gf2_region_bytetab32 (void *tab, gf2_u32 c, int flags) {
+  gf2_u32 basis[32], *t = tab;
+  int i;
+
+  gf2_region_basis32(c, basis, flags);
+  for (i=0; i < 4; ++i)
+    GF2_SPAN_TABLE(t + 256 * i, basis + 8 * i, 8);
+}
+
+/*
+  All of the 16- and 32-bit kernels take an optional table (tab) made
+  beforehand for the same c and byte swapping flags, by the table
+  function for the same kernel (see gf2_region_table16 below). If it's
+  NULL, they make their own.
+*/
+static void gf2_region_mul16_scalar (gf2_u16 *dest, const gf2_u16 *src,
+				     gf2_u16 c, size_t words, int flags,
+				     const void *tab) {
+  gf2_u16 own[512];
+  const gf2_u16 *lo, *hi;
+  int acc = flags & GF2_REGION_XOR;
+
+  if (tab == NULL) {
+    if (words < GF2_REGION_TABLE_MIN) {
+      gf2_region_short16(dest, src, c, words, flags);
+      return;
+    }
+    gf2_region_bytetab16(own, c, flags);
+    tab = own;
+  }
+  lo = tab;
+  hi = lo + 256;
+  if (acc) {
+    for (; words--; ++src, ++dest)
+      *dest ^= lo[*src & 0xff] ^ hi[*src >> 8];
+  } else {
+    for (; words--; ++src, ++dest)
+      *dest  = lo[*src & 0xff] ^ hi[*src >> 8];
+  }
+}
+
+static void gf2_region_mul32_scalar (gf2_u32 *dest, const gf2_u32 *src,
+				     gf2_u32 c, size_t words, int flags,
+				     const void *tab) {
+  gf2_u32 own[1024];
+  const gf2_u32 *t0, *t1, *t2, *t3;
+  gf2_u32 s;
+  int acc = flags & GF2_REGION_XOR;
+
+  if (tab == NULL) {
+    if (words < GF2_REGION_TABLE_MIN) {
+      gf2_region_short32(dest, src, c, words, flags);
+      return;
+    }
+    gf2_region_bytetab32(own, c, flags);
+    tab = own;
+  }
+  t0 = tab;
+  t1 = t0 + 256;
+  t2 = t0 + 512;
+  t3 = t0 + 768;
+  for (; words--; ++src, ++dest) {
+    s = *src;
+    s = t0[s & 0xff] ^ t1[(s >> 8) & 0xff] ^ t2[(s >> 16) & 0xff] ^
+      t3[s >> 24];
+    *dest = acc ? *dest ^ s : s;
+  }
+}
+
+#ifdef GF2_X86_SIMD
+
+/*
+  Nibble tables for the SIMD kernels: tab[n * bytes + b] holds byte b
+  of c * (v << 4n) for v = 0..15. x86 is little-endian, so byte 0 is
+  the low byte of each word in memory.
+*/
+static void gf2_region_nibtab16 (void *out, gf2_u16 c, int flags) {
+  gf2_u8 (*tab)[16] = out;
+  gf2_u16 basis[16], t[16];
+  int n, v;
+
+  gf2_region_basis16(c, basis, flags);
+  for (n=0; n < 4; ++n) {
+    GF2_SPAN_TABLE(t, basis + 4 * n, 4);
+    for (v=0; v < 16; ++v) {
+      tab[2 * n][v]     = t[v] & 0xff;
+      tab[2 * n + 1][v] = t[v] >> 8;
+    }
+  }
+}
+
+static void gf2_region_nibtab32 (void *out, gf2_u32 c, int flags) {
+  gf2_u8 (*tab)[16] = out;
+  gf2_u32 basis[32], t[16];
+  int n, v;
+
+  gf2_region_basis32(c, basis, flags);
+  for (n=0; n < 8; ++n) {
+    GF2_SPAN_TABLE(t, basis + 4 * n, 4);
+    for (v=0; v < 16; ++v) {
+      tab[4 * n][v]     = t[v] & 0xff;
+      tab[4 * n + 1][v] = (t[v] >> 8)  & 0xff;
+      tab[4 * n + 2][v] = (t[v] >> 16) & 0xff;
+      tab[4 * n + 3][v] = t[v] >> 24;
+    }
+  }
+}
+
+__attribute__((target("ssse3")))
+static void gf2_region_mul16_ssse3 (gf2_u16 *dest, const gf2_u16 *src,
+				    gf2_u16 c, size_t words, int flags,
+				    const void *tabs) {
+  gf2_u8  own[8][16];
+  const gf2_u8 (*tab)[16] = tabs;
+  __m128i t[8], mask, sep, a, b, lo, hi, n0, n1, n2, n3, rlo, rhi;
+  int i, acc = flags & GF2_REGION_XOR;
+
+  if (tab == NULL) {
+    if (words < GF2_REGION_TABLE_MIN) {
+      gf2_region_mul16_scalar(dest, src, c, words, flags, NULL);
+      return;
+    }
+    gf2_region_nibtab16(own, c, flags);
+    tab = own;
+  }
+  for (i=0; i < 8; ++i)
+    t[i] = _mm_loadu_si128((const __m128i *) tab[i]);
+  mask = _mm_set1_epi8(0x0f);
+  sep  = _mm_setr_epi8(0,2,4,6,8,10,12,14, 1,3,5,7,9,11,13,15);
+
+  for (; words >= 16; words -= 16, src += 16, dest += 16) {
+    a   = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src), sep);
+    b   = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 8)), sep);
+    lo  = _mm_unpacklo_epi64(a, b);
+    hi  = _mm_unpackhi_epi64(a, b);
+    n0  = _mm_and_si128(lo, mask);
+    n1  = _mm_and_si128(_mm_srli_epi64(lo, 4), mask);
+    n2  = _mm_and_si128(hi, mask);
+    n3  = _mm_and_si128(_mm_srli_epi64(hi, 4), mask);
+    rlo = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(t[0], n0),
+				      _mm_shuffle_epi8(t[2], n1)),
+			_mm_xor_si128(_mm_shuffle_epi8(t[4], n2),
+				      _mm_shuffle_epi8(t[6], n3)));
+    rhi = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(t[1], n0),
+				      _mm_shuffle_epi8(t[3], n1)),
+			_mm_xor_si128(_mm_shuffle_epi8(t[5], n2),
+				      _mm_shuffle_epi8(t[7], n3)));
+    a   = _mm_unpacklo_epi8(rlo, rhi);
+    b   = _mm_unpackhi_epi8(rlo, rhi);
+    if (acc) {
+      a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *) dest));
+      b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)(dest + 8)));
+    }
+    _mm_storeu_si128((__m128i *) dest,      a);
+    _mm_storeu_si128((__m128i *)(dest + 8), b);
+  }
+  gf2_region_mul16_scalar(dest, src, c, words, flags, NULL);
+}
+
+/*
+  The AVX2 version works the same way on each 128-bit lane. The byte
+  planes end up holding words 0-7/16-23 (lane 0) and 8-15/24-31 (lane
+  1), but since the same shuffles put them back again it doesn't
+  matter.
+*/
+__attribute__((target("avx2")))
+static void gf2_region_mul16_avx2 (gf2_u16 *dest, const gf2_u16 *src,
+				   gf2_u16 c, size_t words, int flags,
+				   const void *tabs) {
+  gf2_u8  own[8][16];
+  const gf2_u8 (*tab)[16] = tabs;
+  __m256i t[8], mask, sep, a, b, lo, hi, n0, n1, n2, n3, rlo, rhi;
+  int i, acc = flags & GF2_REGION_XOR;
+
+  if (tab == NULL) {
+    if (words < GF2_REGION_TABLE_MIN) {
+      gf2_region_mul16_scalar(dest, src, c, words, flags, NULL);
+      return;
+    }
+    gf2_region_nibtab16(own, c, flags);
+    tab = own;
+  }
+  for (i=0; i < 8; ++i)
+    t[i] = _mm256_broadcastsi128_si256
+      (_mm_loadu_si128((const __m128i *) tab[i]));
+  mask = _mm256_set1_epi8(0x0f);
+  sep  = _mm256_setr_epi8(0,2,4,6,8,10,12,14, 1,3,5,7,9,11,13,15,
+			  0,2,4,6,8,10,12,14, 1,3,5,7,9,11,13,15);
+
+  for (; words >= 32; words -= 32, src += 32, dest += 32) {
+    a   = _mm256_shuffle_epi8
+      (_mm256_loadu_si256((const __m256i *) src), sep);
+    b   = _mm256_shuffle_epi8
+      (_mm256_loadu_si256((const __m256i *)(src + 16)), sep);
+    lo  = _mm256_unpacklo_epi64(a, b);
+    hi  = _mm256_unpackhi_epi64(a, b);
+    n0  = _mm256_and_si256(lo, mask);
+    n1  = _mm256_and_si256(_mm256_srli_epi64(lo, 4), mask);
+    n2  = _mm256_and_si256(hi, mask);
+    n3  = _mm256_and_si256(_mm256_srli_epi64(hi, 4), mask);
+    rlo = _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(t[0], n0),
+					    _mm256_shuffle_epi8(t[2], n1)),
+			   _mm256_xor_si256(_mm256_shuffle_epi8(t[4], n2),
+					    _mm256_shuffle_epi8(t[6], n3)));
+    rhi = _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(t[1], n0),
+					    _mm256_shuffle_epi8(t[3], n1)),
+			   _mm256_xor_si256(_mm256_shuffle_epi8(t[5], n2),
+					    _mm256_shuffle_epi8(t[7], n3)));
+    a   = _mm256_unpacklo_epi8(rlo, rhi);
+    b   = _mm256_unpackhi_epi8(rlo, rhi);
+    if (acc) {
+      a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *) dest));
+      b = _mm256_xor_si256(b, _mm256_loadu_si256((const __m256i *)(dest + 16)));
+    }
+    _mm256_storeu_si256((__m256i *) dest,       a);
+    _mm256_storeu_si256((__m256i *)(dest + 16), b);
+  }
+  gf2_region_mul16_scalar(dest, src, c, words, flags, NULL);
+}
+
+/*
+  For 32-bit words, a byte shuffle followed by a 4x4 transpose of
+  32-bit units turns four vectors of words into four byte planes. The
+  same two steps turn the result planes back into words.
+*/
+__attribute__((target("ssse3")))
+static void gf2_region_mul32_ssse3 (gf2_u32 *dest, const gf2_u32 *src,
+				    gf2_u32 c, size_t words, int flags,
+				    const void *tabs) {
+  gf2_u8  own[32][16];
+  const gf2_u8 (*tab)[16] = tabs;
+  __m128i mask, sep, v[4], p[4], r[4], t0, t1, t2, t3, lo, hi;
+  int i, n, acc = flags & GF2_REGION_XOR;
+
+  if (tab == NULL) {
+    if (words < GF2_REGION_TABLE_MIN) {
+      gf2_region_mul32_scalar(dest, src, c, words, flags, NULL);
+      return;
+    }
+    gf2_region_nibtab32(own, c, flags);
+    tab = own;
+  }
+  mask = _mm_set1_epi8(0x0f);
+  sep  = _mm_setr_epi8(0,4,8,12, 1,5,9,13, 2,6,10,14, 3,7,11,15);
+
+  for (; words >= 16; words -= 16, src += 16, dest += 16) {
+    for (i=0; i < 4; ++i)
+      v[i] = _mm_shuffle_epi8
+	(_mm_loadu_si128((const __m128i *)(src + 4 * i)), sep);
+    t0 = _mm_unpacklo_epi32(v[0], v[1]);
+    t1 = _mm_unpacklo_epi32(v[2], v[3]);
+    t2 = _mm_unpackhi_epi32(v[0], v[1]);
+    t3 = _mm_unpackhi_epi32(v[2], v[3]);
+    p[0] = _mm_unpacklo_epi64(t0, t1);
+    p[1] = _mm_unpackhi_epi64(t0, t1);
+    p[2] = _mm_unpacklo_epi64(t2, t3);
+    p[3] = _mm_unpackhi_epi64(t2, t3);
+
+    r[0] = r[1] = r[2] = r[3] = _mm_setzero_si128();
+    for (n=0; n < 4; ++n) {	/* source byte plane n, nibbles 2n, 2n+1 */
+      lo = _mm_and_si128(p[n], mask);
+      hi = _mm_and_si128(_mm_srli_epi64(p[n], 4), mask);
+      for (i=0; i < 4; ++i) {	/* result byte plane i */
+	r[i] = _mm_xor_si128
+	  (r[i], _mm_xor_si128
+	   (_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)
+					     tab[8 * n + i]), lo),
+	    _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)
+					     tab[8 * n + 4 + i]), hi)));
+      }
+    }
+
+    t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    t1 = _mm_unpacklo_epi32(r[2], r[3]);
+    t2 = _mm_unpackhi_epi32(r[0], r[1]);
+    t3 = _mm_unpackhi_epi32(r[2], r[3]);
+    v[0] = _mm_unpacklo_epi64(t0, t1);
+    v[1] = _mm_unpackhi_epi64(t0, t1);
+    v[2] = _mm_unpacklo_epi64(t2, t3);
+    v[3] = _mm_unpackhi_epi64(t2, t3);
+    for (i=0; i < 4; ++i) {
+      v[i] = _mm_shuffle_epi8(v[i], sep);
+      if (acc)
+	v[i] = _mm_xor_si128
+	  (v[i], _mm_loadu_si128((const __m128i *)(dest + 4 * i)));
+      _mm_storeu_si128((__m128i *)(dest + 4 * i), v[i]);
+    }
+  }
+  gf2_region_mul32_scalar(dest, src, c, words, flags, NULL);
+}
+
+__attribute__((target("avx2")))
+static void gf2_region_mul32_avx2 (gf2_u32 *dest, const gf2_u32 *src,
+				   gf2_u32 c, size_t words, int flags,
+				   const void *tabs) {
+  gf2_u8  own[32][16];
+  const gf2_u8 (*tab)[16] = tabs;
+  __m256i mask, sep, v[4], p[4], r[4], t0, t1, t2, t3, lo, hi;
+  int i, n, acc = flags & GF2_REGION_XOR;
+
+  if (tab == NULL) {
+    if (words < GF2_REGION_TABLE_MIN) {
+      gf2_region_mul32_scalar(dest, src, c, words, flags, NULL);
+      return;
+    }
+    gf2_region_nibtab32(own, c, flags);
+    tab = own;
+  }
+  mask = _mm256_set1_epi8(0x0f);
+  sep  = _mm256_setr_epi8(0,4,8,12, 1,5,9,13, 2,6,10,14, 3,7,11,15,
+			  0,4,8,12, 1,5,9,13, 2,6,10,14, 3,7,11,15);
+
+  for (; words >= 32; words -= 32, src += 32, dest += 32) {
+    for (i=0; i < 4; ++i)
+      v[i] = _mm256_shuffle_epi8
+	(_mm256_loadu_si256((const __m256i *)(src + 8 * i)), sep);
+    t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+    t1 = _mm256_unpacklo_epi32(v[2], v[3]);
+    t2 = _mm256_unpackhi_epi32(v[0], v[1]);
+    t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+    p[0] = _mm256_unpacklo_epi64(t0, t1);
+    p[1] = _mm256_unpackhi_epi64(t0, t1);
+    p[2] = _mm256_unpacklo_epi64(t2, t3);
+    p[3] = _mm256_unpackhi_epi64(t2, t3);
+
+    r[0] = r[1] = r[2] = r[3] = _mm256_setzero_si256();
+    for (n=0; n < 4; ++n) {
+      lo = _mm256_and_si256(p[n], mask);
+      hi = _mm256_and_si256(_mm256_srli_epi64(p[n], 4), mask);
+      for (i=0; i < 4; ++i) {
+	r[i] = _mm256_xor_si256
+	  (r[i], _mm256_xor_si256
+	   (_mm256_shuffle_epi8(_mm256_broadcastsi128_si256
+				(_mm_loadu_si128((const __m128i *)
+						 tab[8 * n + i])), lo),
+	    _mm256_shuffle_epi8(_mm256_broadcastsi128_si256
+				(_mm_loadu_si128((const __m128i *)
+						 tab[8 * n + 4 + i])), hi)));
+      }
+    }
+
+    t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+    t1 = _mm256_unpacklo_epi32(r[2], r[3]);
+    t2 = _mm256_unpackhi_epi32(r[0], r[1]);
+    t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    v[0] = _mm256_unpacklo_epi64(t0, t1);
+    v[1] = _mm256_unpackhi_epi64(t0, t1);
+    v[2] = _mm256_unpacklo_epi64(t2, t3);
+    v[3] = _mm256_unpackhi_epi64(t2, t3);
+    for (i=0; i < 4; ++i) {
+      v[i] = _mm256_shuffle_epi8(v[i], sep);
+      if (acc)
+	v[i] = _mm256_xor_si256
+	  (v[i], _mm256_loadu_si256((const __m256i *)(dest + 8 * i)));
+      _mm256_storeu_si256((__m256i *)(dest + 8 * i), v[i]);
+    }
+  }
+  gf2_region_mul32_scalar(dest, src, c, words, flags, NULL);
+}
+
+/*
+  GF(2^32) multiplication with carry-less multiply (PCLMULQDQ)
+
+  A 32 x 32 bit carry-less product P = H.x^32 + L has 63 bits, and is
+  reduced with Barrett's method. For p = x^32 + 0x8d, mu = x^64 / p is
+  also x^32 + 0x8d (because 0x8d has degree < 16), so
+
+    q = (H * mu) >> 32 = H ^ ((H * 0x8d) >> 32)
+    r = L ^ low32(q * 0x8d)
+
+  which is three carry-less multiplies in all. The region versions
+  put the even and odd words of each 64-bit lane into separate
+  registers, do two multiplies per 128-bit lane and reduce all lanes
+  at once. With VPCLMULQDQ, that's 8 (AVX2) or 16 (AVX-512) words at a
+  time; for 32-bit words this beats the byte-plane shuffle code. Byte
+  swapping is a pshufb after loading or before storing.
+*/
+__attribute__((target("pclmul,sse2")))
+static gf2_u32 gf2_clmul_u32_mul (gf2_u32 a, gf2_u32 b) {
+  __m128i poly = _mm_cvtsi32_si128(poly_u32);
+  __m128i p, h, q;
+
+  p = _mm_clmulepi64_si128(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b), 0);
+  h = _mm_srli_epi64(p, 32);
+  q = _mm_xor_si128(h, _mm_srli_epi64(_mm_clmulepi64_si128(h, poly, 0), 32));
+  return _mm_cvtsi128_si32(_mm_xor_si128(p, _mm_clmulepi64_si128(q, poly, 0)));
+}
+
+/* reduce the 63-bit product in each 64-bit lane */
+__attribute__((target("pclmul,sse2")))
+static inline __m128i gf2_clmul_reduce128 (__m128i p, __m128i poly) {
+  __m128i h = _mm_srli_epi64(p, 32);
+  __m128i q = _mm_srli_epi64
+    (_mm_unpacklo_epi64(_mm_clmulepi64_si128(h, poly, 0x00),
+			_mm_clmulepi64_si128(h, poly, 0x01)), 32);
+  q = _mm_xor_si128(q, h);
+  return _mm_xor_si128(p, _mm_unpacklo_epi64
+		       (_mm_clmulepi64_si128(q, poly, 0x00),
+			_mm_clmulepi64_si128(q, poly, 0x01)));
+}
+
+__attribute__((target("pclmul,ssse3")))
+static void gf2_region_mul32_pclmul (gf2_u32 *dest, const gf2_u32 *src,
+				     gf2_u32 c, size_t words, int flags,
+				     const void *tab) {
+  __m128i cc   = _mm_set1_epi64x(c);
+  __m128i poly = _mm_set1_epi64x(poly_u32);
+  __m128i lo32 = _mm_set1_epi64x(0xffffffff);
+  __m128i bswap = _mm_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+  __m128i v, e, o;
+  gf2_u32 s;
+
+  for (; words >= 4; words -= 4, src += 4, dest += 4) {
+    v = _mm_loadu_si128((const __m128i *) src);
+    if (flags & GF2_REGION_SWAP_IN)
+      v = _mm_shuffle_epi8(v, bswap);
+    e = _mm_and_si128(v, lo32);
+    o = _mm_srli_epi64(v, 32);
+    e = _mm_unpacklo_epi64(_mm_clmulepi64_si128(e, cc, 0x00),
+			   _mm_clmulepi64_si128(e, cc, 0x01));
+    o = _mm_unpacklo_epi64(_mm_clmulepi64_si128(o, cc, 0x00),
+			   _mm_clmulepi64_si128(o, cc, 0x01));
+    v = _mm_or_si128(_mm_and_si128(gf2_clmul_reduce128(e, poly), lo32),
+		     _mm_slli_epi64(gf2_clmul_reduce128(o, poly), 32));
+    if (flags & GF2_REGION_SWAP_OUT)
+      v = _mm_shuffle_epi8(v, bswap);
+    if (flags & GF2_REGION_XOR)
+      v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i *) dest));
+    _mm_storeu_si128((__m128i *) dest, v);
+  }
+  for (; words--; ++src, ++dest) {
+    s = *src;
+    if (flags & GF2_REGION_SWAP_IN)  s = GF2_BSWAP32(s);
+    s = gf2_clmul_u32_mul(c, s);
+    if (flags & GF2_REGION_SWAP_OUT) s = GF2_BSWAP32(s);
+    *dest = (flags & GF2_REGION_XOR) ? *dest ^ s : s;
+  }
+}
+
+__attribute__((target("avx2,pclmul,vpclmulqdq")))
+static inline __m256i gf2_clmul_reduce256 (__m256i p, __m256i poly) {
+  __m256i h = _mm256_srli_epi64(p, 32);
+  __m256i q = _mm256_srli_epi64
+    (_mm256_unpacklo_epi64(_mm256_clmulepi64_epi128(h, poly, 0x00),
+			   _mm256_clmulepi64_epi128(h, poly, 0x01)), 32);
+  q = _mm256_xor_si256(q, h);
+  return _mm256_xor_si256(p, _mm256_unpacklo_epi64
+			  (_mm256_clmulepi64_epi128(q, poly, 0x00),
+			   _mm256_clmulepi64_epi128(q, poly, 0x01)));
+}
+
+__attribute__((target("avx2,pclmul,vpclmulqdq")))
+static void gf2_region_mul32_vpclmul_avx2 (gf2_u32 *dest, const gf2_u32 *src,
+					   gf2_u32 c, size_t words, int flags,
+					   const void *tab) {
+  __m256i cc   = _mm256_set1_epi64x(c);
+  __m256i poly = _mm256_set1_epi64x(poly_u32);
+  __m256i lo32 = _mm256_set1_epi64x(0xffffffff);
+  __m256i bswap = _mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+				   3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+  __m256i v, e, o;
+
+  for (; words >= 8; words -= 8, src += 8, dest += 8) {
+    v = _mm256_loadu_si256((const __m256i *) src);
+    if (flags & GF2_REGION_SWAP_IN)
+      v = _mm256_shuffle_epi8(v, bswap);
+    e = _mm256_and_si256(v, lo32);
+    o = _mm256_srli_epi64(v, 32);
+    e = _mm256_unpacklo_epi64(_mm256_clmulepi64_epi128(e, cc, 0x00),
+			      _mm256_clmulepi64_epi128(e, cc, 0x01));
+    o = _mm256_unpacklo_epi64(_mm256_clmulepi64_epi128(o, cc, 0x00),
+			      _mm256_clmulepi64_epi128(o, cc, 0x01));
+    v = _mm256_or_si256
+      (_mm256_and_si256(gf2_clmul_reduce256(e, poly), lo32),
+       _mm256_slli_epi64(gf2_clmul_reduce256(o, poly), 32));
+    if (flags & GF2_REGION_SWAP_OUT)
+      v = _mm256_shuffle_epi8(v, bswap);
+    if (flags & GF2_REGION_XOR)
+      v = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i *) dest));
+    _mm256_storeu_si256((__m256i *) dest, v);
+  }
+  gf2_region_mul32_pclmul(dest, src, c, words, flags, NULL);
+}
+
+__attribute__((target("avx512f,avx512bw,pclmul,vpclmulqdq")))
+static inline __m512i gf2_clmul_reduce512 (__m512i p, __m512i poly) {
+  __m512i h = _mm512_srli_epi64(p, 32);
+  __m512i q = _mm512_srli_epi64
+    (_mm512_unpacklo_epi64(_mm512_clmulepi64_epi128(h, poly, 0x00),
+			   _mm512_clmulepi64_epi128(h, poly, 0x01)), 32);
+  q = _mm512_xor_si512(q, h);
+  return _mm512_xor_si512(p, _mm512_unpacklo_epi64
+			  (_mm512_clmulepi64_epi128(q, poly, 0x00),
+			   _mm512_clmulepi64_epi128(q, poly, 0x01)));
+}
+
+__attribute__((target("avx512f,avx512bw,pclmul,vpclmulqdq")))
+static void gf2_region_mul32_vpclmul_avx512 (gf2_u32 *dest,
+					     const gf2_u32 *src,
+					     gf2_u32 c, size_t words, int flags,
+					     const void *tab) {
+  __m512i cc   = _mm512_set1_epi64(c);
+  __m512i poly = _mm512_set1_epi64(poly_u32);
+  __m512i lo32 = _mm512_set1_epi64(0xffffffff);
+  __m512i bswap = _mm512_broadcast_i32x4
+    (_mm_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12));
+  __m512i v, e, o;
+
+  for (; words >= 16; words -= 16, src += 16, dest += 16) {
+    v = _mm512_loadu_si512((const void *) src);
+    if (flags & GF2_REGION_SWAP_IN)
+      v = _mm512_shuffle_epi8(v, bswap);
+    e = _mm512_and_si512(v, lo32);
+    o = _mm512_srli_epi64(v, 32);
+    e = _mm512_unpacklo_epi64(_mm512_clmulepi64_epi128(e, cc, 0x00),
+			      _mm512_clmulepi64_epi128(e, cc, 0x01));
+    o = _mm512_unpacklo_epi64(_mm512_clmulepi64_epi128(o, cc, 0x00),
+			      _mm512_clmulepi64_epi128(o, cc, 0x01));
+    v = _mm512_or_si512
+      (_mm512_and_si512(gf2_clmul_reduce512(e, poly), lo32),
+       _mm512_slli_epi64(gf2_clmul_reduce512(o, poly), 32));
+    if (flags & GF2_REGION_SWAP_OUT)
+      v = _mm512_shuffle_epi8(v, bswap);
+    if (flags & GF2_REGION_XOR)
+      v = _mm512_xor_si512(v, _mm512_loadu_si512((const void *) dest));
+    _mm512_storeu_si512((void *) dest, v);
+  }
+  gf2_region_mul32_pclmul(dest, src, c, words, flags, NULL);
+}
+
+#endif
+
+typedef void (*gf2_region_fn)   (gf2_u8 *, const gf2_u8 *, gf2_u8,
+				 size_t, int);
+typedef void (*gf2_region16_fn) (gf2_u16 *, const gf2_u16 *, gf2_u16,
+				 size_t, int, const void *);
+typedef void (*gf2_region32_fn) (gf2_u32 *, const gf2_u32 *, gf2_u32,
+				 size_t, int, const void *);
+typedef void (*gf2_table16_fn)  (void *, gf2_u16, int);
+typedef void (*gf2_table32_fn)  (void *, gf2_u32, int);
+
+/*
+  listed from fastest to slowest; AVX-512BW uses the AVX2 code for
+  16-bit words. If the CPU also has the carry-less multiply feature
+  named in clmul_cpu, the clmul32 kernel replaces fn32, and single
+  32-bit multiplies use PCLMULQDQ too.
+*/
+static const struct {
+  const char      *name;
+  gf2_region_fn    fn;
+  gf2_region16_fn  fn16;
+  gf2_region32_fn  fn32;
+  const char      *clmul_cpu;
+  gf2_region32_fn  clmul32;
+} region_kernels[] = {
+#ifdef GF2_X86_SIMD
+  { "avx512bw", gf2_region_mul8_avx512bw,
+                gf2_region_mul16_avx2,   gf2_region_mul32_avx2,
+                "vpclmulqdq", gf2_region_mul32_vpclmul_avx512 },
+  { "avx2",     gf2_region_mul8_avx2,
+                gf2_region_mul16_avx2,   gf2_region_mul32_avx2,
+                "vpclmulqdq", gf2_region_mul32_vpclmul_avx2 },
+  { "ssse3",    gf2_region_mul8_ssse3,
+                gf2_region_mul16_ssse3,  gf2_region_mul32_ssse3,
+                "pclmul",     gf2_region_mul32_pclmul },
+#endif
+  { "scalar",   gf2_region_mul8_scalar,
+                gf2_region_mul16_scalar, gf2_region_mul32_scalar,
+                NULL,         NULL },
+};
+#define REGION_KERNELS (sizeof(region_kernels) / sizeof(region_kernels[0]))
+
+static gf2_region_fn    region_fn   = NULL;
+static gf2_region16_fn  region16_fn = NULL;
+static gf2_region32_fn  region32_fn = NULL;
+static const char      *region_name = NULL;
+
+/* how to make tables for region16_fn/region32_fn, and their size */
+static gf2_table16_fn   table16_fn  = NULL;
+static gf2_table32_fn   table32_fn  = NULL;
+static size_t           table16_size = 0;
+static size_t           table32_size = 0;
+
+static int gf2_region_cpu_ok (const char *name) {
+#ifdef GF2_X86_SIMD
+  __builtin_cpu_init();
+  if (strcmp(name, "avx512bw") == 0)
+    return __builtin_cpu_supports("avx512bw");
+  if (strcmp(name, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+  if (strcmp(name, "ssse3") == 0)
+    return __builtin_cpu_supports("ssse3");
+  if (strcmp(name, "pclmul") == 0)
+    return __builtin_cpu_supports("pclmul");
+  if (strcmp(name, "vpclmulqdq") == 0)
+    return __builtin_cpu_supports("vpclmulqdq") &&
+      __builtin_cpu_supports("pclmul");
+#endif
+  return (strcmp(name, "scalar") == 0);
+}
+
+/*
+  Check a carry-less multiply kernel against the tables before using
+  it. Products of powers of x and of a few pseudo-random values cover
+  every reduction path; odd j also checks the byte swapping.
+*/
+static int gf2_region_clmul_ok (gf2_region32_fn fn) {
+  gf2_u32 src[37], dest[37], c = 0x8d, want;
+  int i, j, swap;
+
+  for (j=0; j < 40; ++j, c = c * 0x9e3779b9ul + 1) {
+    swap = (j & 1) ? GF2_REGION_SWAP_IN | GF2_REGION_SWAP_OUT : 0;
+    for (i=0; i < 37; ++i)
+      src[i] = (i < 32) ? 1ul << ((i + j) & 31) : c ^ (i * 0x01000193ul);
+    fn(dest, src, c, 37, swap, NULL);
+    for (i=0; i < 37; ++i) {
+      want = swap ? GF2_BSWAP32(gf2_fast_u32_mul(c, GF2_BSWAP32(src[i])))
+	: gf2_fast_u32_mul(c, src[i]);
+      if (dest[i] != want)
+	return 0;
+#ifdef GF2_X86_SIMD
+      if (!swap && gf2_clmul_u32_mul(c, src[i]) != dest[i])
+	return 0;
+#endif
+    }
+  }
+  return 1;
+}
+
+/*
+  Select a named kernel, or the fastest one this CPU supports if name
+  is NULL or empty. Returns 0 if the named kernel isn't available.
+*/
+int gf2_region_select (const char *name) {
+  int i, c;
+
+  if (region_fn == NULL) {
+    for (c=0; c < 256; ++c) {
+      for (i=0; i < 16; ++i) {
+	region_nibble_tab[c][i]      = gf2_mul8(c, i);
+	region_nibble_tab[c][16 + i] = gf2_mul8(c, i << 4);
+      }
+    }
+  }
+  for (i=0; i < REGION_KERNELS; ++i) {
+    if (name && *name && strcmp(name, region_kernels[i].name))
+      continue;
+    if (!gf2_region_cpu_ok(region_kernels[i].name))
+      continue;
+    region_name = region_kernels[i].name;
+    region_fn   = region_kernels[i].fn;
+    region16_fn = region_kernels[i].fn16;
+    region32_fn = region_kernels[i].fn32;
+    u32_mul_fn  = gf2_fast_u32_mul;
+    if (region_kernels[i].fn16 == gf2_region_mul16_scalar) {
+      table16_fn   = gf2_region_bytetab16;
+      table32_fn   = gf2_region_bytetab32;
+      table16_size = 2 * 256 * sizeof(gf2_u16);
+      table32_size = 4 * 256 * sizeof(gf2_u32);
+    } else {
+#ifdef GF2_X86_SIMD
+      table16_fn   = gf2_region_nibtab16;
+      table32_fn   = gf2_region_nibtab32;
+      table16_size = 8 * 16;
+      table32_size = 32 * 16;
+#endif
+    }
+    if (region_kernels[i].clmul_cpu &&
+	gf2_region_cpu_ok(region_kernels[i].clmul_cpu) &&
+	gf2_region_clmul_ok(region_kernels[i].clmul32)) {
+      region32_fn = region_kernels[i].clmul32;
+      table32_fn   = NULL;	/* clmul kernels don't need any */
+      table32_size = 0;
+#ifdef GF2_X86_SIMD
+      u32_mul_fn  = gf2_clmul_u32_mul;
+#endif
+    }
+    return 1;
+  }
+  return 0;
+}
+
+void gf2_region_init (void) {
+  if (region_fn == NULL)
+    gf2_region_select(NULL);
+}
+
+const char *gf2_region_kernel (void) {
+  gf2_region_init();
+  return region_name;
+}
+
+/* nibble tables for c: 16 bytes of c * {0..15}, then c * {0..15}<<4 */
+const gf2_u8 *gf2_region_nibbles (gf2_u8 c) {
+  gf2_region_init();
+  return region_nibble_tab[c];
+}
+
+/* dest = c * src */
+void gf2_region_mul8 (gf2_u8 *dest, const gf2_u8 *src, gf2_u8 c,
+		      size_t len) {
+  if (c == 0) {
+    memset(dest, 0, len);
+  } else if (c == 1) {
+    if (dest != src) memmove(dest, src, len);
+  } else {
+    gf2_region_init();
+    (*region_fn)(dest, src, c, len, 0);
+  }
+}
+
+/* dest ^= c * src */
+void gf2_region_mul8_xor (gf2_u8 *dest, const gf2_u8 *src, gf2_u8 c,
+			  size_t len) {
+  if (c == 0)
+    return;
+  gf2_region_init();
+  (*region_fn)(dest, src, c, len, 1);
+}
+
+/*
+  16- and 32-bit versions of the above, with flags for accumulating
+  and byte swapping. Copying (c == 1) is only a shortcut if the words
+  are swapped both ways or not at all.
+*/
+#define GF2_REGION_SWAPS (GF2_REGION_SWAP_IN | GF2_REGION_SWAP_OUT)
+
+void gf2_region_mul16_ord (gf2_u16 *dest, const gf2_u16 *src, gf2_u16 c,
+			   size_t words, int flags) {
+  int swaps = flags & GF2_REGION_SWAPS;
+
+  if (c == 0) {
+    if (!(flags & GF2_REGION_XOR))
+      memset(dest, 0, words * sizeof(gf2_u16));
+  } else if (c == 1 && !(flags & GF2_REGION_XOR) &&
+	     (swaps == 0 || swaps == GF2_REGION_SWAPS)) {
+    if (dest != src) memmove(dest, src, words * sizeof(gf2_u16));
+  } else {
+    gf2_region_init();
+    (*region16_fn)(dest, src, c, words, flags, NULL);
+  }
+}
+
+void gf2_region_mul32_ord (gf2_u32 *dest, const gf2_u32 *src, gf2_u32 c,
+			   size_t words, int flags) {
+  int swaps = flags & GF2_REGION_SWAPS;
+
+  if (c == 0) {
+    if (!(flags & GF2_REGION_XOR))
+      memset(dest, 0, words * sizeof(gf2_u32));
+  } else if (c == 1 && !(flags & GF2_REGION_XOR) &&
+	     (swaps == 0 || swaps == GF2_REGION_SWAPS)) {
+    if (dest != src) memmove(dest, src, words * sizeof(gf2_u32));
+  } else {
+    gf2_region_init();
+    (*region32_fn)(dest, src, c, words, flags, NULL);
+  }
+}
+
+/*
+  Tables for multiplying by c with the kernel that's selected now can
+  be made in advance with gf2_region_table{16,32}, into a buffer of
+  gf2_region_table_size(width) bytes, and passed to the _tab versions
+  of the above. This saves making them again on every call when the
+  same constants are used over and over (see gf2_matrix_prepare). The
+  swap flags must be the same when making and using the tables, and
+  they're no good after selecting a different kernel. Size 0 means
+  the kernel doesn't need any, and tab can be NULL.
+*/
+size_t gf2_region_table_size (int width) {
+  gf2_region_init();
+  switch (width) {
+  case 2:  return table16_size;
+  case 4:  return table32_size;
+  default: return 0;
+  }
+}
+
+void gf2_region_table16 (void *tab, gf2_u16 c, int flags) {
+  gf2_region_init();
+  if (table16_fn) (*table16_fn)(tab, c, flags & GF2_REGION_SWAPS);
+}
+
+void gf2_region_table32 (void *tab, gf2_u32 c, int flags) {
+  gf2_region_init();
+  if (table32_fn) (*table32_fn)(tab, c, flags & GF2_REGION_SWAPS);
+}
+
+void gf2_region_mul16_tab (gf2_u16 *dest, const gf2_u16 *src, gf2_u16 c,
+			   const void *tab, size_t words, int flags) {
+  int swaps = flags & GF2_REGION_SWAPS;
+
+  if (c == 0) {
+    if (!(flags & GF2_REGION_XOR))
+      memset(dest, 0, words * sizeof(gf2_u16));
+  } else if (c == 1 && !(flags & GF2_REGION_XOR) &&
+	     (swaps == 0 || swaps == GF2_REGION_SWAPS)) {
+    if (dest != src) memmove(dest, src, words * sizeof(gf2_u16));
+  } else {
+    gf2_region_init();
+    (*region16_fn)(dest, src, c, words, flags, table16_size ? tab : NULL);
+  }
+}
+
+void gf2_region_mul32_tab (gf2_u32 *dest, const gf2_u32 *src, gf2_u32 c,
+			   const void *tab, size_t words, int flags) {
+  int swaps = flags & GF2_REGION_SWAPS;
+
+  if (c == 0) {
+    if (!(flags & GF2_REGION_XOR))
+      memset(dest, 0, words * sizeof(gf2_u32));
+  } else if (c == 1 && !(flags & GF2_REGION_XOR) &&
+	     (swaps == 0 || swaps == GF2_REGION_SWAPS)) {
+    if (dest != src) memmove(dest, src, words * sizeof(gf2_u32));
+  } else {
+    gf2_region_init();
+    (*region32_fn)(dest, src, c, words, flags, table32_size ? tab : NULL);
+  }
+}
+
+void gf2_region_mul16 (gf2_u16 *dest, const gf2_u16 *src, gf2_u16 c,
+		       size_t words) {
+  gf2_region_mul16_ord(dest, src, c, words, 0);
+}
+
+void gf2_region_mul16_xor (gf2_u16 *dest, const gf2_u16 *src, gf2_u16 c,
+			   size_t words) {
+  gf2_region_mul16_ord(dest, src, c, words, GF2_REGION_XOR);
+}
+
+void gf2_region_mul32 (gf2_u32 *dest, const gf2_u32 *src, gf2_u32 c,
+		       size_t words) {
+  gf2_region_mul32_ord(dest, src, c, words, 0);
+}
+
+void gf2_region_mul32_xor (gf2_u32 *dest, const gf2_u32 *src, gf2_u32 c,
+			   size_t words) {
+  gf2_region_mul32_ord(dest, src, c, words, GF2_REGION_XOR);
+}
+
+/*
+  Flags for data in byte order inorder/outorder (0 native, 1 little-
+  endian, 2 big-endian) on this machine
+*/
+int gf2_region_swap_flags (int width, int inorder, int outorder) {
+  static const gf2_u16 test = 0x0201;
+  int native = (*(const char *) &test == 1) ? 1 : 2;
+  int flags  = 0;
+
+  if (width == 1) return 0;
+  if (inorder  && inorder  != native) flags |= GF2_REGION_SWAP_IN;
+  if (outorder && outorder != native) flags |= GF2_REGION_SWAP_OUT;
+  return flags;
+}
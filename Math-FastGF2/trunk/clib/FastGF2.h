@@ -12,6 +12,9 @@
   you can use define USE_CUSTOM_TYPEDEFS and supply your own types.
 */
 
+#include <stddef.h>
+#include <sys/types.h>
+
 #ifdef USE_CUSTOM_TYPEDEFS
 
 /*
@@ -91,6 +94,7 @@ typedef signed long long    gf2_s32;
 gf2_u32 gf2_mul (int width, gf2_u32 a, gf2_u32 b);
 gf2_u32 gf2_inv (int width, gf2_u32 a);
 gf2_u32 gf2_div (int width, gf2_u32 a, gf2_u32 b);
+gf2_u32 gf2_pow (int width, gf2_u32 a, gf2_u32 b);
 gf2_u32 gf2_info(int bits);
 
 /* the same, but bringing out "width" */
@@ -104,6 +108,74 @@ gf2_u32 gf2_mul32 (gf2_u32 a, gf2_u32 b);
 gf2_u32 gf2_inv32 (gf2_u32 a);
 gf2_u32 gf2_div32 (gf2_u32 a, gf2_u32 b);
 
+/*
+  region operations on whole buffers of 8-bit field elements; the
+  fastest available SIMD kernel is chosen at run time
+*/
+void gf2_region_init (void);
+int  gf2_region_select (const char *name);
+const char *gf2_region_kernel (void);
+void gf2_region_mul8     (gf2_u8 *dest, const gf2_u8 *src, gf2_u8 c,
+			  size_t len);
+void gf2_region_mul8_xor (gf2_u8 *dest, const gf2_u8 *src, gf2_u8 c,
+			  size_t len);
+void gf2_region_mul16     (gf2_u16 *dest, const gf2_u16 *src, gf2_u16 c,
+			   size_t words);
+void gf2_region_mul16_xor (gf2_u16 *dest, const gf2_u16 *src, gf2_u16 c,
+			   size_t words);
+void gf2_region_mul32     (gf2_u32 *dest, const gf2_u32 *src, gf2_u32 c,
+			   size_t words);
+void gf2_region_mul32_xor (gf2_u32 *dest, const gf2_u32 *src, gf2_u32 c,
+			   size_t words);
+
+/*
+  The same with flags: GF2_REGION_XOR to add the product into dest,
+  and GF2_REGION_SWAP_IN/GF2_REGION_SWAP_OUT if src words are/dest
+  words should be byte-swapped relative to native order. Swapping is
+  folded into the kernels' tables or shuffles, so it costs (almost)
+  nothing extra.
+*/
+#define GF2_REGION_XOR       1
+#define GF2_REGION_SWAP_IN   2
+#define GF2_REGION_SWAP_OUT  4
+void gf2_region_mul16_ord (gf2_u16 *dest, const gf2_u16 *src, gf2_u16 c,
+			   size_t words, int flags);
+void gf2_region_mul32_ord (gf2_u32 *dest, const gf2_u32 *src, gf2_u32 c,
+			   size_t words, int flags);
+int  gf2_region_swap_flags (int width, int inorder, int outorder);
+size_t gf2_region_table_size (int width);
+void gf2_region_table16 (void *tab, gf2_u16 c, int flags);
+void gf2_region_table32 (void *tab, gf2_u32 c, int flags);
+void gf2_region_mul16_tab (gf2_u16 *dest, const gf2_u16 *src, gf2_u16 c,
+			   const void *tab, size_t words, int flags);
+void gf2_region_mul32_tab (gf2_u32 *dest, const gf2_u32 *src, gf2_u32 c,
+			   const void *tab, size_t words, int flags);
+const gf2_u8 *gf2_region_nibbles (gf2_u8 c);
+
+/*
+  fully unrolled 8-bit dot products for the values of k picked when
+  building (clib/Fixed.c): dest = c[0] * src[0] + ... + c[k-1] *
+  src[k-1]. gf2_fixed_dot8 returns NULL if there isn't one for k.
+*/
+#define GF2_FIXED_MAX 64
+typedef void (*gf2_dot8_fn) (gf2_u8 *dest, const gf2_u8 * const *src,
+			     const gf2_u8 *c, size_t len);
+gf2_dot8_fn gf2_fixed_dot8 (int k);
+int  gf2_fixed_enable (int on);
+int  gf2_fixed_list (int *ks, int max);
+
+/*
+  process-wide thread pool (clib/Pool.c); multiplies are split across
+  gf2_pool_get_threads() threads unless told otherwise
+*/
+typedef void (*gf2_pool_task_fn) (void *arg, int task);
+int  gf2_pool_set_threads (int n);
+int  gf2_pool_get_threads (void);
+void gf2_pool_run (int ntasks, int threads, gf2_pool_task_fn fn, void *arg);
+
+/* bytes of a cache level (1-3) per CPU, or 0 if unknown (also Pool.c) */
+long gf2_cache_size (int level);
+
 /* matrix */
 typedef struct {
   int rows;
@@ -116,21 +188,88 @@ typedef struct {
   /* 
     save some information so we know whether to call free() when we're
     finished with the object. FREE_NONE means don't call free on either
-    the structure or the values array.
+    the structure or the values array. FREE_EXTERNAL means the values
+    belong to something else (a Perl scalar or an mmap'd file) and the
+    structure is part of a larger one that knows how to let go of it.
   */
   enum {
-    FREE_NONE, FREE_VALUES, FREE_STRUCT, FREE_BOTH,
+    FREE_NONE, FREE_VALUES, FREE_STRUCT, FREE_BOTH, FREE_EXTERNAL,
   } alloc_bits;
 } gf2_matrix_t;
 
 
 int gf2_matrix_offset_right (gf2_matrix_t *m);
 int gf2_matrix_offset_down (gf2_matrix_t *m);
+int gf2_matrix_multiply_submatrix (gf2_matrix_t *self, gf2_matrix_t *xform,
+				   gf2_matrix_t *result,
+				   int self_row,  int result_row, int nrows,
+				   int xform_col, int result_col, int ncols);
+int gf2_matrix_multiply_submatrix_mt (gf2_matrix_t *self,
+				      gf2_matrix_t *xform,
+				      gf2_matrix_t *result,
+				      int self_row,  int result_row, int nrows,
+				      int xform_col, int result_col, int ncols,
+				      int threads);
+int gf2_matrix_multiply_submatrix_ord (gf2_matrix_t *self,
+				       gf2_matrix_t *xform,
+				       gf2_matrix_t *result,
+				       int self_row,  int result_row, int nrows,
+				       int xform_col, int result_col, int ncols,
+				       int threads, int inorder, int outorder);
+int gf2_matrix_multiply_submatrix_xor (gf2_matrix_t *self,
+				       gf2_matrix_t *xform,
+				       gf2_matrix_t *result,
+				       int self_row,  int result_row, int nrows,
+				       int xform_col, int result_col, int ncols,
+				       int threads, int inorder, int outorder);
 
-#ifdef NOW_IS_OK
+/*
+  A transform prepared for multiplying by over and over: its
+  coefficients in a flat ROWWISE array, and, for 16- and 32-bit words,
+  the region kernel's tables for each of them (tabsize bytes apiece,
+  or NULL if the kernel doesn't use any). swap is the flags from
+  gf2_region_swap_flags for the input/output byte orders. unit[r] is
+  the column of the only non-zero coefficient in row r if that's a 1
+  (as in the identity part of a systematic transform) and the row can
+  be copied without any byte swapping, or -1.
+*/
+typedef struct {
+  int rows;
+  int cols;
+  int width;
+  int swap;
+  const char *kernel;		/* kernel the tables were made for */
+  size_t tabsize;
+  gf2_u32 *coeffs;
+  int *unit;
+  char *tables;
+} gf2_prepared_t;
 
-/* disabled code... mostly this is now implemented in Perl */
+gf2_prepared_t *gf2_matrix_prepare (gf2_matrix_t *m,
+				    int inorder, int outorder);
+void gf2_prepared_free (gf2_prepared_t *p);
+int gf2_prepared_multiply (gf2_prepared_t *p,
+			   gf2_matrix_t *xform, gf2_matrix_t *result,
+			   int p_row,     int result_row, int nrows,
+			   int xform_col, int result_col, int ncols,
+			   int threads);
+int gf2_prepared_multiply_rows (gf2_prepared_t *p,
+				gf2_matrix_t *xform, char * const *in_ptrs,
+				gf2_matrix_t *result, char * const *out_ptrs,
+				int xform_col, int result_col, int ncols,
+				int threads);
 
+int gf2_matrix_solve  (gf2_matrix_t *m, gf2_matrix_t *result);
+int gf2_matrix_invert (gf2_matrix_t *m, gf2_matrix_t *inverse);
+int gf2_matrix_inverse_cauchy (gf2_matrix_t *inv,
+			       const gf2_u32 *x, const gf2_u32 *y);
+
+/*
+  Streaming multiply (gf2_process_streams). Each input or output stream
+  has a closure that is called to fill or empty part of a circular
+  buffer (the in or out matrix); the callback returns the number of
+  bytes it read or wrote, 0 for eof (fill only) or < 0 for error.
+*/
 #ifdef _LARGEFILE64_SOURCE
 #define OFF_T off64_t
 #define OFF_T_FMT "%lld"
@@ -190,10 +329,67 @@ struct gf2_streambuf_control {
   } hs;
 };
 
+OFF_T gf2_process_streams (gf2_matrix_t *xform,
+			   gf2_matrix_t *in,
+			   struct gf2_streambuf_control *fill_ctl,
+			   int fillers,
+			   gf2_matrix_t *out,
+			   struct gf2_streambuf_control *empty_ctl,
+			   int emptiers,
+			   OFF_T bytes_to_read, int inorder, int outorder);
+OFF_T gf2_prepared_process_streams (gf2_prepared_t *prep,
+				    gf2_matrix_t *in,
+				    struct gf2_streambuf_control *fill_ctl,
+				    int fillers,
+				    gf2_matrix_t *out,
+				    struct gf2_streambuf_control *empty_ctl,
+				    int emptiers,
+				    OFF_T bytes_to_read);
+
+/* closures for reading/writing file descriptors */
+struct gf2_fd_stream {
+  int   fd;
+  int   align;			/* pad input with zeros to this at eof */
+  OFF_T bytes;			/* bytes read so far */
+};
+void gf2_fd_filler  (struct gf2_streambuf_control *ctl,
+		     struct gf2_fd_stream *s, int fd, int align);
+void gf2_fd_emptier (struct gf2_streambuf_control *ctl,
+		     struct gf2_fd_stream *s, int fd);
+
+/*
+  the same job as gf2_process_streams on file descriptors, with a
+  reader, compute workers and a writer per output stream all running
+  at once over a pool of buffers (clib/Pipeline.c)
+*/
+#define GF2_PIPE_URING 1	/* read and write through io_uring */
+#define GF2_PIPE_FSYNC 2	/* fsync output streams at the end */
+OFF_T gf2_pipeline_fds (gf2_prepared_t *prep,
+			int fillers, const int *fill_fds, const int *aligns,
+			int emptiers, const int *empty_fds,
+			OFF_T bytes_to_read,
+			int cols, int nbufs, int workers, int flags,
+			unsigned char *hashes);
+
+/* SHA-256, for hashing streams as they go through (clib/Sha256.c) */
+#define GF2_SHA256_LEN 32
+typedef struct {
+  unsigned long h[8];		/* (only 32 bits of each are used) */
+  unsigned long long len;	/* bytes hashed so far */
+  unsigned char buf[64];	/* partial block */
+  int      fill;
+} gf2_sha256_t;
+void gf2_sha256_init   (gf2_sha256_t *c);
+void gf2_sha256_update (gf2_sha256_t *c, const void *data, size_t len);
+void gf2_sha256_final  (gf2_sha256_t *c, unsigned char *digest);
+
+#ifdef NOW_IS_OK
+
+/* disabled code... mostly this is now implemented in Perl */
+
 int gf2_matrix_row_size_in_bytes (gf2_matrix_t *m);
 int gf2_matrix_col_size_in_bytes (gf2_matrix_t *m);
 char* gf2_matrix_element (gf2_matrix_t *m, int r, int c);
-gf2_matrix_t* gf2_matrix_invert(gf2_matrix_t *m);
 int gf2_matrix_multiply (gf2_matrix_t* result, char org, char* poly,
 			 gf2_matrix_t* a, gf2_matrix_t* b);
 #endif
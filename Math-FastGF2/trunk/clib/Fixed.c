@@ -0,0 +1,273 @@
+/* Fully unrolled 8-bit multiply kernels for particular values of k */
+/*
+  Copyright (c) by Declan Malone 2009-2019.
+  Licensed under the terms of the GNU General Public License and
+  the GNU Lesser (Library) General Public License.
+*/
+
+/*
+  The generic multiply (gf2_multiply_cols in Matrix.c) builds each
+  result row in a panel with k calls to a region kernel, each of which
+  reads and writes the whole output row again. Only a handful of
+  (k, n) shapes get used in practice, so for those we have kernels
+  that do the whole dot product in one pass: for each 16/32/64 bytes
+  of output, load the same bytes from all k input rows, look each one
+  up in its own coefficient's nibble tables, xor them together and
+  store the result once.
+
+  Each kernel is an always-inline function instantiated with a
+  constant k, so the compiler unrolls the loop over the input rows
+  completely and keeps the 2k coefficient tables in registers (for k
+  up to about 6 with SSSE3/AVX2 or 14 with AVX-512; beyond that some
+  of them live on the stack, which is still in L1). n doesn't matter
+  to the kernels since each result row is a separate call.
+
+  The k values to build kernels for are picked when configuring:
+
+   perl Makefile.PL FIXED_K=3,4,6,8,10,16
+
+  Makefile.PL writes the list to FixedK.h as GF2_FIXED_LIST. Any other
+  k (and all 16- and 32-bit multiplies) use the generic code.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FastGF2.h"
+#include "FixedK.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GF2_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef __GNUC__
+#define GF2_INLINE inline __attribute__((always_inline))
+#else
+#define GF2_INLINE inline
+#endif
+
+#if defined(__GNUC__) && __GNUC__ >= 8
+#define GF2_UNROLL _Pragma("GCC unroll 64")
+#else
+#define GF2_UNROLL
+#endif
+
+/*
+  Templates. The source row pointers are copied into a local array
+  first: dest is a char pointer, so the compiler would otherwise have
+  to assume that every store could change them.
+*/
+static GF2_INLINE
+void gf2_dot8_tail (gf2_u8 *dest, const gf2_u8 * const *src,
+		    const gf2_u8 *c, size_t i, size_t len, const int k) {
+  const gf2_u8 *s[GF2_FIXED_MAX], *tab[GF2_FIXED_MAX];
+  gf2_u8 b, sum;
+  int v;
+
+  GF2_UNROLL
+  for (v=0; v < k; ++v) {
+    s[v]   = src[v];
+    tab[v] = gf2_region_nibbles(c[v]);
+  }
+  for (; i < len; ++i) {
+    sum = 0;
+    GF2_UNROLL
+    for (v=0; v < k; ++v) {
+      b    = s[v][i];
+      sum ^= tab[v][b & 15] ^ tab[v][16 + (b >> 4)];
+    }
+    dest[i] = sum;
+  }
+}
+
+#ifdef GF2_X86_SIMD
+
+__attribute__((target("ssse3"))) static GF2_INLINE
+void gf2_dot8_ssse3 (gf2_u8 *dest, const gf2_u8 * const *src,
+		     const gf2_u8 *c, size_t len, const int k) {
+  const gf2_u8 *s[GF2_FIXED_MAX], *t;
+  __m128i lo[GF2_FIXED_MAX], hi[GF2_FIXED_MAX];
+  __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i x, sum;
+  size_t i;
+  int v;
+
+  GF2_UNROLL
+  for (v=0; v < k; ++v) {
+    s[v]  = src[v];
+    t     = gf2_region_nibbles(c[v]);
+    lo[v] = _mm_loadu_si128((const __m128i *) t);
+    hi[v] = _mm_loadu_si128((const __m128i *)(t + 16));
+  }
+  for (i=0; i + 16 <= len; i += 16) {
+    sum = _mm_setzero_si128();
+    GF2_UNROLL
+    for (v=0; v < k; ++v) {
+      x   = _mm_loadu_si128((const __m128i *)(s[v] + i));
+      sum = _mm_xor_si128
+	(sum, _mm_xor_si128
+	 (_mm_shuffle_epi8(lo[v], _mm_and_si128(x, mask)),
+	  _mm_shuffle_epi8(hi[v], _mm_and_si128(_mm_srli_epi64(x, 4), mask))));
+    }
+    _mm_storeu_si128((__m128i *)(dest + i), sum);
+  }
+  gf2_dot8_tail(dest, src, c, i, len, k);
+}
+
+__attribute__((target("avx2"))) static GF2_INLINE
+void gf2_dot8_avx2 (gf2_u8 *dest, const gf2_u8 * const *src,
+		    const gf2_u8 *c, size_t len, const int k) {
+  const gf2_u8 *s[GF2_FIXED_MAX], *t;
+  __m256i lo[GF2_FIXED_MAX], hi[GF2_FIXED_MAX];
+  __m256i mask = _mm256_set1_epi8(0x0f);
+  __m256i x, sum;
+  size_t i;
+  int v;
+
+  GF2_UNROLL
+  for (v=0; v < k; ++v) {
+    s[v]  = src[v];
+    t     = gf2_region_nibbles(c[v]);
+    lo[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) t));
+    hi[v] = _mm256_broadcastsi128_si256
+      (_mm_loadu_si128((const __m128i *)(t + 16)));
+  }
+  for (i=0; i + 32 <= len; i += 32) {
+    sum = _mm256_setzero_si256();
+    GF2_UNROLL
+    for (v=0; v < k; ++v) {
+      x   = _mm256_loadu_si256((const __m256i *)(s[v] + i));
+      sum = _mm256_xor_si256
+	(sum, _mm256_xor_si256
+	 (_mm256_shuffle_epi8(lo[v], _mm256_and_si256(x, mask)),
+	  _mm256_shuffle_epi8(hi[v], _mm256_and_si256(_mm256_srli_epi64(x, 4),
+						      mask))));
+    }
+    _mm256_storeu_si256((__m256i *)(dest + i), sum);
+  }
+  gf2_dot8_tail(dest, src, c, i, len, k);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static GF2_INLINE
+void gf2_dot8_avx512bw (gf2_u8 *dest, const gf2_u8 * const *src,
+			const gf2_u8 *c, size_t len, const int k) {
+  const gf2_u8 *s[GF2_FIXED_MAX], *t;
+  __m512i lo[GF2_FIXED_MAX], hi[GF2_FIXED_MAX];
+  __m512i mask = _mm512_set1_epi8(0x0f);
+  __m512i x, sum;
+  size_t i;
+  int v;
+
+  GF2_UNROLL
+  for (v=0; v < k; ++v) {
+    s[v]  = src[v];
+    t     = gf2_region_nibbles(c[v]);
+    lo[v] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) t));
+    hi[v] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)(t + 16)));
+  }
+  for (i=0; i + 64 <= len; i += 64) {
+    sum = _mm512_setzero_si512();
+    GF2_UNROLL
+    for (v=0; v < k; ++v) {
+      x   = _mm512_loadu_si512((const void *)(s[v] + i));
+      sum = _mm512_xor_si512
+	(sum, _mm512_xor_si512
+	 (_mm512_shuffle_epi8(lo[v], _mm512_and_si512(x, mask)),
+	  _mm512_shuffle_epi8(hi[v], _mm512_and_si512(_mm512_srli_epi64(x, 4),
+						      mask))));
+    }
+    _mm512_storeu_si512((void *)(dest + i), sum);
+  }
+  gf2_dot8_tail(dest, src, c, i, len, k);
+}
+
+#endif
+
+/* Instantiate the templates for each k in GF2_FIXED_LIST */
+
+#define GF2_FIXED_SCALAR(K)						\
+  static void gf2_dot8_scalar_##K (gf2_u8 *dest,			\
+				   const gf2_u8 * const *src,		\
+				   const gf2_u8 *c, size_t len) {	\
+    gf2_dot8_tail(dest, src, c, 0, len, K);				\
+  }
+
+#ifdef GF2_X86_SIMD
+#define GF2_FIXED_SIMD(K, isa, tgt)					\
+  __attribute__((target(tgt)))						\
+  static void gf2_dot8_##isa##_##K (gf2_u8 *dest,			\
+				    const gf2_u8 * const *src,		\
+				    const gf2_u8 *c, size_t len) {	\
+    gf2_dot8_##isa(dest, src, c, len, K);				\
+  }
+#define GF2_FIXED_KERNELS(K)						\
+  GF2_FIXED_SCALAR(K)							\
+  GF2_FIXED_SIMD(K, ssse3,    "ssse3")					\
+  GF2_FIXED_SIMD(K, avx2,     "avx2")					\
+  GF2_FIXED_SIMD(K, avx512bw, "avx512f,avx512bw")
+#define GF2_FIXED_ENTRY(K)						\
+  { K, { gf2_dot8_scalar_##K, gf2_dot8_ssse3_##K,			\
+	 gf2_dot8_avx2_##K,   gf2_dot8_avx512bw_##K } },
+#else
+#define GF2_FIXED_KERNELS(K) GF2_FIXED_SCALAR(K)
+#define GF2_FIXED_ENTRY(K)						\
+  { K, { gf2_dot8_scalar_##K, gf2_dot8_scalar_##K,			\
+	 gf2_dot8_scalar_##K, gf2_dot8_scalar_##K } },
+#endif
+
+GF2_FIXED_LIST(GF2_FIXED_KERNELS)
+
+/*
+  One kernel per region kernel name, in the same order as below, so
+  that gf2_region_select("scalar") etc. also picks which of these is
+  used. The list ends with k = 0.
+*/
+static const char *fixed_isa[] = { "scalar", "ssse3", "avx2", "avx512bw" };
+
+static const struct {
+  int         k;
+  gf2_dot8_fn fn[4];
+} fixed_kernels[] = {
+  GF2_FIXED_LIST(GF2_FIXED_ENTRY)
+  { 0, { NULL, NULL, NULL, NULL } }
+};
+
+static int fixed_enabled = 1;
+
+/*
+  Return the kernel for k that goes with the region kernel currently
+  selected, or NULL if there isn't one or they're switched off
+*/
+gf2_dot8_fn gf2_fixed_dot8 (int k) {
+  const char *name;
+  int i, isa;
+
+  if (!fixed_enabled) return NULL;
+  name = gf2_region_kernel();
+  for (isa=0; isa < 4; ++isa)
+    if (strcmp(name, fixed_isa[isa]) == 0)
+      break;
+  if (isa == 4) return NULL;
+  for (i=0; fixed_kernels[i].k; ++i)
+    if (fixed_kernels[i].k == k)
+      return fixed_kernels[i].fn[isa];
+  return NULL;
+}
+
+/* Turn the kernels on or off (on < 0 just asks); returns old setting */
+int gf2_fixed_enable (int on) {
+  int old = fixed_enabled;
+
+  if (on >= 0) fixed_enabled = !!on;
+  return old;
+}
+
+/* Store up to max of the k values built in; returns how many there are */
+int gf2_fixed_list (int *ks, int max) {
+  int i;
+
+  for (i=0; fixed_kernels[i].k; ++i)
+    if (i < max) ks[i] = fixed_kernels[i].k;
+  return i;
+}
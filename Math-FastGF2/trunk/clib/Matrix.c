@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "FastGF2.h"
 
@@ -39,353 +40,1158 @@ int gf2_matrix_offset_down (gf2_matrix_t *m) {
   return 0;
 }
 
-#ifdef NOW_IS_OK
+/*
+  Cache-blocked matrix multiply
+
+  Works out result = self x xform for nrows rows of self (starting at
+  self_row) and ncols columns of xform (starting at xform_col), with
+  the answer going into result starting at (result_row, result_col).
+
+  In IDA, self is the (small) transform matrix and xform is the big
+  buffer of input data. Instead of calculating each output element as
+  a dot product (which re-reads every input column once for each
+  transform row) we walk across xform in panels of columns. Each
+  output row in the panel is built up as a sum of input rows scaled by
+  a single element of self, which is exactly what the region kernels
+  do. A panel of k input rows stays in cache while all nrows output
+  rows are produced from it.
+
+  When the xform (or result) rows aren't contiguous, as with the
+  COLWISE input buffer used when splitting (or the COLWISE output
+  buffer when combining), the panel is first copied into (or out of)
+  a scratch buffer so that the kernels always see flat rows.
+
+  Panel widths are given in columns. The input panel (k rows) should
+  sit comfortably in L2 and a single output row in L1. The 8-bit value
+  was picked by running tool/bench-multiply for k up to 32; the wider
+  types use the same panel size in bytes.
+*/
+#define GF2_TILE_COLS_U8   1024
+#define GF2_TILE_COLS_U16   512
+#define GF2_TILE_COLS_U32   256
 
-/* 
-  Misc stuff that's implemented in Perl now, but I might enable as C
-  routines later
+/*
+  swap is the GF2_REGION_SWAP_* flags for the input/result data; tab
+  is a table for c made with those flags by gf2_region_table16/32, or
+  NULL
 */
+static void gf2_region_op (int width, char *dest, const char *src,
+			   gf2_u32 c, size_t words, int acc, int swap,
+			   const void *tab) {
+  int flags = swap | (acc ? GF2_REGION_XOR : 0);
+
+  switch (width) {
+  case 1:
+    if (acc)
+      gf2_region_mul8_xor((gf2_u8*) dest, (const gf2_u8*) src, c, words);
+    else
+      gf2_region_mul8    ((gf2_u8*) dest, (const gf2_u8*) src, c, words);
+    break;
+  case 2:
+    gf2_region_mul16_tab((gf2_u16*) dest, (const gf2_u16*) src, c, tab,
+			 words, flags);
+    break;
+  case 4:
+    gf2_region_mul32_tab((gf2_u32*) dest, (const gf2_u32*) src, c, tab,
+			 words, flags);
+    break;
+  }
+}
+
+/*
+  Copy a rows x cols block of elements between two layouts. The outer
+  loop goes across columns, so that for the COLWISE side of the copy
+  we read or write memory sequentially.
+*/
+static void gf2_copy_block (char *to, int to_down, int to_right,
+			    const char *from, int from_down, int from_right,
+			    int rows, int cols, int width) {
+  int r, c;
+
+  switch (width) {
+  case 1:
+    for (c=0; c < cols; ++c, to += to_right, from += from_right)
+      for (r=0; r < rows; ++r)
+	*(gf2_u8*)(to + r * to_down) = *(const gf2_u8*)(from + r * from_down);
+    break;
+  case 2:
+    for (c=0; c < cols; ++c, to += to_right, from += from_right)
+      for (r=0; r < rows; ++r)
+	*(gf2_u16*)(to + r * to_down) = *(const gf2_u16*)(from + r * from_down);
+    break;
+  case 4:
+    for (c=0; c < cols; ++c, to += to_right, from += from_right)
+      for (r=0; r < rows; ++r)
+	*(gf2_u32*)(to + r * to_down) = *(const gf2_u32*)(from + r * from_down);
+    break;
+  }
+}
 
-OFF_T
-gf2_process_streams(gf2_matrix_t *xform,
-		    gf2_matrix_t *in,  
-		    struct gf2_streambuf_control *fill_ctl, 
-		    int fillers,
-		    gf2_matrix_t *out,  
-		    struct gf2_streambuf_control *empty_ctl, 
-		    int emptiers,
-		    OFF_T bytes_to_read) {
-
-  OFF_T  bytes_read=0;
-  int    width;
-
-  /* variables for controlling usage of input/output buffer */
-  /* All the commented-out variables are now handled in the
-     gf2_streambuf_control structure on a per-stream basis. */
-  char*     IR;			/* input read ptr (where we read) */
-  /*  char*     IW;*/		/* input write ptr (where callback writes) */
-  char*     OW;			/* output write ptr (where we write) */
-  /* char*     OR; */		/* output read ptr (where callback reads) */
-  /* char*     IEND; */		/* last address in input buffer */
-  /* char*     OEND; */		/* last address in output buffer */
-
-  /* 
-    The following variables can vary depending on whether we have a
-    single stream or multiple streams. When dealing with a single
-    stream, they represent the full size of the matrix buffer, but for
-    multiple streams, the values are divided by the number of streams.
+static gf2_u32 gf2_elem_get (const char *p, int width) {
+  switch (width) {
+  case 1:  return *(const gf2_u8 *) p;
+  case 2:  return *(const gf2_u16*) p;
+  default: return *(const gf2_u32*) p;
+  }
+}
+
+static void gf2_elem_set (char *p, int width, gf2_u32 val) {
+  switch (width) {
+  case 1:  *(gf2_u8 *) p = val; break;
+  case 2:  *(gf2_u16*) p = val; break;
+  default: *(gf2_u32*) p = val; break;
+  }
+}
+
+/*
+  The coefficients (and any region kernel tables) come from a prepared
+  copy of self; see gf2_matrix_prepare below. If acc is set, the
+  product is added (xored) into result rather than replacing it.
+
+  If in_ptrs is given, xform is ignored and row v of the input starts
+  at in_ptrs[v] (rows that live in separate buffers, like mapped share
+  files). Likewise out_ptrs for the nrows rows of result.
+*/
+static int gf2_multiply_cols (const gf2_prepared_t *self,
+			      gf2_matrix_t *xform, gf2_matrix_t *result,
+			      int self_row,  int result_row, int nrows,
+			      int xform_col, int result_col, int ncols,
+			      int acc,
+			      char * const *in_ptrs, char * const *out_ptrs) {
+
+  int width  = self->width;
+  int swap   = self->swap;
+  int tdown  = in_ptrs  ? 0 : gf2_matrix_offset_down(xform);
+  int tright = in_ptrs  ? width : gf2_matrix_offset_right(xform);
+  int odown  = out_ptrs ? 0 : gf2_matrix_offset_down(result);
+  int oright = out_ptrs ? width : gf2_matrix_offset_right(result);
+  int k      = self->cols;
+  char *in_rows  = NULL;	/* flat copy of xform panel */
+  char *out_rows = NULL;	/* flat result panel before copying out */
+  char *tp, *op, *srow, *drow;
+  const gf2_u32 *ip;
+  const char *tab;
+  gf2_dot8_fn dot = (width == 1 && !acc) ? gf2_fixed_dot8(k) : NULL;
+  const gf2_u8 *dot_rows[GF2_FIXED_MAX];
+  gf2_u8 dot_coeffs[GF2_FIXED_MAX];
+  int tile, panel_bytes, stride;
+  int r, c, v, w;
+
+  switch (width) {
+  case 1: tile = GF2_TILE_COLS_U8;  break;
+  case 2: tile = GF2_TILE_COLS_U16; break;
+  case 4: tile = GF2_TILE_COLS_U32; break;
+  default:
+    fprintf(stderr, "gf2_matrix_multiply_submatrix: bad width %d\n", width);
+    return 0;
+  }
+  if (ncols <= 0 || nrows <= 0) return 1;
+  if (tile > ncols) tile = ncols;
+  panel_bytes = tile * width;
+
+  /*
+    Scratch rows are padded by a cache line so that the rows of a
+    panel don't all map to the same few cache sets (which was a big
+    slowdown for k > 24 with unpadded power-of-two panels)
   */
-  OFF_T   ILEN;		/* length of input buffer */
-  OFF_T   OLEN;		/* length of output buffer */
-  OFF_T   IFmin;		/* input fill levels (bytes) */
-  OFF_T   OFmax;		/* output fill levels (bytes) */
-  OFF_T   want_in_size;	/* min input needed to process */
-  OFF_T   want_out_size;	/* min amount of output space needed */
-
-  char      eof;
-  OFF_T   rc;
-  OFF_T   max_fill_or_empty;
-  /*  gf2_matrix_closure_t fill_some; */
-  /*  gf2_matrix_closure_t empty_some; */
-
-  /* variables for doing the matrix multiply */
-  int      i,j,k;
-  gf2_u32  p;
-  char*    trow;
-  char*    icol;
-  char*    ocol;
-  OFF_T    idown,iright,odown,oright,tdown,tright;
-
-  printf ("Asked to process " OFF_T_FMT " bytes\n", bytes_to_read);
+  stride = panel_bytes + 64;
+
+  if (tright != width) {
+    in_rows = malloc(k * stride);
+    if (in_rows == NULL) goto nomem;
+  }
+  if (oright != width) {
+    out_rows = malloc(nrows * stride);
+    if (out_rows == NULL) goto nomem;
+  }
+
+#define GF2_IN_ROW(v)  (in_rows  ? in_rows  + (v) * stride :		\
+			in_ptrs  ? in_ptrs[v]  + (size_t) (xform_col + c) * width : \
+			tp + (v) * tdown)
+#define GF2_OUT_ROW(r) (out_rows ? out_rows + (r) * stride :		\
+			out_ptrs ? out_ptrs[r] + (size_t) (result_col + c) * width : \
+			op + (r) * odown)
+
+  for (c=0; c < ncols; c += w) {
+    w  = (ncols - c < tile) ? ncols - c : tile;
+    tp = in_ptrs  ? NULL :
+      xform->values  + (size_t) (xform_col  + c) * tright;
+    op = out_ptrs ? NULL :
+      result->values + (size_t) (result_col + c) * oright + result_row * odown;
+
+    if (in_rows)
+      gf2_copy_block(in_rows, stride, width, tp, tdown, tright,
+		     k, w, width);
+    if (out_rows && acc)
+      gf2_copy_block(out_rows, stride, width, op, odown, oright,
+		     nrows, w, width);
+
+    if (dot)
+      for (v=0; v < k; ++v)
+	dot_rows[v] = (const gf2_u8 *) GF2_IN_ROW(v);
+
+    for (r=0, ip=self->coeffs + self_row * k;
+	 r < nrows;
+	 ++r, ip += k) {
+      drow = GF2_OUT_ROW(r);
+      if ((v = self->unit[self_row + r]) >= 0) {
+	/* identity row: a straight copy (or add) of one input row */
+	srow = GF2_IN_ROW(v);
+	if (acc)
+	  gf2_region_op(width, drow, srow, 1, w, 1, swap, NULL);
+	else
+	  memcpy(drow, srow, w * width);
+	continue;
+      }
+      if (dot) {
+	/* unrolled kernel for this k (clib/Fixed.c) does the whole row */
+	for (v=0; v < k; ++v)
+	  dot_coeffs[v] = ip[v];
+	(*dot)((gf2_u8 *) drow, dot_rows, dot_coeffs, w);
+	continue;
+      }
+      tab = self->tables ?
+	self->tables + (size_t) (self_row + r) * k * self->tabsize : NULL;
+      for (v=0; v < k; ++v) {
+	srow = GF2_IN_ROW(v);
+	gf2_region_op(width, drow, srow, ip[v], w, acc || v, swap, tab);
+	if (tab) tab += self->tabsize;
+      }
+    }
+
+    if (out_rows)
+      gf2_copy_block(op, odown, oright, out_rows, stride, width,
+		     nrows, w, width);
+  }
+#undef GF2_IN_ROW
+#undef GF2_OUT_ROW
+
+  free(in_rows);
+  free(out_rows);
+  return 1;
+
+ nomem:
+  fprintf(stderr, "gf2_matrix_multiply_submatrix: out of memory\n");
+  free(in_rows);
+  free(out_rows);
+  return 0;
+}
+
+/*
+  Multi-threaded multiply
+
+  Columns of the result are independent, so the column range is cut
+  into one slice per thread and each slice is multiplied (with its own
+  scratch panels) by gf2_multiply_cols. Slice boundaries are rounded
+  so that they fall on a 64-byte cache line in the first row of the
+  result, so threads don't write to the same line there. That holds
+  for every row of a COLWISE result, and for every row of a ROWWISE
+  one (or of separate row buffers) if all the rows start at the same
+  offset within a cache line, eg when rows are a multiple of 64 bytes
+  long. Otherwise each other row can have one line shared by two
+  threads at each boundary. Padding the rows would avoid that, but
+  matrix values have to stay contiguous (getvals_str, new_from_string,
+  new_from_file). Each thread gets at least GF2_THREAD_MIN_PANELS
+  panels of columns, so small multiplies (like the ones in
+  solve/invert) stay on one thread.
+*/
+#define GF2_THREAD_MIN_PANELS 2
+
+struct gf2_multiply_job {
+  const gf2_prepared_t *self;
+  gf2_matrix_t *xform, *result;
+  int self_row, result_row, nrows, xform_col, result_col, acc;
+  char * const *in_ptrs;
+  char * const *out_ptrs;
+  int *bounds;
+  int ok;
+};
+
+static void gf2_multiply_task (void *arg, int task) {
+  struct gf2_multiply_job *j = arg;
+  int c0 = j->bounds[task];
+
+  if (!gf2_multiply_cols(j->self, j->xform, j->result,
+			 j->self_row, j->result_row, j->nrows,
+			 j->xform_col + c0, j->result_col + c0,
+			 j->bounds[task + 1] - c0, j->acc,
+			 j->in_ptrs, j->out_ptrs))
+    j->ok = 0;
+}
+
+static int gf2_multiply_split (const gf2_prepared_t *self,
+			       gf2_matrix_t *xform, gf2_matrix_t *result,
+			       int self_row,  int result_row, int nrows,
+			       int xform_col, int result_col, int ncols,
+			       int threads, int acc,
+			       char * const *in_ptrs, char * const *out_ptrs) {
+  struct gf2_multiply_job job;
+  int width  = self->width;
+  int oright = out_ptrs ? width : gf2_matrix_offset_right(result);
+  int tile, unit, lead, chunk, ntasks, i;
+  size_t base;
+
+  if (threads <= 0) threads = gf2_pool_get_threads();
+  switch (width) {
+  case 1: tile = GF2_TILE_COLS_U8;  break;
+  case 2: tile = GF2_TILE_COLS_U16; break;
+  case 4: tile = GF2_TILE_COLS_U32; break;
+  default: tile = ncols;
+  }
+  ntasks = ncols / (tile * GF2_THREAD_MIN_PANELS);
+  if (ntasks > threads) ntasks = threads;
+  if (ntasks <= 1 || nrows <= 0)
+    return gf2_multiply_cols(self, xform, result,
+			     self_row,  result_row, nrows,
+			     xform_col, result_col, ncols, acc,
+			     in_ptrs, out_ptrs);
 
   /*
-    Many checks based on code in gf2_matrix_multiply, but we have a
-    few new ones
+    unit is the smallest number of columns that spans a whole number
+    of cache lines; lead is the first column that starts one in the
+    first result row
   */
+  for (unit=1; (unit * oright) % 64; ++unit) ;
+  base = out_ptrs ? (size_t) (out_ptrs[0] + (size_t) result_col * oright) :
+    (size_t) (result->values + result_row * gf2_matrix_offset_down(result)
+	      + (size_t) result_col * oright);
+  for (lead=0; lead < unit && (base + lead * oright) % 64; ++lead) ;
+  if (lead == unit) lead = 0;
+  chunk = (ncols / ntasks + unit - 1) / unit * unit;
+
+  job.bounds = malloc((ntasks + 1) * sizeof(int));
+  if (job.bounds == NULL) {
+    fprintf(stderr, "gf2_matrix_multiply_submatrix: out of memory\n");
+    return 0;
+  }
+  job.bounds[0] = 0;
+  for (i=1; i < ntasks; ++i) {
+    job.bounds[i] = lead + i * chunk;
+    if (job.bounds[i] > ncols) job.bounds[i] = ncols;
+  }
+  job.bounds[ntasks] = ncols;
+
+  job.self       = self;
+  job.xform      = xform;
+  job.result     = result;
+  job.self_row   = self_row;
+  job.result_row = result_row;
+  job.nrows      = nrows;
+  job.xform_col  = xform_col;
+  job.result_col = result_col;
+  job.acc        = acc;
+  job.in_ptrs    = in_ptrs;
+  job.out_ptrs   = out_ptrs;
+  job.ok         = 1;
+
+  gf2_pool_run(ntasks, threads, gf2_multiply_task, &job);
+  free(job.bounds);
+  return job.ok;
+}
+
+/*
+  Prepared transform
+
+  In a split or combine the transform matrix stays the same for the
+  whole file, but the 16- and 32-bit region kernels would otherwise
+  make tables for each coefficient every time they're called (once
+  per panel of every multiply). A prepared transform is a ROWWISE copy
+  of the coefficients plus all of those tables, made once for a given
+  pair of byte orders. For 8-bit words the kernels' tables are already
+  made for every constant, so there are just the coefficients.
+
+  The tables depend on the region kernel, so they're made again if a
+  different one has been selected since. The prepared copy doesn't
+  change if the original matrix does.
+*/
+static int gf2_prepared_tables (gf2_prepared_t *p) {
+  const char *kernel = gf2_region_kernel();
+  size_t tabsize = gf2_region_table_size(p->width);
+  int i, n = p->rows * p->cols;
+
+  if (p->tables && p->kernel == kernel) return 1;
+  free(p->tables);
+  p->tables  = NULL;
+  p->tabsize = tabsize;
+  p->kernel  = kernel;
+  if (tabsize == 0) return 1;
+
+  p->tables = malloc(n * tabsize);
+  if (p->tables == NULL) {
+    fprintf(stderr, "gf2_matrix_prepare: out of memory\n");
+    return 0;
+  }
+  for (i=0; i < n; ++i) {
+    if (p->width == 2)
+      gf2_region_table16(p->tables + i * tabsize, p->coeffs[i], p->swap);
+    else
+      gf2_region_table32(p->tables + i * tabsize, p->coeffs[i], p->swap);
+  }
+  return 1;
+}
+
+/*
+  Prepare rows first_row .. first_row + nrows - 1 of m (all rows if
+  nrows is 0), with tables if want_tables is set. Returns NULL on
+  error.
+*/
+static gf2_prepared_t *gf2_prepare_rows (gf2_matrix_t *m,
+					 int first_row, int nrows,
+					 int swap, int want_tables) {
+  gf2_prepared_t *p;
+  int down  = gf2_matrix_offset_down(m);
+  int right = gf2_matrix_offset_right(m);
+  int r, c, nz;
+
+  if (m->width != 1 && m->width != 2 && m->width != 4) {
+    fprintf(stderr, "gf2_matrix_prepare: bad width %d\n", m->width);
+    return NULL;
+  }
+  if (nrows == 0) nrows = m->rows - first_row;
+  p = calloc(1, sizeof(gf2_prepared_t));
+  if (p) {
+    p->coeffs = malloc((size_t) nrows * m->cols * sizeof(gf2_u32));
+    p->unit   = malloc(nrows * sizeof(int));
+  }
+  if (p == NULL || p->coeffs == NULL || p->unit == NULL) {
+    fprintf(stderr, "gf2_matrix_prepare: out of memory\n");
+    gf2_prepared_free(p);
+    return NULL;
+  }
+  p->rows  = nrows;
+  p->cols  = m->cols;
+  p->width = m->width;
+  p->swap  = swap;
+  for (r=0; r < nrows; ++r) {
+    p->unit[r] = -1;
+    for (c=0, nz=0; c < m->cols; ++c) {
+      p->coeffs[r * m->cols + c] =
+	gf2_elem_get(m->values + (first_row + r) * down + c * right,
+		     m->width);
+      if (p->coeffs[r * m->cols + c] == 0) continue;
+      p->unit[r] = (p->coeffs[r * m->cols + c] == 1) ? c : -1;
+      ++nz;
+    }
+    if (nz != 1 || swap == GF2_REGION_SWAP_IN || swap == GF2_REGION_SWAP_OUT)
+      p->unit[r] = -1;
+  }
+  if (want_tables && m->width != 1 && !gf2_prepared_tables(p)) {
+    gf2_prepared_free(p);
+    return NULL;
+  }
+  return p;
+}
+
+gf2_prepared_t *gf2_matrix_prepare (gf2_matrix_t *m,
+				    int inorder, int outorder) {
+  return gf2_prepare_rows(m, 0, 0,
+			  gf2_region_swap_flags(m->width, inorder, outorder),
+			  1);
+}
+
+void gf2_prepared_free (gf2_prepared_t *p) {
+  if (p == NULL) return;
+  free(p->coeffs);
+  free(p->unit);
+  free(p->tables);
+  free(p);
+}
+
+/*
+  Multiply with a prepared transform, taking nrows of it starting at
+  p_row. Otherwise the same as gf2_matrix_multiply_submatrix_ord, with
+  the byte orders fixed when it was prepared.
+*/
+int gf2_prepared_multiply (gf2_prepared_t *p,
+			   gf2_matrix_t *xform, gf2_matrix_t *result,
+			   int p_row,     int result_row, int nrows,
+			   int xform_col, int result_col, int ncols,
+			   int threads) {
+  if (p->width != 1 && !gf2_prepared_tables(p))
+    return 0;
+  return gf2_multiply_split(p, xform, result,
+			    p_row,     result_row, nrows,
+			    xform_col, result_col, ncols, threads, 0,
+			    NULL, NULL);
+}
+
+/*
+  As above, but with each row of the input (all p->cols of them) and
+  of the result (p->rows) in a buffer of its own, eg a mapped share
+  file. Either list can be NULL to use xform or result as usual. Rows
+  given as pointers hold ncols words from xform_col or result_col on.
+*/
+int gf2_prepared_multiply_rows (gf2_prepared_t *p,
+				gf2_matrix_t *xform, char * const *in_ptrs,
+				gf2_matrix_t *result, char * const *out_ptrs,
+				int xform_col, int result_col, int ncols,
+				int threads) {
+  if (p->width != 1 && !gf2_prepared_tables(p))
+    return 0;
+  return gf2_multiply_split(p, xform, result,
+			    0,         0,          p->rows,
+			    xform_col, result_col, ncols, threads, 0,
+			    in_ptrs, out_ptrs);
+}
+
+/*
+  The _ord version also takes the byte order of the xform (input data)
+  and result matrices, as in gf2_process_streams. self is always in
+  native order. Any byte swapping is done by the region kernels as
+  they go, rather than in separate passes over the data.
+
+  The rows of self that are used get prepared on the way in. Tables
+  are only worth making if there's more than one panel of columns,
+  since otherwise each one would only be used once anyway.
+*/
+static int gf2_multiply_ord (gf2_matrix_t *self, gf2_matrix_t *xform,
+			     gf2_matrix_t *result,
+			     int self_row,  int result_row, int nrows,
+			     int xform_col, int result_col, int ncols,
+			     int threads, int inorder, int outorder,
+			     int acc) {
+  gf2_prepared_t *p;
+  int width = self->width;
+  int tile, ok;
+
+  if (nrows <= 0 || ncols <= 0) return 1;
+  switch (width) {
+  case 2:  tile = GF2_TILE_COLS_U16; break;
+  case 4:  tile = GF2_TILE_COLS_U32; break;
+  default: tile = ncols;
+  }
+  p = gf2_prepare_rows(self, self_row, nrows,
+		       gf2_region_swap_flags(width, inorder, outorder),
+		       ncols > tile);
+  if (p == NULL) return 0;
+  ok = gf2_multiply_split(p, xform, result,
+			  0,         result_row, nrows,
+			  xform_col, result_col, ncols, threads, acc,
+			  NULL, NULL);
+  gf2_prepared_free(p);
+  return ok;
+}
+
+int gf2_matrix_multiply_submatrix_ord (gf2_matrix_t *self,
+				       gf2_matrix_t *xform,
+				       gf2_matrix_t *result,
+				       int self_row,  int result_row, int nrows,
+				       int xform_col, int result_col, int ncols,
+				       int threads, int inorder, int outorder) {
+  return gf2_multiply_ord(self, xform, result,
+			  self_row,  result_row, nrows,
+			  xform_col, result_col, ncols,
+			  threads, inorder, outorder, 0);
+}
+
+/*
+  The same, but adding the product into result. Since the product is
+  linear in xform, this is how a change to some columns of the input
+  (xform holding new xor old) is applied to results already made.
+*/
+int gf2_matrix_multiply_submatrix_xor (gf2_matrix_t *self,
+				       gf2_matrix_t *xform,
+				       gf2_matrix_t *result,
+				       int self_row,  int result_row, int nrows,
+				       int xform_col, int result_col, int ncols,
+				       int threads, int inorder, int outorder) {
+  return gf2_multiply_ord(self, xform, result,
+			  self_row,  result_row, nrows,
+			  xform_col, result_col, ncols,
+			  threads, inorder, outorder, 1);
+}
+
+int gf2_matrix_multiply_submatrix_mt (gf2_matrix_t *self,
+				      gf2_matrix_t *xform,
+				      gf2_matrix_t *result,
+				      int self_row,  int result_row, int nrows,
+				      int xform_col, int result_col, int ncols,
+				      int threads) {
+  return gf2_matrix_multiply_submatrix_ord(self, xform, result,
+					   self_row,  result_row, nrows,
+					   xform_col, result_col, ncols,
+					   threads, 0, 0);
+}
+
+int gf2_matrix_multiply_submatrix (gf2_matrix_t *self, gf2_matrix_t *xform,
+				   gf2_matrix_t *result,
+				   int self_row,  int result_row, int nrows,
+				   int xform_col, int result_col, int ncols) {
+  return gf2_matrix_multiply_submatrix_ord(self, xform, result,
+					   self_row,  result_row, nrows,
+					   xform_col, result_col, ncols,
+					   0, 0, 0);
+}
+
+/*
+  Gauss-Jordan elimination
+
+  Works on a flat ROWWISE copy of the matrix so that each row
+  operation is a single call to a region kernel. As with the old Perl
+  code, any non-zero element will do as a pivot (there's no such
+  thing as a "small" value to avoid in GF(2^m)). Returns 0 if the
+  left-hand rows x rows part of the matrix is singular.
+*/
+static int gf2_gauss_jordan (char *values, int rows, int cols, int width) {
+  int   row_bytes = cols * width;
+  int   bits      = width * 8;
+  int   row, other, col_bytes, n;
+  char *prow, *orow, *a, *b, t;
+  gf2_u32 f;
+
+  for (row=0; row < rows; ++row) {
+    prow = values + row * row_bytes;
+
+    if (gf2_elem_get(prow + row * width, width) == 0) {
+      for (other=row + 1; other < rows; ++other)
+	if (gf2_elem_get(values + other * row_bytes + row * width, width))
+	  break;
+      if (other == rows) return 0;
+
+      /* columns left of the diagonal are already zero in both rows */
+      a = prow + row * width;
+      b = values + other * row_bytes + row * width;
+      for (n = row_bytes - row * width; n--; ++a, ++b) {
+	t = *a; *a = *b; *b = t;
+      }
+    }
+
+    /* normalise, then clear this column in all other rows */
+    col_bytes = row * width;
+    f = gf2_inv(bits, gf2_elem_get(prow + col_bytes, width));
+    gf2_region_op(width, prow + col_bytes, prow + col_bytes, f,
+		  cols - row, 0, 0, NULL);
+
+    for (other=0, orow=values; other < rows; ++other, orow += row_bytes) {
+      if (other == row) continue;
+      f = gf2_elem_get(orow + col_bytes, width);
+      if (f == 0) continue;
+      gf2_region_op(width, orow + col_bytes, prow + col_bytes, f,
+		    cols - row, 1, 0, NULL);
+    }
+  }
+  return 1;
+}
 
-  if ((in == out) || (in == xform) || (xform == out)) {
-    printf("ERROR: in, out and xform must be separate matrices\n");
+/*
+  Solve the equations in m (rows x cols, with cols > rows), leaving
+  the reduced form in m and copying the last cols - rows columns into
+  result.
+*/
+int gf2_matrix_solve (gf2_matrix_t *m, gf2_matrix_t *result) {
+  int   width = m->width;
+  int   rows  = m->rows;
+  int   cols  = m->cols;
+  int   ok;
+  char *work;
+
+  if (cols <= rows || result->rows != rows ||
+      result->cols != cols - rows || result->width != width) {
+    fprintf(stderr, "gf2_matrix_solve: bad matrix sizes\n");
     return 0;
   }
-  if ((in->rows != xform->cols) || (in->rows != out->rows)) {
-    printf("ERROR: incompatible matrix sizes gf2_process_streams\n");
+  work = malloc(rows * cols * width);
+  if (work == NULL) {
+    fprintf(stderr, "gf2_matrix_solve: out of memory\n");
     return 0;
   }
-  width=in->width;
-  if ((out->width != width) || (xform->width != width)) {
-    printf("ERROR: Differing element widths in gf2_process_streams\n");
+
+  gf2_copy_block(work, cols * width, width,
+		 m->values, gf2_matrix_offset_down(m),
+		 gf2_matrix_offset_right(m), rows, cols, width);
+  ok = gf2_gauss_jordan(work, rows, cols, width);
+
+  gf2_copy_block(m->values, gf2_matrix_offset_down(m),
+		 gf2_matrix_offset_right(m), work, cols * width, width,
+		 rows, cols, width);
+  if (ok)
+    gf2_copy_block(result->values, gf2_matrix_offset_down(result),
+		   gf2_matrix_offset_right(result),
+		   work + rows * width, cols * width, width,
+		   rows, cols - rows, width);
+  free(work);
+  return ok;
+}
+
+/*
+  Put the inverse of square matrix m into inverse (m is unchanged).
+  This is the same as solving m with an identity matrix tacked on to
+  the right.
+*/
+int gf2_matrix_invert (gf2_matrix_t *m, gf2_matrix_t *inverse) {
+  int   width = m->width;
+  int   size  = m->rows;
+  int   row_bytes = 2 * size * width;
+  int   ok, i;
+  char *work;
+
+  if (m->cols != size || inverse->rows != size ||
+      inverse->cols != size || inverse->width != width) {
+    fprintf(stderr, "gf2_matrix_invert: bad matrix sizes\n");
     return 0;
   }
-  if (((fillers == 1)  && (in->organisation != COLWISE)) ||
-      ((emptiers == 1) && (out->organisation != COLWISE)) ) {
-    printf("ERROR: expect single-stream buffer to be COLWISE\n");
+  work = calloc(size, row_bytes);
+  if (work == NULL) {
+    fprintf(stderr, "gf2_matrix_invert: out of memory\n");
     return 0;
   }
-  if (((fillers > 1) && (in->organisation != ROWWISE)) ||
-      ((emptiers > 1) && (out->organisation != ROWWISE)) ) {
-    printf("ERROR: expect multi-stream buffer to be ROWWISE\n");
+
+  gf2_copy_block(work, row_bytes, width,
+		 m->values, gf2_matrix_offset_down(m),
+		 gf2_matrix_offset_right(m), size, size, width);
+  for (i=0; i < size; ++i) {
+    switch (width) {
+    case 1: *(gf2_u8 *)(work + i * row_bytes + (size + i) * width) = 1; break;
+    case 2: *(gf2_u16*)(work + i * row_bytes + (size + i) * width) = 1; break;
+    case 4: *(gf2_u32*)(work + i * row_bytes + (size + i) * width) = 1; break;
+    }
+  }
+
+  ok = gf2_gauss_jordan(work, size, 2 * size, width);
+  if (ok)
+    gf2_copy_block(inverse->values, gf2_matrix_offset_down(inverse),
+		   gf2_matrix_offset_right(inverse),
+		   work + size * width, row_bytes, width,
+		   size, size, width);
+  free(work);
+  return ok;
+}
+
+/*
+  Closed-form inverse of a k x k Cauchy matrix with elements
+  1 / (x_i + y_j), where x and y each hold k values. Following the
+  proofwiki page on inverses of Cauchy matrices, element (i,j) of the
+  inverse is
+
+       A_j * B_i / ( (x_j + y_i) * C_j * D_i )
+
+  where A_j = prod_m (x_j + y_m),  B_i = prod_m (x_m + y_i),
+        C_j = prod_{m!=j} (x_j + x_m) and D_i = prod_{m!=i} (y_i + y_m).
+
+  The four product lists take O(k^2) multiplies. All the values that
+  need inverting (k^2 sums plus the C's and D's) are inverted together
+  using Montgomery's trick, which replaces them with three multiplies
+  each and a single call to gf2_inv. Returns 0 if the x and y values
+  aren't all distinct (the matrix would be singular).
+*/
+int gf2_matrix_inverse_cauchy (gf2_matrix_t *inv,
+			       const gf2_u32 *x, const gf2_u32 *y) {
+  int      k     = inv->rows;
+  int      width = inv->width;
+  int      bits  = width * 8;
+  int      down  = gf2_matrix_offset_down(inv);
+  int      right = gf2_matrix_offset_right(inv);
+  int      nvals = k * k + 2 * k;
+  gf2_u32 *vals, *prefix, *e, *f;
+  gf2_u32  a, b, t;
+  int      i, j, m;
+
+  if (inv->cols != k) {
+    fprintf(stderr, "gf2_matrix_inverse_cauchy: matrix not square\n");
     return 0;
   }
-  if (xform->organisation != ROWWISE) {
-    printf("ERROR: expect transform matrix to be ROWWISE\n");
+  vals = malloc((2 * nvals + 2 * k) * sizeof(gf2_u32));
+  if (vals == NULL) {
+    fprintf(stderr, "gf2_matrix_inverse_cauchy: out of memory\n");
     return 0;
   }
-  if (bytes_to_read % (width * xform->cols)) {
-    printf("ERROR: number of bytes to read should be a multiple of k * s\n");
+  prefix = vals   + nvals;
+  e      = prefix + nvals;	/* A_j, later A_j / C_j */
+  f      = e      + k;		/* B_i, later B_i / D_i */
+
+  /* vals = [ (x_j + y_i) for all i,j ] [ C_0 .. C_k-1 ] [ D_0 .. D_k-1 ] */
+  for (j=0; j < k; ++j) {
+    a = b = 1;
+    for (m=0; m < k; ++m) {
+      a = gf2_mul(bits, a, x[j] ^ y[m]);
+      if (m != j) b = gf2_mul(bits, b, x[j] ^ x[m]);
+    }
+    e[j] = a;
+    vals[k * k + j] = b;
+  }
+  for (i=0; i < k; ++i) {
+    a = b = 1;
+    for (m=0; m < k; ++m) {
+      a = gf2_mul(bits, a, x[m] ^ y[i]);
+      if (m != i) b = gf2_mul(bits, b, y[i] ^ y[m]);
+      vals[i * k + m] = x[m] ^ y[i];
+    }
+    f[i] = a;
+    vals[k * k + k + i] = b;
+  }
+
+  /* batch inversion of everything in vals */
+  prefix[0] = vals[0];
+  for (m=1; m < nvals; ++m)
+    prefix[m] = gf2_mul(bits, prefix[m - 1], vals[m]);
+  if (prefix[nvals - 1] == 0) {
+    free(vals);
     return 0;
   }
+  t = gf2_inv(bits, prefix[nvals - 1]);
+  for (m=nvals - 1; m > 0; --m) {
+    a       = gf2_mul(bits, t, prefix[m - 1]);
+    t       = gf2_mul(bits, t, vals[m]);
+    vals[m] = a;
+  }
+  vals[0] = t;
+
+  for (j=0; j < k; ++j)
+    e[j] = gf2_mul(bits, e[j], vals[k * k + j]);
+  for (i=0; i < k; ++i)
+    f[i] = gf2_mul(bits, f[i], vals[k * k + k + i]);
 
-  idown=gf2_matrix_offset_down(in);  
-  iright=gf2_matrix_offset_right(in);
-  odown=gf2_matrix_offset_down(out); 
-  oright=gf2_matrix_offset_right(out);
-  tdown=gf2_matrix_offset_down(xform); 
-  tright=gf2_matrix_offset_right(xform);
+  for (i=0; i < k; ++i)
+    for (j=0; j < k; ++j)
+      gf2_elem_set(inv->values + i * down + j * right, width,
+		   gf2_mul(bits, gf2_mul(bits, e[j], f[i]),
+			   vals[i * k + j]));
+
+  free(vals);
+  return 1;
+}
+
+/*
+  Streaming multiply
+
+  This is the C version of Crypt::IDA's ida_process_streams. The in
+  and out matrices are used as circular buffers. With a single input
+  (or output) stream, the matrix must be COLWISE so that the stream
+  is laid out as one long run of columns; with several streams (one
+  per row), it must be ROWWISE so that each row is a separate
+  circular buffer. Each stream has its own fill level (BF) and
+  read/write pointer (IW/OR) in its gf2_streambuf_control; IR and OW
+  (our read and write pointers) are shared since we always process
+  whole columns.
+
+  The main loop reads until every input stream has at least one
+  column, flushes output until there's room for at least one column,
+  then multiplies as many columns as are available in one call to
+  gf2_matrix_multiply_submatrix. A batch never wraps around the end
+  of either buffer.
+
+  inorder and outorder are 0 (native), 1 (little-endian) or 2
+  (big-endian). The buffers hold words in those byte orders and the
+  multiply converts them on the fly.
+
+  Returns the number of input bytes read (not counting any partial
+  words at eof), or -1 on error.
+*/
+OFF_T gf2_process_streams (gf2_matrix_t *xform,
+			   gf2_matrix_t *in,
+			   struct gf2_streambuf_control *fill_ctl,
+			   int fillers,
+			   gf2_matrix_t *out,
+			   struct gf2_streambuf_control *empty_ctl,
+			   int emptiers,
+			   OFF_T bytes_to_read, int inorder, int outorder) {
+  gf2_prepared_t *prep;
+  OFF_T rc;
+
+  if ((in == xform) || (xform == out)) {
+    fprintf(stderr, "gf2_process_streams: in, out and xform must be "
+	    "separate matrices\n");
+    return -1;
+  }
+  if (xform->organisation != ROWWISE) {
+    fprintf(stderr, "gf2_process_streams: expect transform matrix to "
+	    "be ROWWISE\n");
+    return -1;
+  }
+
+  /* coefficients and region tables are made once for the whole run */
+  prep = gf2_matrix_prepare(xform, inorder, outorder);
+  if (prep == NULL)
+    return -1;
+  rc = gf2_prepared_process_streams(prep, in, fill_ctl, fillers,
+				    out, empty_ctl, emptiers, bytes_to_read);
+  gf2_prepared_free(prep);
+  return rc;
+}
+
+/*
+  The same with a transform that has already been prepared (the byte
+  orders are part of that), so that a caller running many short
+  streams through one transform only makes its tables once.
+*/
+OFF_T gf2_prepared_process_streams (gf2_prepared_t *prep,
+				    gf2_matrix_t *in,
+				    struct gf2_streambuf_control *fill_ctl,
+				    int fillers,
+				    gf2_matrix_t *out,
+				    struct gf2_streambuf_control *empty_ctl,
+				    int emptiers,
+				    OFF_T bytes_to_read) {
+
+  int   width;
+  OFF_T bytes_read = 0;
+  OFF_T per_stream;		/* bytes_to_read split between fillers */
+  OFF_T used = 0;		/* bytes of each stream multiplied so far */
+
+  /* shared input read/output write pointers (as column numbers) */
+  int   IR, OW;
 
   /*
-    Some variables have different values depending on whether we're
-    provided with a single stream or multiple streams
+    Lengths and fill levels. For a single stream, these are for the
+    whole matrix, but with multiple streams they're per row.
   */
-  IFmin=0; OFmax=0;  eof=0;
-  OW=out->values;
-  IR=in->values;
+  OFF_T ILEN, OLEN;		/* length of each circular buffer */
+  OFF_T IFmin, OFmax;		/* lowest input, highest output fill */
+  OFF_T want_in_size;		/* bytes in one column of each stream */
+  OFF_T want_out_size;
+  OFF_T idown, odown;		/* offset of stream i's buffer */
+
+  struct gf2_streambuf_control *ctl;
+  OFF_T max, rc;
+  int   eof = 0;
+  int   i, k;
+
+  if (in == out) {
+    fprintf(stderr, "gf2_process_streams: in, out and xform must be "
+	    "separate matrices\n");
+    return -1;
+  }
+  if ((in->rows != prep->cols) || (out->rows != prep->rows)) {
+    fprintf(stderr, "gf2_process_streams: incompatible matrix sizes\n");
+    return -1;
+  }
+  width = in->width;
+  if ((out->width != width) || (prep->width != width) ||
+      (width != 1 && width != 2 && width != 4)) {
+    fprintf(stderr, "gf2_process_streams: differing/bad element widths\n");
+    return -1;
+  }
+  if ((fillers != 1 && fillers != in->rows) ||
+      (emptiers != 1 && emptiers != out->rows)) {
+    fprintf(stderr, "gf2_process_streams: need 1 stream or 1 per row\n");
+    return -1;
+  }
+  if (((fillers  == 1) && (in->rows  > 1) && (in->organisation  != COLWISE)) ||
+      ((emptiers == 1) && (out->rows > 1) && (out->organisation != COLWISE))) {
+    fprintf(stderr, "gf2_process_streams: expect single-stream buffer "
+	    "to be COLWISE\n");
+    return -1;
+  }
+  if (((fillers  > 1) && (in->organisation  != ROWWISE)) ||
+      ((emptiers > 1) && (out->organisation != ROWWISE))) {
+    fprintf(stderr, "gf2_process_streams: expect multi-stream buffer "
+	    "to be ROWWISE\n");
+    return -1;
+  }
+  if (bytes_to_read % (width * prep->cols)) {
+    fprintf(stderr, "gf2_process_streams: number of bytes to read "
+	    "should be a multiple of k * s\n");
+    return -1;
+  }
+
+  /*
+    With several input streams, each one gives its share of
+    bytes_to_read, even if some of them go on past that. What's been
+    read from a stream is whatever has been multiplied (the same for
+    all streams) plus what's still in its buffer.
+  */
+  per_stream = bytes_to_read / fillers;
+
   if (fillers == 1) {
-    ILEN=in->rows * in->cols * in->width; 
-    fill_ctl[0].hp.IW = in->values;
-    fill_ctl[0].END   = in->values + ILEN - 1;
-    fill_ctl[0].BF=0;
+    ILEN  = (OFF_T) in->rows * in->cols * width;
+    idown = 0;
     want_in_size = width * in->rows;
   } else {
-    ILEN=in->cols * in->width;
-    for (i=0; i < fillers; ++i) {
-      fill_ctl[i].hp.IW = in->values + i * ILEN;
-      fill_ctl[i].END   = fill_ctl[i].hp.IW + ILEN - 1;
-      fill_ctl[i].BF=0;
-    }
+    ILEN  = (OFF_T) in->cols * width;
+    idown = ILEN;
     want_in_size = width;
   }
+  for (i=0, ctl=fill_ctl; i < fillers; ++i, ++ctl) {
+    ctl->hp.IW = in->values + i * idown;
+    ctl->END   = ctl->hp.IW + ILEN - 1;
+    ctl->BF    = 0;
+  }
   if (emptiers == 1) {
-    OLEN=out->rows * out->cols * out->width;
-    empty_ctl[0].hp.OR = out->values;
-    empty_ctl[0].END   = out->values + OLEN - 1;
-    empty_ctl[0].BF=0;
+    OLEN  = (OFF_T) out->rows * out->cols * width;
+    odown = 0;
     want_out_size = width * out->rows;
   } else {
-    OLEN=out->cols * out->width;
-    for (i=0; i < emptiers; ++i) {
-      empty_ctl[i].hp.OR = out->values + i * OLEN;
-      empty_ctl[i].END   = empty_ctl[i].hp.OR + OLEN - 1;
-      empty_ctl[i].BF=0;
-    }
-    want_out_size=width;
+    OLEN  = (OFF_T) out->cols * width;
+    odown = OLEN;
+    want_out_size = width;
+  }
+  for (i=0, ctl=empty_ctl; i < emptiers; ++i, ++ctl) {
+    ctl->hp.OR = out->values + i * odown;
+    ctl->END   = ctl->hp.OR + OLEN - 1;
+    ctl->BF    = 0;
   }
 
-  /* printf("want_in_size is %Ld; want_out_size is %Ld\n",
-      (long long) want_in_size,(long long) want_out_size); 
-      printf("ILEN is %Ld; OLEN is %Ld\n",
-      (long long) ILEN,(long long) OLEN); */
+  IR = OW = 0;
+  IFmin = OFmax = 0;
   do {
 
+    /* fill input until every stream has at least one column */
     while (!eof && (IFmin < want_in_size)) {
-
-      /* 
-	go through each gf2_streambuf_control struct and request more
-	input. Save IFMin as the (new) minimum fill level among them.
-      */
-      /* printf("Need input: IFmin is %Ld\n", (long long) IFmin);   */
-
-      for (i = 0, IFmin=ILEN; i < fillers; ++i) {
-	max_fill_or_empty=ILEN - fill_ctl[i].BF;
-	if (fill_ctl[i].hp.IW >= IR + i * idown) {
-	  if (fill_ctl[i].hp.IW + max_fill_or_empty > 
-	      fill_ctl[i].END)
-	    max_fill_or_empty=fill_ctl[i].END - 
-	      fill_ctl[i].hp.IW + 1;
-	} else {
-	  if (fill_ctl[i].hp.IW + max_fill_or_empty >= 
-	      IR + i * idown) 
-	    max_fill_or_empty=IR  + i * idown -
-	      fill_ctl[i].hp.IW;
-	}
-
-	/* printf ("Before maxfill adjustment: " OFF_T_FMT "\n",max_fill_or_empty); */
-	if (bytes_to_read && 
-	    (bytes_read + fill_ctl[i].BF + max_fill_or_empty > 
-	     bytes_to_read))
-	  max_fill_or_empty=
-	    bytes_to_read - fill_ctl[i].BF - bytes_read;
-
-	/* printf ("Calling fill handler with maxfill " OFF_T_FMT "\n",max_fill_or_empty); */
-	/* call handler */
-	rc=(*(fill_ctl[i].handler.fp))
-	  ( &(fill_ctl[i].handler), fill_ctl[i].hp.IW, max_fill_or_empty);
-
-	/* check return value */
-	if (rc < 0) {
-	  printf ("ERROR: read error on input stream: %s\n",
-	     strerror(errno)); 
-	  return 0;
-	} else if (rc == 0) {
-	  /* printf ("Natural EOF on input stream\n");  */
-	  eof++;
-	} else {
-	  fill_ctl[i].BF   +=rc;
-	  fill_ctl[i].hp.IW+=rc;
-	  if (fill_ctl[i].hp.IW > fill_ctl[i].END)
-	    fill_ctl[i].hp.IW -= ILEN;
-	  bytes_read+=rc;
-	  /* WRONG!
-	  if (bytes_to_read && 
-	      (fill_ctl[i].BF + bytes_read >= bytes_to_read)) {
-	    printf ("Read would exceed %lld\n",(long long) bytes_to_read);
-	    eof++;
+      for (i=0, IFmin=ILEN, ctl=fill_ctl; i < fillers; ++i, ++ctl) {
+
+	/* free space up to the end of the buffer (or our read pointer) */
+	max = ILEN - ctl->BF;
+	if (ctl->END - ctl->hp.IW + 1 < max)
+	  max = ctl->END - ctl->hp.IW + 1;
+	if (bytes_to_read && (used + ctl->BF + max > per_stream))
+	  max = per_stream - used - ctl->BF;
+
+	/*
+	  A full buffer just means this stream is ahead of the others,
+	  but if we've read all we were asked to, the callback is still
+	  called (with 0 bytes) so that it returns eof.
+	*/
+	if (max || (bytes_to_read && used + ctl->BF >= per_stream)) {
+	  rc = (*(ctl->handler.fp)) (&(ctl->handler), ctl->hp.IW, max);
+	  if (rc < 0) {
+	    fprintf(stderr, "gf2_process_streams: read error on input "
+		    "stream: %s\n", strerror(errno));
+	    return -1;
+	  } else if (rc == 0) {
+	    ++eof;
+	  } else {
+	    ctl->BF    += rc;
+	    ctl->hp.IW += rc;
+	    if (ctl->hp.IW > ctl->END)
+	      ctl->hp.IW -= ILEN;
+	    bytes_read += rc;
 	  }
-	  */
 	}
-	if (fill_ctl[i].BF < IFmin) 
-	  IFmin=fill_ctl[i].BF;
+	if (ctl->BF < IFmin)
+	  IFmin = ctl->BF;
       }
-
-      if (eof) {
-	/* printf ("EOF detected in one or more streams\n");  */
-	if ((fillers > 1) && (eof % fillers)) {
-	  printf ("Not all input streams of same length\n");
-	  return 0;
-	}
+      if (eof % fillers) {
+	fprintf(stderr, "gf2_process_streams: not all input streams of "
+		"same length\n");
+	return -1;
       }
-
     }
 
-    /* printf("After input: IFmin is %Ld\n", (long long) IFmin);  */
-    
-
-    do {			/* loop to flush output */
+    do {			/* loop to flush output at eof */
 
-      /* printf ("Checking for output space; OFmax is %Ld\n",
-	 (long long) OFmax);  */
- 
-      /* Do we have enough space in oputput buffer to allow us to process */
-      /* a chunk? If not, empty some until we do.                         */
+      /* empty output until there's room for one column */
       while ((eof && OFmax) || (OFmax + want_out_size > OLEN)) {
-
-        /* printf ("Seems like we needed to flush\n"); */
-
-	for (i=0,OFmax=0; i< emptiers; ++i) {
-
-	  /* printf ("Outbuf %d is %Ld full, and OFmax is ???\n",
-	     i,(long long)empty_ctl[i].BF); */
-
-	  max_fill_or_empty=empty_ctl[i].BF;
-	  if (empty_ctl[i].hp.OR >= OW + i * odown)  {
-	    if (empty_ctl[i].BF + want_out_size > OLEN) {
-	      max_fill_or_empty=empty_ctl[i].END - empty_ctl[i].hp.OR + 1;
-	      /* printf ("Stopping overflow, max_empty is now %lld\n", 
-		 (long long) max_fill_or_empty); */
-	    }
-	  } else {
-	    if (empty_ctl[i].hp.OR + want_out_size > OW + i * odown) {
-		max_fill_or_empty=OW + i * odown - empty_ctl[i].hp.OR;
-		/* printf ("Stopping tail overwrite, max_empty is now %Ld\n", 
-		   (long long) max_fill_or_empty);  */
+	for (i=0, OFmax=0, ctl=empty_ctl; i < emptiers; ++i, ++ctl) {
+	  max = ctl->BF;
+	  if (ctl->END - ctl->hp.OR + 1 < max)
+	    max = ctl->END - ctl->hp.OR + 1;
+	  if (max) {
+	    rc = (*(ctl->handler.fp)) (&(ctl->handler), ctl->hp.OR, max);
+	    if (rc <= 0) {
+	      fprintf(stderr, "gf2_process_streams: write error on output "
+		      "stream: %s\n", rc ? strerror(errno) : "no progress");
+	      return -1;
 	    }
+	    ctl->BF    -= rc;
+	    ctl->hp.OR += rc;
+	    if (ctl->hp.OR > ctl->END)
+	      ctl->hp.OR -= OLEN;
 	  }
-
-
-	  if(max_fill_or_empty == 0) 
-	    continue;
-	  
-	  /* call handler */
-	  rc=(*(empty_ctl[i].handler.fp))
-	    ( &(empty_ctl[i].handler),empty_ctl[i].hp.OR,max_fill_or_empty);
-	  if (rc ==0) {
-	    printf ("ERROR: write error in gf2_process_streams\n");
-	    return 0;
-	  }
-	  empty_ctl[i].BF   -=rc;
-	  empty_ctl[i].hp.OR+=rc;
-	  if (empty_ctl[i].hp.OR > empty_ctl[i].END) 
-	    empty_ctl[i].hp.OR -= OLEN;
-	  if (empty_ctl[i].BF > OFmax) 
-	    OFmax=empty_ctl[i].BF;
+	  if (ctl->BF > OFmax)
+	    OFmax = ctl->BF;
 	}
       }
 
       /*
-	The actual processing ... produce one column of output from
-	one column of input
+	Process as many columns as we have input and room for, without
+	going past the end of either buffer
       */
-      /* printf ("On to processing: IFmin, OFmax are (%Ld,%Ld)\n",
-	 (long long) IFmin, (long long) OFmax); */
-
-      for (k=0;			/* kolumns processed */
-	   (IFmin >= want_in_size) && (OFmax + want_out_size <= OLEN);
-	   ++k) {
-
-	/* for each row of xform matrix ...*/
-	for (i=0, trow=xform->values;
-	     i < xform->rows ; 
-	     ++i, trow += tdown ) {
-
-	  /* multiply first row element by first column element */
-	  icol=IR; ocol=OW;
-	  /* gf2_multiply(OW + i *odown,trow,icol,poly,width,scratch); */
-	  /* printf("{%02x}x{%02x} = {%02x}\n",
-	     (unsigned char)*trow,(unsigned char)*icol,
-	     (unsigned char)*(OW+i*odown));  */
-
-	  /* then add the products of all the rest */
-	  for (j=1; j < xform->cols; ++j) {
-	    icol += idown; ocol+=odown;
-	    /* gf2_multiply(p, trow + j * tright, icol, poly, width, scratch); */
-	    /* printf("{%02x}x{%02x} = {%02x}",
-	       (unsigned char)*(trow+j*tright),
-	       (unsigned char)*icol,(unsigned char)*p); */
-	    /* vector_xor(OW + i*odown,p,width); */
-	    /* printf(" running total = {%02x}\n",
-	       (unsigned char)*(OW + i*odown)); */
-	  }
-	  /* printf("Total: {%02x}\n",(unsigned char)*(OW + i*odown)); */
-	  
-	}
-
-	/* printf ("Processed one column: IFmin, OFmax are (%Ld,%Ld)\n",
-		  (long long) IFmin, (long long) OFmax); */
-	IFmin-=want_in_size; OFmax+=want_out_size;
-	IR+=iright;
-	if (IR > fill_ctl[0].END)
-	  IR=in->values;
-	OW+=oright;
-	if (OW > empty_ctl[0].END) 
-	  OW=out->values;
-	/* printf ("Moving to next column: IFmin, OFmax are (%lld, %lld)\n",
-	  (long long) IFmin, (long long) OFmax); */
-      }
+      k = IFmin / want_in_size;
+      if (k > (OLEN - OFmax) / want_out_size)
+	k = (OLEN - OFmax) / want_out_size;
+      if (k > in->cols - IR)
+	k = in->cols - IR;
+      if (k > out->cols - OW)
+	k = out->cols - OW;
 
-      /* printf ("Finished processing chunk of k=%d columns\n",k);*/
-
-      /* we've been updating IFmin and OFmax, but not the real BF
-	 variables in the gf2_streambuf_control structures. We do that
-	 after the processing loop is finished.
-      */
       if (k) {
-	for (i=0;  i < fillers; ++i) {
-	  fill_ctl[i].BF -= k * want_in_size;
-	}
-	for (i=0; i < emptiers; ++i) {
+	if (!gf2_prepared_multiply(prep, in, out,
+				   0, 0, prep->rows, IR, OW, k, 0))
+	  return -1;
+
+	IFmin -= k * want_in_size;
+	OFmax += k * want_out_size;
+	used  += k * want_in_size;
+	IR = (IR + k) % in->cols;
+	OW = (OW + k) % out->cols;
+	for (i=0; i < fillers; ++i)
+	  fill_ctl[i].BF  -= k * want_in_size;
+	for (i=0; i < emptiers; ++i)
 	  empty_ctl[i].BF += k * want_out_size;
-	}
       }
 
-      /* If we're at eof here, keep looping until all output is flushed... */
-      /* printf ("Finished post-processing chunks: eof, IFmin, OFmax are (%d,%lld,%lld)\n",
-	 eof, (long long) IFmin, (long long) OFmax);  */
-
     } while (eof && OFmax);
 
-
   } while (!eof);
+
+  /* partial words left over at eof were never used */
+  for (i=0; i < fillers; ++i)
+    bytes_read -= fill_ctl[i].BF % width;
+
+  return bytes_read;
+}
+
+/*
+  fd callbacks for gf2_process_streams. As with Crypt::IDA's
+  fill_from_fh, if align is set, input is padded with zeros at eof up
+  to the next multiple of align bytes.
+*/
+static OFF_T gf2_fd_fill (gf2_matrix_closure_t c, char *buf, OFF_T max) {
+  struct gf2_fd_stream *s = (struct gf2_fd_stream *) c->u1.V;
+  OFF_T rc;
+
+  do {
+    rc = read(s->fd, buf, max);
+  } while (rc < 0 && errno == EINTR);
+  if (rc == 0 && s->align) {
+    while ((s->bytes + rc) % s->align && rc < max)
+      buf[rc++] = 0;
+  }
+  if (rc > 0)
+    s->bytes += rc;
+  return rc;
+}
+
+static OFF_T gf2_fd_empty (gf2_matrix_closure_t c, char *buf, OFF_T max) {
+  struct gf2_fd_stream *s = (struct gf2_fd_stream *) c->u1.V;
+  OFF_T rc;
+
+  do {
+    rc = write(s->fd, buf, max);
+  } while (rc < 0 && errno == EINTR);
+  return rc;
+}
+
+void gf2_fd_filler (struct gf2_streambuf_control *ctl,
+		    struct gf2_fd_stream *s, int fd, int align) {
+  s->fd    = fd;
+  s->align = align;
+  s->bytes = 0;
+  ctl->handler.fp      = gf2_fd_fill;
+  ctl->handler.u1_type = 'V';
+  ctl->handler.u1_many = 1;
+  ctl->handler.u1.V    = s;
+  ctl->handler.u2_type = 0;
+}
+
+void gf2_fd_emptier (struct gf2_streambuf_control *ctl,
+		     struct gf2_fd_stream *s, int fd) {
+  s->fd    = fd;
+  s->align = 0;
+  s->bytes = 0;
+  ctl->handler.fp      = gf2_fd_empty;
+  ctl->handler.u1_type = 'V';
+  ctl->handler.u1_many = 1;
+  ctl->handler.u1.V    = s;
+  ctl->handler.u2_type = 0;
 }
 
+#ifdef NOW_IS_OK
+
+/* 
+  Misc stuff that's implemented in Perl now, but I might enable as C
+  routines later
+*/
 
 /* Create a new identity matrix or if passed an existing matrix, store
    an identity matrix in it. If matrix is passed in, any other passed
@@ -0,0 +1,927 @@
+/* Threaded reader/compute/writer pipeline for streaming multiplies */
+/*
+  Copyright (c) by Declan Malone 2009-2019.
+  Licensed under the terms of the GNU General Public License and
+  the GNU Lesser (Library) General Public License.
+*/
+
+/*
+  gf2_process_streams does everything in the calling thread, so the
+  disk sits idle while it multiplies and the CPU sits idle while it
+  reads and writes. This does the same job with file descriptors for
+  all the streams, split up the way the PS3 code (ppu-io.c) did it:
+
+   * the calling thread reads input into the next free buffer
+   * compute workers each take the next full buffer and multiply it
+   * one writer thread per output stream writes its part of each
+     buffer once it's been multiplied, in order
+
+  There's a fixed pool of nbufs buffers, each big enough for cols
+  columns of input and output. A buffer goes round FREE -> FULL ->
+  BUSY -> DONE -> FREE; the last writer to finish with it frees it
+  for the reader again. Everything is protected by a single mutex,
+  which is fine since each buffer is a lot of work compared to
+  taking the lock.
+
+  With GF2_PIPE_URING (on Linux, where the kernel allows it) the
+  reader and writer threads are replaced by one io_uring: the calling
+  thread queues the reads for every input stream of a free buffer, or
+  the writes for every output stream of a multiplied one, and submits
+  them with a single system call. Reads and writes for several
+  buffers can be in flight at once, each at its own file offset, so a
+  slow disk always has a queue of requests to work on. The buffers
+  and file descriptors are registered with the ring (when the kernel
+  lets us) to save mapping them for every request. This needs all the
+  streams to be seekable files not opened for append; otherwise the
+  threads are used after all.
+
+  If asked for hashes, there's also a thread per stream (input and
+  output) that runs SHA-256 over that stream's part of each buffer,
+  in order, once it's been multiplied; a buffer isn't freed until the
+  hashers are finished with it as well as the writers. The data is
+  still in cache from the multiply, so this is a lot cheaper than
+  reading it all again later. Input hashes don't include the eof
+  padding.
+
+  Input and output layouts are the same as for gf2_process_streams: a
+  single stream is COLWISE and multiple streams are one per row.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "FastGF2.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_SINGLE_MMAP)
+#define GF2_HAVE_URING
+#endif
+#endif
+#endif
+
+enum { BUF_FREE, BUF_FULL, BUF_BUSY, BUF_DONE, BUF_READING };
+
+/* one stream's part of a buffer, for the io_uring code */
+struct gf2_pipe_io {
+  OFF_T off;			/* file offset for the start of it */
+  OFF_T want;			/* bytes to read or write */
+  OFF_T done;			/* bytes read or written so far */
+  int   eof;
+};
+
+struct gf2_pipe_buf {
+  gf2_matrix_t in, out;
+  int   state;
+  int   cols;			/* columns of data in the buffer */
+  int   writers;		/* writers/hashers yet to finish with it */
+  OFF_T seq;			/* which buffer of the stream it holds */
+  int   pending;		/* io_uring requests not yet complete */
+  int   last;			/* reads stop at the end of this one */
+  struct gf2_pipe_io *io;
+  OFF_T *inlen;			/* bytes read per input, without padding */
+};
+
+struct gf2_ring;
+
+struct gf2_pipeline {
+  gf2_prepared_t *prep;
+  struct gf2_pipe_buf *bufs;
+  int   nbufs;
+  int   cols;
+  int   flags;
+  int   fillers, emptiers;
+  const int *fill_fds, *aligns, *empty_fds;
+  OFF_T in_bytes, out_bytes;	/* bytes of each stream in a full buffer */
+  OFF_T limit;			/* bytes to read from each input stream */
+  OFF_T *totals;		/* bytes read (with padding) per input */
+  int   consumers;		/* writers and hashers for each buffer */
+  gf2_sha256_t *sha;		/* one per input then output, or NULL */
+  unsigned char *hashes;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  OFF_T next_compute;		/* next buffer for a worker to take */
+  OFF_T nseq;			/* number of buffers, once reading's done */
+  int   done;			/* reader has finished */
+  int   error;
+
+  struct gf2_ring *ring;
+};
+
+/*
+  each writer thread gets the pipeline and its output stream number;
+  hashers get the stream number counting inputs first, then outputs
+*/
+struct gf2_pipe_writer {
+  struct gf2_pipeline *pl;
+  int i;
+};
+
+static void gf2_pipe_fail (struct gf2_pipeline *pl) {
+  pthread_mutex_lock(&pl->lock);
+  pl->error = 1;
+  pthread_cond_broadcast(&pl->cond);
+  pthread_mutex_unlock(&pl->lock);
+}
+
+static void *gf2_pipe_worker (void *arg) {
+  struct gf2_pipeline *pl = (struct gf2_pipeline *) arg;
+  struct gf2_pipe_buf *b;
+  int ok;
+
+  pthread_mutex_lock(&pl->lock);
+  for (;;) {
+    /* another worker may take the buffer we were waiting for */
+    for (;;) {
+      b = pl->bufs + pl->next_compute % pl->nbufs;
+      if (pl->error || b->state == BUF_FULL ||
+	  (pl->done && pl->next_compute >= pl->nseq))
+	break;
+      pthread_cond_wait(&pl->cond, &pl->lock);
+    }
+    if (pl->error || b->state != BUF_FULL) break;
+    ++pl->next_compute;
+    b->state = BUF_BUSY;
+    pthread_mutex_unlock(&pl->lock);
+
+    ok = gf2_prepared_multiply(pl->prep, &b->in, &b->out,
+			       0, 0, pl->prep->rows, 0, 0, b->cols, 1);
+
+    pthread_mutex_lock(&pl->lock);
+    if (!ok) pl->error = 1;
+    b->state   = BUF_DONE;
+    b->writers = pl->consumers;
+    pthread_cond_broadcast(&pl->cond);
+  }
+  pthread_mutex_unlock(&pl->lock);
+  return NULL;
+}
+
+static void *gf2_pipe_writer (void *arg) {
+  struct gf2_pipe_writer *w = (struct gf2_pipe_writer *) arg;
+  struct gf2_pipeline *pl = w->pl;
+  struct gf2_pipe_buf *b;
+  int   fd = pl->empty_fds[w->i];
+  OFF_T seq, len, rc;
+  char *p;
+
+  for (seq=0; ; ++seq) {
+    b = pl->bufs + seq % pl->nbufs;
+    pthread_mutex_lock(&pl->lock);
+    while (!pl->error && !(b->state == BUF_DONE && b->seq == seq) &&
+	   !(pl->done && seq >= pl->nseq))
+      pthread_cond_wait(&pl->cond, &pl->lock);
+    if (pl->error || b->state != BUF_DONE || b->seq != seq) {
+      pthread_mutex_unlock(&pl->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pl->lock);
+
+    p   = b->out.values + w->i * pl->out_bytes;
+    len = b->cols * (pl->out_bytes / pl->cols);
+    while (len) {
+      rc = write(fd, p, len);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+	fprintf(stderr, "gf2_pipeline_fds: write error on output "
+		"stream: %s\n", rc ? strerror(errno) : "no progress");
+	gf2_pipe_fail(pl);
+	return NULL;
+      }
+      p   += rc;
+      len -= rc;
+    }
+
+    pthread_mutex_lock(&pl->lock);
+    if (--b->writers == 0) {
+      b->state = BUF_FREE;
+      pthread_cond_broadcast(&pl->cond);
+    }
+    pthread_mutex_unlock(&pl->lock);
+  }
+
+  if ((pl->flags & GF2_PIPE_FSYNC) && !pl->error && fsync(fd)) {
+    fprintf(stderr, "gf2_pipeline_fds: fsync failed on output "
+	    "stream: %s\n", strerror(errno));
+    gf2_pipe_fail(pl);
+  }
+  return NULL;
+}
+
+static void *gf2_pipe_hasher (void *arg) {
+  struct gf2_pipe_writer *h = (struct gf2_pipe_writer *) arg;
+  struct gf2_pipeline *pl = h->pl;
+  struct gf2_pipe_buf *b;
+  gf2_sha256_t *sha = pl->sha + h->i;
+  int   out = h->i - pl->fillers;
+  OFF_T seq;
+
+  for (seq=0; ; ++seq) {
+    b = pl->bufs + seq % pl->nbufs;
+    pthread_mutex_lock(&pl->lock);
+    while (!pl->error && !(b->state == BUF_DONE && b->seq == seq) &&
+	   !(pl->done && seq >= pl->nseq))
+      pthread_cond_wait(&pl->cond, &pl->lock);
+    if (pl->error || b->state != BUF_DONE || b->seq != seq) {
+      pthread_mutex_unlock(&pl->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pl->lock);
+
+    if (out < 0)
+      gf2_sha256_update(sha, b->in.values + h->i * pl->in_bytes,
+			b->inlen[h->i]);
+    else
+      gf2_sha256_update(sha, b->out.values + out * pl->out_bytes,
+			b->cols * (pl->out_bytes / pl->cols));
+
+    pthread_mutex_lock(&pl->lock);
+    if (--b->writers == 0) {
+      b->state = BUF_FREE;
+      pthread_cond_broadcast(&pl->cond);
+    }
+    pthread_mutex_unlock(&pl->lock);
+  }
+
+  gf2_sha256_final(sha, pl->hashes + h->i * GF2_SHA256_LEN);
+  return NULL;
+}
+
+/*
+  Read up to want bytes from fd into buf, stopping early only at eof.
+  At eof, pad with zeros up to the next multiple of align bytes of
+  the stream (*total counts the stream's bytes so far), as
+  gf2_fd_fill does. Returns the number of bytes stored, or -1, and
+  puts the number actually read (without padding) in *real.
+*/
+static OFF_T gf2_pipe_read (int fd, char *buf, OFF_T want, int align,
+			    OFF_T *total, OFF_T *real, int *eof) {
+  OFF_T got = 0, rc;
+
+  *real = -1;
+  while (got < want) {
+    rc = read(fd, buf + got, want - got);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc < 0) return -1;
+    if (rc == 0) {
+      *eof  = 1;
+      *real = got;
+      if (align)
+	while ((*total + got) % align && got < want)
+	  buf[got++] = 0;
+      break;
+    }
+    got += rc;
+  }
+  if (*real < 0) *real = got;
+  *total += got;
+  return got;
+}
+
+/* Check that all the inputs are the same length once they're read */
+static int gf2_pipe_same_length (struct gf2_pipeline *pl) {
+  int i;
+
+  for (i=1; i < pl->fillers; ++i)
+    if (pl->totals[i] != pl->totals[0]) {
+      fprintf(stderr, "gf2_pipeline_fds: not all input streams of "
+	      "same length\n");
+      return 0;
+    }
+  return 1;
+}
+
+/* The reader: fill each free buffer in turn with blocking reads */
+static void gf2_pipe_reader (struct gf2_pipeline *pl) {
+  struct gf2_pipe_buf *b;
+  OFF_T want, got, seq;
+  int i, eof = 0;
+
+  for (seq=0; !eof && !pl->error; ++seq) {
+    b = pl->bufs + seq % pl->nbufs;
+    pthread_mutex_lock(&pl->lock);
+    while (!pl->error && b->state != BUF_FREE)
+      pthread_cond_wait(&pl->cond, &pl->lock);
+    pthread_mutex_unlock(&pl->lock);
+    if (pl->error) break;
+
+    b->cols = pl->cols;
+    for (i=0; i < pl->fillers; ++i) {
+      want = pl->in_bytes;
+      if (pl->limit && pl->totals[i] + want > pl->limit)
+	want = pl->limit - pl->totals[i];
+      got  = gf2_pipe_read(pl->fill_fds[i], b->in.values + i * pl->in_bytes,
+			   want, pl->aligns ? pl->aligns[i] : 0,
+			   pl->totals + i, b->inlen + i, &eof);
+      if (got < 0) {
+	fprintf(stderr, "gf2_pipeline_fds: read error on input "
+		"stream: %s\n", strerror(errno));
+	gf2_pipe_fail(pl);
+	break;
+      }
+      if (pl->limit && pl->totals[i] >= pl->limit) eof = 1;
+      got /= pl->in_bytes / pl->cols;
+      if (got < b->cols)
+	b->cols = got;
+    }
+    if (pl->error) break;
+    if (eof && !gf2_pipe_same_length(pl)) {
+      gf2_pipe_fail(pl);
+      break;
+    }
+
+    pthread_mutex_lock(&pl->lock);
+    if (b->cols) {
+      b->seq   = seq;
+      b->state = BUF_FULL;
+    } else {
+      --seq;			/* nothing in this one */
+    }
+    if (eof) {
+      pl->nseq = seq + 1;
+      pl->done = 1;
+    }
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+  }
+}
+
+#ifdef GF2_HAVE_URING
+
+/*
+  Just enough of an io_uring to submit reads, writes and fsyncs and
+  reap their completions, using the system calls directly rather than
+  depending on liburing.
+*/
+struct gf2_ring {
+  int fd;
+  unsigned entries;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void  *sq_map, *cq_map;
+  size_t sq_len, cq_len, sqes_len;
+  unsigned tail;		/* our copy of the sq tail */
+  unsigned queued;		/* sqes not yet submitted */
+  int   fixed_files, fixed_bufs;
+  int  *fds;			/* fillers then emptiers */
+  OFF_T *start;			/* each fd's offset when we started */
+  OFF_T *moved;			/* and how far we've got since */
+  int   inflight;		/* requests queued or submitted */
+  int   nreading;		/* buffers being read */
+  int   reading;		/* still starting reads */
+  OFF_T read_seq, write_seq;
+  OFF_T eof_seq;		/* first buffer that reached eof */
+  int   eof_cols;		/* columns in that buffer */
+};
+
+enum { IO_READ = 1, IO_WRITE, IO_FSYNC };
+
+static void gf2_ring_free (struct gf2_ring *r) {
+  if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+  if (r->cq_map && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map)
+    munmap(r->cq_map, r->cq_len);
+  if (r->sq_map && r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_len);
+  if (r->fd >= 0) close(r->fd);
+  free(r->fds);
+  free(r->start);
+  free(r->moved);
+  free(r);
+}
+
+/*
+  Set up a ring for the pipeline, or return NULL if we can't (no
+  io_uring in the kernel, streams that aren't plain files, etc.), in
+  which case the threads do the I/O instead.
+*/
+static struct gf2_ring *gf2_ring_setup (struct gf2_pipeline *pl) {
+  struct io_uring_params p;
+  struct gf2_ring *r;
+  struct iovec *iov;
+  int nfds = pl->fillers + pl->emptiers;
+  int per  = pl->fillers > pl->emptiers ? pl->fillers : pl->emptiers;
+  int i, fl;
+
+  r = calloc(1, sizeof(struct gf2_ring));
+  if (r == NULL) return NULL;
+  r->fd    = -1;
+  r->fds   = malloc(nfds * sizeof(int));
+  r->start = calloc(nfds, sizeof(OFF_T));
+  r->moved = calloc(nfds, sizeof(OFF_T));
+  if (!r->fds || !r->start || !r->moved) goto fail;
+  for (i=0; i < nfds; ++i) {
+    r->fds[i] = (i < pl->fillers) ?
+      pl->fill_fds[i] : pl->empty_fds[i - pl->fillers];
+    r->start[i] = SEEK(r->fds[i], 0, SEEK_CUR);
+    fl = fcntl(r->fds[i], F_GETFL);
+    if (r->start[i] < 0 || fl < 0 || (fl & O_APPEND)) goto fail;
+  }
+
+  /* room for every stream of every buffer, plus the fsyncs */
+  memset(&p, 0, sizeof(p));
+  r->fd = syscall(__NR_io_uring_setup, pl->nbufs * per + pl->emptiers, &p);
+  if (r->fd < 0) goto fail;
+  r->entries = p.sq_entries;
+  r->sq_len  = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_len  = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+    r->cq_len = r->sq_len;
+  }
+  r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_map == MAP_FAILED) goto fail;
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    r->cq_map = r->sq_map;
+  else
+    r->cq_map = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+  if (r->cq_map == MAP_FAILED) goto fail;
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) goto fail;
+
+  r->sq_head  = (unsigned *) ((char *) r->sq_map + p.sq_off.head);
+  r->sq_tail  = (unsigned *) ((char *) r->sq_map + p.sq_off.tail);
+  r->sq_mask  = (unsigned *) ((char *) r->sq_map + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *) ((char *) r->sq_map + p.sq_off.array);
+  r->cq_head  = (unsigned *) ((char *) r->cq_map + p.cq_off.head);
+  r->cq_tail  = (unsigned *) ((char *) r->cq_map + p.cq_off.tail);
+  r->cq_mask  = (unsigned *) ((char *) r->cq_map + p.cq_off.ring_mask);
+  r->cqes     = (struct io_uring_cqe *) ((char *) r->cq_map + p.cq_off.cqes);
+  r->tail     = *r->sq_tail;
+
+  /* registering is only an optimisation, so failures don't matter */
+  r->fixed_files = !syscall(__NR_io_uring_register, r->fd,
+			    IORING_REGISTER_FILES, r->fds, nfds);
+  iov = malloc(pl->nbufs * sizeof(struct iovec));
+  if (iov) {
+    for (i=0; i < pl->nbufs; ++i) {
+      iov[i].iov_base = pl->bufs[i].in.values;
+      iov[i].iov_len  = pl->fillers  * pl->in_bytes +
+			pl->emptiers * pl->out_bytes;
+    }
+    r->fixed_bufs = !syscall(__NR_io_uring_register, r->fd,
+			     IORING_REGISTER_BUFFERS, iov, pl->nbufs);
+    free(iov);
+  }
+  return r;
+
+ fail:
+  gf2_ring_free(r);
+  return NULL;
+}
+
+/* Submit anything queued and wait for at least wait completions */
+static int gf2_ring_enter (struct gf2_ring *r, unsigned wait) {
+  long rc;
+
+  __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+  do {
+    rc = syscall(__NR_io_uring_enter, r->fd, r->queued, wait,
+		 wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (rc < 0 && (errno == EINTR || errno == EAGAIN));
+  if (rc < 0) {
+    fprintf(stderr, "gf2_pipeline_fds: io_uring_enter: %s\n",
+	    strerror(errno));
+    return 0;
+  }
+  r->queued -= rc;
+  return 1;
+}
+
+/*
+  Queue a request for stream i of buffer b (the rest of it, if some
+  of it has been done already)
+*/
+static int gf2_ring_queue (struct gf2_pipeline *pl, int kind,
+			   struct gf2_pipe_buf *b, int i) {
+  struct gf2_ring *r = pl->ring;
+  struct io_uring_sqe *sqe;
+  struct gf2_pipe_io *io = b->io + i;
+  int slot = b - pl->bufs;
+  int fdi  = (kind == IO_READ) ? i : pl->fillers + i;
+  char *p;
+
+  if (r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries
+      && !gf2_ring_enter(r, 0))
+    return 0;
+  sqe = r->sqes + (r->tail & *r->sq_mask);
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[r->tail & *r->sq_mask] = r->tail & *r->sq_mask;
+  ++r->tail;
+  ++r->queued;
+  ++r->inflight;
+
+  if (r->fixed_files) {
+    sqe->fd     = fdi;
+    sqe->flags |= IOSQE_FIXED_FILE;
+  } else {
+    sqe->fd     = r->fds[fdi];
+  }
+  sqe->user_data = ((__u64) kind << 48) | ((__u64) slot << 24) | i;
+  if (kind == IO_FSYNC) {
+    sqe->opcode = IORING_OP_FSYNC;
+    return 1;
+  }
+  p = (kind == IO_READ) ?
+    b->in.values  + i * pl->in_bytes :
+    b->out.values + i * pl->out_bytes;
+  sqe->addr = (unsigned long) (p + io->done);
+  sqe->len  = io->want - io->done;
+  sqe->off  = io->off + io->done;
+  if (r->fixed_bufs) {
+    sqe->opcode    = (kind == IO_READ) ?
+      IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    sqe->buf_index = slot;
+  } else {
+    sqe->opcode    = (kind == IO_READ) ? IORING_OP_READ : IORING_OP_WRITE;
+  }
+  return 1;
+}
+
+/* All the reads for buffer b are in (called with the lock held) */
+static void gf2_ring_read_done (struct gf2_pipeline *pl,
+				struct gf2_pipe_buf *b) {
+  struct gf2_ring *r = pl->ring;
+  struct gf2_pipe_io *io;
+  OFF_T got, before;
+  int i, align, eof = b->last;
+
+  b->cols = pl->cols;
+  for (i=0; i < pl->fillers; ++i) {
+    io  = b->io + i;
+    got = b->inlen[i] = io->done;
+    r->moved[i] += got;
+    if (io->eof) {
+      eof    = 1;
+      align  = pl->aligns ? pl->aligns[i] : 0;
+      before = io->off - r->start[i];
+      while (align && (before + got) % align && got < io->want)
+	b->in.values[i * pl->in_bytes + got++] = 0;
+    }
+    pl->totals[i] += got;
+    got /= pl->in_bytes / pl->cols;
+    if (got < b->cols)
+      b->cols = got;
+  }
+  if (eof && (r->eof_seq < 0 || b->seq < r->eof_seq)) {
+    r->reading  = 0;
+    r->eof_seq  = b->seq;
+    r->eof_cols = b->cols;
+  }
+  b->state = b->cols ? BUF_FULL : BUF_FREE;
+  if (--r->nreading == 0 && !r->reading) {
+    if (!gf2_pipe_same_length(pl)) pl->error = 1;
+    pl->nseq = r->eof_seq + (r->eof_cols ? 1 : 0);
+    pl->done = 1;
+  }
+  pthread_cond_broadcast(&pl->cond);
+}
+
+/* Handle one completion (called with the lock held) */
+static void gf2_ring_complete (struct gf2_pipeline *pl,
+			       struct io_uring_cqe *cqe) {
+  struct gf2_ring *r = pl->ring;
+  int kind = cqe->user_data >> 48;
+  int slot = (cqe->user_data >> 24) & 0xffffff;
+  int i    = cqe->user_data & 0xffffff;
+  struct gf2_pipe_buf *b = pl->bufs + slot;
+  struct gf2_pipe_io  *io = b->io + i;
+  int res = cqe->res;
+
+  --r->inflight;
+  if (res == -EINTR || res == -EAGAIN) {
+    if (!gf2_ring_queue(pl, kind, b, i)) pl->error = 1;
+    return;
+  }
+  if (res < 0 || (res == 0 && kind == IO_WRITE)) {
+    fprintf(stderr, "gf2_pipeline_fds: %s error on %s stream: %s\n",
+	    kind == IO_FSYNC ? "fsync" : kind == IO_READ ? "read" : "write",
+	    kind == IO_READ ? "input" : "output",
+	    res ? strerror(-res) : "no progress");
+    pl->error = 1;
+    pthread_cond_broadcast(&pl->cond);
+    return;
+  }
+  if (kind == IO_FSYNC) return;
+
+  if (res == 0)
+    io->eof = 1;
+  io->done += res;
+  if (!io->eof && io->done < io->want) {
+    if (!gf2_ring_queue(pl, kind, b, i)) pl->error = 1;
+    return;
+  }
+  if (--b->pending) return;
+  if (kind == IO_READ) {
+    gf2_ring_read_done(pl, b);
+  } else {
+    for (i=0; i < pl->emptiers; ++i)
+      r->moved[pl->fillers + i] += b->io[i].done;
+    if (--b->writers == 0)
+      b->state = BUF_FREE;
+    pthread_cond_broadcast(&pl->cond);
+  }
+}
+
+/*
+  The io_uring version of the reader and writers, run by the calling
+  thread. Starts reads into any free buffers and writes of any
+  multiplied ones (in order), submits them all together, then waits
+  for some of them to finish. If nothing is in flight it waits for a
+  worker to finish a buffer instead.
+*/
+static void gf2_ring_io (struct gf2_pipeline *pl) {
+  struct gf2_ring *r = pl->ring;
+  struct gf2_pipe_buf *b;
+  unsigned head;
+  int i, synced = !(pl->flags & GF2_PIPE_FSYNC);
+
+  r->reading = 1;
+  r->eof_seq = -1;
+  pthread_mutex_lock(&pl->lock);
+  while (!pl->error) {
+
+    while (r->reading &&
+	   (b = pl->bufs + r->read_seq % pl->nbufs)->state == BUF_FREE) {
+      b->state   = BUF_READING;
+      b->seq     = r->read_seq++;
+      b->pending = pl->fillers;
+      b->last    = pl->limit &&
+	(b->seq + 1) * pl->in_bytes >= pl->limit;
+      for (i=0; i < pl->fillers; ++i) {
+	b->io[i].off  = r->start[i] + b->seq * pl->in_bytes;
+	b->io[i].want = b->last ?
+	  pl->limit - b->seq * pl->in_bytes : pl->in_bytes;
+	b->io[i].done = 0;
+	b->io[i].eof  = 0;
+	if (!gf2_ring_queue(pl, IO_READ, b, i)) pl->error = 1;
+      }
+      ++r->nreading;
+      if (b->last) r->reading = 0;
+    }
+
+    while ((b = pl->bufs + r->write_seq % pl->nbufs)->state == BUF_DONE &&
+	   b->seq == r->write_seq) {
+      b->pending = pl->emptiers;
+      for (i=0; i < pl->emptiers; ++i) {
+	b->io[i].off  = r->start[pl->fillers + i] +
+	  r->write_seq * pl->out_bytes;
+	b->io[i].want = b->cols * (pl->out_bytes / pl->cols);
+	b->io[i].done = 0;
+	b->io[i].eof  = 0;
+	if (!gf2_ring_queue(pl, IO_WRITE, b, i)) pl->error = 1;
+      }
+      ++r->write_seq;
+    }
+
+    if (pl->done && r->write_seq >= pl->nseq && !r->inflight) {
+      if (synced) break;
+      for (i=0; i < pl->emptiers; ++i)
+	if (!gf2_ring_queue(pl, IO_FSYNC, pl->bufs, i)) pl->error = 1;
+      synced = 1;
+    }
+    if (pl->error) break;
+    if (!r->inflight) {
+      pthread_cond_wait(&pl->cond, &pl->lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&pl->lock);
+    i = gf2_ring_enter(r, 1);
+    pthread_mutex_lock(&pl->lock);
+    if (!i) {
+      pl->error = 1;
+      break;
+    }
+    head = *r->cq_head;
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+      gf2_ring_complete(pl, r->cqes + (head & *r->cq_mask));
+      ++head;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  }
+  pthread_cond_broadcast(&pl->cond);
+  pthread_mutex_unlock(&pl->lock);
+
+  /* don't leave the kernel writing into buffers we're about to free */
+  while (r->inflight && gf2_ring_enter(r, r->inflight)) {
+    head = *r->cq_head;
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+      --r->inflight;
+      ++head;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  /* leave each fd where blocking reads and writes would have */
+  for (i=0; i < pl->fillers + pl->emptiers; ++i)
+    SEEK(r->fds[i], r->start[i] + r->moved[i], SEEK_SET);
+}
+
+#else
+
+struct gf2_ring { int unused; };
+
+static struct gf2_ring *gf2_ring_setup (struct gf2_pipeline *pl) {
+  return NULL;
+}
+static void gf2_ring_io (struct gf2_pipeline *pl) { }
+static void gf2_ring_free (struct gf2_ring *r) { }
+
+#endif
+
+/*
+  Multiply everything from the fill_fds through prep and out to the
+  empty_fds. There must be one filler or one per column of prep, and
+  one emptier or one per row; aligns gives the eof padding for each
+  filler. bytes_to_read (if not 0) is the total over all fillers.
+
+  cols is the number of columns in each buffer and nbufs the number
+  of buffers (0 picks a default for either). workers is the number
+  of compute threads, or 0 for the thread pool's setting. flags can
+  have GF2_PIPE_URING to do the reading and writing through io_uring
+  if possible and GF2_PIPE_FSYNC to sync the outputs at the end.
+
+  If hashes isn't NULL, it gets the SHA-256 of each input stream
+  followed by each output stream (GF2_SHA256_LEN bytes apiece).
+
+  Returns the number of input bytes read (not counting any partial
+  words at eof), or -1 on error.
+*/
+OFF_T gf2_pipeline_fds (gf2_prepared_t *prep,
+			int fillers, const int *fill_fds, const int *aligns,
+			int emptiers, const int *empty_fds,
+			OFF_T bytes_to_read,
+			int cols, int nbufs, int workers, int flags,
+			unsigned char *hashes) {
+  struct gf2_pipeline pl;
+  struct gf2_pipe_writer *wargs = NULL;
+  struct gf2_pipe_buf *b;
+  pthread_t *tids = NULL;
+  pthread_attr_t attr;
+  sigset_t all, old;
+  OFF_T bytes_read = 0;
+  int width = prep->width;
+  int k = prep->cols, n = prep->rows;
+  int i, nthreads = 0, writers, nhash = hashes ? fillers + emptiers : 0;
+
+  if ((fillers != 1 && fillers != k) || (emptiers != 1 && emptiers != n)) {
+    fprintf(stderr, "gf2_pipeline_fds: need 1 stream or 1 per row\n");
+    return -1;
+  }
+  if (bytes_to_read % (width * k)) {
+    fprintf(stderr, "gf2_pipeline_fds: number of bytes to read "
+	    "should be a multiple of k * s\n");
+    return -1;
+  }
+  if (workers <= 0) workers = gf2_pool_get_threads();
+  if (cols    <= 0) cols    = 65536;
+  if (nbufs   <= 0) nbufs   = 2 * workers + 2;
+  if (nbufs   <  2) nbufs   = 2;
+
+  memset(&pl, 0, sizeof(pl));
+  pl.prep      = prep;
+  pl.nbufs     = nbufs;
+  pl.cols      = cols;
+  pl.flags     = flags;
+  pl.fillers   = fillers;
+  pl.emptiers  = emptiers;
+  pl.fill_fds  = fill_fds;
+  pl.aligns    = aligns;
+  pl.empty_fds = empty_fds;
+  pl.in_bytes  = (OFF_T) cols * width * (fillers  == 1 ? k : 1);
+  pl.out_bytes = (OFF_T) cols * width * (emptiers == 1 ? n : 1);
+  pl.limit     = bytes_to_read / fillers;
+  pl.hashes    = hashes;
+  pthread_mutex_init(&pl.lock, NULL);
+  pthread_cond_init(&pl.cond, NULL);
+
+  pl.bufs   = calloc(nbufs, sizeof(struct gf2_pipe_buf));
+  pl.totals = calloc(fillers, sizeof(OFF_T));
+  tids      = calloc(workers + emptiers + nhash, sizeof(pthread_t));
+  wargs     = calloc(emptiers + nhash, sizeof(struct gf2_pipe_writer));
+  if (!pl.bufs || !pl.totals || !tids || !wargs) goto nomem;
+  if (nhash) {
+    pl.sha = malloc(nhash * sizeof(gf2_sha256_t));
+    if (pl.sha == NULL) goto nomem;
+    for (i=0; i < nhash; ++i)
+      gf2_sha256_init(pl.sha + i);
+  }
+  for (i=0, b=pl.bufs; i < nbufs; ++i, ++b) {
+    b->in.values = malloc(fillers * pl.in_bytes + emptiers * pl.out_bytes);
+    b->io = calloc(fillers > emptiers ? fillers : emptiers,
+		   sizeof(struct gf2_pipe_io));
+    b->inlen = calloc(fillers, sizeof(OFF_T));
+    if (b->in.values == NULL || b->io == NULL || b->inlen == NULL)
+      goto nomem;
+    b->in.rows   = k;
+    b->in.cols   = cols;
+    b->in.width  = width;
+    b->in.organisation = (fillers == 1) ? COLWISE : ROWWISE;
+    b->in.alloc_bits   = FREE_NONE;
+    b->out.values = b->in.values + fillers * pl.in_bytes;
+    b->out.rows   = n;
+    b->out.cols   = cols;
+    b->out.width  = width;
+    b->out.organisation = (emptiers == 1) ? COLWISE : ROWWISE;
+    b->out.alloc_bits   = FREE_NONE;
+    b->state = BUF_FREE;
+  }
+
+  /* tables are made on first use, so make them before sharing prep */
+  if (!gf2_prepared_multiply(prep, &pl.bufs[0].in, &pl.bufs[0].out,
+			     0, 0, n, 0, 0, 0, 1)) {
+    pl.error = 1;
+    goto out;
+  }
+  if (flags & GF2_PIPE_URING)
+    pl.ring = gf2_ring_setup(&pl);
+  writers = pl.ring ? 0 : emptiers;
+  pl.consumers = (pl.ring ? 1 : emptiers) + nhash;
+
+  /* workers and writers block signals, as the pool's workers do */
+  pthread_attr_init(&attr);
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (i=0; i < workers; ++i, ++nthreads)
+    if (pthread_create(tids + nthreads, &attr, gf2_pipe_worker, &pl))
+      break;
+  if (i == workers) {
+    for (i=0; i < writers; ++i, ++nthreads) {
+      wargs[i].pl = &pl;
+      wargs[i].i  = i;
+      if (pthread_create(tids + nthreads, &attr, gf2_pipe_writer, wargs + i))
+	break;
+    }
+  }
+  if (nthreads == workers + writers) {
+    for (i=0; i < nhash; ++i, ++nthreads) {
+      wargs[writers + i].pl = &pl;
+      wargs[writers + i].i  = i;
+      if (pthread_create(tids + nthreads, &attr, gf2_pipe_hasher,
+			 wargs + writers + i))
+	break;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy(&attr);
+  if (nthreads < workers + writers + nhash) {
+    fprintf(stderr, "gf2_pipeline_fds: failed to start threads\n");
+    pl.error = 1;
+  }
+
+  /* this thread does the reading (and the writing with io_uring) */
+  if (pl.ring)
+    gf2_ring_io(&pl);
+  else
+    gf2_pipe_reader(&pl);
+
+  pthread_mutex_lock(&pl.lock);
+  pl.done = 1;
+  pthread_cond_broadcast(&pl.cond);
+  pthread_mutex_unlock(&pl.lock);
+  for (i=0; i < nthreads; ++i)
+    pthread_join(tids[i], NULL);
+
+  /* partial words left over at eof were never used */
+  for (i=0; i < fillers; ++i)
+    bytes_read += pl.totals[i] - pl.totals[i] % width;
+
+ out:
+  if (pl.ring)
+    gf2_ring_free(pl.ring);
+  if (pl.bufs)
+    for (i=0; i < nbufs; ++i) {
+      free(pl.bufs[i].in.values);
+      free(pl.bufs[i].io);
+      free(pl.bufs[i].inlen);
+    }
+  free(pl.bufs);
+  free(pl.totals);
+  free(pl.sha);
+  free(tids);
+  free(wargs);
+  pthread_mutex_destroy(&pl.lock);
+  pthread_cond_destroy(&pl.cond);
+  return pl.error ? -1 : bytes_read;
+
+ nomem:
+  fprintf(stderr, "gf2_pipeline_fds: out of memory\n");
+  pl.error = 1;
+  goto out;
+}
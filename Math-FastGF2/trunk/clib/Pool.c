@@ -0,0 +1,247 @@
+/* Process-wide thread pool for the matrix routines */
+/*
+  Copyright (c) by Declan Malone 2009-2019.
+  Licensed under the terms of the GNU General Public License and
+  the GNU Lesser (Library) General Public License.
+*/
+
+/*
+  The pool runs one job at a time. A job is a function and an argument
+  plus a number of tasks; the function is called once for each task
+  number, by whichever thread gets to it first. The calling thread
+  also takes tasks, so a pool of n threads has n - 1 workers.
+
+  Workers are started the first time they're needed and then sleep on
+  a condition variable between jobs. If another thread is already
+  using the pool (eg, two Perl threads multiplying at once) the second
+  caller just runs all its tasks itself.
+
+  Threads don't survive fork(), so the child forgets about them and
+  starts new ones if it needs them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "FastGF2.h"
+
+static pthread_mutex_t pool_busy = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done = PTHREAD_COND_INITIALIZER;
+
+static int pool_size    = 1;	/* threads to use, including caller */
+static int pool_workers = 0;	/* worker threads started */
+static int pool_atfork  = 0;
+static unsigned long pool_gen = 0;
+
+/* current job (all protected by pool_lock) */
+static gf2_pool_task_fn job_fn   = NULL;
+static void            *job_arg  = NULL;
+static int              job_tasks = 0;
+static int              job_next  = 0;
+static int              job_done  = 0;
+static int              job_workers = 0; /* workers allowed to help */
+
+/* take tasks from the current job until there are none left */
+static void gf2_pool_work (void) {
+  int task;
+
+  while (job_next < job_tasks) {
+    task = job_next++;
+    pthread_mutex_unlock(&pool_lock);
+    job_fn(job_arg, task);
+    pthread_mutex_lock(&pool_lock);
+    if (++job_done == job_tasks)
+      pthread_cond_signal(&pool_done);
+  }
+}
+
+static void *gf2_pool_worker (void *id) {
+  unsigned long seen;
+
+  pthread_mutex_lock(&pool_lock);
+  seen = pool_gen;
+  for (;;) {
+    while (pool_gen == seen)
+      pthread_cond_wait(&pool_work, &pool_lock);
+    seen = pool_gen;
+    if ((int) (size_t) id < job_workers)
+      gf2_pool_work();
+  }
+  return NULL;
+}
+
+static void gf2_pool_child (void) {
+  pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t  c = PTHREAD_COND_INITIALIZER;
+
+  pool_busy = m;
+  pool_lock = m;
+  pool_work = c;
+  pool_done = c;
+  pool_workers = 0;
+  job_tasks = job_next = job_done = 0;
+}
+
+/*
+  Start workers until there are at least n. Called with pool_lock
+  held. Workers block all signals so that they're always delivered to
+  the calling (Perl) thread. Returns the number of workers running.
+*/
+static int gf2_pool_start (int n) {
+  pthread_attr_t attr;
+  pthread_t      tid;
+  sigset_t       all, old;
+
+  if (!pool_atfork) {
+    pthread_atfork(NULL, NULL, gf2_pool_child);
+    pool_atfork = 1;
+  }
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  while (pool_workers < n) {
+    if (pthread_create(&tid, &attr, gf2_pool_worker,
+		       (void *) (size_t) pool_workers))
+      break;
+    ++pool_workers;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy(&attr);
+  return pool_workers;
+}
+
+/*
+  Set the number of threads that jobs are split across. 0 (or less)
+  means one per online CPU. Returns the new setting.
+*/
+int gf2_pool_set_threads (int n) {
+  if (n <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n <= 0) n = 1;
+  }
+  pthread_mutex_lock(&pool_lock);
+  pool_size = n;
+  pthread_mutex_unlock(&pool_lock);
+  return n;
+}
+
+int gf2_pool_get_threads (void) {
+  return pool_size;
+}
+
+/* first line of sysfs file "name" for CPU 0's cache i; 0 if none */
+static int gf2_cache_info (int i, const char *name, char *buf, int len) {
+  char  path[96];
+  FILE *f;
+  int   ok;
+
+  snprintf(path, sizeof(path),
+	   "/sys/devices/system/cpu/cpu0/cache/index%d/%s", i, name);
+  if ((f = fopen(path, "r")) == NULL) return 0;
+  ok = fgets(buf, len, f) != NULL;
+  fclose(f);
+  return ok;
+}
+
+/* number of CPUs in a list like "0-3,8-11" */
+static long gf2_count_cpus (const char *list) {
+  long n = 0, lo, hi;
+  char *end;
+
+  while (*list >= '0' && *list <= '9') {
+    lo = hi = strtol(list, &end, 10);
+    if (*end == '-')
+      hi = strtol(end + 1, &end, 10);
+    n += hi - lo + 1;
+    if (*end != ',') break;
+    list = end + 1;
+  }
+  return n;
+}
+
+/*
+  Bytes of the level 1 (data), 2 or 3 cache that one CPU can count on,
+  so that callers can size their buffers to suit; 0 if unknown. Linux
+  describes CPU 0's caches in sysfs, including which CPUs share each
+  one (the size is divided between them). Otherwise sysconf may know
+  the whole size.
+*/
+long gf2_cache_size (int level) {
+  char  buf[256], *end;
+  long  size = 0, sharers = 1;
+  int   i;
+
+  for (i=0; i < 8 && size == 0; ++i) {
+    if (!gf2_cache_info(i, "level", buf, sizeof(buf))) break;
+    if (atoi(buf) != level) continue;
+    if (gf2_cache_info(i, "type", buf, sizeof(buf)) &&
+	!strncmp(buf, "Instruction", 11))
+      continue;
+    if (!gf2_cache_info(i, "size", buf, sizeof(buf))) continue;
+    size = strtol(buf, &end, 10);
+    if (*end == 'K') size <<= 10;
+    if (*end == 'M') size <<= 20;
+    if (gf2_cache_info(i, "shared_cpu_list", buf, sizeof(buf)) &&
+	gf2_count_cpus(buf) > 1)
+      sharers = gf2_count_cpus(buf);
+  }
+  if (size > 0)
+    return size / sharers;
+
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE) && \
+  defined(_SC_LEVEL3_CACHE_SIZE)
+  switch (level) {
+  case 1: size = sysconf(_SC_LEVEL1_DCACHE_SIZE); break;
+  case 2: size = sysconf(_SC_LEVEL2_CACHE_SIZE);  break;
+  case 3: size = sysconf(_SC_LEVEL3_CACHE_SIZE);  break;
+  }
+#endif
+  return size > 0 ? size : 0;
+}
+
+/*
+  Call fn(arg, task) for task = 0 .. ntasks - 1, using up to threads
+  threads (or the pool default if threads <= 0). Returns once all
+  tasks have finished.
+*/
+void gf2_pool_run (int ntasks, int threads,
+		   gf2_pool_task_fn fn, void *arg) {
+  int task;
+
+  if (threads <= 0) threads = pool_size;
+  if (threads > ntasks) threads = ntasks;
+  if (threads <= 1 || pthread_mutex_trylock(&pool_busy)) {
+    for (task=0; task < ntasks; ++task)
+      fn(arg, task);
+    return;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  if (pool_workers < threads - 1)
+    gf2_pool_start(threads - 1);
+
+  job_fn    = fn;
+  job_arg   = arg;
+  job_tasks = ntasks;
+  job_next  = 0;
+  job_done  = 0;
+  job_workers = threads - 1;
+  ++pool_gen;
+  pthread_cond_broadcast(&pool_work);
+
+  gf2_pool_work();
+  while (job_done < job_tasks)
+    pthread_cond_wait(&pool_done, &pool_lock);
+  job_tasks = 0;
+  pthread_mutex_unlock(&pool_lock);
+  pthread_mutex_unlock(&pool_busy);
+}
@@ -0,0 +1,127 @@
+/* SHA-256 (FIPS 180-4) for hashing streams as they're processed */
+/*
+  Copyright (c) by Declan Malone 2009-2019.
+  Licensed under the terms of the GNU General Public License and
+  the GNU Lesser (Library) General Public License.
+*/
+
+/*
+  The pipeline (Pipeline.c) can hash each stream while its buffers
+  are still in cache, so that callers don't have to read everything
+  again afterwards to get the hashes. This is a plain portable
+  implementation, so as not to need any crypto library.
+*/
+
+#include <string.h>
+#include <stdint.h>
+
+#include "FastGF2.h"
+
+static const uint32_t gf2_sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void gf2_sha256_block (gf2_sha256_t *c, const unsigned char *p) {
+  uint32_t w[64], a, b, d, e, f, g, h, cc, t1, t2;
+  int i;
+
+  for (i=0; i < 16; ++i, p += 4)
+    w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+      (uint32_t) p[2] << 8 | p[3];
+  for (; i < 64; ++i)
+    w[i] = w[i-16] + (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3))
+      + w[i-7] + (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10));
+
+  a = c->h[0]; b = c->h[1]; cc = c->h[2]; d = c->h[3];
+  e = c->h[4]; f = c->h[5]; g  = c->h[6]; h = c->h[7];
+  for (i=0; i < 64; ++i) {
+    t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g))
+      + gf2_sha256_k[i] + w[i];
+    t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+      ((a & b) ^ (a & cc) ^ (b & cc));
+    h = g; g = f; f = e; e = d + t1;
+    d = cc; cc = b; b = a; a = t1 + t2;
+  }
+  c->h[0] = (uint32_t) (c->h[0] + a);
+  c->h[1] = (uint32_t) (c->h[1] + b);
+  c->h[2] = (uint32_t) (c->h[2] + cc);
+  c->h[3] = (uint32_t) (c->h[3] + d);
+  c->h[4] = (uint32_t) (c->h[4] + e);
+  c->h[5] = (uint32_t) (c->h[5] + f);
+  c->h[6] = (uint32_t) (c->h[6] + g);
+  c->h[7] = (uint32_t) (c->h[7] + h);
+}
+
+void gf2_sha256_init (gf2_sha256_t *c) {
+  static const uint32_t iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  int i;
+
+  for (i=0; i < 8; ++i)
+    c->h[i] = iv[i];
+  c->len  = 0;
+  c->fill = 0;
+}
+
+void gf2_sha256_update (gf2_sha256_t *c, const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *) data;
+  size_t take;
+
+  c->len += len;
+  if (c->fill) {
+    take = 64 - c->fill;
+    if (take > len) take = len;
+    memcpy(c->buf + c->fill, p, take);
+    c->fill += take;
+    p   += take;
+    len -= take;
+    if (c->fill < 64) return;
+    gf2_sha256_block(c, c->buf);
+    c->fill = 0;
+  }
+  for (; len >= 64; p += 64, len -= 64)
+    gf2_sha256_block(c, p);
+  memcpy(c->buf, p, len);
+  c->fill = len;
+}
+
+void gf2_sha256_final (gf2_sha256_t *c, unsigned char *digest) {
+  uint64_t bits = (uint64_t) c->len * 8;
+  int i;
+
+  c->buf[c->fill++] = 0x80;
+  if (c->fill > 56) {
+    memset(c->buf + c->fill, 0, 64 - c->fill);
+    gf2_sha256_block(c, c->buf);
+    c->fill = 0;
+  }
+  memset(c->buf + c->fill, 0, 56 - c->fill);
+  for (i=0; i < 8; ++i)
+    c->buf[56 + i] = bits >> (56 - 8 * i);
+  gf2_sha256_block(c, c->buf);
+  for (i=0; i < 8; ++i) {
+    digest[4*i]   = c->h[i] >> 24;
+    digest[4*i+1] = c->h[i] >> 16;
+    digest[4*i+2] = c->h[i] >> 8;
+    digest[4*i+3] = c->h[i];
+  }
+}
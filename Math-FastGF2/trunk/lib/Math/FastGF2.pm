@@ -16,7 +16,7 @@ require Exporter;
 	       );
 @EXPORT_OK = ( @{ $EXPORT_TAGS{'all'} } );
 @EXPORT = (  );
-$VERSION = '0.07';
+$VERSION = '0.08';
 
 require XSLoader;
 XSLoader::load('Math::FastGF2', $VERSION);
@@ -120,6 +120,42 @@ or tell the module to export all symbols at the time you "use" it:
 after which you can make calls to C<gf2_info> without having to
 prefix the module name.
 
+Two more non-exported routines report on and control the "region"
+code used by L<Math::FastGF2::Matrix> when multiplying 8-bit
+matrices. These multiply a whole buffer by a constant, using SIMD
+instructions (SSSE3, AVX2 or AVX-512BW) if the CPU supports them:
+
+ $name = Math::FastGF2::gf2_region_kernel();     # eg, "avx2"
+ $ok   = Math::FastGF2::gf2_region_select("ssse3");
+
+C<gf2_region_kernel> returns the name of the kernel currently in use,
+which will be the fastest one available unless another one has been
+picked with C<gf2_region_select>. The latter returns false if the
+named kernel is unknown or not supported on this machine. Passing an
+empty string selects the fastest kernel again. Valid names are
+C<scalar>, C<ssse3>, C<avx2> and C<avx512bw>.
+
+For a few common values of k (the number of columns in the transform
+matrix), 8-bit multiplies use fully unrolled kernels that work out a
+whole row of the result in one pass instead of k passes. They use the
+same instruction set as the selected region kernel. The values of k
+are picked when building (C<perl Makefile.PL FIXED_K=3,4,6,8,10,16>,
+which is the default list):
+
+ @k   = Math::FastGF2::gf2_fixed_kernels();      # eg, (3,4,6,8,10,16)
+ $old = Math::FastGF2::gf2_fixed_enable(0);      # use generic code
+ Math::FastGF2::gf2_fixed_enable(1);             # back on
+
+C<gf2_fixed_enable> returns the previous setting; pass -1 to just
+query it.
+
+For sizing buffers, C<gf2_cache_size> returns how many bytes of the
+level 1 (data), 2 or 3 cache one CPU has, or 0 if that isn't known.
+Where a cache is shared between CPUs (as level 3 usually is), it's
+divided between them:
+
+ $l2  = Math::FastGF2::gf2_cache_size(2);        # eg, 2097152
+
 =head1 TECHNICAL INFORMATION
 
 =head2 BACKGROUND
@@ -7,6 +7,7 @@ use warnings;
 no warnings qw(redefine);
 
 use Carp;
+use Fcntl qw(O_RDONLY O_RDWR O_CREAT);
 
 use Math::FastGF2 ":ops";
 
@@ -19,7 +20,7 @@ require Exporter;
 	       );
 @EXPORT_OK = ( @{ $EXPORT_TAGS{'all'} } );
 @EXPORT = (  );
-$VERSION = '0.07';
+$VERSION = '0.08';
 
 require XSLoader;
 XSLoader::load('Math::FastGF2', $VERSION);
@@ -43,7 +44,18 @@ sub new {
      org => "rowwise",
      @_,
     );
-  my $org;			# numeric value 1==ROWWISE, 2==COLWISE
+  my $org=_check_new_args(\%o);
+  return undef unless defined $org;
+
+  return alloc_c($class,$o{rows},$o{cols},$o{width},$org);
+}
+
+# Check rows, cols, width and org options for new and friends. Returns
+# the numeric org value (1==ROWWISE, 2==COLWISE) or undef on error.
+sub _check_new_args {
+  my $o=shift;
+  my %o=%$o;
+  my $org;
   my $errors=0;
 
   foreach (qw(rows cols width)) {
@@ -74,9 +86,86 @@ sub new {
     ++$errors;
   }
 
-  return undef if $errors;
+  return $errors ? undef : $org;
+}
 
-  return alloc_c($class,$o{rows},$o{cols},$o{width},$org);
+# Matrices using someone else's memory for their values
+sub new_from_string {
+  my $proto  = shift;
+  my $class  = ref($proto) || $proto;
+  my %o=
+    (
+     rows => undef,
+     cols => undef,
+     width => undef,
+     org => "rowwise",
+     string => undef,
+     offset => 0,
+     @_,
+    );
+
+  unless (ref($o{string}) eq "SCALAR") {
+    carp "new_from_string needs a string parameter (a scalar ref)";
+    return undef;
+  }
+  my $org=_check_new_args(\%o);
+  return undef unless defined $org;
+
+  my $m=wrap_string_c($class,$o{rows},$o{cols},$o{width},$org,
+		      $o{string},$o{offset});
+  carp "can't use string (read-only or wide characters?)" unless $m;
+  return $m;
+}
+
+sub new_from_file {
+  my $proto  = shift;
+  my $class  = ref($proto) || $proto;
+  my %o=
+    (
+     rows => undef,
+     cols => undef,
+     width => undef,
+     org => "rowwise",
+     file => undef,
+     fh => undef,
+     offset => 0,
+     writable => 0,
+     advise => undef,		# "sequential", "random" or "willneed"
+     @_,
+    );
+  my $fh=$o{fh};
+  my %advice=(sequential => 1, random => 2, willneed => 3);
+
+  unless (defined($fh) xor defined($o{file})) {
+    carp "new_from_file needs one of file or fh parameters";
+    return undef;
+  }
+  my $org=_check_new_args(\%o);
+  return undef unless defined $org;
+
+  if (defined($o{file})) {
+    my $mode=$o{writable} ? O_RDWR | O_CREAT : O_RDONLY;
+    unless (sysopen $fh, $o{file}, $mode, 0644) {
+      carp "can't open $o{file}: $!";
+      return undef;
+    }
+  }
+  my $fd=fileno($fh);
+  unless (defined($fd) and $fd >= 0) {
+    carp "new_from_file: fh has no file descriptor";
+    return undef;
+  }
+  if (defined($o{advise}) and !exists($advice{$o{advise}})) {
+    carp "advise should be one of " . join ", ", sort keys %advice;
+    return undef;
+  }
+
+  # the mapping stays valid after we close any file we opened
+  my $m=map_file_c($class,$o{rows},$o{cols},$o{width},$org,
+		   $fd,$o{offset},$o{writable} ? 1 : 0,
+		   defined($o{advise}) ? $advice{$o{advise}} : 0);
+  carp "can't map file: $!" unless $m;
+  return $m;
 }
 
 
@@ -120,11 +209,26 @@ sub ORG {
   return $orgs[$self->ORGNUM];
 }
 
-sub multiply {
-  my $self   = shift;
-  my $class  = ref($self);
-  my $other  = shift;
-  my $result = shift;
+sub multiply     { return _multiply(0, @_) }
+
+# Add (xor) the product into an existing result matrix
+sub multiply_xor {
+  unless (defined($_[2])) {
+    carp "multiply_xor needs a result matrix to add to";
+    return undef;
+  }
+  return _multiply(1, @_);
+}
+
+sub _multiply {
+  my $acc     = shift;
+  my $self    = shift;
+  my $class   = ref($self);
+  my $other   = shift;
+  my $result  = shift;
+  my $threads = shift || 0;
+  my $inorder = shift || 0;
+  my $outorder= shift || 0;
 
   unless (defined($other) and ref($other) eq $class) {
     carp "need another matrix to multiply by";
@@ -161,12 +265,41 @@ sub multiply {
     }
   }
 
+  if ($inorder < 0 or $inorder > 2 or $outorder < 0 or $outorder > 2) {
+    carp "order != 0 (native), 1 (little-endian) or 2 (big-endian)";
+    return undef;
+  }
+
   multiply_submatrix_c($self, $other, $result,
 		       0,0,$self->ROWS,
-		       0,0,$other->COLS);
+		       0,0,$other->COLS, $threads, $inorder, $outorder,
+		       $acc);
   return $result;
 }
 
+# Make a prepared transform (Math::FastGF2::Matrix::Prepared) for
+# multiplying other matrices by self over and over
+sub prepare {
+  my $self    = shift;
+  my $inorder = shift || 0;
+  my $outorder= shift || 0;
+
+  if ($inorder < 0 or $inorder > 2 or $outorder < 0 or $outorder > 2) {
+    carp "order != 0 (native), 1 (little-endian) or 2 (big-endian)";
+    return undef;
+  }
+  my $p=prepare_c($self, $inorder, $outorder);
+  carp "Problem preparing transform" unless defined $p;
+  return $p;
+}
+
+# Default number of threads for multiply (process-wide)
+sub threads {
+  my $self = shift;
+  my $n    = shift;
+  return threads_c(defined($n) ? $n : -1);
+}
+
 sub eq {
   my $self   = shift;
   my $class  = ref($self);
@@ -482,7 +615,7 @@ sub swap_cols {
 }
 
 
-# I'll replace this with some C code later
+# Gauss-Jordan elimination is done in C (see clib/Matrix.c)
 sub solve {
 
   my $self  = shift;
@@ -490,67 +623,20 @@ sub solve {
 
   my $rows=$self->ROWS;
   my $cols=$self->COLS;
-  my $bits=$self->WIDTH * 8;
 
   unless ($cols > $rows) {
     carp "solve only works on matrices with COLS > ROWS";
     return undef;
   }
 
-  # work down the diagonal one row at a time ...
-  for my $row (0 .. $rows - 1) {
-
-    # We have to check whether the matrix is non-singular; all k x k
-    # sub-matrices generated by the split part of the IDA are
-    # guaranteed to be invertible, but user-supplied matrices may not
-    # be, so we have to test for this.
-
-    if ($self->getval($row,$row) == 0) {
-      print "had to swap zeros\n";
-      my $found=undef;
-      for my $other_row ($row + 1 .. $rows - 1) {
-	next if $row == $other_row;
-	if ($self->getval($other_row,$row) != 0) {
-	  $found=$other_row;
-	  last;
-	}
-      }
-      return undef unless defined $found;
-      $self->swap_rows($row,$found,$row);
-    }
-
-    # normalise the current row first
-    my $diag_inverse = gf2_inv($bits,$self->getval($row,$row));
-
-    $self->setval($row,$row,1);
-    for my $col ($row + 1 .. $cols - 1) {
-      $self->setval($row,$col,
-	gf2_mul($bits, $self->getval($row,$col), $diag_inverse));
-    }
-
-    # zero all elements above and below ...
-    for my $other_row (0 .. $rows - 1) {
-      next if $row == $other_row;
-
-      my $other=$self->getval($other_row,$row);
-      next if $other == 0;
-      $self->setval($other_row,$row,0);
-      for my $col ($row + 1 .. $cols - 1) {
-	$self->setval($other_row,$col,
-	  gf2_mul($bits, $self->getval($row,$col), $other) ^
-	    $self->getval($other_row,$col));
-      }
-    }
-  }
-
+  # We have to check whether the matrix is non-singular; all k x k
+  # sub-matrices generated by the split part of the IDA are
+  # guaranteed to be invertible, but user-supplied matrices may not
+  # be, so solve_c returns false in that case.
   my $result=alloc_c($class, $rows, $cols - $rows,
 		     $self->WIDTH, $self->ORGNUM);
-  for my $row (0 .. $rows - 1) {
-    for my $col (0 .. $cols - $rows - 1) {
-      $result->setval($row,$col,
-		      $self->getval($row, $col + $rows));
-    }
-  }
+  return undef unless defined $result;
+  return undef unless solve_c($self, $result);
 
   return $result;
 }
@@ -567,11 +653,86 @@ sub invert {
     return undef;
   }
 
-  my $cat=
-    $self->concat($self->new_identity(size => $self->COLS,
-				      width => $self->WIDTH));
-  return undef unless defined ($cat);
-  return $cat->solve;
+  my $key=join ":", "invert", $self->ROWS, $self->WIDTH, $self->ORGNUM,
+    $self->getvals_str(0,0,$self->ROWS * $self->COLS,0);
+  my $inverse=_inverse_cache_get($class,$key,$self->ROWS,
+				 $self->WIDTH,$self->ORGNUM);
+  return $inverse if defined $inverse;
+
+  $inverse=alloc_c($class, $self->ROWS, $self->COLS,
+		   $self->WIDTH, $self->ORGNUM);
+  return undef unless defined $inverse;
+  return undef unless invert_c($self, $inverse);
+
+  _inverse_cache_put($key,$inverse);
+  return $inverse;
+}
+
+# Process-wide LRU cache of inverse matrices. When combining many
+# files made with the same scheme, the same k x k matrix gets
+# inverted over and over. Entries are keyed by whatever the inverse
+# was made from (the values of the matrix passed to invert, or the
+# key and xvals passed to new_inverse_cauchy) and hold the inverse's
+# values. Callers always get a fresh copy, so they're free to change
+# it.
+my %inv_cache;			# key => [ values, last used ]
+my $inv_cache_size = 64;	# max entries (0 disables)
+my $inv_cache_tick = 0;
+my ($inv_cache_hits, $inv_cache_misses) = (0,0);
+
+sub inverse_cache {
+  my $proto = shift;
+  my $n     = shift;
+
+  if (defined($n)) {
+    $inv_cache_size = $n > 0 ? int $n : 0;
+    _inverse_cache_trim();
+  }
+  return $inv_cache_size;
+}
+
+sub inverse_cache_stats {
+  return ($inv_cache_hits, $inv_cache_misses, scalar(keys %inv_cache));
+}
+
+sub inverse_cache_clear {
+  %inv_cache=();
+  $inv_cache_hits = $inv_cache_misses = 0;
+}
+
+sub _inverse_cache_get {
+  my ($class,$key,$size,$width,$orgnum)=@_;
+
+  return undef unless $inv_cache_size;
+  my $entry=$inv_cache{$key};
+  unless (defined($entry)) {
+    ++$inv_cache_misses;
+    return undef;
+  }
+  ++$inv_cache_hits;
+  $entry->[1]=++$inv_cache_tick;
+
+  my $mat=alloc_c($class, $size, $size, $width, $orgnum);
+  $mat->setvals_str(0,0,$entry->[0],0) if defined $mat;
+  return $mat;
+}
+
+sub _inverse_cache_put {
+  my ($key,$mat)=@_;
+
+  return unless $inv_cache_size;
+  $inv_cache{$key}=[ $mat->getvals_str(0,0,$mat->ROWS * $mat->COLS,0),
+		     ++$inv_cache_tick ];
+  _inverse_cache_trim();
+}
+
+# drop least recently used entries (there aren't many to search)
+sub _inverse_cache_trim {
+  while (keys %inv_cache > $inv_cache_size) {
+    my ($oldest)=sort { $inv_cache{$a}[1] <=> $inv_cache{$b}[1] }
+      keys %inv_cache;
+    delete $inv_cache{$oldest};
+  }
 }
 
 sub zero {
@@ -597,6 +758,7 @@ sub new_cauchy {
 	xyvals    => undef,	# was "key"
 	rows      => undef,
 	cols      => undef,
+	systematic => 0,	# identity for the first cols rows?
 	@_
     );
 
@@ -654,6 +816,10 @@ sub new_cauchy {
     # ported from IDA::ida_key_to_matrix
     $w <<= 3; 			# bits <- bytes
     for my $row (0..$rows - 1 ) {
+	if ($o{systematic} and $row < $cols) {
+	    $self->setval($row, $row, 1); # rest are already 0
+	    next;
+	}
 	for my $col (0 .. $cols - 1) {
 	    my $xi  = $x[$row];
 	    my $yj  = $y[$col];
@@ -703,97 +869,28 @@ sub new_inverse_cauchy {
     my $key = $o{xylist}   || die "xylist parameter required\n";
     die "xvals parameter required\n" unless defined $o{xvals};
 
-    # Note: no check done below to ensure that xvals are unique
-    my @x   = map {$key->[$_]} @{$o{xvals}};
-    my @y   = splice @$key, -$k;
-    push @$key, @y; 	# splice is destructive; undo damage
-
-    #    warn "xlist: [" . (join ", ", @x) . "]\n";
-    #    warn "ylist: [" . (join ", ", @y) . "]\n";
-    die if @x - @y;		# is it square?
+    # Repeated x or y values are caught when calculating the inverse
     die if @$key < 2 * $k;	# is n >= k?
-    die if @x != $k;		# did user supply k xvals?
+    die if @{$o{xvals}} != $k;	# did user supply k xvals?
+
+    my ($orgnum) = grep { $orgs[$_] eq $o{org} } (ROWWISE, COLWISE);
+    my $cache_key = join ":", "cauchy", $k, $w, $orgnum || 0,
+	join(",", @$key), join(",", @{$o{xvals}});
+    if (defined $orgnum) {
+	my $cached = _inverse_cache_get($class, $cache_key, $k, $w, $orgnum);
+	return $cached if defined $cached;
+    }
 
     my $self = $class->new(rows => $k, cols => $k, width => $w,
 			   org => $o{org});
     die unless ref $self;
 
-    # Using the proof wiki page as a guide...
-    #
-    # rename k to n so we can use it as a loop counter (and go -1
-    # because we're using zero-based indexes)
-    my ($i, $j, $n, $bits) = (0,0, $k-1, $w * 8);
-
-    if ($n < 3) {
-	# unoptimised version
-	for $i (0 .. $n) {
-	    for $j (0 .. $n) {
-		
-		my $top = 1;	# multiplicative identity
-		map {
-		    $top = gf2_mul($bits, $top, $x[$j] ^ $y[$_]);
-		    $top = gf2_mul($bits, $top, $x[$_] ^ $y[$i]);
-		} (0 .. $n);
-		
-		my $bot = $x[$j] ^ $y[$i];
-		
-		map { $bot = gf2_mul($bits, $bot, $x[$j] ^ $x[$_]) }
-		grep { $_ != $j } (0 .. $n); # $_ is our $k
-		
-		map { $bot = gf2_mul($bits, $bot, $y[$i] ^ $y[$_]) }
-		grep { $_ != $i } (0 .. $n); # $_ is our $k
-		
-		$top = gf2_mul($bits, $top, gf2_inv($bits, $bot));
-		
-		$self->setval($i,$j,$top);
-	    }
-	}
-    } else {
-	# The above two big product loops are ripe for optimisation
-	# Instead of calculating:
-	# * product of row except for ... (n-1 multiplications)
-	# * product of col except for ... (n-1 multiplications)
-	# You can memoise full row/col products 
-	# 
-	# This should be hugely noticeable for large n, but should
-	# probably also even have a positive effect for n>3 assuming
-	# a word size of 1 byte and gf2_inv that is as cheap (or cheaper)
-	# than a multiplication.
-
-	my @jmemo = ();
-	for $j (0..$n) {
-	    my ($sum,$xj) = (1, $x[$j]);
-	    map { $sum = gf2_mul($bits, $sum, $xj ^ $x[$_]) } 
-	    grep { $_ != $j} (0..$n);
-	    push @jmemo, $sum;
-	}
-	my @imemo = ();
-	for $i (0..$n) {
-	    my ($sum,$yi) = (1, $y[$i]);
-	    map { $sum = gf2_mul($bits, $sum, $yi ^ $y[$_]) }
-	    grep {$_ != $i} (0..$n);
-	    push @imemo, $sum;
-	}
-	for $i (0 .. $n) {
-	    for $j (0 .. $n) {
-
-		# We can save one multiplication by 1 below:
-		my $top = gf2_mul($bits, $x[$j] ^ $y[0], $x[0] ^ $y[$i]);
-		map {
-		    $top = gf2_mul($bits, $top, $x[$j] ^ $y[$_]);
-		    $top = gf2_mul($bits, $top, $x[$_] ^ $y[$i]);
-		} (1 .. $n);
-	
-		my $bot = $x[$j] ^ $y[$i];
-		$bot = gf2_mul($bits, $bot, $jmemo[$j]);
-		$bot = gf2_mul($bits, $bot, $imemo[$i]);
-		
-		$top = gf2_mul($bits, $top, gf2_inv($bits, $bot));
-		
-		$self->setval($i,$j,$top);
-	    }
-	}
-    }
+    # The closed-form inverse (see the proofwiki page above) is
+    # calculated in C; see gf2_matrix_inverse_cauchy in clib/Matrix.c
+    die "x and y values must be distinct\n"
+	unless inverse_cauchy_c($self, $key, $o{xvals});
+
+    _inverse_cache_put($cache_key, $self);
     return $self;
 }
 
@@ -1086,6 +1183,90 @@ sub reorganise {
 }
 
 
+package Math::FastGF2::Matrix::Prepared;
+
+use Carp;
+
+# Same checks as Math::FastGF2::Matrix::multiply. The byte orders were
+# fixed by prepare. Either matrix can also be a list of one-row
+# matrices, one for each row.
+sub multiply {
+  my $self    = shift;
+  my $other   = shift;
+  my $result  = shift;
+  my $threads = shift || 0;
+  my $class   = "Math::FastGF2::Matrix";
+
+  if (ref($other) eq "ARRAY" or ref($result) eq "ARRAY") {
+    return $self->_multiply_rows($other, $result, $threads);
+  }
+  unless (defined($other) and ref($other) eq $class) {
+    carp "need a matrix to multiply by";
+    return undef;
+  }
+  unless ($self->COLS == $other->ROWS and $self->WIDTH == $other->WIDTH) {
+    carp "matrix has wrong ROWS or WIDTH for this transform";
+    return undef;
+  }
+  if (defined($result)) {
+    unless (ref($result) eq $class and $self->ROWS == $result->ROWS and
+	    $self->WIDTH == $result->WIDTH and
+	    $other->COLS <= $result->COLS) {
+      carp "result matrix has wrong size or WIDTH for this transform";
+      return undef;
+    }
+  } else {
+    $result=$class->new(rows => $self->ROWS, cols => $other->COLS,
+			width => $self->WIDTH, org => "rowwise");
+    return undef unless defined $result;
+  }
+
+  multiply_submatrix_c($self, $other, $result,
+		       0,0,$self->ROWS,
+		       0,0,$other->COLS, $threads) or return undef;
+  return $result;
+}
+
+sub _multiply_rows {
+  my ($self, $other, $result, $threads) = @_;
+  my $class = "Math::FastGF2::Matrix";
+  my $w     = $self->WIDTH;
+  my $cols;
+
+  # check a matrix or list of rows, returning its number of columns
+  my $check = sub {
+    my ($m, $rows) = @_;
+    if (ref($m) eq "ARRAY") {
+      return undef unless @$m == $rows;
+      my $c;
+      for (@$m) {
+	return undef unless ref($_) eq $class and $_->ROWS == 1 and
+	  $_->WIDTH == $w;
+	$c = $_->COLS if !defined($c) or $_->COLS < $c;
+      }
+      return $c;
+    }
+    return undef unless ref($m) eq $class and $m->ROWS == $rows and
+      $m->WIDTH == $w;
+    return $m->COLS;
+  };
+
+  $cols = $check->($other, $self->COLS);
+  unless (defined($cols)) {
+    carp "input has wrong number of rows or WIDTH for this transform";
+    return undef;
+  }
+  my $rcols = defined($result) ? $check->($result, $self->ROWS) : undef;
+  unless (defined($rcols) and $rcols >= $cols) {
+    carp "result must be a matrix or list of rows big enough for the product";
+    return undef;
+  }
+  multiply_rows_c($self, $other, $result, 0, 0, $cols, $threads)
+    or return undef;
+  return $result;
+}
+
+
 1;
 
 __END__
@@ -1163,6 +1344,55 @@ becomes full. With "colwise" organisation, values are written
 top-to-bottom first, moving right to the next column as each column
 becomes full.
 
+=head2 new_from_string
+
+To use the contents of an existing Perl string as the matrix values,
+without copying them:
+
+ $m=Math::FastGF2::Matrix->
+   new_from_string(rows => $r, cols => $c, width => $w,
+                   org => "rowwise", string => \$buf, offset => $o);
+
+The C<string> parameter must be a reference to a (writable)
+scalar. The matrix uses the C<$r * $c * $w> bytes of C<$buf>
+starting at C<$offset> (default 0), extending the string with zero
+bytes if it isn't long enough. Changes made through the matrix show
+up in C<$buf> and vice versa, so data can be read into the buffer
+(eg, with C<sysread($fh, $buf, $len, $offset)>) and results written
+out straight from it. Values are stored in native byte order.
+
+The matrix holds a reference to the scalar, so it won't go away
+before the matrix does. Perl may move the string buffer when C<$buf>
+grows or is assigned to, so the matrix looks it up again each time
+it's used. If by then C<$buf> is too short to hold the matrix (or
+isn't a byte string), the method croaks. Changing C<$buf> in place
+(with four-argument C<substr>, C<vec>, or C<sysread>/C<read> with an
+offset) is still the cheapest way to get data into it.
+
+=head2 new_from_file
+
+To map part of a file into memory and use it as the matrix values:
+
+ $m=Math::FastGF2::Matrix->
+   new_from_file(rows => $r, cols => $c, width => $w,
+                 org => "rowwise", file => $name, offset => $o,
+                 writable => $flag);
+
+Either C<file> (a file name) or C<fh> (an open file handle) must be
+given. If C<writable> is set, changes to the matrix are written back
+to the file, which is created or extended if needed (on Linux the
+extra space is allocated with C<posix_fallocate> where the filesystem
+supports it). Otherwise the file must be long enough already and the
+matrix gets a private copy of each page as it is changed, leaving the
+file as it was. The mapping is released when the matrix is
+destroyed. Returns undef (and sets C<$!>) if the file can't be opened
+or mapped.
+
+An C<advise> option of "sequential", "random" or "willneed" is passed
+on to C<madvise> for the mapping. "sequential" suits a matrix that
+will be multiplied from one end to the other, letting the kernel read
+ahead further and drop pages once they've been used.
+
 =head2 new_identity
 
 To create a new identity matrix with C<$size> rows and columns, width
@@ -1201,6 +1431,13 @@ respect to each other. Thus this submatrix is invertible. This has
 applications in constructing error-correcting codes. See the
 L<Crypt::IDA> manual page for details.
 
+With C<< systematic => 1 >>, the first C<cols> rows are replaced by
+an identity matrix (their x values are ignored), so that multiplying
+by the matrix copies its input to the first C<cols> rows of the
+result, and only the remaining rows need any real work. Any C<cols>
+rows of the result are still linearly independent, since every
+square submatrix of a Cauchy matrix is invertible.
+
 =head2 new_inverse_cauchy
 
 Creates an inverse Cauchy matrix from a set of y values and an subset
@@ -1221,9 +1458,11 @@ the C<@xvals> array. Effectively, it selects 'size' rows from the
 Cauchy matrix described by C<[ @xvals, @yvals ]> and inverts that
 matrix.
 
-This uses an algorithm described in volume 1 of Knuth's I<"The Art of
-Computer Programming">, which should run faster than the regular
-Gaussian elimination method implemented by the C<invert> method.
+This uses the closed-form inverse described in volume 1 of Knuth's
+I<"The Art of Computer Programming">, implemented in C. It needs only
+O(k^2) field operations (plus a single inversion), so it runs much
+faster than the regular Gaussian elimination method implemented by
+the C<invert> method.
 
 =head2 new_vandermonde
 
@@ -1377,7 +1616,8 @@ only work with strings:
  $m->setvals_str($row, $col, $str, $byteorder);
 
 Profiling has shown that these routines are much quicker than the Perl
-versions.
+versions. They won't read or write past the end of the matrix:
+getvals_str returns undef and setvals_str does nothing if asked to.
 
 =head2 Examples
 
@@ -1461,6 +1701,87 @@ avoiding the overhead of allocating a new one:
 The C<$result> matrix is also returned, though it can be safely
 ignored.
 
+Large multiplies (such as those done by L<Crypt::IDA> when splitting
+or combining a big buffer) can be spread across several threads. Each
+thread works on a separate range of columns of the result. A third
+argument gives the number of threads to use for this call:
+
+ $m1->multiply($m2,$result,4);
+
+Otherwise, the process-wide default is used. This starts at 1 (no
+extra threads) and can be changed with:
+
+ Math::FastGF2::Matrix->threads($n);   # 0 means one per CPU
+ $n = Math::FastGF2::Matrix->threads;  # current setting
+
+Worker threads are started the first time they are needed and are
+then kept for later calls. Multiplies that are too small to benefit
+are always done in the calling thread.
+
+Two more arguments give the byte order that C<$m2>'s values are
+stored in and the byte order to store C<$result>'s values in, using
+the same codes as C<setvals> (0 for native, 1 for little-endian, 2
+for big-endian):
+
+ $m1->multiply($m2,$result,0,2,2);     # big-endian data in and out
+
+C<$m1> is always taken to be in native order. This is mainly for
+matrices made with C<new_from_string> or C<new_from_file>, where the
+raw data comes from outside, or for input/output that is set and read
+with byte order 0. Any byte swapping is done as part of the multiply,
+which is quicker than converting the data separately.
+
+To add the product to what's already in C<$result> instead of
+replacing it (addition being xor in these fields), use:
+
+ $m1->multiply_xor($m2,$result);       # $result += $m1 x $m2
+
+It takes the same arguments as C<multiply>, except that C<$result>
+is required. Since the product is linear in C<$m2>, this can be used
+to patch a result when some columns of C<$m2> change: multiply by a
+matrix holding the old values xor the new ones (see C<sf_update> in
+L<Crypt::IDA::ShareFile>).
+
+=head2 Prepared transforms
+
+When the same matrix is used to multiply many others (like the
+transform matrix when splitting or combining a large file), it can be
+prepared once:
+
+ $p = $m1->prepare;                    # or prepare($inorder,$outorder)
+ $p->multiply($m2,$result);            # same as $m1->multiply($m2,$result)
+ $p->multiply($m3,$result,4);          # with 4 threads
+
+C<prepare> takes a copy of the matrix's values and, for 16- and
+32-bit widths, makes the multiplication tables that the region
+kernels would otherwise make for each value at every call. C<multiply>
+takes the same arguments as above except for the byte orders, which
+are given to C<prepare> instead (the tables include the byte
+swapping). A new result matrix is C<rowwise>. C<ROWS>, C<COLS> and
+C<WIDTH> work as for matrices.
+
+Later changes to C<$m1> don't affect C<$p>. The tables are made again
+if a different kernel is selected with
+C<Math::FastGF2::gf2_region_select>. 8-bit matrices gain little since
+tables for every 8-bit value are made when the module loads.
+
+Either of the matrices given to a prepared C<multiply> can also be a
+reference to a list of one-row matrices, one for each row (so C<COLS>
+of them for the input, or C<ROWS> for the result). This is for rows
+that live in separate buffers, such as a set of share files mapped
+with C<new_from_file>:
+
+ @shares = map { Math::FastGF2::Matrix->new_from_file
+                   (rows => 1, cols => $n, width => 1, file => $_,
+                    offset => $hs, writable => 1) } @names;
+ $p->multiply($input, \@shares);
+
+The product has as many columns as the input (the fewest of any row
+in a list), and a result big enough for it must be given.
+
+The streaming multiply used by L<Crypt::IDA> for file descriptors
+already prepares its transform once for the whole stream.
+
 =head2 Invert
 
 To invert a square matrix (using Gauss-Jordan method):
@@ -1468,7 +1789,27 @@ To invert a square matrix (using Gauss-Jordan method):
  $inverse=$m->invert;
 
 A new inverse matrix is returned if the matrix was invertible, or
-undef otherwise.
+undef otherwise. The new matrix has the same organisation as the
+original, which is left unchanged.
+
+=head2 Inverse cache
+
+C<invert> and C<new_inverse_cauchy> keep a process-wide cache of the
+inverses they have worked out, so that asking for the same inverse
+again (eg, when combining many files that were split with the same
+key) just copies the values from the cache. The cache is keyed on the
+values of the matrix being inverted (or the key and C<xvals> passed
+to C<new_inverse_cauchy>), along with its width and organisation.
+The least recently used entry is dropped when it is full. Each call
+returns a new matrix, so it is safe to change it.
+
+ $size = Math::FastGF2::Matrix->inverse_cache;     # default 64
+ Math::FastGF2::Matrix->inverse_cache(1000);       # set size
+ Math::FastGF2::Matrix->inverse_cache(0);          # disable
+ ($hits, $misses, $entries) = Math::FastGF2::Matrix->inverse_cache_stats;
+ Math::FastGF2::Matrix->inverse_cache_clear;       # empty, reset stats
+
+Failed inversions (singular matrices) are not cached.
 
 =head2 Concat(enate)
 
@@ -1494,6 +1835,11 @@ equations to be solved (ie, the left-hand side of equations), and the
 remaining column(s) being the value(s) the equations evaluate to (ie,
 the right-hand side of equations).
 
+Note that C<solve> works in place: on return, C<$m> will hold the
+reduced form of the equations (with the identity matrix in the first
+$m->ROWS columns if a solution was found). Both C<solve> and C<invert>
+are implemented in C.
+
 =head2 Equality
 
 To test whether two matrices have the same values:
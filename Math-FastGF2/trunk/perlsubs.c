@@ -34,8 +34,164 @@ SV* mat_alloc_c(char* class, int rows, int cols, int width, int org) {
   return obj_ref;
 }
 
+/*
+  Matrices whose values live in someone else's memory: either the
+  string buffer of a Perl scalar (which we keep a reference to) or an
+  mmap'd region of a file (which we unmap). The gf2_matrix_t comes
+  first so that these can go anywhere a normal matrix can.
+*/
+typedef struct {
+  gf2_matrix_t m;
+  SV          *owner;		/* scalar holding the values, or NULL */
+  STRLEN       offset;		/* where the values start in owner */
+  STRLEN       need;		/* length owner must have, at least */
+  void        *map;		/* start of mapping (page aligned) */
+  size_t       map_len;
+} mat_external_t;
+
+/*
+  Get the matrix from an object. Holding a reference to a scalar
+  doesn't stop Perl moving its string buffer (when it grows, or is
+  assigned to), so for a matrix wrapping a string, find the buffer
+  again every time. Croak if the string has become too short or isn't
+  a plain byte string any more.
+*/
+static gf2_matrix_t *mat_of (SV *Self) {
+  gf2_matrix_t   *m = (gf2_matrix_t*) SvIV(SvRV(Self));
+  mat_external_t *x = (mat_external_t *) m;
+  SV             *sv;
+
+  if (m->alloc_bits != FREE_EXTERNAL || x->owner == NULL) return m;
+  sv = x->owner;
+#ifdef SvIsCOW
+  /* assignment may have left it sharing another scalar's buffer */
+  if (SvIsCOW(sv)) sv_force_normal_flags(sv, 0);
+#endif
+  if (!SvPOK(sv) || SvUTF8(sv) || SvCUR(sv) < x->need)
+    croak("String holding matrix values is too short or not bytes");
+  m->values = SvPVX(sv) + x->offset;
+  return m;
+}
+
+static SV *mat_external_obj (char *class, mat_external_t *x,
+			     int rows, int cols, int width, int org) {
+  SV *obj_ref, *obj;
+
+  x->m.alloc_bits   = FREE_EXTERNAL;
+  x->m.rows         = rows;
+  x->m.cols         = cols;
+  x->m.width        = width;
+  x->m.organisation = org;
+
+  obj_ref = newSViv(0);
+  obj     = newSVrv(obj_ref, class);
+  sv_setiv(obj,(IV)x);
+  SvREADONLY_on(obj);
+  return obj_ref;
+}
+
+/*
+  Use the string in scalar ref Buf, starting at offset, as the values
+  of a new matrix. The string is extended with zeroes if it's too
+  short. Returns undef if the scalar is read-only or can't be made
+  into a plain byte string.
+*/
+SV *mat_wrap_string_c (char *class, int rows, int cols, int width,
+		       int org, SV *Buf, int offset) {
+  mat_external_t *x;
+  SV     *sv;
+  STRLEN  len, need = (STRLEN) offset + (STRLEN) rows * cols * width;
+  char   *pv;
+
+  if (!SvROK(Buf) || offset < 0) return &PL_sv_undef;
+  sv = SvRV(Buf);
+  if (SvREADONLY(sv) || SvROK(sv)) return &PL_sv_undef;
+
+  /* we'll be writing to the buffer, so it can't be shared (COW) */
+  pv = SvPV_force(sv, len);
+  if (SvUTF8(sv) && !sv_utf8_downgrade(sv, TRUE)) return &PL_sv_undef;
+  if (len < need) {
+    pv = SvGROW(sv, need + 1);
+    memset(pv + len, 0, need - len);
+    SvCUR_set(sv, need);
+    pv[need] = 0;
+  }
+  SvPOK_only(sv);
+
+  x = malloc(sizeof(mat_external_t));
+  if (x == NULL) return &PL_sv_undef;
+  x->m.values = pv + offset;
+  x->owner    = SvREFCNT_inc_simple_NN(sv);
+  x->offset   = offset;
+  x->need     = need;
+  x->map      = NULL;
+  x->map_len  = 0;
+  return mat_external_obj(class, x, rows, cols, width, org);
+}
+
+/*
+  Map rows * cols * width bytes of file descriptor fd, starting at
+  offset. If writable, changes go back to the file (which is extended
+  if needed, with the new blocks allocated up front so that page
+  faults on the mapping don't have to); otherwise the mapping is
+  private, so the matrix can still be changed but the file is left
+  alone. advice is passed on to madvise: 1 for sequential access, 2
+  for random, 3 to start reading the pages in now, 0 for none.
+  Returns undef with errno set on failure.
+*/
+SV *mat_map_file_c (char *class, int rows, int cols, int width, int org,
+		    int fd, NV offset, int writable, int advice) {
+  mat_external_t *x;
+  struct stat st;
+  OFF_T  off   = (OFF_T) offset;
+  OFF_T  start = off & ~((OFF_T) sysconf(_SC_PAGESIZE) - 1);
+  size_t need  = (size_t) rows * cols * width;
+  size_t len   = need + (size_t) (off - start);
+  void  *map;
+
+  if (need == 0 || fstat(fd, &st)) return &PL_sv_undef;
+  if (st.st_size < off + (OFF_T) need) {
+    if (!writable) {
+      errno = EINVAL;
+      return &PL_sv_undef;
+    }
+#ifdef __linux__
+    /* not all filesystems can do it, so fall back to a sparse file */
+    if (posix_fallocate(fd, st.st_size, off + need - st.st_size))
+#endif
+    if (ftruncate(fd, off + need)) return &PL_sv_undef;
+  }
+
+  map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	     writable ? MAP_SHARED : MAP_PRIVATE, fd, start);
+  if (map == MAP_FAILED) return &PL_sv_undef;
+  switch (advice) {
+  case 1: madvise(map, len, MADV_SEQUENTIAL); break;
+  case 2: madvise(map, len, MADV_RANDOM);     break;
+  case 3: madvise(map, len, MADV_WILLNEED);   break;
+  }
+
+  x = malloc(sizeof(mat_external_t));
+  if (x == NULL) {
+    munmap(map, len);
+    return &PL_sv_undef;
+  }
+  x->m.values = (char *) map + (off - start);
+  x->owner    = NULL;
+  x->map      = map;
+  x->map_len  = len;
+  return mat_external_obj(class, x, rows, cols, width, org);
+}
+
 void mat_DESTROY (SV* Self) {
   gf2_matrix_t *m=(gf2_matrix_t*)SvIV(SvRV(Self));
+  if (m->alloc_bits == FREE_EXTERNAL) {
+    mat_external_t *x = (mat_external_t *) m;
+    if (x->owner) SvREFCNT_dec(x->owner);
+    if (x->map)   munmap(x->map, x->map_len);
+    free(x);
+    return;
+  }
   if (m->alloc_bits & 1)
     free(m->values);
   if (m->alloc_bits & 2)
@@ -60,7 +216,7 @@ int mat_ORGNUM  (SV* Self) {
 }
 
 gf2_u32 mat_getval(SV *Self, int row, int col) {
-  gf2_matrix_t *m=(gf2_matrix_t*)SvIV(SvRV(Self));
+  gf2_matrix_t *m=mat_of(Self);
   int  down=gf2_matrix_offset_down(m);
   int right=gf2_matrix_offset_right(m);
   void *p=(void*)m->values + (row * down) + (col * right);
@@ -95,7 +251,7 @@ gf2_u32 mat_getval(SV *Self, int row, int col) {
 }
 
 gf2_u32 mat_setval(SV *Self, int row, int col, gf2_u32 val) {
-  gf2_matrix_t *m=(gf2_matrix_t*)SvIV(SvRV(Self));
+  gf2_matrix_t *m=mat_of(Self);
   int  down=gf2_matrix_offset_down(m);
   int right=gf2_matrix_offset_right(m);
   void *p=(void*)m->values + (row * down) + (col * right);
@@ -150,183 +306,316 @@ static int mat_local_byte_order (void) {
 void
 mat_multiply_submatrix_c (SV *Self, SV *Transform, SV *Result,
 			    int self_row,  int result_row, int nrows,
-			    int xform_col, int result_col, int ncols) {
-  gf2_matrix_t *self   = (gf2_matrix_t*) SvIV(SvRV(Self));
-  gf2_matrix_t *xform  = (gf2_matrix_t*) SvIV(SvRV(Transform));
-  gf2_matrix_t *result = (gf2_matrix_t*) SvIV(SvRV(Result));
-
-  /* i == input == self, t == transform, o == output == result; r <- i * t */
-  /* all offsets are measured in bytes */
-  int idown  = gf2_matrix_offset_down(self);
-  int iright = gf2_matrix_offset_right(self);
-  int tdown  = gf2_matrix_offset_down(xform); 
-  int tright = gf2_matrix_offset_right(xform);
-  int odown  = gf2_matrix_offset_down(result); 
-  int oright = gf2_matrix_offset_right(result); 
-
-  /* 
-     Treat the most common case of width = 1 and ROWWISE/COLWISE pair
-     of matrices separately to avoid pointer arithmetic overheads
+			    int xform_col, int result_col, int ncols,
+			    int threads, int inorder, int outorder, int acc) {
+  gf2_matrix_t *self   = mat_of(Self);
+  gf2_matrix_t *xform  = mat_of(Transform);
+  gf2_matrix_t *result = mat_of(Result);
+
+  /*
+    All the work (including the common IDA split/combine layouts) is
+    done by the cache-blocked multiply in clib/Matrix.c. inorder and
+    outorder say what byte order Transform and Result hold their
+    values in (0 = native, as usual). With acc set, the product is
+    xored into Result.
   */
-  if ((self->width == 1) && (iright == 1) &&
-      (
-           ((tright == 1) && (odown == 1))  /* combine */
-	|| ((tdown == 1) && (oright == 1))  /* split   */
-       )) {
-    int r,c,v;
-    gf2_u8  u8, *u8_irp, *u8_orp, *u8_tcp, *u8_ocp, *u8_vip, *u8_vtp;
-      
-    
-    if ((tright == 1) && (odown == 1)) {
-      // fprintf(stderr, "FAST: combine\n");
-      /* (iright == tright == odown == 1) */
-      gf2_u8 *u8_tcp_start = xform->values  + xform_col;
-      gf2_u8 *u8_ocp_start = result->values + oright * result_col;
-      for (r=0,
-	     u8_irp=self->values   + idown * self_row,
-	     u8_orp=result->values + result_row;
-	   r < nrows;
-	   ++r,  u8_irp += idown) {
-	for (c=0,
-	       u8_tcp=u8_tcp_start,
-	       u8_ocp=u8_ocp_start;
-	     c < ncols;
-	     ++c, u8_tcp ++, u8_ocp += oright) {
-	  for (v=0,
-		 u8_vip=u8_irp, u8_vtp=u8_tcp,
-		 u8=gf2_mul8(*u8_vip,*u8_vtp);
-	       u8_vip ++, u8_vtp += tdown,
-		 ++v < self->cols; ) {
-	      u8^=gf2_mul8(*u8_vip,*u8_vtp);
-	  }
-	  *(u8_ocp + r) = u8;
-	}
-      }
-    } else {
-      //fprintf(stderr, "FAST: split\n");
-      /* (iright == tdown == oright == 1) */
-      gf2_u8 *u8_tcp_start = xform->values  + tright * xform_col;
-      gf2_u8 *u8_ocp_start = result->values + result_col;
-      for (r=0,
-	     u8_irp=self->values   + idown * self_row,
-	     u8_orp=result->values + odown * result_row;
-	   r < nrows;
-	   ++r,  u8_irp += idown) {
-	for (c=0,
-	       u8_tcp=u8_tcp_start,
-	       u8_ocp=u8_ocp_start;
-	     c < ncols;
-	     ++c, u8_tcp += tright, u8_ocp++) {
-	  for (v=0,
-		 u8_vip=u8_irp, u8_vtp=u8_tcp,
-		 u8=gf2_mul8(*u8_vip,*u8_vtp);
-	       u8_vip ++, u8_vtp++,
-		 ++v < self->cols; ) {
-	    u8^=gf2_mul8(*u8_vip,*u8_vtp);
-	  }
-	  *(u8_ocp + r * odown) = u8;
-	}
-      }
-    }
-    return;
+  if (acc)
+    gf2_matrix_multiply_submatrix_xor(self, xform, result,
+				      self_row,  result_row, nrows,
+				      xform_col, result_col, ncols,
+				      threads, inorder, outorder);
+  else
+    gf2_matrix_multiply_submatrix_ord(self, xform, result,
+				      self_row,  result_row, nrows,
+				      xform_col, result_col, ncols,
+				      threads, inorder, outorder);
+}
+
+/*
+  Get (n < 0) or set the default number of threads used by multiply.
+  Setting 0 means one thread per CPU.
+*/
+int mat_threads_c (int n) {
+  return (n < 0) ? gf2_pool_get_threads() : gf2_pool_set_threads(n);
+}
+
+/*
+  Prepared transforms (gf2_matrix_prepare) are a separate class,
+  Math::FastGF2::Matrix::Prepared, since they're not matrices as far
+  as the rest of the code is concerned. They only refer to their own
+  copy of the values, so the original matrix can go away.
+*/
+SV *mat_prepare_c (SV *Self, int inorder, int outorder) {
+  gf2_matrix_t   *self = mat_of(Self);
+  gf2_prepared_t *p;
+  SV *obj_ref, *obj;
+
+  p = gf2_matrix_prepare(self, inorder, outorder);
+  if (p == NULL) return &PL_sv_undef;
+
+  obj_ref = newSViv(0);
+  obj     = newSVrv(obj_ref, "Math::FastGF2::Matrix::Prepared");
+  sv_setiv(obj, (IV) p);
+  SvREADONLY_on(obj);
+  return obj_ref;
+}
+
+void prep_DESTROY (SV *Self) {
+  gf2_prepared_free((gf2_prepared_t*) SvIV(SvRV(Self)));
+}
+
+int prep_ROWS (SV *Self) {
+  return ((gf2_prepared_t*) SvIV(SvRV(Self)))->rows;
+}
+
+int prep_COLS (SV *Self) {
+  return ((gf2_prepared_t*) SvIV(SvRV(Self)))->cols;
+}
+
+int prep_WIDTH (SV *Self) {
+  return ((gf2_prepared_t*) SvIV(SvRV(Self)))->width;
+}
+
+/* as with mat_multiply_submatrix_c, the Perl code checks the args */
+int prep_multiply_submatrix_c (SV *Self, SV *Transform, SV *Result,
+			       int self_row,  int result_row, int nrows,
+			       int xform_col, int result_col, int ncols,
+			       int threads) {
+  gf2_prepared_t *p    = (gf2_prepared_t*) SvIV(SvRV(Self));
+  gf2_matrix_t *xform  = mat_of(Transform);
+  gf2_matrix_t *result = mat_of(Result);
+
+  return gf2_prepared_multiply(p, xform, result,
+			       self_row,  result_row, nrows,
+			       xform_col, result_col, ncols, threads);
+}
+
+/*
+  Other and Result are each either a matrix or a reference to a list
+  of one-row matrices, one for each row. Again, the Perl code checks
+  the args. Returns 0 on error.
+*/
+static char **prep_row_list (SV *List, gf2_matrix_t **m) {
+  AV    *av;
+  SV   **svp;
+  char **ptrs;
+  int    i, n;
+
+  if (SvTYPE(SvRV(List)) != SVt_PVAV) {
+    *m = mat_of(List);
+    return NULL;
+  }
+  *m   = NULL;
+  av   = (AV*) SvRV(List);
+  n    = av_len(av) + 1;
+  ptrs = malloc((n ? n : 1) * sizeof(char *));
+  if (ptrs == NULL) return NULL;
+  for (i=0; i < n; ++i) {
+    svp = av_fetch(av, i, 0);
+    ptrs[i] = mat_of(*svp)->values;
   }
+  return ptrs;
+}
 
-  gf2_u8   u8,  *u8_irp,  *u8_orp,  *u8_tcp,  *u8_ocp,  *u8_vip,  *u8_vtp;
-  gf2_u16 u16, *u16_irp, *u16_orp, *u16_tcp, *u16_ocp, *u16_vip, *u16_vtp;
-  gf2_u32 u32, *u32_irp, *u32_orp, *u32_tcp, *u32_ocp, *u32_vip, *u32_vtp;
+int prep_multiply_rows_c (SV *Self, SV *Other, SV *Result,
+			  int xform_col, int result_col, int ncols,
+			  int threads) {
+  gf2_prepared_t *p = (gf2_prepared_t*) SvIV(SvRV(Self));
+  gf2_matrix_t *xform, *result;
+  char **in_ptrs  = prep_row_list(Other,  &xform);
+  char **out_ptrs = prep_row_list(Result, &result);
+  int ok = 0;
+
+  if ((xform || in_ptrs) && (result || out_ptrs))
+    ok = gf2_prepared_multiply_rows(p, xform, in_ptrs, result, out_ptrs,
+				    xform_col, result_col, ncols, threads);
+  free(in_ptrs);
+  free(out_ptrs);
+  return ok;
+}
 
-  int r,c,v;
 
-  switch (self->width) {
-  case 1:
-    for (r=0,
-	   u8_irp=self->values   + idown * self_row,
-	   u8_orp=result->values + odown * result_row;
-	 r < nrows;
-	 ++r,  u8_irp += idown) {
-      for (c=0,
-	     u8_tcp=xform->values  + tright * xform_col,
-	     u8_ocp=result->values + oright * result_col;
-	   c < ncols;
-	   ++c, u8_tcp += tright, u8_ocp += oright) {
-	for (v=0,
-	       u8_vip=u8_irp, u8_vtp=u8_tcp,
-	       u8=gf2_mul8(*u8_vip,*u8_vtp);
-	     u8_vip += iright, u8_vtp += tdown,
-	       ++v < self->cols; ) {
-	  u8^=gf2_mul8(*u8_vip,*u8_vtp);
-	}
-	*(u8_ocp + r * odown) = u8;
-      }
-    }
-    break;
+/*
+  Gauss-Jordan solve and invert are done in clib/Matrix.c. As with
+  multiply_submatrix_c, the Perl code checks sizes and allocates the
+  result matrix. Both return 0 if the matrix is singular.
+*/
+int mat_solve_c (SV *Self, SV *Result) {
+  return gf2_matrix_solve(mat_of(Self),
+			  mat_of(Result));
+}
 
-    /* 
-       For 16- and 32-bit words, we have to divide offset values by
-       width whenever adding them to gf2_u16 or gf2_u32 pointers since
-       C increments them to point to the next word rather than the
-       next byte. Other than that (and passing the correct width
-       parameter to gf2_mul) there's no difference between the u8 and
-       u16/u32 multiplication code
-    */
+int mat_invert_c (SV *Self, SV *Result) {
+  return gf2_matrix_invert(mat_of(Self),
+			   mat_of(Result));
+}
 
-  case 2:
-    for (r=0, 
-	   u16_irp=(gf2_u16 *) (self->values   + idown * self_row), 
-	   u16_orp=(gf2_u16 *) (result->values + odown * result_row);
-	 r < nrows;
-	 ++r,  u16_irp +=(idown >> 1), u16_orp + (odown >> 1)) {
-      for (c=0,
-	     u16_tcp=(gf2_u16 *) (xform->values  + tright * xform_col),
-	     u16_ocp=(gf2_u16 *) (result->values + oright * result_col);
-	   c < ncols;
-	   ++c, u16_tcp += (tright >> 1), u16_ocp += (oright >> 1)) {
-	for (v=0, 
-	       u16_vip=u16_irp, u16_vtp=u16_tcp,
-	       u16=gf2_mul(16,*u16_vip,*u16_vtp);
-	     u16_vip += (iright >> 1), u16_vtp += (tdown >> 1),
-	       ++v < self->cols; ) {
-	  u16^=gf2_mul(16,*u16_vip,*u16_vtp);
-	}
-	*(u16_ocp + r * (odown >> 1)) = u16;
-      }
-    }
-    break;
-    
-  case 4:
-    for (r=0, 
-	   u32_irp=(gf2_u32 *) (self->values   + idown * self_row), 
-	   u32_orp=(gf2_u32 *) (result->values + odown * result_row);
-	 r < nrows;
-	 ++r,  u32_irp +=(idown >> 2), u32_orp + (odown >> 2)) {
-      for (c=0,
-	     u32_tcp=(gf2_u32 *) (xform->values  + tright * xform_col),
-	     u32_ocp=(gf2_u32 *) (result->values + oright * result_col);
-	   c < ncols;
-	   ++c, u32_tcp += (tright >> 2), u32_ocp += (oright >> 2)) {
-	for (v=0, 
-	       u32_vip=u32_irp, u32_vtp=u32_tcp,
-	       u32=gf2_mul(32,*u32_vip,*u32_vtp);
-	     u32_vip += (iright >> 2), u32_vtp += (tdown >> 2),
-	       ++v < self->cols; ) {
-	  u32^=gf2_mul(32,*u32_vip,*u32_vtp);
-	}
-	*(u32_ocp + r * (odown >> 2)) = u32;
-      }
-    }
-    break;
-    
-  default:
-    fprintf(stderr,
-       "Unsupported width %d in multiply_submatrix_c\n",self->width);
+/*
+  Fill in an inverse Cauchy matrix. Xylist is the full key (x values
+  followed by k y values) and Sharelist holds the indexes of the k x
+  values (shares) to use. Returns 0 if the values aren't distinct.
+*/
+int mat_inverse_cauchy_c (SV *Self, SV *Xylist, SV *Sharelist) {
+  gf2_matrix_t *self = mat_of(Self);
+  AV      *key    = (AV*) SvRV(Xylist);
+  AV      *shares = (AV*) SvRV(Sharelist);
+  int      k      = self->rows;
+  int      keylen = av_len(key) + 1;
+  gf2_u32 *xy;
+  SV     **svp;
+  int      i, idx, ok;
+
+  if ((av_len(shares) + 1 != k) || (keylen < 2 * k)) return 0;
+  xy = malloc(2 * k * sizeof(gf2_u32));
+  if (xy == NULL) return 0;
+
+  for (i=0; i < k; ++i) {
+    svp = av_fetch(shares, i, 0);
+    idx = svp ? SvIV(*svp) : -1;
+    if ((idx < 0) || (idx >= keylen - k)) { free(xy); return 0; }
+    svp = av_fetch(key, idx, 0);
+    xy[i] = svp ? SvUV(*svp) : 0;
+    svp = av_fetch(key, keylen - k + i, 0);
+    xy[k + i] = svp ? SvUV(*svp) : 0;
+  }
+  ok = gf2_matrix_inverse_cauchy(self, xy, xy + k);
+  free(xy);
+  return ok;
+}
+
+/*
+  Run gf2_process_streams with file descriptors for all the input and
+  output streams. Fillfds and Emptyfds are lists of fds; Aligns gives
+  the eof padding for each filler. Xform can also be a prepared
+  transform, in which case inorder and outorder are ignored (they were
+  given when it was prepared). Returns the number of bytes read, or
+  undef on error.
+*/
+SV *mat_process_streams_fd_c (SV *Xform, SV *In, SV *Fillfds, SV *Aligns,
+			      SV *Out, SV *Emptyfds, NV bytes,
+			      int inorder, int outorder) {
+  AV *fillfds  = (AV*) SvRV(Fillfds);
+  AV *aligns   = (AV*) SvRV(Aligns);
+  AV *emptyfds = (AV*) SvRV(Emptyfds);
+  int fillers  = av_len(fillfds)  + 1;
+  int emptiers = av_len(emptyfds) + 1;
+  struct gf2_streambuf_control *ctl;
+  struct gf2_fd_stream *fds;
+  SV   **svp;
+  OFF_T  rc;
+  int    i, align;
+
+  if (fillers < 1 || emptiers < 1) return &PL_sv_undef;
+  ctl = calloc(fillers + emptiers, sizeof(struct gf2_streambuf_control));
+  fds = calloc(fillers + emptiers, sizeof(struct gf2_fd_stream));
+  if (ctl == NULL || fds == NULL) {
+    free(ctl);
+    free(fds);
+    return &PL_sv_undef;
   }
+
+  for (i=0; i < fillers; ++i) {
+    svp   = av_fetch(aligns, i, 0);
+    align = svp ? SvIV(*svp) : 0;
+    svp   = av_fetch(fillfds, i, 0);
+    gf2_fd_filler(ctl + i, fds + i, svp ? SvIV(*svp) : -1, align);
+  }
+  for (i=0; i < emptiers; ++i) {
+    svp = av_fetch(emptyfds, i, 0);
+    gf2_fd_emptier(ctl + fillers + i, fds + fillers + i,
+		   svp ? SvIV(*svp) : -1);
+  }
+
+  if (sv_derived_from(Xform, "Math::FastGF2::Matrix::Prepared"))
+    rc = gf2_prepared_process_streams
+      ((gf2_prepared_t*) SvIV(SvRV(Xform)),
+       mat_of(In),  ctl, fillers,
+       mat_of(Out), ctl + fillers,
+       emptiers, (OFF_T) bytes);
+  else
+    rc = gf2_process_streams(mat_of(Xform),
+			     mat_of(In),  ctl, fillers,
+			     mat_of(Out), ctl + fillers,
+			     emptiers, (OFF_T) bytes, inorder, outorder);
+  free(ctl);
+  free(fds);
+  return (rc < 0) ? &PL_sv_undef : newSVnv((NV) rc);
 }
 
+/*
+  The same, but through gf2_pipeline_fds, so that reading, multiplying
+  and writing all go on at once in separate threads. There are no
+  buffer matrices to pass in; the pipeline has nbufs buffers of cols
+  columns each (0 for defaults) and workers compute threads (0 for
+  the pool's setting). flags are the GF2_PIPE_* flags. If Hashes is
+  an array ref, it's filled with the SHA-256 digest of each input then
+  each output stream (32-byte strings).
+*/
+SV *mat_pipeline_fd_c (SV *Xform, SV *Fillfds, SV *Aligns, SV *Emptyfds,
+		       NV bytes, int inorder, int outorder,
+		       int cols, int nbufs, int workers, int flags,
+		       SV *Hashes) {
+  AV *fillfds  = (AV*) SvRV(Fillfds);
+  AV *aligns   = (AV*) SvRV(Aligns);
+  AV *emptyfds = (AV*) SvRV(Emptyfds);
+  int fillers  = av_len(fillfds)  + 1;
+  int emptiers = av_len(emptyfds) + 1;
+  AV *hashav   = (SvROK(Hashes) && SvTYPE(SvRV(Hashes)) == SVt_PVAV) ?
+    (AV*) SvRV(Hashes) : NULL;
+  gf2_prepared_t *prep;
+  unsigned char *hashes = NULL;
+  int  *fds;
+  SV  **svp;
+  OFF_T rc;
+  int   i, own = 0;
+
+  if (fillers < 1 || emptiers < 1) return &PL_sv_undef;
+  fds = calloc(2 * fillers + emptiers, sizeof(int));
+  if (fds == NULL) return &PL_sv_undef;
+  if (hashav) {
+    hashes = malloc((fillers + emptiers) * GF2_SHA256_LEN);
+    if (hashes == NULL) {
+      free(fds);
+      return &PL_sv_undef;
+    }
+  }
+  for (i=0; i < fillers; ++i) {
+    svp = av_fetch(fillfds, i, 0);
+    fds[i] = svp ? SvIV(*svp) : -1;
+    svp = av_fetch(aligns, i, 0);
+    fds[fillers + i] = svp ? SvIV(*svp) : 0;
+  }
+  for (i=0; i < emptiers; ++i) {
+    svp = av_fetch(emptyfds, i, 0);
+    fds[2 * fillers + i] = svp ? SvIV(*svp) : -1;
+  }
+
+  if (sv_derived_from(Xform, "Math::FastGF2::Matrix::Prepared")) {
+    prep = (gf2_prepared_t*) SvIV(SvRV(Xform));
+  } else {
+    prep = gf2_matrix_prepare(mat_of(Xform),
+			      inorder, outorder);
+    own  = 1;
+  }
+  rc = prep ? gf2_pipeline_fds(prep, fillers, fds, fds + fillers,
+			       emptiers, fds + 2 * fillers, (OFF_T) bytes,
+			       cols, nbufs, workers, flags, hashes) : -1;
+  if (own && prep) gf2_prepared_free(prep);
+  if (hashav && rc >= 0) {
+    av_clear(hashav);
+    for (i=0; i < fillers + emptiers; ++i)
+      av_push(hashav, newSVpvn((char *) hashes + i * GF2_SHA256_LEN,
+			       GF2_SHA256_LEN));
+  }
+  free(hashes);
+  free(fds);
+  return (rc < 0) ? &PL_sv_undef : newSVnv((NV) rc);
+}
 
 /* No error checking, so don't call directly */
 int mat_values_eq_c (SV *This, SV *That) {
-  gf2_matrix_t *this  = (gf2_matrix_t*) SvIV(SvRV(This));
-  gf2_matrix_t *that  = (gf2_matrix_t*) SvIV(SvRV(That));
+  gf2_matrix_t *this  = mat_of(This);
+  gf2_matrix_t *that  = mat_of(That);
 
   int   thisdown, thisright;
   int   thatdown, thatright;
@@ -375,7 +664,7 @@ int mat_values_eq_c (SV *This, SV *That) {
 
 SV* mat_get_raw_values_c (SV *Self, int row, int col, 
 			  int words, int byteorder) {
-  gf2_matrix_t *self  = (gf2_matrix_t*) SvIV(SvRV(Self));
+  gf2_matrix_t *self  = mat_of(Self);
   char *from_start = self->values + 
     gf2_matrix_offset_down(self) * row +
     gf2_matrix_offset_right(self) * col;
@@ -409,7 +698,7 @@ SV* mat_get_raw_values_c (SV *Self, int row, int col,
 // get_raw_values_c, it does bounds checking.
 SV* mat_getvals_str (SV *Self, int row, int col, 
 		       int words, int byteorder) {
-  gf2_matrix_t *self  = (gf2_matrix_t*) SvIV(SvRV(Self));
+  gf2_matrix_t *self  = mat_of(Self);
 
   int errors = 0;
   if ((byteorder < 0) || (byteorder > 2)) ++errors;
@@ -421,8 +710,14 @@ SV* mat_getvals_str (SV *Self, int row, int col,
     gf2_matrix_offset_down(self) * row +
     gf2_matrix_offset_right(self) * col;
   char *to_start;
+  /* don't read past the end of the matrix */
+  size_t room = (size_t) self->rows * self->cols * self->width -
+    (size_t) (from_start - self->values);
+  if ((words < 0) || (size_t) words > room / self->width)
+    return &PL_sv_undef;
   int len=self->width * words;
-  SV *Str=newSVpv(from_start, len);
+  /* newSVpv would take a zero len to mean strlen */
+  SV *Str=newSVpvn(from_start, len);
   int native_byteorder=mat_local_byte_order();
   char *from, *to;
   int i,j;
@@ -448,7 +743,7 @@ void mat_set_raw_values_c (SV *Self, int row, int col,
 			   int words, int byteorder,
 			   SV *Str) {
 
-  gf2_matrix_t *self  = (gf2_matrix_t*) SvIV(SvRV(Self));
+  gf2_matrix_t *self  = mat_of(Self);
   int len=self->width * words;
   char *from_start;
   char *to_start= self->values + 
@@ -478,7 +773,7 @@ void mat_set_raw_values_c (SV *Self, int row, int col,
 void mat_setvals_str (SV *Self, int row, int col, 
 		      SV *Str, int byteorder ) {
 
-  gf2_matrix_t *self  = (gf2_matrix_t*) SvIV(SvRV(Self));
+  gf2_matrix_t *self  = mat_of(Self);
 
   int errors = 0;
   if ((byteorder < 0) || (byteorder > 2)) ++errors;
@@ -496,6 +791,13 @@ void mat_setvals_str (SV *Self, int row, int col,
   char *from, *to;
   int i,j;
 
+  /* don't write past the end of the matrix */
+  STRLEN slen;
+  (void) SvPV(Str,slen);
+  if (slen > (size_t) self->rows * self->cols * self->width -
+      (size_t) (to_start - self->values))
+    return;
+
   if ( (width > 1) && byteorder &&
        (native_byteorder != byteorder) ) {
     int words;
@@ -518,7 +820,7 @@ void mat_setvals_str (SV *Self, int row, int col,
 /* new code to implement previous offset_to_rowcol */
 void mat_offset_to_rowcol (SV *Self, int offset, int *row, int *col) {
 
-  gf2_matrix_t *self  = (gf2_matrix_t*) SvIV(SvRV(Self));
+  gf2_matrix_t *self  = mat_of(Self);
   int width = self->width;
   int cols  = self->cols;
   int rows  = self->rows;
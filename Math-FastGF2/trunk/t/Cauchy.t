@@ -194,6 +194,59 @@ ok($cauchy->eq($mat4_key), "New (4,4) matrix same as for old code");
 # I can't see the need to do any more testing on new_cauchy ...  The
 # above should have proved that it works as expected.
 
+# new_inverse_cauchy (closed form, in C) against Gaussian elimination
+# for all widths, with shares picked out of order
+for my $w (1, 2, 4) {
+    my $hi = $w == 1 ? 0 : 1 << (8 * $w - 2); # use high bits if we can
+    my @x = map { $hi + $_ } (10..19);
+    my @y = map { $hi + $_ } (30..35);
+    my @shares = (9,2,5,0,7,3);
+    my $full = Math::FastGF2::Matrix->
+	new_cauchy(xvals => \@x, yvals => \@y, width => $w);
+    my $sub  = $full->copy_rows(@shares);
+    my $inv  = Math::FastGF2::Matrix->
+	new_inverse_cauchy(size => 6, width => $w, xylist => [@x, @y],
+			   xvals => \@shares);
+    ok($inv->eq($sub->invert), "closed-form inverse, width $w");
+}
+eval {
+    Math::FastGF2::Matrix->
+	new_inverse_cauchy(size => 2, width => 1, xylist => [1,2,3,3],
+			   xvals => [0,1]);
+};
+ok($@, "new_inverse_cauchy dies on repeated values");
+
+# systematic: identity on top, Cauchy rows below. The identity rows
+# are copied by the multiply, so check the product as well as that
+# any k rows can be inverted.
+for my $w (1, 2, 4) {
+    my $sys = Math::FastGF2::Matrix->
+	new_cauchy(xvals => [1..8], yvals => [9..14], width => $w,
+		   systematic => 1);
+    my $full = Math::FastGF2::Matrix->
+	new_cauchy(xvals => [1..8], yvals => [9..14], width => $w);
+    ok($sys->copy_rows(0..5)->eq(Math::FastGF2::Matrix->new_identity
+				 (size => 6, width => $w)),
+       "systematic Cauchy has identity on top, width $w");
+    ok($sys->copy_rows(6,7)->eq($full->copy_rows(6,7)),
+       "systematic Cauchy rows below, width $w");
+    ok(defined($sys->copy_rows(7,0,6,2,3,5)->invert),
+       "systematic Cauchy submatrix inverts, width $w");
+
+    my $in = Math::FastGF2::Matrix->
+	new(rows => 6, cols => 1000, width => $w, org => "colwise");
+    $in->setvals(0,0,join "", map { chr int rand 256 } 1 .. 6000 * $w);
+    my $out = $sys->multiply($in);
+    my $ok  = 1;
+    for my $r (0 .. 5) {
+	$ok = 0 unless $out->getvals_str($r,0,1000,0) eq
+	    $in->copy_rows($r)->reorganise->getvals_str(0,0,1000,0);
+    }
+    ok($ok, "systematic split copies data rows, width $w");
+    ok($out->copy_rows(6,7)->eq($full->copy_rows(6,7)->multiply($in)),
+       "systematic split parity rows, width $w");
+}
+
 done_testing;
 exit;
 
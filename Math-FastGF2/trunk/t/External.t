@@ -0,0 +1,165 @@
+# -*- Perl -*-
+
+# Matrices whose values live in a Perl string or an mmap'd file
+# (new_from_string and new_from_file) instead of their own buffer,
+# including a prepared multiply straight into a set of mapped files.
+
+use strict;
+use warnings;
+
+use Test::More tests => 30;
+use File::Temp qw(tempfile);
+
+BEGIN { use_ok('Math::FastGF2::Matrix') };
+
+my $class="Math::FastGF2::Matrix";
+
+# string: values are shared both ways
+my $buf="abcdefgh";
+my $m=$class->new_from_string(rows => 2, cols => 4, width => 1,
+			      string => \$buf);
+ok(defined($m), "new_from_string");
+is($m->getval(0,1), ord "b", "reads string contents");
+is($m->getval(1,0), ord "e", "rowwise layout");
+$m->setval(1,3,ord "H");
+is($buf, "abcdefgH", "setval writes through to string");
+substr($buf, 0, 1, "A");
+is($m->getval(0,0), ord "A", "in-place change to string seen by matrix");
+
+# offset and extending a short string
+my $short="xy";
+$m=$class->new_from_string(rows => 2, cols => 2, width => 2,
+			   org => "colwise", string => \$short, offset => 2);
+is(length($short), 10, "short string extended");
+is($m->getval(1,1), 0, "extension is zero-filled");
+$m->setval(0,1,0x1234);
+is(unpack("S", substr($short, 6, 2)), 0x1234, "colwise offset in string");
+
+# lifetime: matrix keeps the string alive
+{
+  my $tmp="\x01\x02\x03\x04";
+  $m=$class->new_from_string(rows => 1, cols => 4, width => 1,
+			     string => \$tmp);
+}
+is($m->getval(0,3), 4, "string outlives its scope");
+undef $m;
+
+# the string can grow or be assigned to; the matrix follows it
+{
+  my $s="abcd";
+  my $g=$class->new_from_string(rows => 1, cols => 4, width => 1,
+				string => \$s);
+  $s .= "y" x 1e6;
+  $g->setvals_str(0,0,"WXYZ",0);
+  is(substr($s, 0, 4), "WXYZ", "matrix follows string that grew");
+  $s="pqrs" . "z" x 10;
+  is($g->getvals_str(0,0,4,0), "pqrs", "matrix follows assigned string");
+  my $other="mnop";
+  $s=$other;
+  $g->setvals_str(0,0,"ABCD",0);
+  ok($s eq "ABCD" && $other eq "mnop",
+     "writing doesn't touch a string assigned from");
+  $s="x";
+  ok(!eval { $g->getvals_str(0,0,4,0); 1 }, "croaks if string too short");
+  $s="abcd";
+  is($g->getval(0,3), ord "d", "usable again once long enough");
+}
+
+# read-only strings are refused
+{
+  local $SIG{__WARN__}=sub {};
+  ok(!defined($class->new_from_string(rows => 1, cols => 1, width => 1,
+				      string => \"constant")),
+     "read-only string refused");
+}
+
+# multiply straight from one string into another
+my $in =join "", map { chr int rand 256 } 1 .. 3 * 100;
+my $out="";
+my $xform=$class->new_cauchy(org => "rowwise", width => 1,
+			     xvals => [1 .. 5], yvals => [6 .. 8]);
+my $min=$class->new_from_string(rows => 3, cols => 100, width => 1,
+				org => "colwise", string => \$in);
+my $mout=$class->new_from_string(rows => 5, cols => 100, width => 1,
+				 string => \$out);
+$xform->multiply($min,$mout);
+my $ref=$xform->multiply($min);
+ok($mout->eq($ref), "multiply between wrapped strings");
+is($out, $ref->getvals_str(0,0,500,0), "result is in output string");
+
+# files
+my ($fh,$name)=tempfile(UNLINK => 1);
+binmode $fh;
+print $fh "0123456789" x 10;
+close $fh;
+
+$m=$class->new_from_file(rows => 4, cols => 4, width => 1,
+			 file => $name, offset => 10);
+ok(defined($m), "new_from_file (read-only)");
+is($m->getvals_str(0,0,16,0), "0123456789012345", "file contents at offset");
+$m->setval(0,0,ord "X");
+is($m->getval(0,0), ord "X", "private mapping can be changed");
+undef $m;
+open $fh, "<", $name; binmode $fh;
+is(scalar(<$fh>), "0123456789" x 10, "file not changed by private mapping");
+close $fh;
+
+{
+  local $SIG{__WARN__}=sub {};
+  ok(!defined($class->new_from_file(rows => 100, cols => 100, width => 1,
+				    file => $name)),
+     "read-only mapping past end of file refused");
+}
+
+# writable, with an offset that isn't page-aligned, extending the file
+open $fh, "+<", $name; binmode $fh;
+$m=$class->new_from_file(rows => 2, cols => 50, width => 2,
+			 fh => $fh, offset => 5001, writable => 1);
+ok(defined($m), "new_from_file (writable, via fh)");
+$m->setvals(0,0,[1 .. 100]);
+undef $m;
+is(-s $name, 5201, "file extended to fit");
+seek $fh, 5001, 0;
+read $fh, my $got, 200;
+is_deeply([unpack "S*", $got], [1 .. 100], "changes written to file");
+close $fh;
+
+# mapping outlives the handle
+$m=$class->new_from_file(rows => 1, cols => 10, width => 1, file => $name);
+is($m->getvals_str(0,0,10,0), "0123456789", "mapping usable after close");
+
+# madvise hint
+$m=$class->new_from_file(rows => 1, cols => 10, width => 1, file => $name,
+			 advise => "sequential");
+is($m->getvals_str(0,0,10,0), "0123456789", "mapping with advise");
+{
+  local $SIG{__WARN__}=sub {};
+  ok(!defined($class->new_from_file(rows => 1, cols => 10, width => 1,
+				    file => $name, advise => "often")),
+     "bad advise value refused");
+}
+
+# split into three mapped "share" files and compare with a plain multiply
+{
+  my $xform=$class->new(rows => 3, cols => 2, width => 1);
+  $xform->setvals(0,0,[1, 2, 3, 4, 5, 6]);
+  my $in=$class->new_from_string(rows => 2, cols => 5000, width => 1,
+				 org => "colwise",
+				 string => \(join "", map { chr } (0 .. 255) x 40));
+  my @names=map { (tempfile(UNLINK => 1))[1] } 1 .. 3;
+  my @shares=map { $class->new_from_file(rows => 1, cols => 5000, width => 1,
+					 file => $_, offset => 7,
+					 writable => 1) } @names;
+  $xform->prepare->multiply($in, \@shares);
+  @shares=();
+  my $want=$xform->multiply($in);
+  my $same=1;
+  for my $i (0 .. 2) {
+    open $fh, "<", $names[$i]; binmode $fh;
+    seek $fh, 7, 0;
+    read $fh, $got, 5000;
+    close $fh;
+    $same=0 unless $got eq $want->getvals_str($i,0,5000,0);
+  }
+  ok($same, "prepared multiply into mapped rows");
+}
@@ -1,6 +1,6 @@
 # -*- Perl -*-
 
-use Test::More tests => 59;
+use Test::More tests => 61;
 BEGIN { use_ok('Math::FastGF2', ':all') };
 
 # just a few random multiplies first
@@ -194,3 +194,9 @@ ok(gf2_info(32) == 0x8d,   "poly for u32 != {10000008d}");
 
 # Also check on the table space used by the library
 ok(gf2_info(0) == 19968,   "table space != 19.5 Kbytes");
+
+# cache sizes are 0 when unknown, and otherwise grow with the level
+my @cache=map { Math::FastGF2::gf2_cache_size($_) } 1 .. 3;
+ok(!grep({ $_ < 0 } @cache), "cache sizes not negative");
+ok(!$cache[0] || !$cache[1] || $cache[0] <= $cache[1],
+   "L1 no bigger than L2");
@@ -1,6 +1,6 @@
 # -*- Perl -*-
 
-use Test::More tests => 195;
+use Test::More tests => 219;
 BEGIN { use_ok('Math::FastGF2::Matrix', ':all') };
 
 my $failed;
@@ -837,3 +837,81 @@ ok ($copy->eq($tr_5x4),
 ok ($copy->ORG ne $mat_5x4->ORG,
     "transpose: yes, org: different returns different ORG?");
 
+
+# Gauss-Jordan solve/invert corner cases: zero on the diagonal (needs
+# a row swap), singular matrices and COLWISE organisation
+for my $w (1,2,4) {
+  my $swap=Math::FastGF2::Matrix->new(rows=>3, cols =>3, width=>$w);
+  $swap->setvals(0,0,[0,1,0, 1,0,0, 0,0,1]);
+  my $inv=$swap->invert;
+  ok (defined($inv) and $inv->eq($swap),
+      "invert $w-byte matrix with zero on diagonal?");
+
+  my $singular=Math::FastGF2::Matrix->new(rows=>2, cols =>2, width=>$w);
+  $singular->setvals(0,0,[3,5, 3,5]);
+  ok (!defined($singular->invert), "singular $w-byte matrix won't invert?");
+
+  my $colwise=Math::FastGF2::Matrix->new(rows=>3, cols =>3, width=>$w,
+					 org => "colwise");
+  $colwise->setvals(0,0,[2,3,4, 7,0,9, 1,1,8]);
+  $inv=$colwise->invert;
+  ok (defined($inv) and $inv->ORG eq "colwise" and
+      $colwise->multiply($inv)->eq(Math::FastGF2::Matrix->new_identity
+				   (size => 3, width => $w)),
+      "invert $w-byte colwise matrix?");
+
+  my $eqns=Math::FastGF2::Matrix->new(rows=>2, cols =>3, width=>$w);
+  $eqns->setvals(0,0,[0,1,7, 1,1,4]);
+  my $sol=$eqns->solve;
+  ok (defined($sol) and $sol->getval(0,0) == 3 and $sol->getval(1,0) == 7,
+      "solve $w-byte equations x=3, y=7?");
+}
+
+# inverse cache: second invert of the same values is a hit, and gives
+# back a separate (but equal) matrix
+Math::FastGF2::Matrix->inverse_cache_clear;
+my $m=Math::FastGF2::Matrix->new(rows=>3, cols =>3, width=>2);
+$m->setvals(0,0,[2,3,4, 7,0,9, 1,1,8]);
+my $inv1=$m->invert;
+my $inv2=$m->invert;
+is_deeply([Math::FastGF2::Matrix->inverse_cache_stats], [1,1,1],
+	  "inverse cache: one miss then one hit");
+ok ($inv1->eq($inv2), "cached inverse is the same");
+$inv2->setval(0,0,0);
+ok ($m->invert->eq($inv1), "changing returned inverse doesn't touch cache");
+
+my @cauchy=(size => 3, width => 1, xylist => [1 .. 8], xvals => [4,0,2]);
+my $c1=Math::FastGF2::Matrix->new_inverse_cauchy(@cauchy);
+my $c2=Math::FastGF2::Matrix->new_inverse_cauchy(@cauchy);
+my $c3=Math::FastGF2::Matrix->new_inverse_cauchy(@cauchy, xvals => [4,0,1]);
+my ($hits,$misses)=Math::FastGF2::Matrix->inverse_cache_stats;
+ok ($hits == 3 and $misses == 3 and $c1->eq($c2) and !$c1->eq($c3),
+    "inverse cache keyed on Cauchy key and xvals");
+
+# least recently used entry goes first
+$m->invert;			# hit; now newer than $c1's entry
+is (Math::FastGF2::Matrix->inverse_cache(2), 2, "set inverse cache size");
+my $entries=(Math::FastGF2::Matrix->inverse_cache_stats)[2];
+Math::FastGF2::Matrix->new_inverse_cauchy(@cauchy);
+$m->invert;
+($hits,$misses)=Math::FastGF2::Matrix->inverse_cache_stats;
+ok ($entries == 2 and $hits == 5 and $misses == 4,
+    "least recently used entry dropped");
+
+Math::FastGF2::Matrix->inverse_cache(0);
+Math::FastGF2::Matrix->inverse_cache_clear;
+$m->invert;
+is_deeply([Math::FastGF2::Matrix->inverse_cache_stats], [0,0,0],
+	  "inverse cache can be disabled");
+is (Math::FastGF2::Matrix->inverse_cache(64), 64, "restore inverse cache");
+
+# string get/set stay within the matrix; zero words gets nothing
+my $s=Math::FastGF2::Matrix->new(rows => 2, cols => 4, width => 1,
+				 org => "rowwise");
+$s->setvals_str(0,0,"abcdefgh",0);
+is ($s->getvals_str(1,1,0,0), "", "getvals_str of zero words");
+ok (!defined($s->getvals_str(1,1,4,0)), "getvals_str past end of matrix");
+$s->setvals_str(1,2,"xyz",0);
+is ($s->getvals_str(0,0,8,0), "abcdefgh", "setvals_str past end ignored");
+$s->setvals_str(1,1,"xyz",0);
+is ($s->getvals_str(1,1,3,0), "xyz", "string get/set up to end of matrix");
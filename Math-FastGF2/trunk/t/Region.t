@@ -0,0 +1,331 @@
+# -*- Perl -*-
+
+# Check the region (SIMD) kernels and the other fast paths of the
+# matrix multiply against plain gf2_mul, and against each other.
+
+use Test::More tests => 105;
+BEGIN { use_ok('Math::FastGF2', ':all') };
+BEGIN { use_ok('Math::FastGF2::Matrix') };
+
+my $class="Math::FastGF2::Matrix";
+
+# the kernel picked at load time, and selecting by name
+my $best=Math::FastGF2::gf2_region_kernel();
+ok(defined($best) and $best =~ /^(scalar|ssse3|avx2|avx512bw)$/,
+   "default kernel is '$best'");
+ok(!Math::FastGF2::gf2_region_select("no_such_kernel"),
+   "selecting unknown kernel fails");
+ok(Math::FastGF2::gf2_region_kernel() eq $best,
+   "failed select leaves kernel unchanged");
+
+srand(1);
+
+sub random_matrix {
+  my ($rows,$cols,$org,$width)=@_;
+  $width=1 unless defined $width;
+  my $m=$class->new(rows=>$rows, cols=>$cols, width=>$width, org=>$org);
+  $m->setvals(0,0,join "", map { chr int rand 256 }
+	      1 .. $rows * $cols * $width);
+  return $m;
+}
+
+# check $r == $a x $b using plain gf2_mul
+sub check_product {
+  my ($a,$b,$r)=@_;
+  my $bits=$a->WIDTH * 8;
+  for my $row (0 .. $a->ROWS - 1) {
+    for my $col (0 .. $b->COLS - 1) {
+      my $sum=0;
+      for my $v (0 .. $a->COLS - 1) {
+	$sum ^= gf2_mul($bits, $a->getval($row,$v), $b->getval($v,$col));
+      }
+      return 0 unless $sum == $r->getval($row,$col);
+    }
+  }
+  return 1;
+}
+
+# each kernel available on this machine against gf2_mul. Column
+# counts exercise the tail code in each kernel and span more than one
+# panel.
+for my $kernel (qw(scalar ssse3 avx2 avx512bw)) {
+ SKIP: {
+    skip "$kernel kernel not supported on this machine", 14
+      unless Math::FastGF2::gf2_region_select($kernel);
+    ok(Math::FastGF2::gf2_region_kernel() eq $kernel,
+       "selected $kernel kernel");
+
+    # IDA split layout: rowwise transform, colwise input, rowwise output
+    for my $cols (1, 63, 1100) {
+      my $xform=random_matrix(6,4,"rowwise");
+      my $in   =random_matrix(4,$cols,"colwise");
+      my $out  =$xform->multiply($in);
+      ok(check_product($xform,$in,$out), "$kernel split, $cols columns");
+    }
+
+    # IDA combine layout: rowwise inverse, rowwise input, colwise output
+    for my $cols (17, 129) {
+      my $inv  =random_matrix(3,3,"rowwise");
+      my $in   =random_matrix(3,$cols,"rowwise");
+      my $out  =$class->new(rows=>3, cols=>$cols, width=>1, org=>"colwise");
+      $inv->multiply($in,$out);
+      ok(check_product($inv,$in,$out), "$kernel combine, $cols columns");
+    }
+
+    # all rowwise and all colwise
+    for my $org ("rowwise", "colwise") {
+      my $a=random_matrix(5,7,$org);
+      my $b=random_matrix(7,33,$org);
+      ok(check_product($a,$b,$a->multiply($b)), "$kernel, all $org");
+    }
+
+    # zero and identity coefficients take a shortcut
+    my $m=$class->new(rows=>2, cols=>2, width=>1);
+    $m->setvals(0,0,"\x00\x01\x01\x00");
+    my $in=random_matrix(2,100,"rowwise");
+    ok(check_product($m,$in,$m->multiply($in)), "$kernel, 0/1 coefficients");
+
+    # 16- and 32-bit kernels (long enough to use tables, plus a tail)
+    for my $width (2, 4) {
+      my $xform=random_matrix(3,4,"rowwise",$width);
+      my $in   =random_matrix(4,77,"colwise",$width);
+      ok(check_product($xform,$in,$xform->multiply($in)),
+	 "$kernel split, width $width");
+    }
+
+    # byte swapping folded into the multiply must match converting
+    # the data with setvals_str/getvals_str
+    for my $width (2, 4) {
+      my $ok=1;
+      for my $cols (5, 77) {
+	my $xform=random_matrix(3,4,"rowwise",$width);
+	my $raw  =join "", map { chr int rand 256 } 1 .. 4 * $cols * $width;
+	for my $orders ([1,2], [2,1], [2,2], [0,2]) {
+	  my ($inorder, $outorder)=@$orders;
+	  my $in=$class->new(rows=>4, cols=>$cols, width=>$width, org=>"colwise");
+	  $in->setvals_str(0,0,$raw,$inorder);
+	  my $want=$xform->multiply($in)->getvals_str(0,0,3 * $cols,$outorder);
+	  $in->setvals_str(0,0,$raw,0);
+	  my $got=$xform->multiply($in,undef,1,$inorder,$outorder)
+	    ->getvals_str(0,0,3 * $cols,0);
+	  $ok=0 unless $got eq $want;
+	}
+      }
+      ok($ok, "$kernel split with byte order conversion, width $width");
+    }
+
+    # unrolled kernels for each k built in must match the generic code
+    my $ok=1;
+    for my $k (Math::FastGF2::gf2_fixed_kernels()) {
+      my $xform=random_matrix($k + 2,$k,"rowwise");
+      my $in   =random_matrix($k,1100,"colwise");
+      my $inv  =random_matrix($k,$k,"rowwise");
+      my $rows =random_matrix($k,333,"rowwise");
+      my $out  =$class->new(rows=>$k, cols=>333, width=>1, org=>"colwise");
+      my $split=$xform->multiply($in);
+      $inv->multiply($rows,$out);
+      Math::FastGF2::gf2_fixed_enable(0);
+      my $want_split=$xform->multiply($in);
+      my $want_comb =$class->new(rows=>$k, cols=>333, width=>1,
+				 org=>"colwise");
+      $inv->multiply($rows,$want_comb);
+      Math::FastGF2::gf2_fixed_enable(1);
+      $ok=0 unless $split->eq($want_split) and $out->eq($want_comb);
+    }
+    ok($ok, "$kernel unrolled kernels for k in (" .
+       join(",", Math::FastGF2::gf2_fixed_kernels()) . ")");
+  }
+}
+
+# switching the unrolled kernels off and on
+ok(Math::FastGF2::gf2_fixed_enable(-1), "unrolled kernels on by default");
+is(Math::FastGF2::gf2_fixed_enable(0), 1, "switch unrolled kernels off");
+ok(!Math::FastGF2::gf2_fixed_enable(1), "and back on");
+ok(!grep({ $_ < 2 or $_ > 64 } Math::FastGF2::gf2_fixed_kernels()),
+   "unrolled kernel k values in range");
+
+# "" goes back to the best kernel for this machine
+ok(Math::FastGF2::gf2_region_select(""), "select fastest kernel again");
+ok(Math::FastGF2::gf2_region_kernel() eq $best, "back to '$best'");
+
+# 16- and 32-bit multiplies in split and combine layouts, with enough
+# columns to need more than one panel
+for my $width (2, 4) {
+  my $bits=$width * 8;
+  my $cols=1100 / $width;
+  my $xform=random_matrix(5,3,"rowwise",$width);
+  my $in   =random_matrix(3,$cols,"colwise",$width);
+  ok(check_product($xform,$in,$xform->multiply($in)),
+     "$bits-bit split, $cols columns");
+
+  my $inv  =random_matrix(3,3,"rowwise",$width);
+  $in      =random_matrix(3,$cols,"rowwise",$width);
+  my $out  =$class->new(rows=>3, cols=>$cols, width=>$width, org=>"colwise");
+  $inv->multiply($in,$out);
+  ok(check_product($inv,$in,$out), "$bits-bit combine, $cols columns");
+
+  my $a=random_matrix(4,4,"colwise",$width);
+  my $b=random_matrix(4,9,"colwise",$width);
+  ok(check_product($a,$b,$a->multiply($b)), "$bits-bit, all colwise");
+}
+
+# 32-bit single multiplies use PCLMULQDQ when the selected kernel is
+# not "scalar" and the CPU has it. They must agree bit-for-bit with the
+# table code and with a plain shift-and-add multiply.
+sub shift_add_mul32 {
+  my ($a,$b)=@_;
+  my $p=0;
+  for (0..31) {
+    $p ^= $a if $b & 1;
+    $b >>= 1;
+    $a = (($a << 1) & 0xffffffff) ^ (($a & 0x80000000) ? 0x8d : 0);
+  }
+  return $p;
+}
+
+my @pairs=map { [int rand 2**32, int rand 2**32] } 1 .. 2000;
+push @pairs, map { [1 << $_, 0xffffffff] } 0 .. 31;
+push @pairs, [0x80000000, 0x80000000], [0, 0x12345678], [0xffffffff, 1];
+
+ok(Math::FastGF2::gf2_region_select("scalar"), "select scalar tables");
+my @table=map { gf2_mul(32, $_->[0], $_->[1]) } @pairs;
+ok(Math::FastGF2::gf2_region_select(""), "select fastest kernel for clmul");
+my @fast=map { gf2_mul(32, $_->[0], $_->[1]) } @pairs;
+my @ref =map { shift_add_mul32(@$_) } @pairs;
+ok("@table" eq "@ref" && "@fast" eq "@ref",
+   "32-bit multiply agrees with tables and shift-and-add");
+
+# Multi-threaded multiply must give the same answer as one thread for
+# split and combine layouts, including column counts that don't divide
+# evenly between threads and results that don't start on a cache line.
+is(Math::FastGF2::Matrix->threads, 1, "default is one thread");
+is(Math::FastGF2::Matrix->threads(3), 3, "set default threads");
+ok(Math::FastGF2::Matrix->threads(0) >= 1, "threads(0) is one per CPU");
+Math::FastGF2::Matrix->threads(1);
+
+for my $width (1, 2, 4) {
+  my $cols=int(20000 / $width) + 13;
+
+  my $xform=random_matrix(6,4,"rowwise",$width);
+  my $in   =random_matrix(4,$cols,"colwise",$width);
+  my $one  =$xform->multiply($in);
+  my $many =$xform->multiply($in,undef,4);
+  ok($one->eq($many), "width $width split, 4 threads");
+
+  my $inv =random_matrix(5,5,"rowwise",$width);
+  $in     =random_matrix(5,$cols,"rowwise",$width);
+  $one    =$class->new(rows=>5, cols=>$cols, width=>$width, org=>"colwise");
+  $many   =$class->new(rows=>5, cols=>$cols, width=>$width, org=>"colwise");
+  $inv->multiply($in,$one);
+  $inv->multiply($in,$many,3);
+  ok($one->eq($many), "width $width combine, 3 threads");
+
+  # submatrix with offsets, using the process-wide setting
+  Math::FastGF2::Matrix->threads(4);
+  $many=$class->new(rows=>6, cols=>$cols, width=>$width, org=>"rowwise");
+  Math::FastGF2::Matrix::multiply_submatrix_c
+      ($xform, $in, $many, 1, 1, 4, 7, 3, $cols - 10);
+  Math::FastGF2::Matrix->threads(1);
+  $one=$class->new(rows=>6, cols=>$cols, width=>$width, org=>"rowwise");
+  Math::FastGF2::Matrix::multiply_submatrix_c
+      ($xform, $in, $one, 1, 1, 4, 7, 3, $cols - 10);
+  ok($one->eq($many), "width $width submatrix, default 4 threads");
+
+  # rows whose length isn't a multiple of a cache line, so the slice
+  # boundaries only line up with one in the first row
+  $in  =random_matrix(4,4097,"colwise",$width);
+  $one =$xform->multiply($in);
+  $many=$xform->multiply($in,undef,4);
+  ok($one->eq($many), "width $width split, odd row length, 4 threads");
+}
+
+# pool threads must not get in the way of fork
+Math::FastGF2::Matrix->threads(4);
+my $big=random_matrix(4,30000,"colwise");
+my $x  =random_matrix(4,4,"rowwise");
+my $want=$x->multiply($big,undef,1);
+my $pid=fork;
+if (defined($pid) and $pid == 0) {
+  exit($x->multiply($big)->eq($want) ? 0 : 1);
+}
+waitpid($pid,0);
+ok(defined($pid) && $? == 0, "threaded multiply in forked child");
+ok($x->multiply($big)->eq($want), "threaded multiply in parent");
+Math::FastGF2::Matrix->threads(1);
+
+# prepared transforms (tables made once) must match plain multiplies,
+# with byte order conversion, threads and after changing kernel
+for my $width (1, 2, 4) {
+  my $cols =int(9000 / $width) + 5;
+  my $xform=random_matrix(5,3,"rowwise",$width);
+  my $in   =random_matrix(3,$cols,"colwise",$width);
+  my $p    =$xform->prepare(2,1);
+  my $want =$xform->multiply($in,undef,1,2,1);
+  my $ok   =$p->multiply($in)->eq($want);
+  $ok=0 unless $p->multiply($in,undef,3)->eq($want);
+  for my $kernel (qw(scalar ssse3 avx2 avx512bw)) {
+    next unless Math::FastGF2::gf2_region_select($kernel);
+    $ok=0 unless $p->multiply($in)->eq($want);
+  }
+  Math::FastGF2::gf2_region_select("");
+  $xform->setval(0,0,$xform->getval(0,0) ^ 1);
+  $ok=0 unless $p->multiply($in)->eq($want);
+  ok($ok, "width $width prepared transform");
+}
+my $p=random_matrix(2,3,"rowwise",2)->prepare;
+is(join(",", $p->ROWS, $p->COLS, $p->WIDTH), "2,3,2", "prepared accessors");
+{
+  local $SIG{__WARN__}=sub {};
+  ok(!defined($p->multiply(random_matrix(2,5,"colwise",2))),
+     "prepared multiply checks sizes");
+  ok(!defined(random_matrix(2,2,"rowwise")->prepare(3,0)),
+     "prepare checks byte order");
+}
+
+# multiply_xor in split and combine layouts, with byte orders and the
+# unrolled/identity-row shortcuts (which it must not take)
+for my $width (1, 2, 4) {
+  my $ok=1;
+  my $cols=int(3000 / $width) + 3;
+  for my $org ("rowwise", "colwise") {
+    for my $xform (random_matrix(4,4,"rowwise",$width),
+		   $class->new_identity(size => 4, width => $width)) {
+      my $in =random_matrix(4,$cols,"colwise",$width);
+      my $old=random_matrix(4,$cols,$org,$width);
+      my $res=$old->copy;
+      $xform->multiply_xor($in,$res,1,2,2);
+      my $bytes=4 * $cols;
+      my $want=$old->getvals_str(0,0,$bytes,0) ^
+	$xform->multiply($in,$old->copy,1,2,2)->getvals_str(0,0,$bytes,0);
+      $ok=0 unless $res->getvals_str(0,0,$bytes,0) eq $want;
+    }
+  }
+  ok($ok, "width $width multiply_xor");
+}
+
+# prepared multiply with input or result rows in separate matrices, as
+# used for mapped share files
+for my $width (1, 2, 4) {
+  my $ok=1;
+  my $cols=int(7000 / $width) + 1;
+  my $xform=random_matrix(3,4,"rowwise",$width);
+  my $in   =random_matrix(4,$cols,"colwise",$width);
+  my $want =$xform->multiply($in,undef,1,2,2);
+  my $p    =$xform->prepare(2,2);
+  for my $threads (1, 3) {
+    my @out=map { $class->new(rows => 1, cols => $cols, width => $width) }
+      1 .. 3;
+    $p->multiply($in,\@out,$threads);
+    for my $r (0 .. 2) {
+      $ok=0 unless $out[$r]->getvals_str(0,0,$cols,0) eq
+	$want->getvals_str($r,0,$cols,0);
+    }
+    # and back the other way: the rows as the input list
+    my $sq   =random_matrix(4,4,"rowwise",$width);
+    my @rows =map { $in->copy_rows($_) } 0 .. 3;
+    my $res  =random_matrix(4,$cols,"colwise",$width);
+    $sq->prepare(2,2)->multiply(\@rows,$res,$threads);
+    $ok=0 unless $res->eq($sq->multiply($in,undef,1,2,2));
+  }
+  ok($ok, "width $width prepared multiply with row lists");
+}
@@ -0,0 +1,500 @@
+/* Micro-benchmark suite for the C library, with JSON output */
+/*
+  Copyright (c) by Declan Malone 2009-2019.
+  Licensed under the terms of the GNU General Public License and
+  the GNU Lesser (Library) General Public License.
+*/
+
+/*
+  Build with "make bench-gf2" in the top-level directory.
+
+  Unlike the tool/benchmark-*.pl scripts, this calls clib directly so
+  that Perl/XS call overhead doesn't swamp the figures. It times:
+
+   mul, inv, div   single field operations (gf2_mul etc.)
+   region          gf2_region_mul{8,16,32}, with and without xor
+   split           n x k transform times COLWISE k x cols input
+   combine         k x k inverse times ROWWISE input, COLWISE output
+   invert          gf2_matrix_invert on a k x k Cauchy matrix
+   cauchy          gf2_matrix_inverse_cauchy (closed form) for same
+
+  sweeping over width, k, n (= k, 3k/2, 2k) and buffer size. Each
+  figure is the best of several passes, where a pass repeats the
+  operation until at least the minimum time has gone by.
+
+  Output is a single JSON object on stdout, with one record per
+  measurement in "results". Each has "mb_per_s" (from the wall clock)
+  and, on x86, "cycles_per_byte" (from the time stamp counter). For
+  split and combine the byte count is the input buffer size; for
+  invert and cauchy it is the size of the k x k matrix.
+
+  Usage: bench-gf2 [options]
+
+   -c cpu       pin to this CPU (default 0; -1 to not pin)
+   -t threads   threads for split/combine (default 1; 0 = one per CPU)
+   -r kernel    region kernel to use, or "all" to repeat the whole
+                run for every kernel this CPU supports (default is
+                the fastest one)
+   -w list      widths (default 1,2,4)
+   -k list      values of k (default 4,8,16,32)
+   -b list      buffer sizes in Kb (default 16,256,4096)
+   -m ms        minimum time for each pass (default 20)
+   -p passes    passes to take the best of (default 5)
+   -s list      only run these benchmarks (default all, as above)
+   -f 0         don't use the unrolled kernels for fixed k (8-bit
+                split/combine fall back to the generic code)
+
+  Lists are comma-separated.
+*/
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FastGF2.h"
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#define CYCLES() __rdtsc()
+#else
+#define HAVE_TSC 0
+#define CYCLES() 0ull
+#endif
+
+#define MAX_LIST 16
+
+static int list_width[MAX_LIST] = { 1, 2, 4 };
+static int list_k[MAX_LIST]     = { 4, 8, 16, 32 };
+static int list_buf[MAX_LIST]   = { 16, 256, 4096 };
+static int n_width = 3, n_k = 4, n_buf = 3;
+
+static int   min_ns  = 20000000;
+static int   passes  = 5;
+static int   threads = 1;
+static const char *only = NULL;
+
+static int records = 0;		/* for commas between JSON records */
+
+/* stops the compiler from dropping the scalar loops */
+static volatile gf2_u32 sink;
+
+static unsigned long long now_ns (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int parse_list (const char *s, int *list) {
+  int n = 0;
+  char *end;
+
+  while (*s && n < MAX_LIST) {
+    list[n++] = strtol(s, &end, 10);
+    if (*end != ',') break;
+    s = end + 1;
+  }
+  return n;
+}
+
+static int wanted (const char *bench) {
+  const char *p;
+  size_t len = strlen(bench);
+
+  if (only == NULL) return 1;
+  for (p = only; (p = strstr(p, bench)) != NULL; p += len)
+    if ((p == only || p[-1] == ',') && (p[len] == ',' || p[len] == 0))
+      return 1;
+  return 0;
+}
+
+/*
+  A benchmark is a function that does one "operation" on a prepared
+  argument; time_op calls it repeatedly and reports the best rate.
+*/
+typedef void (*bench_fn) (void *arg);
+
+struct timing {
+  double ns;			/* per operation */
+  double cycles;
+};
+
+static struct timing time_op (bench_fn fn, void *arg) {
+  struct timing best = { 0, 0 };
+  unsigned long long start, elapsed, c_start, c_elapsed;
+  long reps, i;
+  int pass;
+
+  for (pass=0; pass < passes; ++pass) {
+    reps = 0;
+    start   = now_ns();
+    c_start = CYCLES();
+    do {
+      for (i=0; i < 8; ++i) fn(arg);
+      reps += 8;
+      elapsed = now_ns() - start;
+    } while (elapsed < (unsigned long long) min_ns);
+    c_elapsed = CYCLES() - c_start;
+    if (pass == 0 || (double) elapsed / reps < best.ns) {
+      best.ns     = (double) elapsed / reps;
+      best.cycles = (double) c_elapsed / reps;
+    }
+  }
+  return best;
+}
+
+static void report (const char *bench, const char *kernel, int width,
+		    int k, int n, int buf_kb, size_t bytes, struct timing t) {
+  printf("%s\n    {\"bench\": \"%s\", \"kernel\": \"%s\", \"width\": %d",
+	 records++ ? "," : "", bench, kernel, width);
+  if (k)      printf(", \"k\": %d", k);
+  if (n)      printf(", \"n\": %d", n);
+  if (buf_kb) printf(", \"buffer_kb\": %d", buf_kb);
+  printf(", \"bytes\": %lu, \"ns\": %.1f, \"mb_per_s\": %.2f",
+	 (unsigned long) bytes, t.ns, bytes * 1000.0 / t.ns);
+  if (HAVE_TSC)
+    printf(", \"cycles_per_byte\": %.4f", t.cycles / bytes);
+  else
+    printf(", \"cycles_per_byte\": null");
+  printf("}");
+  fflush(stdout);
+}
+
+static void *rand_bytes (size_t bytes) {
+  unsigned char *p = malloc(bytes);
+  size_t i;
+
+  if (p == NULL) {
+    fprintf(stderr, "bench-gf2: out of memory\n");
+    exit(1);
+  }
+  for (i=0; i < bytes; ++i)
+    p[i] = rand();
+  return p;
+}
+
+static gf2_matrix_t *new_matrix (int rows, int cols, int width, int org) {
+  gf2_matrix_t *m = malloc(sizeof(gf2_matrix_t));
+
+  if (m == NULL) {
+    fprintf(stderr, "bench-gf2: out of memory\n");
+    exit(1);
+  }
+  m->values       = rand_bytes((size_t) rows * cols * width);
+  m->rows         = rows;
+  m->cols         = cols;
+  m->width        = width;
+  m->organisation = org;
+  m->alloc_bits   = FREE_BOTH;
+  return m;
+}
+
+static void free_matrix (gf2_matrix_t *m) {
+  free(m->values);
+  free(m);
+}
+
+/* single field operations, on a block of operands */
+
+#define SCALAR_OPS 1024
+
+struct scalar_arg {
+  int      width;
+  gf2_u32 *a, *b;
+};
+
+static void bench_mul (void *p) {
+  struct scalar_arg *s = p;
+  gf2_u32 x = 0;
+  int i;
+  for (i=0; i < SCALAR_OPS; ++i)
+    x ^= gf2_mul(s->width, s->a[i], s->b[i]);
+  sink = x;
+}
+
+static void bench_inv (void *p) {
+  struct scalar_arg *s = p;
+  gf2_u32 x = 0;
+  int i;
+  for (i=0; i < SCALAR_OPS; ++i)
+    x ^= gf2_inv(s->width, s->b[i]);
+  sink = x;
+}
+
+static void bench_div (void *p) {
+  struct scalar_arg *s = p;
+  gf2_u32 x = 0;
+  int i;
+  for (i=0; i < SCALAR_OPS; ++i)
+    x ^= gf2_div(s->width, s->a[i], s->b[i]);
+  sink = x;
+}
+
+static void run_scalar (const char *kernel, int width) {
+  struct scalar_arg s;
+  gf2_u32 mask = (width == 4) ? 0xffffffff : (1u << (width * 8)) - 1;
+  int i;
+
+  s.width = width * 8;
+  s.a = malloc(SCALAR_OPS * sizeof(gf2_u32));
+  s.b = malloc(SCALAR_OPS * sizeof(gf2_u32));
+  for (i=0; i < SCALAR_OPS; ++i) {
+    s.a[i] = (rand() ^ ((gf2_u32) rand() << 16)) & mask;
+    do {			/* no zero divisors */
+      s.b[i] = (rand() ^ ((gf2_u32) rand() << 16)) & mask;
+    } while (s.b[i] == 0);
+  }
+  if (wanted("mul"))
+    report("mul", kernel, width, 0, 0, 0, SCALAR_OPS * width,
+	   time_op(bench_mul, &s));
+  if (wanted("inv"))
+    report("inv", kernel, width, 0, 0, 0, SCALAR_OPS * width,
+	   time_op(bench_inv, &s));
+  if (wanted("div"))
+    report("div", kernel, width, 0, 0, 0, SCALAR_OPS * width,
+	   time_op(bench_div, &s));
+  free(s.a);
+  free(s.b);
+}
+
+/* region multiplies */
+
+struct region_arg {
+  int    width;
+  int    xor;
+  size_t bytes;
+  void  *dest, *src;
+  gf2_u32 c;
+};
+
+static void bench_region (void *p) {
+  struct region_arg *r = p;
+
+  switch (r->width * 2 + r->xor) {
+  case 2: gf2_region_mul8    (r->dest, r->src, r->c, r->bytes); break;
+  case 3: gf2_region_mul8_xor(r->dest, r->src, r->c, r->bytes); break;
+  case 4: gf2_region_mul16    (r->dest, r->src, r->c, r->bytes / 2); break;
+  case 5: gf2_region_mul16_xor(r->dest, r->src, r->c, r->bytes / 2); break;
+  case 8: gf2_region_mul32    (r->dest, r->src, r->c, r->bytes / 4); break;
+  case 9: gf2_region_mul32_xor(r->dest, r->src, r->c, r->bytes / 4); break;
+  }
+}
+
+static void run_region (const char *kernel, int width, int buf_kb) {
+  struct region_arg r;
+
+  r.width = width;
+  r.bytes = (size_t) buf_kb * 1024;
+  r.dest  = rand_bytes(r.bytes);
+  r.src   = rand_bytes(r.bytes);
+  r.c     = 0x53535353 & ((width == 4) ? 0xffffffff : (1u << width * 8) - 1);
+  for (r.xor = 0; r.xor < 2; ++r.xor)
+    report(r.xor ? "region_xor" : "region", kernel, width, 0, 0, buf_kb,
+	   r.bytes, time_op(bench_region, &r));
+  free(r.dest);
+  free(r.src);
+}
+
+/* split and combine */
+
+struct multiply_arg {
+  gf2_matrix_t *xform, *in, *out;
+};
+
+static void bench_multiply (void *p) {
+  struct multiply_arg *m = p;
+  gf2_matrix_multiply_submatrix_mt(m->xform, m->in, m->out, 0, 0,
+				   m->xform->rows, 0, 0, m->in->cols, threads);
+}
+
+static void run_multiply (const char *bench, const char *kernel, int width,
+			  int k, int n, int buf_kb) {
+  struct multiply_arg m;
+  int cols = (buf_kb * 1024) / (k * width);
+  int split = (n != 0);
+
+  if (cols < 1) return;
+  m.xform = new_matrix(split ? n : k, k, width, ROWWISE);
+  m.in    = new_matrix(k, cols, width, split ? COLWISE : ROWWISE);
+  m.out   = new_matrix(split ? n : k, cols, width, split ? ROWWISE : COLWISE);
+  report(bench, kernel, width, k, n, buf_kb, (size_t) k * cols * width,
+	 time_op(bench_multiply, &m));
+  free_matrix(m.xform);
+  free_matrix(m.in);
+  free_matrix(m.out);
+}
+
+/* inverting a k x k matrix, by Gauss-Jordan and closed form */
+
+struct invert_arg {
+  gf2_matrix_t *m, *inv;
+  gf2_u32 *x, *y;
+};
+
+static void bench_invert (void *p) {
+  struct invert_arg *a = p;
+  gf2_matrix_invert(a->m, a->inv);
+}
+
+static void bench_cauchy (void *p) {
+  struct invert_arg *a = p;
+  gf2_matrix_inverse_cauchy(a->inv, a->x, a->y);
+}
+
+static void put_elem (gf2_matrix_t *m, int i, gf2_u32 v) {
+  switch (m->width) {
+  case 1: ((gf2_u8  *) m->values)[i] = v; break;
+  case 2: ((gf2_u16 *) m->values)[i] = v; break;
+  case 4: ((gf2_u32 *) m->values)[i] = v; break;
+  }
+}
+
+static void run_invert (const char *kernel, int width, int k) {
+  struct invert_arg a;
+  int i, j, bits = width * 8;
+
+  if (width == 1 && 2 * k > 256) return;
+  a.m   = new_matrix(k, k, width, ROWWISE);
+  a.inv = new_matrix(k, k, width, ROWWISE);
+  a.x   = malloc(k * sizeof(gf2_u32));
+  a.y   = malloc(k * sizeof(gf2_u32));
+
+  /* distinct x_i and y_j, so that every x_i + y_j is non-zero */
+  for (i=0; i < k; ++i) {
+    a.x[i] = i;
+    a.y[i] = k + i;
+  }
+  for (i=0; i < k; ++i)
+    for (j=0; j < k; ++j)
+      put_elem(a.m, i * k + j, gf2_inv(bits, a.x[i] ^ a.y[j]));
+
+  if (wanted("invert"))
+    report("invert", kernel, width, k, 0, 0, (size_t) k * k * width,
+	   time_op(bench_invert, &a));
+  if (wanted("cauchy"))
+    report("cauchy", kernel, width, k, 0, 0, (size_t) k * k * width,
+	   time_op(bench_cauchy, &a));
+  free_matrix(a.m);
+  free_matrix(a.inv);
+  free(a.x);
+  free(a.y);
+}
+
+static void run_all (const char *kernel) {
+  int i, j, b, step, w, k;
+
+  for (i=0; i < n_width; ++i) {
+    w = list_width[i];
+    if (w != 1 && w != 2 && w != 4) continue;
+
+    run_scalar(kernel, w);
+
+    if (wanted("region") || wanted("region_xor"))
+      for (b=0; b < n_buf; ++b)
+	run_region(kernel, w, list_buf[b]);
+
+    for (j=0; j < n_k; ++j) {
+      k = list_k[j];
+      if (k < 1) continue;
+      for (b=0; b < n_buf; ++b) {
+	if (wanted("split"))
+	  for (step=0; step < 3; ++step)
+	    run_multiply("split", kernel, w, k, k + step * k / 2, list_buf[b]);
+	if (wanted("combine"))
+	  run_multiply("combine", kernel, w, k, 0, list_buf[b]);
+      }
+      if (wanted("invert") || wanted("cauchy"))
+	run_invert(kernel, w, k);
+    }
+  }
+}
+
+static void usage (void) {
+  fprintf(stderr,
+	  "Usage: bench-gf2 [-c cpu] [-t threads] [-r kernel|all]\n"
+	  "                 [-w widths] [-k ks] [-b buffer_kbs]\n"
+	  "                 [-m min_ms] [-p passes] [-s benchmarks]\n"
+	  "                 [-f 0|1]\n");
+  exit(1);
+}
+
+int main (int argc, char *argv[]) {
+  static const char *kernels[] = { "scalar", "ssse3", "avx2", "avx512bw" };
+  const char *kernel = NULL;
+  int cpu = 0, pinned = 0;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "c:t:r:w:k:b:m:p:s:f:")) != -1) {
+    switch (opt) {
+    case 'c': cpu     = atoi(optarg); break;
+    case 't': threads = atoi(optarg); break;
+    case 'r': kernel  = optarg; break;
+    case 'w': n_width = parse_list(optarg, list_width); break;
+    case 'k': n_k     = parse_list(optarg, list_k); break;
+    case 'b': n_buf   = parse_list(optarg, list_buf); break;
+    case 'm': min_ns  = atoi(optarg) * 1000000; break;
+    case 'p': passes  = atoi(optarg); break;
+    case 's': only    = optarg; break;
+    case 'f': gf2_fixed_enable(atoi(optarg)); break;
+    default:  usage();
+    }
+  }
+  if (optind != argc || passes < 1) usage();
+
+#ifdef __linux__
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == 0)
+      pinned = 1;
+    else
+      perror("bench-gf2: can't pin to cpu");
+  }
+#endif
+  if (!pinned) cpu = -1;
+
+  gf2_region_init();
+  if (kernel && strcmp(kernel, "all") && !gf2_region_select(kernel)) {
+    fprintf(stderr, "bench-gf2: unknown or unsupported kernel '%s'\n",
+	    kernel);
+    return 1;
+  }
+  threads = gf2_pool_set_threads(threads);
+  srand(1);
+
+  printf("{\n  \"version\": \"%s\",\n  \"cpu\": %d,\n  \"threads\": %d,\n"
+	 "  \"min_ms\": %d,\n  \"passes\": %d,\n  \"tsc\": %s,\n"
+	 "  \"fixed_k\": [",
+	 BENCH_VERSION, cpu, threads, min_ns / 1000000, passes,
+	 HAVE_TSC ? "true" : "false");
+  if (gf2_fixed_enable(-1)) {
+    int ks[GF2_FIXED_MAX], nk = gf2_fixed_list(ks, GF2_FIXED_MAX);
+    for (i=0; i < nk; ++i)
+      printf("%s%d", i ? ", " : "", ks[i]);
+  }
+  printf("],\n  \"results\": [");
+
+  if (kernel && strcmp(kernel, "all") == 0) {
+    for (i=0; i < 4; ++i)
+      if (gf2_region_select(kernels[i]))
+	run_all(kernels[i]);
+  } else {
+    run_all(gf2_region_kernel());
+  }
+  printf("\n  ]\n}\n");
+  return 0;
+}
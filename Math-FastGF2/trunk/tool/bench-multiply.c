@@ -0,0 +1,148 @@
+/* Benchmark for the cache-blocked matrix multiply in clib/Matrix.c */
+/*
+  Copyright (c) by Declan Malone 2009-2019.
+  Licensed under the terms of the GNU General Public License and
+  the GNU Lesser (Library) General Public License.
+*/
+
+/*
+  Build with "make bench-multiply" in the top-level directory.
+
+  For each width and each k = 4, 8, ..., 32 and n = k, 3k/2, 2k, this
+  times an IDA-style split (n x k transform times a COLWISE k x cols
+  input buffer, ROWWISE output) and combine (k x k inverse times a
+  ROWWISE input buffer, COLWISE output), reporting the number of
+  input bytes processed per CPU cycle.
+
+  Usage: bench-multiply [-t threads] [buffer_kb [width ...]]
+
+  With -t, multiplies are split across that many threads (0 for one
+  per CPU). Figures are still bytes per tick of the calling thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FastGF2.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define TICKS() __rdtsc()
+#define TICK_NAME "cycle"
+#else
+static unsigned long long nano_ticks (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#define TICKS() nano_ticks()
+#define TICK_NAME "ns"
+#endif
+
+static gf2_matrix_t *new_matrix (int rows, int cols, int width, int org) {
+  gf2_matrix_t *m = malloc(sizeof(gf2_matrix_t));
+  int i, bytes = rows * cols * width;
+
+  if (m == NULL) return NULL;
+  m->values = malloc(bytes);
+  if (m->values == NULL) { free(m); return NULL; }
+  for (i=0; i < bytes; ++i)
+    m->values[i] = rand();
+  m->rows         = rows;
+  m->cols         = cols;
+  m->width        = width;
+  m->organisation = org;
+  m->alloc_bits   = FREE_BOTH;
+  return m;
+}
+
+static void free_matrix (gf2_matrix_t *m) {
+  free(m->values);
+  free(m);
+}
+
+/* run the multiply enough times to get a stable figure */
+static double time_multiply (gf2_matrix_t *a, gf2_matrix_t *b,
+			     gf2_matrix_t *r) {
+  unsigned long long start, elapsed, best = 0;
+  int pass;
+  size_t in_bytes = (size_t) b->rows * b->cols * b->width;
+
+  for (pass=0; pass < 5; ++pass) {
+    start = TICKS();
+    gf2_matrix_multiply_submatrix(a, b, r, 0, 0, a->rows, 0, 0, b->cols);
+    elapsed = TICKS() - start;
+    if (pass == 0 || elapsed < best) best = elapsed;
+  }
+  return (double) in_bytes / best;
+}
+
+int main (int argc, char *argv[]) {
+  int buf_kb, threads = 1;
+  int widths[3] = { 1, 2, 4 };
+  int nwidths = 3;
+  int i, k, n, step, w, cols;
+  gf2_matrix_t *xform, *in, *out;
+
+  if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+    threads = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  buf_kb = (argc > 1) ? atoi(argv[1]) : 1024;
+
+  if (argc > 2) {
+    for (nwidths=0; nwidths + 2 < argc && nwidths < 3; ++nwidths)
+      widths[nwidths] = atoi(argv[nwidths + 2]);
+  }
+
+  gf2_region_init();
+  threads = gf2_pool_set_threads(threads);
+  printf("# region kernel: %s, %d thread(s), buffer %d Kb, "
+	 "figures are bytes/%s\n",
+	 gf2_region_kernel(), threads, buf_kb, TICK_NAME);
+  printf("%-5s %-3s %-3s %10s %10s\n", "width", "k", "n", "split", "combine");
+
+  for (i=0; i < nwidths; ++i) {
+    w = widths[i];
+    for (k=4; k <= 32; k += 4) {
+      cols = (buf_kb * 1024) / (k * w);
+
+      for (step=0; step < 3; ++step) {
+	n = k + step * k / 2;
+
+	xform = new_matrix(n, k,    w, ROWWISE);
+	in    = new_matrix(k, cols, w, COLWISE);
+	out   = new_matrix(n, cols, w, ROWWISE);
+	if (!xform || !in || !out) {
+	  fprintf(stderr, "out of memory\n");
+	  return 1;
+	}
+	printf("%-5d %-3d %-3d %10.3f", w, k, n,
+	       time_multiply(xform, in, out));
+	free_matrix(xform);
+	free_matrix(in);
+	free_matrix(out);
+
+	/* combine doesn't depend on n, so only do it once for each k */
+	if (step == 0) {
+	  xform = new_matrix(k, k,    w, ROWWISE);
+	  in    = new_matrix(k, cols, w, ROWWISE);
+	  out   = new_matrix(k, cols, w, COLWISE);
+	  if (!xform || !in || !out) {
+	    fprintf(stderr, "out of memory\n");
+	    return 1;
+	  }
+	  printf(" %10.3f", time_multiply(xform, in, out));
+	  free_matrix(xform);
+	  free_matrix(in);
+	  free_matrix(out);
+	}
+	printf("\n");
+      }
+    }
+  }
+  return 0;
+}
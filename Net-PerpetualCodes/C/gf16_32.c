@@ -1,8 +1,20 @@
 /* Basic GF(2**16) and GF(2**32) field operations */
 
 #include "stdio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "gf16_32.h"
 
+// On x86 with gcc/clang, GF(2**32) multiplies can use the carry-less
+// multiply instruction (PCLMULQDQ) instead of the tables below. The
+// code is compiled with target attributes and only called if the CPU
+// has the feature, so no -march flag is needed.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GF32_CLMUL
+#include <immintrin.h>
+#endif
+
 //
 // The algorithm that I'm using for both of these fields is similar:
 //
@@ -1165,7 +1177,8 @@ gf16_t gf16_mul_elems (gf16_t a, gf16_t b) {
   return c ^ lmul_table[a1 | b0] ^ rmul_table[a0 | b0];
 }
 
-gf32_t gf32_mul_elems (gf32_t a, gf32_t b) {
+// gf32_mul_elems uses this unless the CPU has carry-less multiply
+gf32_t gf32_mul_elems_table (gf32_t a, gf32_t b) {
   static const gf16_t *lmul_table=fast_gf2_lmul;
   static const gf16_t *rmul_table=fast_gf2_rmul;
   static const gf32_t *shift_tab=fast_gf2_shift_u32;
@@ -1215,6 +1228,141 @@ static const gf8_t  poly_u8  = 0x1b;
 static const gf16_t poly_u16 = 0x2b;
 static const gf32_t poly_u32 = 0x8d;
 
+// The gf32_vec_* operations differ only in what gets multiplied and
+// where the result goes, so they share one loop:
+//
+//   GF32_OP_MUL:  d  = val * d
+//   GF32_OP_FMA:  d ^= val * s
+//   GF32_OP_FAM:  d  = val * (d ^ s)
+//   GF32_OP_SWAP: d  = val * (d ^ s), s = old d
+#define GF32_OP_MUL  0
+#define GF32_OP_FMA  1
+#define GF32_OP_FAM  2
+#define GF32_OP_SWAP 3
+
+static void gf32_vec_op_table (gf32_t *d, gf32_t *s, gf32_t val,
+			       unsigned len, int op);
+
+#ifdef GF32_CLMUL
+
+// Carry-less multiply with Barrett reduction
+//
+// The 32x32-bit polynomial product P = H.x^32 + L has 63 bits. For
+// our field polynomial p = x^32 + 0x8d, mu = floor(x^64 / p) works
+// out to be p itself, so the quotient and remainder are
+//
+//   q = (H * mu) >> 32 = H ^ ((H * 0x8d) >> 32)
+//   r = L ^ low32(q * 0x8d)
+//
+// That's three carry-less multiplies per product. The vector
+// versions split each 64-bit lane into its even and odd words and do
+// the same thing on all lanes at once: 4 words at a time with SSE, or
+// 8 with AVX2 + VPCLMULQDQ.
+
+__attribute__((target("pclmul,sse2")))
+static gf32_t gf32_mul_elems_clmul (gf32_t a, gf32_t b) {
+  __m128i poly = _mm_cvtsi32_si128(poly_u32);
+  __m128i p, h, q;
+
+  p = _mm_clmulepi64_si128(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b), 0);
+  h = _mm_srli_epi64(p, 32);
+  q = _mm_xor_si128(h, _mm_srli_epi64(_mm_clmulepi64_si128(h, poly, 0), 32));
+  return _mm_cvtsi128_si32(_mm_xor_si128(p, _mm_clmulepi64_si128(q, poly, 0)));
+}
+
+// Multiply the 32-bit value in the low half of each 64-bit lane by
+// val and reduce it. Result is in the low half of each lane.
+__attribute__((target("pclmul,sse2")))
+static inline __m128i gf32_clmul_lanes128 (__m128i v, __m128i val,
+					   __m128i poly) {
+  __m128i p, h, q;
+  p = _mm_unpacklo_epi64(_mm_clmulepi64_si128(v, val, 0x00),
+			 _mm_clmulepi64_si128(v, val, 0x01));
+  h = _mm_srli_epi64(p, 32);
+  q = _mm_unpacklo_epi64(_mm_clmulepi64_si128(h, poly, 0x00),
+			 _mm_clmulepi64_si128(h, poly, 0x01));
+  q = _mm_xor_si128(h, _mm_srli_epi64(q, 32));
+  return _mm_xor_si128(p, _mm_unpacklo_epi64
+		       (_mm_clmulepi64_si128(q, poly, 0x00),
+			_mm_clmulepi64_si128(q, poly, 0x01)));
+}
+
+__attribute__((target("avx2,pclmul,vpclmulqdq")))
+static inline __m256i gf32_clmul_lanes256 (__m256i v, __m256i val,
+					   __m256i poly) {
+  __m256i p, h, q;
+  p = _mm256_unpacklo_epi64(_mm256_clmulepi64_epi128(v, val, 0x00),
+			    _mm256_clmulepi64_epi128(v, val, 0x01));
+  h = _mm256_srli_epi64(p, 32);
+  q = _mm256_unpacklo_epi64(_mm256_clmulepi64_epi128(h, poly, 0x00),
+			    _mm256_clmulepi64_epi128(h, poly, 0x01));
+  q = _mm256_xor_si256(h, _mm256_srli_epi64(q, 32));
+  return _mm256_xor_si256(p, _mm256_unpacklo_epi64
+			  (_mm256_clmulepi64_epi128(q, poly, 0x00),
+			   _mm256_clmulepi64_epi128(q, poly, 0x01)));
+}
+
+__attribute__((target("pclmul,sse2")))
+static void gf32_vec_op_pclmul (gf32_t *d, gf32_t *s, gf32_t val,
+				unsigned len, int op) {
+  __m128i vv   = _mm_set1_epi64x(val);
+  __m128i poly = _mm_set1_epi64x(poly_u32);
+  __m128i lo32 = _mm_set1_epi64x(0xffffffff);
+  __m128i dv, sv, x, r;
+
+  for (; len >= 4; len -= 4, d += 4, s += 4) {
+    dv = _mm_loadu_si128((__m128i *) d);
+    if (op == GF32_OP_MUL) {
+      x = dv;
+    } else {
+      sv = _mm_loadu_si128((__m128i *) s);
+      x  = (op == GF32_OP_FMA) ? sv : _mm_xor_si128(dv, sv);
+      if (op == GF32_OP_SWAP)
+	_mm_storeu_si128((__m128i *) s, dv);
+    }
+    r = _mm_or_si128(_mm_and_si128(gf32_clmul_lanes128
+				   (_mm_and_si128(x, lo32), vv, poly), lo32),
+		     _mm_slli_epi64(gf32_clmul_lanes128
+				    (_mm_srli_epi64(x, 32), vv, poly), 32));
+    if (op == GF32_OP_FMA)
+      r = _mm_xor_si128(r, dv);
+    _mm_storeu_si128((__m128i *) d, r);
+  }
+  gf32_vec_op_table(d, s, val, len, op);
+}
+
+__attribute__((target("avx2,pclmul,vpclmulqdq")))
+static void gf32_vec_op_vpclmul (gf32_t *d, gf32_t *s, gf32_t val,
+				 unsigned len, int op) {
+  __m256i vv   = _mm256_set1_epi64x(val);
+  __m256i poly = _mm256_set1_epi64x(poly_u32);
+  __m256i lo32 = _mm256_set1_epi64x(0xffffffff);
+  __m256i dv, sv, x, r;
+
+  for (; len >= 8; len -= 8, d += 8, s += 8) {
+    dv = _mm256_loadu_si256((__m256i *) d);
+    if (op == GF32_OP_MUL) {
+      x = dv;
+    } else {
+      sv = _mm256_loadu_si256((__m256i *) s);
+      x  = (op == GF32_OP_FMA) ? sv : _mm256_xor_si256(dv, sv);
+      if (op == GF32_OP_SWAP)
+	_mm256_storeu_si256((__m256i *) s, dv);
+    }
+    r = _mm256_or_si256
+      (_mm256_and_si256(gf32_clmul_lanes256
+			 (_mm256_and_si256(x, lo32), vv, poly), lo32),
+       _mm256_slli_epi64(gf32_clmul_lanes256
+			 (_mm256_srli_epi64(x, 32), vv, poly), 32));
+    if (op == GF32_OP_FMA)
+      r = _mm256_xor_si256(r, dv);
+    _mm256_storeu_si256((__m256i *) d, r);
+  }
+  gf32_vec_op_pclmul(d, s, val, len, op);
+}
+
+#endif // GF32_CLMUL
+
 static unsigned char size_of_byte[256]= {
   0,1,2,2,3,3,3,3,4,4,4,4,4,4,4,4, 5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,
   6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,6, 6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,
@@ -1318,30 +1466,115 @@ void gf16_vec_fam_with_swap(gf16_t *d, gf16_t *s,
 }
   
 
-void gf32_vec_mul(gf32_t *s, gf32_t val, unsigned len) {
-  while (len--) {
-    *(s) = gf32_mul_elems(*s, val);
-    ++s;
-  }
-}
-void gf32_vec_fma(gf32_t *d, gf32_t *s, gf32_t val, unsigned len ) {
-  while (len--) {
-    *(d++) ^= gf32_mul_elems(*(s++), val);
-  }
-}
-void gf32_vec_fam_with_swap(gf32_t *d, gf32_t *s,
-			    gf32_t val, unsigned len, int do_swap) {
+// Table-based fallback for gf32_vec_* (and for the tails of the
+// vector code above)
+static void gf32_vec_op_table (gf32_t *d, gf32_t *s, gf32_t val,
+			       unsigned len, int op) {
   gf32_t sv, xor;
-  if (do_swap) {
+  switch (op) {
+  case GF32_OP_MUL:
+    while (len--) {
+      *(d) = gf32_mul_elems_table(*d, val);
+      ++d;
+    }
+    break;
+  case GF32_OP_FMA:
+    while (len--) {
+      *(d++) ^= gf32_mul_elems_table(*(s++), val);
+    }
+    break;
+  case GF32_OP_SWAP:
     while (len--) {
       xor = (sv = *d) ^ *s;
       *(s++) = sv;
-      *(d++) = gf32_mul_elems(val,xor);
+      *(d++) = gf32_mul_elems_table(val,xor);
     }
-  } else {
+    break;
+  default:
     while (len--) {
       xor = *(s++) ^ *d;
-      *(d++) = gf32_mul_elems(val,xor);
+      *(d++) = gf32_mul_elems_table(val,xor);
     }
   }
 }
+
+// Runtime selection of the multiply routines. We pick the widest
+// carry-less multiply code that the CPU supports, then check it
+// against the tables before using it. Selection happens once, on
+// first use from whichever thread gets there first; the pointers are
+// only set when it's finished, vector op first, and the callers load
+// the one they're about to call.
+typedef void gf32_vec_op_t (gf32_t *, gf32_t *, gf32_t, unsigned, int);
+
+static gf32_t (*gf32_mul_fn) (gf32_t, gf32_t) = NULL;
+static gf32_vec_op_t *gf32_vec_op = NULL;
+static pthread_once_t gf32_once = PTHREAD_ONCE_INIT;
+
+#ifdef GF32_CLMUL
+static int gf32_clmul_agrees (gf32_vec_op_t *op) {
+  gf32_t a[19], b[19], d[19], val = 0x8d;
+  int i, j;
+  for (j = 0; j < 40; ++j, val = val * 0x9e3779b9u + 1) {
+    for (i = 0; i < 19; ++i) {
+      a[i] = b[i] = d[i] = val ^ (i * 0x01000193u) ^ (1u << ((i + j) % 32));
+      b[i] = gf32_mul_elems_table(a[i], val);
+    }
+    op(d, d, val, 19, GF32_OP_MUL);
+    if (memcmp(b, d, sizeof(d)))
+      return 0;
+    for (i = 0; i < 19; ++i)
+      if (gf32_mul_elems_clmul(a[i], val) != b[i])
+	return 0;
+  }
+  return 1;
+}
+#endif
+
+static void gf32_select (void) {
+  gf32_t (*mul) (gf32_t, gf32_t) = gf32_mul_elems_table;
+  gf32_vec_op_t *vec = gf32_vec_op_table;
+#ifdef GF32_CLMUL
+  __builtin_cpu_init();
+  if (!getenv("GF32_NO_CLMUL") && __builtin_cpu_supports("pclmul")) {
+    gf32_vec_op_t *op =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("vpclmulqdq")
+      ? gf32_vec_op_vpclmul : gf32_vec_op_pclmul;
+    if (gf32_clmul_agrees(op)) {
+      mul = gf32_mul_elems_clmul;
+      vec = op;
+    }
+  }
+#endif
+  __atomic_store_n(&gf32_vec_op, vec, __ATOMIC_RELEASE);
+  __atomic_store_n(&gf32_mul_fn, mul, __ATOMIC_RELEASE);
+}
+
+static gf32_vec_op_t *gf32_get_vec_op (void) {
+  gf32_vec_op_t *op = __atomic_load_n(&gf32_vec_op, __ATOMIC_ACQUIRE);
+  if (op == NULL) {
+    pthread_once(&gf32_once, gf32_select);
+    op = gf32_vec_op;
+  }
+  return op;
+}
+
+gf32_t gf32_mul_elems (gf32_t a, gf32_t b) {
+  gf32_t (*fn) (gf32_t, gf32_t) =
+    __atomic_load_n(&gf32_mul_fn, __ATOMIC_ACQUIRE);
+  if (fn == NULL) {
+    pthread_once(&gf32_once, gf32_select);
+    fn = gf32_mul_fn;
+  }
+  return fn(a,b);
+}
+
+void gf32_vec_mul(gf32_t *s, gf32_t val, unsigned len) {
+  gf32_get_vec_op()(s, s, val, len, GF32_OP_MUL);
+}
+void gf32_vec_fma(gf32_t *d, gf32_t *s, gf32_t val, unsigned len ) {
+  gf32_get_vec_op()(d, s, val, len, GF32_OP_FMA);
+}
+void gf32_vec_fam_with_swap(gf32_t *d, gf32_t *s,
+			    gf32_t val, unsigned len, int do_swap) {
+  gf32_get_vec_op()(d, s, val, len, do_swap ? GF32_OP_SWAP : GF32_OP_FAM);
+}
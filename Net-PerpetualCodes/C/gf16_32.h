@@ -7,6 +7,7 @@ gf16_t gf16_inv_elem (gf16_t a);
 
 gf32_t gf32_inv_elem (gf32_t a);
 gf32_t gf32_mul_elems (gf32_t a, gf32_t b);
+gf32_t gf32_mul_elems_table (gf32_t a, gf32_t b);
 
 void gf16_vec_mul(gf16_t *s, gf16_t val, unsigned len);
 void gf16_vec_fma(gf16_t *d, gf16_t *s, gf16_t val, unsigned len );